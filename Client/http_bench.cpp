@@ -0,0 +1,414 @@
+// Keep-alive connection scaling benchmark for the HTTP front ends
+// (civetweb on 8888, io_uring on 8890):
+//
+//   ./http_bench [-h host] [-p port] [-c connections] [-s seconds]
+//                [-T threads] [-r keyspace] [-d value bytes]
+//                [-m json|raw] [-o get|post] [-k reuse|fresh]
+//
+// Opens -c connections over -T epoll threads. Each one sends a request for
+// a random pre-filled key, waits for the answer and sends the next, on the
+// same connection for as long as the server keeps it open; a connection
+// the server closes is opened again. Reports how many connections the
+// server held and served, and the requests per second across all of them.
+//
+// -k fresh sends every request with "Connection: close", so each one pays
+// for a new TCP connection, for comparison with the default -k reuse.
+//
+// -m json reads and writes values as JSON on /key, -m raw as raw bytes on
+// /key/<key>. With -d the values are that many bytes, and the report adds
+// the value bytes moved per second.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <mutex>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+std::string host = "127.0.0.1";
+int port = 8888;
+int connections = 10;
+int seconds = 10;
+int threads = 4;
+int keyspace = 50;
+size_t value_size = 0; // 0: short "value_<i>" values
+bool raw = false;
+bool posts = false;
+bool fresh = false; // a new connection per request
+
+std::atomic<bool> stop_test{false};
+std::atomic<long long> total_requests{0};
+std::atomic<long long> total_errors{0};
+std::atomic<long long> connect_failures{0};
+std::atomic<long long> reconnects{0};
+std::atomic<long long> open_at_end{0};
+std::atomic<long long> served_connections{0};
+
+std::mutex latencies_mtx;
+std::vector<long long> latencies_us;
+
+sockaddr_in server_addr() {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    return addr;
+}
+
+std::string key_name(int i) {
+    return "bench:" + std::to_string(i);
+}
+
+std::string value_for(int i) {
+    if(value_size == 0) return "value_" + std::to_string(i);
+    std::string value(value_size, 'a');
+    for(size_t j = 0; j < value_size; j++) value[j] = 'a' + (i + j) % 26;
+    return value;
+}
+
+// One request, without a Connection header
+std::string make_request(bool post, int i, const std::string& value) {
+    std::string key = key_name(i);
+    if(!post) {
+        std::string target = raw ? "/key/" + key : "/key?key=" + key;
+        return "GET " + target + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    }
+    std::string body = raw ? value : "{\"key\": \"" + key + "\", \"value\": \"" + value + "\"}";
+    return std::string("POST ") + (raw ? "/key/" + key : "/key") + " HTTP/1.1\r\nHost: " + host +
+           "\r\nContent-Type: " + (raw ? "application/octet-stream" : "application/json") +
+           "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+// One request on its own connection; false unless the server answered 2xx
+bool request_once(const std::string& request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) return false;
+    sockaddr_in addr = server_addr();
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+    for(size_t sent = 0; sent < request.size();) {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) break;
+        sent += n;
+    }
+    std::string response;
+    char buf[4096];
+    // Sent with "Connection: close", so the answer ends at EOF
+    for(ssize_t n; (n = recv(fd, buf, sizeof(buf), 0)) > 0;)
+        response.append(buf, n);
+    close(fd);
+    return response.compare(0, 10, "HTTP/1.1 2") == 0;
+}
+
+bool fill_keyspace() {
+    for(int i = 0; i < keyspace; i++) {
+        std::string request = make_request(true, i, value_for(i));
+        request.insert(request.find("\r\n") + 2, "Connection: close\r\n");
+        if(!request_once(request)) return false;
+    }
+    return true;
+}
+
+struct Conn {
+    int fd = -1;
+    bool connecting = false;
+    bool served = false; // answered at least once during the run
+    long long answered = 0; // on the current socket
+    std::string in;
+    std::string out;
+    size_t out_sent = 0;
+    bool waiting_out = false; // watching EPOLLOUT for the rest of out
+    std::chrono::steady_clock::time_point sent_at;
+};
+
+// Parses one response at the start of in: its size, or 0 if incomplete
+size_t response_size(const std::string& in, bool* ok, bool* server_closes) {
+    size_t head_end = in.find("\r\n\r\n");
+    if(head_end == std::string::npos) return 0;
+    std::string head = in.substr(0, head_end);
+    std::transform(head.begin(), head.end(), head.begin(), ::tolower);
+    size_t end = head_end + 4;
+    if(head.find("transfer-encoding: chunked") != std::string::npos) {
+        // Large values come chunked: walk the chunks to the empty last one
+        while(true) {
+            size_t line_end = in.find("\r\n", end);
+            if(line_end == std::string::npos) return 0;
+            size_t chunk = std::stoul(in.substr(end, line_end - end), nullptr, 16);
+            end = line_end + 2 + chunk + 2;
+            if(in.size() < end) return 0;
+            if(chunk == 0) break;
+        }
+    } else {
+        size_t pos = head.find("content-length:");
+        if(pos != std::string::npos) end += std::stoul(head.substr(pos + 15));
+        if(in.size() < end) return 0;
+    }
+    *ok = head.compare(0, 10, "http/1.1 2") == 0;
+    *server_closes = head.find("connection: close") != std::string::npos;
+    return end;
+}
+
+class Worker {
+public:
+    Worker(int count) : conns(count) {
+        ep = epoll_create1(0);
+    }
+    ~Worker() {
+        for(auto& c : conns)
+            if(c.fd >= 0) close(c.fd);
+        close(ep);
+    }
+
+    void run() {
+        if(posts)
+            for(int i = 0; i < keyspace; i++) values.push_back(value_for(i));
+        for(size_t i = 0; i < conns.size(); i++)
+            open(i);
+
+        std::vector<epoll_event> events(1024);
+        while(!stop_test) {
+            int n = epoll_wait(ep, events.data(), events.size(), 100);
+            for(int e = 0; e < n; e++) {
+                size_t i = events[e].data.u64;
+                Conn& c = conns[i];
+                if(c.connecting) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    if(err != 0 || (events[e].events & (EPOLLERR | EPOLLHUP))) {
+                        connect_failures++;
+                        open(i);
+                        continue;
+                    }
+                    c.connecting = false;
+                    watch(i, EPOLLIN, EPOLL_CTL_MOD);
+                    send_request(i);
+                    continue;
+                }
+                if((events[e].events & EPOLLOUT) && !flush(i)) continue;
+                read_responses(i);
+            }
+        }
+
+        long long open_count = 0, served = 0;
+        for(auto& c : conns) {
+            if(c.fd >= 0 && !c.connecting) open_count++;
+            if(c.served) served++;
+        }
+        open_at_end += open_count;
+        served_connections += served;
+        std::lock_guard<std::mutex> lock(latencies_mtx);
+        latencies_us.insert(latencies_us.end(), local_latencies.begin(), local_latencies.end());
+    }
+
+private:
+    int ep;
+    std::vector<Conn> conns;
+    std::vector<long long> local_latencies;
+    std::mt19937 gen{std::random_device{}()};
+    std::vector<std::string> values; // for posts, one per key
+
+    void watch(size_t i, uint32_t events, int op) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = i;
+        epoll_ctl(ep, op, conns[i].fd, &ev);
+    }
+
+    // (Re)opens connection i without blocking
+    void open(size_t i) {
+        Conn& c = conns[i];
+        if(c.fd >= 0) close(c.fd);
+        c.in.clear();
+        c.out.clear();
+        c.waiting_out = false;
+        c.answered = 0;
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if(c.fd < 0) {
+            connect_failures++;
+            return;
+        }
+        int on = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        sockaddr_in addr = server_addr();
+        c.connecting = true;
+        if(connect(c.fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+            connect_failures++;
+            close(c.fd);
+            c.fd = -1;
+            return;
+        }
+        watch(i, EPOLLOUT, EPOLL_CTL_ADD);
+    }
+
+    void send_request(size_t i) {
+        Conn& c = conns[i];
+        std::uniform_int_distribution<> pick(0, keyspace - 1);
+        int k = pick(gen);
+        c.out = make_request(posts, k, posts ? values[k] : std::string());
+        if(fresh) c.out.insert(c.out.find("\r\n") + 2, "Connection: close\r\n");
+        c.out_sent = 0;
+        c.sent_at = std::chrono::steady_clock::now();
+        flush(i);
+    }
+
+    // Sends what the socket takes of c.out, waiting for EPOLLOUT for the
+    // rest. False if the connection had to be reopened.
+    bool flush(size_t i) {
+        Conn& c = conns[i];
+        while(c.out_sent < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.out_sent, c.out.size() - c.out_sent, MSG_NOSIGNAL);
+            if(n > 0) {
+                c.out_sent += n;
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if(!c.waiting_out) watch(i, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+                c.waiting_out = true;
+                return true;
+            }
+            // Closed after an earlier answer, as in read_responses()
+            if(c.answered > 0) reconnects++;
+            else total_errors++;
+            open(i);
+            return false;
+        }
+        c.out.clear();
+        c.out_sent = 0;
+        if(c.waiting_out) watch(i, EPOLLIN, EPOLL_CTL_MOD);
+        c.waiting_out = false;
+        return true;
+    }
+
+    void read_responses(size_t i) {
+        Conn& c = conns[i];
+        char buf[65536];
+        bool eof = false;
+        while(true) {
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if(n > 0) {
+                c.in.append(buf, n);
+                continue;
+            }
+            if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) eof = true;
+            break;
+        }
+
+        bool ok = false, server_closes = false;
+        size_t size = response_size(c.in, &ok, &server_closes);
+        if(size == 0) {
+            if(eof) {
+                // Closed between answers, without saying so: the server
+                // does not keep connections alive. Otherwise cut short.
+                if(c.in.empty() && c.answered > 0) reconnects++;
+                else total_errors++;
+                open(i);
+            }
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        local_latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - c.sent_at).count());
+        total_requests++;
+        if(!ok) total_errors++;
+        c.served = true;
+        c.answered++;
+        c.in.erase(0, size);
+
+        if(server_closes || eof) {
+            reconnects++;
+            open(i);
+        } else {
+            send_request(i);
+        }
+    }
+};
+
+// p in [0, 100]; expects a sorted vector
+long long percentile(const std::vector<long long>& sorted, double p) {
+    if(sorted.empty()) return 0;
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+int main(int argc, char** argv) {
+    for(int i = 1; i + 1 < argc; i += 2) {
+        std::string opt = argv[i], val = argv[i + 1];
+        if(opt == "-h") host = val;
+        else if(opt == "-p") port = std::stoi(val);
+        else if(opt == "-c") connections = std::max(1, std::stoi(val));
+        else if(opt == "-s") seconds = std::max(1, std::stoi(val));
+        else if(opt == "-T") threads = std::max(1, std::stoi(val));
+        else if(opt == "-r") keyspace = std::max(1, std::stoi(val));
+        else if(opt == "-d") value_size = std::stoul(val);
+        else if(opt == "-m" && (val == "json" || val == "raw")) raw = val == "raw";
+        else if(opt == "-o" && (val == "get" || val == "post")) posts = val == "post";
+        else if(opt == "-k" && (val == "reuse" || val == "fresh")) fresh = val == "fresh";
+        else {
+            std::cout << "Usage: ./http_bench [-h host] [-p port] [-c connections] [-s seconds]\n"
+                      << "                    [-T threads] [-r keyspace] [-d value bytes]\n"
+                      << "                    [-m json|raw] [-o get|post] [-k reuse|fresh]\n";
+            return 1;
+        }
+    }
+    threads = std::min(threads, connections);
+
+    // Every connection is a file descriptor
+    rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if((long long)limit.rlim_cur < connections + 64)
+            std::cerr << "Warning: only " << limit.rlim_cur << " file descriptors allowed\n";
+    }
+
+    if(!fill_keyspace()) {
+        std::cerr << "Cannot reach " << host << ":" << port << ". Server down?\n";
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for(int t = 0; t < threads; t++)
+        workers.push_back(std::make_unique<Worker>(connections / threads + (t < connections % threads ? 1 : 0)));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> running;
+    for(auto& w : workers)
+        running.emplace_back(&Worker::run, w.get());
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop_test = true;
+    for(auto& t : running) t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    std::cout << "====== " << (posts ? "POST " : "GET ") << (raw ? "/key/<key>" : "/key") << ", "
+              << connections << (fresh ? " connections, a new one per request" : " keep-alive connections")
+              << " ======\n"
+              << "  " << host << ":" << port << ", " << secs << " seconds, " << threads << " threads\n"
+              << "  connections open at the end: " << open_at_end.load() << "\n"
+              << "  connections served at least once: " << served_connections.load() << "\n"
+              << "  reopened after the server closed them: " << reconnects.load() << "\n"
+              << "  " << total_requests.load() << " requests, " << (secs > 0 ? total_requests.load() / secs : 0)
+              << " requests per second\n"
+              << "  latency p50 " << percentile(latencies_us, 50) << " us, p99 "
+              << percentile(latencies_us, 99) << " us\n";
+    if(value_size > 0 && secs > 0)
+        std::cout << "  " << value_size << " byte values, " << total_requests.load() * value_size / secs / 1e6
+                  << " MB of values per second\n";
+    if(total_errors > 0 || connect_failures > 0)
+        std::cout << "  " << total_errors.load() << " errors, " << connect_failures.load() << " failed connects\n";
+    return 0;
+}
@@ -7,7 +7,14 @@
 #include <random>
 #include <mutex>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
 #include <curl/curl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 
 std::atomic<long long> total_requests(0);
 std::atomic<long long> total_response_time_us(0);
@@ -17,11 +24,76 @@ const std::string BASE_URL = "http://127.0.0.1:8888";
 std::mutex popular_keys_mtx;
 std::vector<std::string> popular_keys;
 const int POPULAR_KEY_COUNT = 50;
+// Latencies (us) of successful GETs, merged from all workers at the end
+std::mutex get_latencies_mtx;
+std::vector<long long> get_latencies_us;
+// put-durability: POST latencies (us) per ?durability= level
+const char* DURABILITY_LEVELS[] = {"memory", "log", "db"};
+const int NUM_DURABILITY_LEVELS = 3;
+std::mutex post_latencies_mtx;
+std::vector<long long> post_latencies_us[NUM_DURABILITY_LEVELS];
+// mget / mset: keys per request, and keys moved in total
+int batch_size = 10;
+std::atomic<long long> total_keys(0);
+std::vector<std::string> batch_keys; // written once before the mget run
+const int BATCH_KEY_COUNT = 10000;
+// bin-*: the server's binary protocol listener (see Server/include/BinaryServer.h)
+const int BINARY_PORT = 8889;
+const size_t BIN_HEADER_SIZE = 16;
+
+// --fresh: a new curl handle, so a new TCP connection, for every request.
+// By default each worker thread keeps one handle and curl keeps its
+// connection alive between requests.
+bool fresh_connections = false;
+std::atomic<long long> total_connects(0); // TCP connections curl opened
+
+struct ThreadHandle {
+    CURL* curl = curl_easy_init();
+    ~ThreadHandle() { curl_easy_cleanup(curl); }
+};
+
+CURL* http_handle() {
+    if(fresh_connections) return curl_easy_init();
+    thread_local ThreadHandle handle;
+    // Clears the options but keeps the open connection
+    if(handle.curl) curl_easy_reset(handle.curl);
+    return handle.curl;
+}
+
+void http_done(CURL* curl) {
+    long connects = 0;
+    if(curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK)
+        total_connects += connects;
+    if(fresh_connections) curl_easy_cleanup(curl);
+}
 
 static size_t write_callback(void*, size_t size, size_t nmemb, void*) {
     return size * nmemb;  // discard body (we don't need it)
 }
 
+static size_t append_callback(void* data, size_t size, size_t nmemb, void* out) {
+    static_cast<std::string*>(out)->append(static_cast<char*>(data), size * nmemb);
+    return size * nmemb;
+}
+
+// Server-side counters (engine, write amplification, queues) after the run
+std::string fetch_stats() {
+    std::string body;
+    CURL* curl = curl_easy_init();
+    if(!curl) return body;
+
+    curl_easy_setopt(curl, CURLOPT_URL, (BASE_URL + "/stats").c_str());
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 2000L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    if(curl_easy_perform(curl) != CURLE_OK)
+        body.clear();
+    curl_easy_cleanup(curl);
+    return body;
+}
+
 std::string random_string(std::mt19937& gen, int length = 10) {
     static const char chars[] =
         "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
@@ -32,8 +104,8 @@ std::string random_string(std::mt19937& gen, int length = 10) {
         s.push_back(chars[dist(gen)]);
     return s;
 }
-bool http_post(const std::string& url, const std::string& json) {
-    CURL* curl = curl_easy_init();
+bool http_post(const std::string& url, const std::string& json, long expected_code = 201) {
+    CURL* curl = http_handle();
     if(!curl) return false;
 
     struct curl_slist* headers = nullptr;
@@ -55,12 +127,12 @@ bool http_post(const std::string& url, const std::string& json) {
     }
 
     curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    return (code == 201);
+    http_done(curl);
+    return (code == expected_code);
 }
 
 bool http_get(const std::string& url) {
-    CURL* curl = curl_easy_init();
+    CURL* curl = http_handle();
     if(!curl) return false;
 
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
@@ -75,12 +147,12 @@ bool http_get(const std::string& url) {
     if(res == CURLE_OK)
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 
-    curl_easy_cleanup(curl);
+    http_done(curl);
     return (code == 200);
 }
 
 bool http_delete(const std::string& url) {
-    CURL* curl = curl_easy_init();
+    CURL* curl = http_handle();
     if(!curl) return false;
 
     curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
@@ -96,20 +168,161 @@ bool http_delete(const std::string& url) {
     if(res == CURLE_OK)
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 
-    curl_easy_cleanup(curl);
+    http_done(curl);
     return (code == 200);
 }
 
-void client_worker(const std::string& workload) {
+// {"keys": [...]} for /keys/mget and /keys/mdel
+std::string keys_body(const std::vector<std::string>& keys) {
+    std::string body = "{\"keys\":[";
+    for(size_t i = 0; i < keys.size(); i++)
+        body += (i ? ",\"" : "\"") + keys[i] + "\"";
+    return body + "]}";
+}
+
+// {"items": [{"key": ..., "value": ...}, ...]} for /keys/mset
+std::string items_body(const std::vector<std::string>& keys, const std::vector<std::string>& values) {
+    std::string body = "{\"items\":[";
+    for(size_t i = 0; i < keys.size(); i++)
+        body += std::string(i ? "," : "") + "{\"key\":\"" + keys[i] + "\",\"value\":\"" + values[i] + "\"}";
+    return body + "]}";
+}
+
+int binary_connect() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BINARY_PORT);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+// GET request: magic 0x80, opcode 1, key length, no value, opaque
+void append_binary_get(std::string& buf, const std::string& key, uint32_t opaque) {
+    char header[BIN_HEADER_SIZE] = {};
+    header[0] = (char)0x80;
+    header[1] = 1;
+    uint16_t key_len = key.size();
+    memcpy(header + 2, &key_len, 2);
+    memcpy(header + 8, &opaque, 4);
+    buf.append(header, BIN_HEADER_SIZE);
+    buf += key;
+}
+
+bool send_all(int fd, const std::string& buf) {
+    size_t sent = 0;
+    while(sent < buf.size()) {
+        ssize_t n = send(fd, buf.data() + sent, buf.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool recv_exact(int fd, char* buf, size_t len) {
+    size_t got = 0;
+    while(got < len) {
+        ssize_t n = recv(fd, buf + got, len - got, 0);
+        if(n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+// bin-get-popular: get-popular over the binary protocol, one connection
+// per thread, batch_size GETs pipelined per round trip. Every response
+// counts as a request; its latency is that of the whole round trip.
+void binary_worker() {
+    std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<> pick(0, POPULAR_KEY_COUNT - 1);
+    std::vector<long long> local_get_latencies;
+    std::string out, value;
+
+    int fd = binary_connect();
+    if(fd < 0) {
+        std::cerr << "Cannot connect to binary port " << BINARY_PORT << "\n";
+        total_failed++;
+        return;
+    }
+
+    while(!stop_test) {
+        auto start = std::chrono::steady_clock::now();
+        out.clear();
+        for(int i = 0; i < batch_size; i++) {
+            std::lock_guard<std::mutex> lock(popular_keys_mtx);
+            append_binary_get(out, popular_keys[pick(gen) % popular_keys.size()], i);
+        }
+        if(!send_all(fd, out)) {
+            total_failed += batch_size;
+            break;
+        }
+
+        int ok = 0, failed = 0;
+        bool connected = true;
+        for(int i = 0; i < batch_size && connected; i++) {
+            char header[BIN_HEADER_SIZE];
+            uint32_t value_len;
+            connected = recv_exact(fd, header, BIN_HEADER_SIZE);
+            if(!connected) break;
+            memcpy(&value_len, header + 4, 4);
+            value.resize(value_len);
+            connected = recv_exact(fd, value.data(), value_len);
+            if(connected && header[12] == 0) ok++;
+            else failed++;
+        }
+        if(!connected) {
+            total_failed += batch_size - ok;
+            break;
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        long long us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        total_requests += ok;
+        total_keys += ok;
+        total_failed += failed;
+        total_response_time_us += us * ok;
+        local_get_latencies.insert(local_get_latencies.end(), ok, us);
+    }
+    close(fd);
+
+    std::lock_guard<std::mutex> lock(get_latencies_mtx);
+    get_latencies_us.insert(get_latencies_us.end(),
+                            local_get_latencies.begin(), local_get_latencies.end());
+}
+
+void client_worker(const std::string& workload, int id) {
+    if(workload == "bin-get-popular") {
+        binary_worker();
+        return;
+    }
+
     std::mt19937 gen(std::random_device{}());
     std::uniform_int_distribution<> pick(0, POPULAR_KEY_COUNT - 1);
+    std::uniform_int_distribution<> pick_batch(0, BATCH_KEY_COUNT - 1);
     std::uniform_int_distribution<> mix(0, 99);
+    std::vector<long long> local_get_latencies;
+    std::vector<long long> local_post_latencies[NUM_DURABILITY_LEVELS];
+    int next_level = id % NUM_DURABILITY_LEVELS;
+
+    // get-under-write: even threads flood writes, odd threads measure GET misses
+    bool writer = (workload == "put-all") ||
+                  (workload == "get-under-write" && id % 2 == 0);
 
     while(!stop_test) {
         auto start = std::chrono::steady_clock::now();
         bool ok = false;
+        bool is_get = false;
+        int post_level = -1;
+        int keys_moved = 1;
 
-        if(workload == "put-all") {
+        if(writer) {
             std::string key = "key_" + random_string(gen, 12);
             std::string val = random_string(gen, 32);
             std::string body = "{\"key\":\"" + key + "\",\"value\":\"" + val + "\"}";
@@ -118,9 +331,36 @@ void client_worker(const std::string& workload) {
                 ok = http_delete(BASE_URL + "/key/" + key);
             }
 
-        } else if(workload == "get-all") {
+        } else if(workload == "put-durability") {
+            // Every thread rotates through the levels, one POST each
+            post_level = next_level;
+            next_level = (next_level + 1) % NUM_DURABILITY_LEVELS;
+            std::string key = "dur_" + random_string(gen, 12);
+            std::string val = random_string(gen, 32);
+            std::string body = "{\"key\":\"" + key + "\",\"value\":\"" + val + "\"}";
+            ok = http_post(BASE_URL + "/key?durability=" + DURABILITY_LEVELS[post_level], body);
+
+        } else if(workload == "mget") {
+            std::vector<std::string> keys;
+            for(int i = 0; i < batch_size; i++)
+                keys.push_back(batch_keys[pick_batch(gen) % batch_keys.size()]);
+            ok = http_post(BASE_URL + "/keys/mget", keys_body(keys), 200);
+            is_get = true;
+            keys_moved = batch_size;
+
+        } else if(workload == "mset") {
+            std::vector<std::string> keys, values;
+            for(int i = 0; i < batch_size; i++) {
+                keys.push_back("mset_" + random_string(gen, 12));
+                values.push_back(random_string(gen, 32));
+            }
+            ok = http_post(BASE_URL + "/keys/mset", items_body(keys, values), 200);
+            keys_moved = batch_size;
+
+        } else if(workload == "get-all" || workload == "get-under-write") {
             std::string key = "miss_" + random_string(gen, 12);
             ok = http_get(BASE_URL + "/key?key=" + key);
+            is_get = true;
 
         } else if(workload == "get-popular") {
             std::string key;
@@ -129,6 +369,7 @@ void client_worker(const std::string& workload) {
                 key = popular_keys[pick(gen)];
             }
             ok = http_get(BASE_URL + "/key?key=" + key);
+            is_get = true;
 
         } else if(workload == "get-put") {
             int r = mix(gen);
@@ -139,6 +380,7 @@ void client_worker(const std::string& workload) {
                     key = popular_keys[pick(gen)];
                 }
                 ok = http_get(BASE_URL + "/key?key=" + key);
+                is_get = true;
 
             } else if(r < 95) {
                 std::string key = "mix_" + random_string(gen, 12);
@@ -160,12 +402,34 @@ void client_worker(const std::string& workload) {
             auto end = std::chrono::steady_clock::now();
             long long us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
             total_requests++;
+            total_keys += keys_moved;
             total_response_time_us += us;
+            if(is_get)
+                local_get_latencies.push_back(us);
+            if(post_level >= 0)
+                local_post_latencies[post_level].push_back(us);
         }
         else{
             total_failed++;
         }
     }
+
+    {
+        std::lock_guard<std::mutex> lock(get_latencies_mtx);
+        get_latencies_us.insert(get_latencies_us.end(),
+                                local_get_latencies.begin(), local_get_latencies.end());
+    }
+    std::lock_guard<std::mutex> lock(post_latencies_mtx);
+    for(int l = 0; l < NUM_DURABILITY_LEVELS; l++)
+        post_latencies_us[l].insert(post_latencies_us[l].end(),
+                                    local_post_latencies[l].begin(), local_post_latencies[l].end());
+}
+
+// p in [0, 100]; expects a sorted vector
+long long percentile(const std::vector<long long>& sorted, double p) {
+    if(sorted.empty()) return 0;
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1));
+    return sorted[idx];
 }
 
 void pre_populate() {
@@ -186,29 +450,62 @@ void pre_populate() {
     std::cout << "Done.\n";
 }
 
+// Writes the key set for mget with /keys/mset, 1000 keys per request
+void pre_populate_batch() {
+    std::cout << "Pre-populating " << BATCH_KEY_COUNT << " batch keys...\n";
+    std::mt19937 gen(std::random_device{}());
+
+    for(int start = 0; start < BATCH_KEY_COUNT; start += 1000) {
+        std::vector<std::string> keys, values;
+        for(int i = start; i < std::min(start + 1000, BATCH_KEY_COUNT); i++) {
+            keys.push_back("batch_" + std::to_string(i));
+            values.push_back(random_string(gen, 48));
+        }
+        if(http_post(BASE_URL + "/keys/mset", items_body(keys, values), 200))
+            batch_keys.insert(batch_keys.end(), keys.begin(), keys.end());
+        else
+            std::cerr << "Failed prepopulate: batch starting at " << start << "\n";
+    }
+    std::cout << "Done.\n";
+}
+
 int main(int argc, char** argv) {
-    if(argc != 4) {
-        std::cout << "Usage: ./load_gen <threads> <duration_secs> <workload>\n";
+    if(argc > 1 && std::string(argv[1]) == "--fresh") {
+        fresh_connections = true;
+        argv++;
+        argc--;
+    }
+    if(argc != 4 && argc != 5) {
+        std::cout << "Usage: ./load_gen [--fresh] <threads> <duration_secs> <workload> [batch_size]\n";
         return 1;
     }
 
     int threads = std::stoi(argv[1]);
     int duration = std::stoi(argv[2]);
     std::string workload = argv[3];
+    if(argc == 5)
+        batch_size = std::max(1, std::stoi(argv[4]));
 
     curl_global_init(CURL_GLOBAL_ALL);
 
-    if(workload == "get-popular" || workload == "get-put") {
+    if(workload == "get-popular" || workload == "get-put" || workload == "bin-get-popular") {
         pre_populate();
         if(popular_keys.empty()) {
             std::cerr << "No popular keys inserted. Server down?\n";
             return 1;
         }
     }
+    if(workload == "mget") {
+        pre_populate_batch();
+        if(batch_keys.empty()) {
+            std::cerr << "No batch keys inserted. Server down?\n";
+            return 1;
+        }
+    }
 
     std::vector<std::thread> workers;
     for(int i = 0; i < threads; i++)
-        workers.emplace_back(client_worker, workload);
+        workers.emplace_back(client_worker, workload, i);
 
     std::this_thread::sleep_for(std::chrono::seconds(duration));
     stop_test = true;
@@ -227,6 +524,36 @@ int main(int argc, char** argv) {
     std::cout << "Throughput:               " << tps << " req/s\n";
     std::cout << "Avg Response Time:        " << avg_rt << " us\n";
     std::cout << "Total Failed:        " << total_failed << "\n";
+    if(total_connects > 0) {
+        std::cout << "HTTP Connections:         " << (fresh_connections ? "new per request" : "reused per thread") << "\n";
+        std::cout << "TCP Connects:             " << total_connects.load() << " ("
+                  << (double)total_connects.load() / std::max(1LL, final + total_failed.load()) << " per request)\n";
+    }
+    if(workload == "mget" || workload == "mset") {
+        std::cout << "Batch Size:               " << batch_size << "\n";
+        std::cout << "Key Throughput:           " << (double)total_keys.load() / duration << " keys/s\n";
+    }
+    if(workload == "bin-get-popular")
+        std::cout << "Pipeline Depth:           " << batch_size << "\n";
+
+    if(!get_latencies_us.empty()) {
+        std::sort(get_latencies_us.begin(), get_latencies_us.end());
+        std::cout << "GET p50 Latency:          " << percentile(get_latencies_us, 50) << " us\n";
+        std::cout << "GET p99 Latency:          " << percentile(get_latencies_us, 99) << " us\n";
+    }
+
+    for(int l = 0; l < NUM_DURABILITY_LEVELS; l++) {
+        auto& lat = post_latencies_us[l];
+        if(lat.empty()) continue;
+        std::sort(lat.begin(), lat.end());
+        std::cout << "POST durability=" << DURABILITY_LEVELS[l] << ": "
+                  << lat.size() << " reqs, p50 " << percentile(lat, 50)
+                  << " us, p99 " << percentile(lat, 99) << " us\n";
+    }
+
+    std::string stats = fetch_stats();
+    if(!stats.empty())
+        std::cout << "\n--- Server Stats ---\n" << stats << "\n";
 
     curl_global_cleanup();
     return 0;
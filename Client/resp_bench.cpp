@@ -0,0 +1,313 @@
+// Pipelined benchmark for the server's Redis (RESP2) listener, in the
+// style of redis-benchmark:
+//
+//   ./resp_bench [-h host] [-p port] [-c clients] [-n requests] [-P pipeline]
+//                [-d value_size] [-r keyspace] [-t get,set,...]
+//
+// Every client is a thread with its own connection, sending -P commands
+// per round trip. Tests: ping, set, get, mset, mget (10 keys), del.
+// The key space is filled with SET before the read tests run.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <mutex>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+std::string host = "127.0.0.1";
+int port = 6379;
+int clients = 50;
+long long requests = 100000;
+int pipeline = 1;
+int value_size = 3;
+int keyspace = 10000;
+const int MULTI_KEYS = 10;
+
+// Latencies (us) of every round trip, merged from all clients per test
+std::mutex latencies_mtx;
+std::vector<long long> latencies_us;
+
+// Buffered reader over the socket, enough RESP to skip over one reply
+class RespReader {
+public:
+    explicit RespReader(int fd) : fd(fd) {}
+
+    // Returns false if the connection broke; *error is set for "-" replies
+    bool read_reply(bool* error) {
+        std::string line;
+        if(!read_line(line)) return false;
+        if(line.empty()) return false;
+        switch(line[0]) {
+        case '-':
+            *error = true;
+            return true;
+        case '+':
+        case ':':
+            return true;
+        case '$': {
+            long long size = std::stoll(line.substr(1));
+            return size < 0 || skip(size + 2);
+        }
+        case '*': {
+            long long count = std::stoll(line.substr(1));
+            for(long long i = 0; i < count; i++)
+                if(!read_reply(error)) return false;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+private:
+    int fd;
+    std::string buf;
+    size_t pos = 0;
+
+    bool fill() {
+        if(pos > 0) {
+            buf.erase(0, pos);
+            pos = 0;
+        }
+        char chunk[65536];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if(n <= 0) return false;
+        buf.append(chunk, n);
+        return true;
+    }
+
+    bool read_line(std::string& line) {
+        while(true) {
+            size_t end = buf.find("\r\n", pos);
+            if(end != std::string::npos) {
+                line = buf.substr(pos, end - pos);
+                pos = end + 2;
+                return true;
+            }
+            if(!fill()) return false;
+        }
+    }
+
+    bool skip(long long n) {
+        while((long long)(buf.size() - pos) < n)
+            if(!fill()) return false;
+        pos += n;
+        return true;
+    }
+};
+
+int connect_server() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+void append_command(std::string& out, const std::vector<std::string>& args) {
+    out += "*" + std::to_string(args.size()) + "\r\n";
+    for(auto& a : args)
+        out += "$" + std::to_string(a.size()) + "\r\n" + a + "\r\n";
+}
+
+std::string key_name(int i) {
+    return "key:" + std::to_string(i);
+}
+
+// One command of the given test, on random keys
+void append_test_command(std::string& out, const std::string& test, std::mt19937& gen,
+                         const std::string& value) {
+    std::uniform_int_distribution<> pick(0, keyspace - 1);
+    if(test == "ping") {
+        append_command(out, {"PING"});
+    } else if(test == "set") {
+        append_command(out, {"SET", key_name(pick(gen)), value});
+    } else if(test == "get") {
+        append_command(out, {"GET", key_name(pick(gen))});
+    } else if(test == "del") {
+        append_command(out, {"DEL", key_name(pick(gen))});
+    } else if(test == "mset") {
+        std::vector<std::string> args = {"MSET"};
+        for(int i = 0; i < MULTI_KEYS; i++) {
+            args.push_back(key_name(pick(gen)));
+            args.push_back(value);
+        }
+        append_command(out, args);
+    } else if(test == "mget") {
+        std::vector<std::string> args = {"MGET"};
+        for(int i = 0; i < MULTI_KEYS; i++)
+            args.push_back(key_name(pick(gen)));
+        append_command(out, args);
+    }
+}
+
+// Sends `count` commands of `test`, `pipeline` per round trip
+void client_worker(const std::string& test, long long count,
+                   std::atomic<long long>& errors, std::atomic<long long>& done) {
+    std::mt19937 gen(std::random_device{}());
+    std::string value(value_size, 'x');
+    std::vector<long long> local_latencies;
+
+    int fd = connect_server();
+    if(fd < 0) {
+        errors += count;
+        return;
+    }
+    RespReader reader(fd);
+
+    std::string out;
+    while(count > 0) {
+        int batch = (int)std::min<long long>(pipeline, count);
+        out.clear();
+        for(int i = 0; i < batch; i++)
+            append_test_command(out, test, gen, value);
+
+        auto start = std::chrono::steady_clock::now();
+        size_t sent = 0;
+        while(sent < out.size()) {
+            ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if(n <= 0) break;
+            sent += n;
+        }
+        int replies = 0;
+        for(; replies < batch; replies++) {
+            bool error = false;
+            if(!reader.read_reply(&error)) break;
+            if(error) errors++;
+        }
+        if(sent < out.size() || replies < batch) {
+            errors += count;
+            break;
+        }
+        auto end = std::chrono::steady_clock::now();
+        local_latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+        done += batch;
+        count -= batch;
+    }
+    close(fd);
+
+    std::lock_guard<std::mutex> lock(latencies_mtx);
+    latencies_us.insert(latencies_us.end(), local_latencies.begin(), local_latencies.end());
+}
+
+// p in [0, 100]; expects a sorted vector
+long long percentile(const std::vector<long long>& sorted, double p) {
+    if(sorted.empty()) return 0;
+    size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+void run_test(const std::string& test) {
+    std::atomic<long long> errors(0), done(0);
+    latencies_us.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for(int c = 0; c < clients; c++) {
+        // Spread the requests, the first clients take the remainder
+        long long share = requests / clients + (c < requests % clients ? 1 : 0);
+        workers.emplace_back(client_worker, test, share, std::ref(errors), std::ref(done));
+    }
+    for(auto& t : workers) t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    std::string name = test;
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    if(test == "mset" || test == "mget")
+        name += " (" + std::to_string(MULTI_KEYS) + " keys)";
+    std::cout << "====== " << name << " ======\n"
+              << "  " << done.load() << " requests completed in " << secs << " seconds\n"
+              << "  " << clients << " parallel clients, pipeline " << pipeline
+              << ", " << value_size << " bytes payload\n"
+              << "  " << (secs > 0 ? done.load() / secs : 0) << " requests per second\n"
+              << "  round trip p50 " << percentile(latencies_us, 50)
+              << " us, p99 " << percentile(latencies_us, 99) << " us\n";
+    if(errors > 0)
+        std::cout << "  " << errors.load() << " errors\n";
+    std::cout << "\n";
+}
+
+// Writes every key of the key space once, so read tests hit
+bool fill_keyspace() {
+    int fd = connect_server();
+    if(fd < 0) return false;
+    RespReader reader(fd);
+    std::string value(value_size, 'x');
+    for(int start = 0; start < keyspace; start += 1000) {
+        std::string out;
+        int n = std::min(1000, keyspace - start);
+        for(int i = 0; i < n; i++)
+            append_command(out, {"SET", key_name(start + i), value});
+        if(send(fd, out.data(), out.size(), MSG_NOSIGNAL) != (ssize_t)out.size()) break;
+        for(int i = 0; i < n; i++) {
+            bool error = false;
+            if(!reader.read_reply(&error)) {
+                close(fd);
+                return false;
+            }
+        }
+    }
+    close(fd);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string tests = "ping,set,get,mset,mget";
+    for(int i = 1; i + 1 < argc; i += 2) {
+        std::string opt = argv[i], val = argv[i + 1];
+        if(opt == "-h") host = val;
+        else if(opt == "-p") port = std::stoi(val);
+        else if(opt == "-c") clients = std::max(1, std::stoi(val));
+        else if(opt == "-n") requests = std::stoll(val);
+        else if(opt == "-P") pipeline = std::max(1, std::stoi(val));
+        else if(opt == "-d") value_size = std::max(1, std::stoi(val));
+        else if(opt == "-r") keyspace = std::max(1, std::stoi(val));
+        else if(opt == "-t") tests = val;
+        else {
+            std::cout << "Usage: ./resp_bench [-h host] [-p port] [-c clients] [-n requests] [-P pipeline]\n"
+                      << "                    [-d value_size] [-r keyspace] [-t ping,set,get,mset,mget,del]\n";
+            return 1;
+        }
+    }
+
+    std::vector<std::string> selected;
+    std::stringstream ss(tests);
+    const std::vector<std::string> known = {"ping", "set", "get", "mset", "mget", "del"};
+    for(std::string t; std::getline(ss, t, ',');) {
+        if(std::find(known.begin(), known.end(), t) == known.end()) {
+            std::cerr << "Unknown test: " << t << "\n";
+            return 1;
+        }
+        selected.push_back(t);
+    }
+
+    if(std::find(selected.begin(), selected.end(), "get") != selected.end() ||
+       std::find(selected.begin(), selected.end(), "mget") != selected.end()) {
+        if(!fill_keyspace()) {
+            std::cerr << "Cannot reach " << host << ":" << port << ". Server down?\n";
+            return 1;
+        }
+    }
+    for(auto& t : selected)
+        run_test(t);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include "LogFormat.h"
+#pragma once
+
+// Append-only record log with group commit. Appends are serialized and
+// written immediately; a syncer thread then issues one fdatasync for all
+// of them and fires their durability callbacks. Under concurrency the
+// cost of a sync is thus shared by every writer waiting on it.
+class AppendLog
+{
+public:
+    using SyncCallback = std::function<void(bool ok)>;
+
+    // Opens (or creates) the log for appending
+    explicit AppendLog(const std::string &path);
+    // Syncs whatever is outstanding and fires the remaining callbacks
+    ~AppendLog();
+
+    // Returns the offset just past the record. on_durable (optional) runs
+    // on the syncer thread once the record is on stable storage.
+    uint64_t append(uint8_t flags, const std::string &key, const std::string &value,
+                    SyncCallback on_durable = nullptr);
+
+    // Blocking fdatasync of everything appended so far, for callers that
+    // can't wait for the syncer. Callbacks still fire from the syncer.
+    bool sync();
+
+    uint64_t size() const { return size_.load(); }
+    const std::string &path() const { return path_; }
+    uint64_t syncs() const { return syncs_.load(); }
+    uint64_t synced_records() const { return synced_records_.load(); }
+
+    // Reads every intact record starting at `offset`, truncating a torn tail.
+    // fn gets each record and the offset just past it.
+    static void replay(const std::string &path, uint64_t offset,
+                       const std::function<void(const LogRecord &, uint64_t end)> &fn);
+
+private:
+    void sync_loop();
+
+    std::string path_;
+    int fd_ = -1;
+    std::atomic<uint64_t> size_{0};
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool dirty_ = false;
+    bool stop_ = false;
+    std::vector<SyncCallback> waiting_;
+    std::thread syncer_;
+
+    std::atomic<uint64_t> syncs_{0};
+    std::atomic<uint64_t> synced_records_{0};
+};
@@ -0,0 +1,123 @@
+#include <mysql/mysql.h> // MySQL C API
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <functional>
+#pragma once
+
+// Runs queries on libmysqlclient's non-blocking API, driven by epoll.
+// A handful of loop threads each own several connections, so many queries
+// can be in flight without tying up one caller thread per query.
+//
+// Only the text protocol has a non-blocking variant in libmysqlclient
+// (there is no mysql_stmt_execute_nonblocking), so arguments are sent as
+// hex literals, which need no escaping.
+//
+// Connections are opened blocking at startup. A connection the server
+// dropped is reopened with mysql_real_connect_nonblocking on its loop, so
+// a slow or unreachable server never stalls the other connections. Every
+// query has a deadline `timeout` after it was queued: past it, the query
+// fails, and a connection still waiting for its answer is replaced.
+class AsyncDBExecutor
+{
+public:
+    // ok == false means the query failed; result then holds the error text.
+    // Otherwise result is the first column of the first row ("" if no row).
+    using Callback = std::function<void(bool ok, std::string result)>;
+    // Rows of the first result set; error holds the error text when !ok
+    using Rows = std::vector<std::vector<std::string>>;
+    using RowsCallback = std::function<void(bool ok, Rows rows, std::string error)>;
+
+    AsyncDBExecutor(const std::string &host,
+                    const std::string &user,
+                    const std::string &password,
+                    const std::string &db,
+                    int port,
+                    size_t num_threads,
+                    size_t conns_per_thread,
+                    std::chrono::milliseconds timeout);
+    ~AsyncDBExecutor();
+
+    // Queue a raw SQL statement. cb runs on an executor thread, keep it short.
+    void execute(std::string sql, Callback cb);
+    void execute(std::string sql, RowsCallback cb);
+
+    // CALL select_kv() for key
+    void get(const std::string &key, Callback cb);
+    std::future<std::string> get(const std::string &key);
+
+    // Number of queries submitted but not completed yet
+    size_t in_flight() const { return in_flight_.load(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request
+    {
+        std::string sql;
+        RowsCallback cb;
+        Clock::time_point deadline;
+    };
+
+    enum class ConnState
+    {
+        Connecting,  // mysql_real_connect_nonblocking
+        Down,        // connect failed, retried at retry_at
+        Idle,
+        Query,       // mysql_real_query_nonblocking
+        StoreResult, // mysql_store_result_nonblocking
+        NextResult,  // draining extra result sets from CALL
+    };
+
+    struct Connection
+    {
+        MYSQL *mysql = nullptr;
+        int fd = -1; // registered with the loop's epoll while >= 0
+        ConnState state = ConnState::Idle;
+        Clock::time_point deadline; // of a connect under way
+        Clock::time_point retry_at;
+        Request req;
+        bool have_rows = false; // first result set already captured
+        Rows rows;
+    };
+
+    struct Loop
+    {
+        int epoll_fd = -1;
+        int event_fd = -1; // wakes the loop when requests are submitted
+        std::thread thread;
+        std::mutex mtx;
+        std::deque<Request> inbox;   // guarded by mtx
+        std::deque<Request> pending; // loop thread only
+        std::vector<std::unique_ptr<Connection>> conns;
+    };
+
+    void connect(Connection *c);
+    // Closes c and starts opening it again; drive() then takes it on
+    void reconnect(Loop *loop, Connection *c);
+    // Leaves c Down until its next try
+    void fail_connect(Loop *loop, Connection *c);
+    void watch(Loop *loop, Connection *c);
+    void unwatch(Loop *loop, Connection *c);
+    void run(Loop *loop);
+    // Fails what is past its deadline and retries connections that are down
+    void expire(Loop *loop);
+    // Advances c's state machine; returns once it needs to wait on the socket
+    void drive(Loop *loop, Connection *c);
+    void finish(Loop *loop, Connection *c, bool ok, std::string error);
+
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::atomic<size_t> next_loop_{0};
+    std::atomic<size_t> in_flight_{0};
+    std::atomic<bool> stop_{false};
+
+    std::string host_, user_, password_, db_;
+    int port_;
+    std::chrono::milliseconds timeout_;
+};
@@ -0,0 +1,73 @@
+#include <string>
+#include <cstdint>
+#include "KVService.h"
+#include "EventServer.h"
+#pragma once
+
+// Compact binary protocol served next to the HTTP API, for clients that
+// want cache hits without HTTP parsing and JSON. Every message is a
+// 16-byte little-endian header followed by the key, then the value:
+//
+//   0  u8   magic         0x80 request, 0x81 response
+//   1  u8   opcode        1 GET, 2 PUT, 3 DELETE
+//   2  u16  key length    (0 in responses)
+//   4  u32  value length  GET response: the value, errors: a message
+//   8  u32  opaque        copied into the response
+//  12  u8   flags         request: durability of PUT/DELETE (0 log, 1 memory, 2 db)
+//                         response: status (0 ok, 1 not found, 2 overloaded,
+//                         3 failed, 4 bad request)
+//  13  u8[3]              zero
+//
+// Clients may pipeline any number of requests. Cache hits are answered
+// in order, reads that miss and writes whenever storage is done, so
+// responses can come back out of order: match them by opaque. As with
+// concurrent HTTP clients, a GET pipelined behind a PUT to the same key
+// may see the old value until the PUT has been answered.
+namespace binproto
+{
+    const size_t HEADER_SIZE = 16;
+    const uint8_t REQUEST_MAGIC = 0x80;
+    const uint8_t RESPONSE_MAGIC = 0x81;
+    const uint32_t MAX_VALUE_SIZE = 16 << 20; // larger requests close the connection
+
+    enum Opcode : uint8_t
+    {
+        GET = 1,
+        PUT = 2,
+        DELETE = 3,
+    };
+
+    enum Status : uint8_t
+    {
+        OK = 0,
+        NOT_FOUND = 1,
+        OVERLOADED = 2,
+        FAILED = 3,
+        BAD_REQUEST = 4,
+    };
+
+    // Appends one framed message to buf
+    void encode(std::string &buf, uint8_t magic, uint8_t opcode, uint8_t flags, uint32_t opaque,
+                const char *key, uint16_t key_len, const char *value, uint32_t value_len);
+}
+
+struct BinaryServerConfig
+{
+    int port = 8889;
+    size_t threads = 4; // event loops, each with its own SO_REUSEPORT socket
+};
+
+// Serves the binary protocol on EventServer's event loops. Misses and
+// writes go through KVService's async calls and are answered unordered.
+class BinaryServer : public EventServer
+{
+public:
+    // Starts listening; throws std::runtime_error if the port can't be bound
+    BinaryServer(KVService &kv, const BinaryServerConfig &config);
+    ~BinaryServer() override;
+
+private:
+    long on_input(Connection &conn, const char *data, size_t len) override;
+
+    KVService &kv_;
+};
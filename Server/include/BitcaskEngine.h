@@ -0,0 +1,132 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "StorageEngine.h"
+#include "AppendLog.h"
+#pragma once
+
+struct BitcaskConfig
+{
+    std::string dir = "data/bitcask";
+    uint64_t max_file_size = 64ull << 20;            // rotate the active file past this
+    std::chrono::seconds merge_interval{30};        // how often compaction runs
+    double merge_dead_ratio = 0.5;                   // compact files at least this stale
+};
+
+// Embedded Bitcask-style engine, no external database needed.
+//
+// Every write is appended to the active data file and the in-memory index
+// (key -> file, offset) is updated, so a read is a single pread. The
+// active file is an AppendLog, whose syncer fdatasync()s it on behalf of
+// all writers that appended since the last sync (group commit) and then
+// fires their commit callbacks. Older files are immutable; a background
+// thread writes hint files for them (for fast index rebuild at startup)
+// and compacts files whose records are mostly overwritten or deleted.
+class BitcaskEngine : public StorageEngine
+{
+public:
+    explicit BitcaskEngine(const BitcaskConfig &config);
+    ~BitcaskEngine();
+
+    const char *name() const override { return "bitcask"; }
+
+    using StorageEngine::get;
+    void get(const std::string &key, GetCallback cb) override;
+    bool put(const std::string &key, const std::string &value,
+             WriteCallback on_commit = nullptr,
+             Durability durability = Durability::Log) override;
+    bool remove(const std::string &key, WriteCallback on_commit = nullptr,
+                Durability durability = Durability::Log) override;
+    KeyValues scan(const std::string &start_key, size_t limit) override;
+    void report_stats(nlohmann::json &out) override;
+
+private:
+    struct Location
+    {
+        uint32_t file_id;
+        uint64_t offset; // of the record header
+        uint32_t key_len;
+        uint32_t value_len;
+    };
+
+    struct IndexShard
+    {
+        std::shared_mutex mtx;
+        std::unordered_map<std::string, Location> entries;
+    };
+
+    struct DataFile
+    {
+        uint32_t id;
+        int fd = -1; // for reads; the active file is written through log_
+        std::atomic<uint64_t> size{0};
+        std::atomic<uint64_t> dead_bytes{0}; // overwritten, deleted or tombstone records
+        std::atomic<bool> has_hint{false};
+        ~DataFile();
+    };
+
+    IndexShard *shard_for(const std::string &key);
+    std::shared_ptr<DataFile> file(uint32_t id);
+    std::string data_path(uint32_t id) const;
+    std::string hint_path(uint32_t id) const;
+
+    // Startup
+    void load();
+    void load_hint(DataFile &f);
+    // Calls fn for each entry of the hint file of data file id
+    void read_hint(uint32_t id, const std::function<void(uint8_t flags, const std::string &key,
+                                                         const Location &loc)> &fn);
+    void load_data(DataFile &f);
+    void apply_loaded(const std::string &key, uint8_t flags, const Location &loc);
+    std::shared_ptr<DataFile> open_active_locked(uint32_t id);
+
+    // Appends one record and updates the index; write_mtx_ must be held
+    void append_locked(uint8_t flags, const std::string &key, const std::string &value,
+                       WriteCallback on_commit = nullptr);
+    void rotate_locked();
+    bool write_record(uint8_t flags, const std::string &key, const std::string &value,
+                      WriteCallback on_commit);
+    void mark_dead(uint32_t file_id, uint64_t bytes);
+
+    void merge_loop();
+    void write_hint(const std::shared_ptr<DataFile> &f);
+    void compact(const std::shared_ptr<DataFile> &f);
+    // Which of keys a data file older than f still has a record for
+    std::unordered_set<std::string> keys_in_older_files(const DataFile &f,
+                                                        const std::unordered_set<std::string> &keys);
+
+    BitcaskConfig config_;
+    std::vector<std::unique_ptr<IndexShard>> index_;
+
+    std::shared_mutex files_mtx_;
+    std::map<uint32_t, std::shared_ptr<DataFile>> files_;
+
+    // Appends are serialized; fsyncs are batched by log_'s syncer
+    std::mutex write_mtx_;
+    std::shared_ptr<DataFile> active_;
+    std::unique_ptr<AppendLog> log_;
+    // Logs of rotated-out files. The merge thread closes them: closing
+    // joins a syncer whose callbacks may write again.
+    std::vector<std::unique_ptr<AppendLog>> retired_logs_;
+
+    std::atomic<bool> stop_{false};
+
+    std::mutex merge_mtx_;
+    std::condition_variable cv_merge_;
+    std::thread merger_;
+
+    // Of the retired logs; report_stats() adds log_'s
+    std::atomic<uint64_t> syncs_{0};
+    std::atomic<uint64_t> synced_records_{0};
+    std::atomic<uint64_t> compactions_{0};
+};
@@ -0,0 +1,188 @@
+#include <string>
+#include <string_view>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include "StorageEngine.h"
+#pragma once
+
+// What is stored under a key whose value was split into chunks. The value
+// itself lives under chunk keys derived from the key and the manifest's
+// generation, so every version of a value has chunks of its own.
+struct ChunkManifest
+{
+    uint64_t generation = 0;
+    uint64_t size = 0; // of the whole value
+    uint32_t chunk_size = 0;
+
+    uint64_t chunks() const { return (size + chunk_size - 1) / chunk_size; }
+    std::string encode() const;
+    // False unless value is an encoded manifest
+    static bool decode(std::string_view value, ChunkManifest &out);
+};
+
+// Large values in storage as fixed-size chunks plus a manifest, so no
+// request has to hold a whole value: uploads write chunks as they arrive,
+// downloads send one chunk while the next is read.
+//
+// Chunks are written at Durability::Database, whatever the value's own
+// durability, and a manifest is only stored once its chunks are committed.
+// Chunks are read with plain get()s, which with the mysql engine go
+// straight to MySQL and don't see writes still queued for it.
+//
+// Each upload writes its chunks under a new generation, so concurrent
+// uploads of one key don't mix and a reader holding a manifest keeps
+// reading the chunks it points at while a new version is written. The old
+// generation's chunks are removed DROP_DELAY after the write that replaced
+// it commits (see replace()), time for reads already under way to finish;
+// a reader still on them after that gets Changed (or ok == false) rather
+// than part of a value.
+//
+// Which generation a key holds is kept in memory, learnt from the writes
+// and reads of this process, so replacing a value needs no storage read.
+// A key first seen chunked is swept once in the background for chunks
+// that earlier runs of the server left behind. A large value written
+// before a restart and then overwritten with a small one or deleted
+// before anything read it keeps its chunks until the key next holds a
+// large value.
+class ChunkStore
+{
+public:
+    ChunkStore(StorageEngine &storage, size_t chunk_size);
+    ~ChunkStore();
+
+    size_t chunk_size() const { return chunk_size_; }
+    // Values longer than one chunk go in chunks, and so do the rare small
+    // ones that would read back as a manifest
+    bool needs_chunks(std::string_view value) const;
+
+    // Writes value's chunks as one multi_put() and fills m with the manifest
+    // to store under key once they are committed. Same contract as
+    // StorageEngine::multi_put(): false if shed, on_commit may be nullptr.
+    bool put_chunks(const std::string &key, const std::string &value, ChunkManifest &m,
+                    StorageEngine::WriteCallback on_commit);
+    // The whole value behind m, read as one multi_get(). ok == false on a
+    // storage error or if the value was overwritten meanwhile.
+    void get(const std::string &key, const ChunkManifest &m, StorageEngine::GetCallback cb);
+    // Removes m's chunks in the background, DROP_DELAY from now
+    void drop(const std::string &key, const ChunkManifest &m);
+
+    // For a write about to store `stored` under key ("" for a delete): use
+    // the returned callback as the write's on_commit, or call it from
+    // there, and the chunks of the value it replaced are dropped once it
+    // committed. cached is key's cached value, if any. nullptr when there
+    // is nothing to track: neither value is known to be chunked.
+    StorageEngine::WriteCallback replace(const std::string &key, const std::string &cached,
+                                         const std::string &stored);
+
+    enum class StreamResult
+    {
+        Ok,
+        Failed,  // storage error, or send returned false
+        Changed, // overwritten while it was read
+    };
+    // Blocking: hands the value behind m to send one chunk at a time,
+    // reading the next chunk while send runs
+    StreamResult stream(const std::string &key, const ChunkManifest &m,
+                        const std::function<bool(std::string_view)> &send);
+
+    // Blocking writer for a value of unknown length, e.g. a request body
+    // read piece by piece. Bytes go into a chunk-sized buffer; each full
+    // chunk is written out once more bytes arrive, with at most
+    // MAX_IN_FLIGHT chunks waiting for their commit, so the
+    // engine's queue never holds more of the value than that either. A
+    // value that ends up fitting in one chunk is never written as chunks.
+    class Writer
+    {
+    public:
+        Writer(ChunkStore &store, const std::string &key);
+        ~Writer();
+
+        // Free space to read the next bytes into, then commit() them
+        char *room(size_t &len);
+        void commit(size_t n) { used_ += n; }
+        void append(std::string_view data);
+
+        // Writes the last chunk and waits for the others. stored is then
+        // what to put under key: the value itself if it fit in one chunk,
+        // else its manifest. False if a chunk write failed; shed() tells
+        // whether the engine refused it.
+        bool finish(std::string &stored);
+        bool shed() const { return shed_; }
+        uint64_t size() const { return written_ + used_; }
+
+    private:
+        static const int MAX_IN_FLIGHT = 2;
+
+        bool flush();
+        void wait_for(int in_flight);
+
+        ChunkStore &store_;
+        std::string key_;
+        ChunkManifest manifest_;
+        std::string buf_; // up to chunk_size bytes
+        size_t used_ = 0;
+        uint64_t written_ = 0;
+        uint64_t index_ = 0;
+        bool shed_ = false;
+
+        struct Pending;
+        std::shared_ptr<Pending> pending_;
+    };
+
+    // Chunk counters, into the "chunks" section of /stats
+    void report_stats(nlohmann::json &out) const;
+
+private:
+    static std::string chunk_key(const std::string &key, uint64_t generation, uint64_t index);
+    // The data of chunk index, false if it is missing
+    static bool chunk_data(const std::string &chunk, const ChunkManifest &m, uint64_t index,
+                           std::string_view &data);
+    ChunkManifest start(uint64_t size);
+
+    // A reader found m under key
+    void seen(const std::string &key, const ChunkManifest &m);
+    static constexpr std::chrono::seconds DROP_DELAY{5};
+
+    // Both with mu_ held
+    void drop_locked(const std::string &key, const ChunkManifest &m);
+    void sweep_locked(const std::string &key, uint64_t current);
+    // The background thread behind both
+    void sweep_loop();
+    void remove_chunks(const std::string &key, const ChunkManifest &m);
+    void sweep(const std::string &key, uint64_t current);
+
+    StorageEngine &storage_;
+    size_t chunk_size_;
+    // Generations below this one were handed out by earlier runs
+    const uint64_t first_generation_;
+    std::atomic<uint64_t> next_generation_;
+
+    std::mutex mu_;
+    std::unordered_map<std::string, ChunkManifest> chunked_; // key -> its manifest
+    std::deque<std::pair<std::string, uint64_t>> to_sweep_;  // key, generation to keep
+    struct Dropped
+    {
+        std::chrono::steady_clock::time_point due;
+        std::string key;
+        ChunkManifest manifest;
+    };
+    std::deque<Dropped> to_drop_; // in due order
+    bool stopping_ = false;
+    std::condition_variable sweep_cv_;
+    std::thread sweeper_;
+
+    std::atomic<uint64_t> values_written_{0};
+    std::atomic<uint64_t> chunks_written_{0};
+    std::atomic<uint64_t> values_read_{0};
+    std::atomic<uint64_t> chunks_read_{0};
+    std::atomic<uint64_t> reads_changed_{0};
+    std::atomic<uint64_t> generations_dropped_{0};
+};
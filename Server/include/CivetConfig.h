@@ -0,0 +1,35 @@
+#include <string>
+#include <vector>
+#include <utility>
+#pragma once
+
+// civetweb options of the HTTP API: this server's defaults, then those of
+// a config file, then the command line, the last one winning:
+//
+//   ./server [--config <file>] [--<option> <value> ...]
+//
+// The file uses civetweb's own format, one "<option> <value>" per line and
+// '#' for comments. Any civetweb option is accepted; the ones that matter
+// for throughput have defaults in CivetConfig.cpp, described in the readme.
+class CivetConfig
+{
+public:
+    CivetConfig();
+
+    // Throws std::runtime_error if the file can't be read or has a bad line
+    void load_file(const std::string &path);
+    // Loads --config first, whatever its position, then applies the other
+    // options over it. Throws std::invalid_argument on unknown options.
+    void parse_args(int argc, char **argv);
+    // Throws std::invalid_argument if civetweb has no such option
+    void set(const std::string &name, const std::string &value);
+    const std::string &get(const std::string &name) const;
+
+    // NULL-terminated name/value list for CivetServer; valid while this lives
+    std::vector<const char *> options() const;
+    // "name=value ..." for the startup log
+    std::string describe() const;
+
+private:
+    std::vector<std::pair<std::string, std::string>> options_;
+};
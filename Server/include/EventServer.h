@@ -0,0 +1,80 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "nlohmann/json.hpp"
+#pragma once
+
+// Non-blocking listening socket on port with SO_REUSEPORT, so several
+// event loops can each accept on their own. Throws std::runtime_error.
+int listen_reuseport(int port);
+
+// Base of the front ends that serve their own protocol from a few epoll
+// event loops on non-blocking sockets, instead of civetweb's blocking
+// thread per connection. Nothing on a loop thread blocks: a request that
+// needs storage gets a Reply, which is handed back to the connection's
+// loop through an eventfd when the engine is done.
+//
+// Subclasses parse requests in on_input(), call start() at the end of
+// their constructor and stop() at the start of their destructor.
+class EventServer
+{
+public:
+    virtual ~EventServer();
+
+    // Connection and request counters for /stats
+    void report_stats(nlohmann::json &out) const;
+
+protected:
+    struct Connection;
+    struct Loop;
+
+    // A response completed off the loop thread. Thread-safe; send() once.
+    class Reply
+    {
+    public:
+        void send(std::string bytes) const;
+
+    private:
+        friend class EventServer;
+        std::shared_ptr<Loop> loop_;
+        uint64_t conn_id_ = 0;
+        uint64_t slot_ = 0; // position among ordered responses, 0 = unordered
+    };
+
+    // Each loop binds port with SO_REUSEPORT. Throws std::runtime_error
+    // if the port can't be bound.
+    EventServer(const char *name, int port, size_t threads);
+    void start();
+    void stop();
+
+    // Handles the request at the start of data[0..len). Returns the bytes
+    // it used, 0 if the request is not complete yet, or -1 to drop the
+    // connection (broken framing).
+    virtual long on_input(Connection &conn, const char *data, size_t len) = 0;
+
+    // Buffer to append an immediate response to. It is sent after every
+    // ordered response deferred before it.
+    std::string &respond(Connection &conn);
+    // A response to send later. Ordered ones go out in request order, as
+    // pipelining in RESP requires; unordered ones as soon as they are done.
+    Reply defer(Connection &conn, bool ordered);
+
+    std::atomic<uint64_t> requests_{0};
+
+private:
+    void run(Loop &loop);
+    void accept_connections(Loop &loop);
+    void drain_completions(Loop &loop);
+    // Parses what it can, writes what it can. False if the connection must go.
+    bool service(Loop &loop, uint64_t id, Connection &conn);
+    void close_connection(Loop &loop, uint64_t id);
+
+    std::string name_; // for log lines
+    std::vector<std::shared_ptr<Loop>> loops_;
+
+    std::atomic<uint64_t> connections_{0}; // open right now
+    std::atomic<uint64_t> accepted_{0};
+    std::atomic<uint64_t> protocol_errors_{0};
+};
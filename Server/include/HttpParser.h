@@ -0,0 +1,44 @@
+#include <string>
+#include <string_view>
+#include <cstddef>
+#pragma once
+
+// Request line and the headers the /key API cares about. The views point
+// into the buffer the request was parsed from.
+struct HttpRequest
+{
+    std::string_view method;
+    std::string_view path;  // target up to '?'
+    std::string_view query; // after '?', empty if none
+    int minor_version = 1;  // HTTP/1.x
+    bool keep_alive = true;
+    bool expect_continue = false;
+    bool chunked = false; // any Transfer-Encoding
+    size_t content_length = 0;
+    std::string_view content_type; // as sent, parameters included
+    size_t head_size = 0; // request line and headers, blank line included
+};
+
+enum class HttpParse
+{
+    Complete,
+    Incomplete, // the blank line has not arrived yet
+    Invalid,
+};
+
+// Largest request head accepted, like civetweb's max_request_size
+constexpr size_t MAX_HTTP_HEAD = 16 << 10;
+
+// Parses the request head at data[0..len) in place, without copying or
+// allocating. The body, if any, starts at data + req.head_size.
+HttpParse parse_http_request(const char *data, size_t len, HttpRequest &req);
+
+// URL-decodes (%XX, and '+' in form data such as queries) in into out.
+// False on a broken escape.
+bool http_url_decode(std::string_view in, std::string &out, bool form = true);
+
+// True if content_type is type, ignoring case and any parameters
+bool http_media_type_is(std::string_view content_type, std::string_view type);
+
+// Finds name in a query string and URL-decodes its value into out
+bool http_query_param(std::string_view query, std::string_view name, std::string &out);
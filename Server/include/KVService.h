@@ -0,0 +1,107 @@
+#include <string>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include "LRUCache.h"
+#include "StorageEngine.h"
+#include "ChunkStore.h"
+#include "nlohmann/json.hpp"
+#pragma once
+
+// When a write is acknowledged, from ?durability= on POST and DELETE:
+//   memory  once the engine accepted it (lost if the process dies)
+//   log     once it is fdatasync'ed in the engine's local log (default)
+//   db      once the backing store committed it (MySQL for the mysql engine)
+struct WriteAck
+{
+    bool wait = true;
+    Durability durability = Durability::Log;
+};
+
+// How a GET may use the cache, from ?consistency=:
+//   cache     serve fresh and soft-expired cache entries, read storage
+//             otherwise (default)
+//   fresh     always read storage, then refresh the cache
+//   stale-ok  also serve stale entries, refreshing them in the background
+enum class ReadConsistency
+{
+    Cache,
+    Fresh,
+    StaleOk,
+};
+
+enum class KVStatus
+{
+    Ok,
+    NotFound,
+    Overloaded, // shed by the engine
+    Failed,     // storage error, or accepted but not persisted
+};
+
+// The cache-aside rules every front end shares: leased fills, background
+// refresh of soft-expired entries, cache updates after acknowledged writes.
+//
+// lookup(), fetch(), put() and remove() never block, for front ends that
+// run an event loop. Their callbacks may run inline or on an engine thread.
+//
+// Values longer than a chunk are stored through ChunkStore; these calls
+// hand them over whole, only the civetweb handlers stream them.
+class KVService
+{
+public:
+    using GetCallback = std::function<void(KVStatus status, std::string value)>;
+    using WriteCallback = std::function<void(KVStatus status)>;
+
+    KVService(LRUCache &cache, StorageEngine &storage, ChunkStore &chunks);
+
+    // Caches a storage read unless a write to the key came in meanwhile
+    void fill(const std::string &key, const std::string &value, uint64_t lease);
+    // Re-reads key without blocking the caller and refills the cache
+    void refresh(const std::string &key);
+    // A reader waited for another reader's fill (see LRUCache::wait_for_fill)
+    void count_fill_wait() { fill_waits_++; }
+
+    // What lookup() leaves for fetch() when the cache can't answer
+    struct ReadMiss
+    {
+        uint64_t lease = 0;
+        bool should_refresh = false;
+        // A fresh read: goes through StorageEngine::refresh(), which is
+        // ordered behind the writes the engine already accepted
+        bool fresh = false;
+        // The cache had the manifest of a chunked value: only the chunks
+        // are left to read
+        bool chunked = false;
+        ChunkManifest manifest;
+    };
+
+    // True, with value, if the cache can answer right away under mode
+    // (fresh or soft-expired entry, or a stale one for stale-ok; never for
+    // fresh). Otherwise pass miss on to fetch().
+    bool lookup(const std::string &key, std::string &value, ReadMiss &miss,
+                ReadConsistency mode = ReadConsistency::Cache);
+    // Reads key from storage and fills the cache under miss's lease. A
+    // miss another reader is already filling is read without a lease
+    // rather than waited for, since waiting would stall the caller's loop.
+    void fetch(const std::string &key, const ReadMiss &miss, GetCallback cb);
+    // cb gets Ok once the write reached ack's level, and the cache has it
+    void put(const std::string &key, const std::string &value, const WriteAck &ack, WriteCallback cb);
+    void remove(const std::string &key, const WriteAck &ack, WriteCallback cb);
+
+    // Refresh and fill counters, into the "cache" section of /stats
+    void report_stats(nlohmann::json &out) const;
+
+private:
+    void get_chunks(const std::string &key, const ChunkManifest &m, GetCallback cb);
+    void put_stored(const std::string &key, const std::string &value, const WriteAck &ack, WriteCallback cb);
+    void put_chunked(const std::string &key, const std::string &value, const WriteAck &ack, WriteCallback cb);
+
+    LRUCache &cache_;
+    StorageEngine &storage_;
+    ChunkStore &chunks_;
+
+    std::atomic<uint64_t> refreshes_{0};
+    std::atomic<uint64_t> refresh_failures_{0};
+    std::atomic<uint64_t> fill_waits_{0};
+    std::atomic<uint64_t> fills_rejected_{0};
+};
@@ -0,0 +1,102 @@
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include "Task.h"
+#include "KVService.h"
+#pragma once
+
+// KVService's read path as awaitables for Task handlers. Each records its
+// stage in the given StageTimings, which must belong to the thread the
+// Task runs on.
+
+// co_await cache_lookup(...): KVService::lookup(), never suspends
+class CacheLookupStage
+{
+public:
+    CacheLookupStage(KVService &kv, const std::string &key, std::string &value, KVService::ReadMiss &miss,
+                     ReadConsistency mode, StageTimings &timings)
+        : kv_(kv), key_(key), value_(value), miss_(miss), mode_(mode), timings_(timings)
+    {
+    }
+
+    bool await_ready() const noexcept { return true; }
+    void await_suspend(std::coroutine_handle<>) const noexcept {}
+    bool await_resume()
+    {
+        StageTimer timer(timings_, Stage::Cache);
+        return kv_.lookup(key_, value_, miss_, mode_);
+    }
+
+private:
+    KVService &kv_;
+    const std::string &key_;
+    std::string &value_;
+    KVService::ReadMiss &miss_;
+    ReadConsistency mode_;
+    StageTimings &timings_;
+};
+
+inline CacheLookupStage cache_lookup(KVService &kv, const std::string &key, std::string &value,
+                                     KVService::ReadMiss &miss, ReadConsistency mode, StageTimings &timings)
+{
+    return CacheLookupStage(kv, key, value, miss, mode, timings);
+}
+
+struct FetchResult
+{
+    KVStatus status = KVStatus::Failed;
+    std::string value;
+};
+
+// co_await db_fetch(...): KVService::fetch() of a miss. The Task goes on
+// inline if the engine answers right away, otherwise it is suspended and
+// the engine's callback hands it to scheduler. The Db stage runs until the
+// Task is resumed, so it includes the wait for the scheduler's thread.
+class DbFetchStage
+{
+public:
+    DbFetchStage(KVService &kv, const std::string &key, const KVService::ReadMiss &miss, Scheduler &scheduler,
+                 StageTimings &timings)
+        : kv_(kv), key_(key), miss_(miss), scheduler_(scheduler), timings_(timings),
+          start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> task)
+    {
+        task_ = task;
+        kv_.fetch(key_, miss_, [this](KVStatus status, std::string value)
+                  {
+            result_.status = status;
+            result_.value = std::move(value);
+            // Second to get here: the Task is suspended and ours to resume
+            if (done_.exchange(true))
+                scheduler_.schedule(task_); });
+        // The callback already ran: don't suspend at all
+        return !done_.exchange(true);
+    }
+    FetchResult await_resume()
+    {
+        timings_.record(Stage::Db, std::chrono::steady_clock::now() - start_);
+        return std::move(result_);
+    }
+
+private:
+    KVService &kv_;
+    const std::string &key_;
+    KVService::ReadMiss miss_;
+    Scheduler &scheduler_;
+    StageTimings &timings_;
+    std::chrono::steady_clock::time_point start_;
+    std::coroutine_handle<> task_;
+    std::atomic<bool> done_{false};
+    FetchResult result_;
+};
+
+inline DbFetchStage db_fetch(KVService &kv, const std::string &key, const KVService::ReadMiss &miss,
+                             Scheduler &scheduler, StageTimings &timings)
+{
+    return DbFetchStage(kv, key, miss, scheduler, timings);
+}
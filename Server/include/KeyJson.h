@@ -0,0 +1,43 @@
+#include <string>
+#include <string_view>
+#pragma once
+
+// Hand-rolled JSON for the /key endpoints, in place of building and
+// dumping nlohmann::json objects on every request.
+//
+// Request bodies are scanned once: key and value come back as views into
+// the body, and are only decoded into a buffer when they contain escapes.
+// Responses are appended from fixed fragments plus the escaped strings,
+// byte for byte what nlohmann's dump() would produce with
+// error_handler_t::replace (a plain dump() throws on invalid UTF-8).
+namespace keyjson
+{
+    // "key" and "value" of a POST /key body
+    struct KeyValue
+    {
+        std::string_view key;
+        std::string_view value;
+        std::string key_buf; // backing for key/value when they had escapes
+        std::string value_buf;
+    };
+
+    // Parses {"key": "...", "value": "..."}, other members are skipped.
+    // False unless the body is valid JSON with both members as strings.
+    bool parse_key_value(std::string_view body, KeyValue &out);
+
+    // Appends s as a JSON string, quotes included. Bytes that are not
+    // valid UTF-8 become U+FFFD, one per maximal subpart (a cut sequence
+    // is one, a stray continuation byte another), as in nlohmann.
+    void append_string(std::string &out, std::string_view s);
+    // The same for a string that arrives in pieces, without the quotes: a
+    // UTF-8 sequence cut at the end of a piece waits in carry for the next
+    // one. Pass last with the final piece.
+    void append_string_piece(std::string &out, std::string &carry, std::string_view piece, bool last);
+
+    // Response bodies
+    void append_value(std::string &out, std::string_view key, std::string_view value); // {"key":..,"value":..}
+    void append_not_found(std::string &out, std::string_view key);                     // {"error":"Key not found","key":..}
+    void append_created(std::string &out, std::string_view key);                       // {"created_key":..,"status":"ok"}
+    void append_deleted(std::string &out);                                             // {"key_to_delete":..,"status":"ok"}
+    void append_error(std::string &out, std::string_view message);                     // {"message":..,"status":"error"}
+}
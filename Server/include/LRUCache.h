@@ -4,41 +4,109 @@
 #include <list>
 #include <vector>
 #include <mutex> 
+#include <condition_variable>
 #include <memory> // For std::unique_ptr
+#include <chrono>
 
 #pragma once
 
 // Configuration for sharding
 const size_t NUM_SHARDS = 32;
 
-// Internal structure for each shard - REMAINS UNCHANGED
+struct CacheEntry {
+    std::string value;
+    std::list<std::string>::iterator lru_pos;
+    bool stale = false;      // may no longer match the DB
+    bool refreshing = false; // a background refresh has been handed out
+    // Past soft_expiry the value is still served but due for a refresh;
+    // past hard_expiry it is dropped. time_point::max() = never.
+    std::chrono::steady_clock::time_point soft_expiry = std::chrono::steady_clock::time_point::max();
+    std::chrono::steady_clock::time_point hard_expiry = std::chrono::steady_clock::time_point::max();
+};
+
+// Right to fill a key after reading it from storage. Writes to the key
+// void it, so a reader that raced a write cannot cache the old value.
+struct CacheLease {
+    uint64_t token;
+    std::chrono::steady_clock::time_point expires; // others may take over after this
+};
+
+// Internal structure for each shard
 struct CacheShard {
     // This cannot be moved!
     std::mutex mtx; 
     
     // ... other members ...
     std::list<std::string> lru_list;
-    // The pair stores: {value, list_iterator}
-    std::unordered_map<std::string, std::pair<std::string, std::list<std::string>::iterator>> cache;
+    std::unordered_map<std::string, CacheEntry> cache;
     size_t max_size_per_shard; 
+
+    std::unordered_map<std::string, CacheLease> leases;
+    uint64_t next_lease = 1;
+    std::condition_variable lease_released; // a lease was filled, released or voided
 };
 
+// SoftExpired: probably still right, serve it and refresh.
+// Stale: marked as possibly wrong, only stale-ok readers get it.
+enum class CacheStatus { Miss, Hit, SoftExpired, Stale };
+
+// One key's result from multi_lookup(), as lookup() would report it
+struct CacheLookup {
+    CacheStatus status = CacheStatus::Miss;
+    std::string value;
+    bool should_refresh = false;
+    uint64_t lease = 0;
+};
 
 class LRUCache
 {
 public:
     LRUCache(size_t size);
+    // Expiry applied by put(); zero disables that limit. Call before use.
+    void set_ttl(std::chrono::milliseconds soft, std::chrono::milliseconds hard);
+    // A write: stores value and voids any lease on key
     void put(const std::string &key, const std::string &value);
+    // Fresh entries only: "" on a miss or a stale entry
     std::string get(const std::string &key);
+    // Returns the value even if stale or soft-expired. In those cases
+    // *should_refresh is set to true for exactly one caller, until the
+    // entry is put() again or the refresh is abandoned.
+    // On a Miss, *lease gets a token for fill(), or 0 while another reader
+    // holds an unexpired lease on key (see wait_for_fill()).
+    CacheStatus lookup(const std::string &key, std::string &value, bool *should_refresh = nullptr,
+                       uint64_t *lease = nullptr);
+    // lookup() for many keys, taking each shard's lock once. result[i]
+    // belongs to keys[i]; misses get leases as in lookup().
+    std::vector<CacheLookup> multi_lookup(const std::vector<std::string> &keys);
+    // A lease regardless of other readers, which it supersedes
+    uint64_t lease(const std::string &key);
+    // Stores value ("" removes the entry) only if token is still the
+    // key's lease; put(), remove(), mark_stale() and newer leases void it.
+    bool fill(const std::string &key, const std::string &value, uint64_t token);
+    void release_lease(const std::string &key, uint64_t token);
+    // Waits up to timeout for the current lease on key to end. True, with
+    // the value, if it left a servable (fresh or soft-expired) entry.
+    bool wait_for_fill(const std::string &key, std::string &value, std::chrono::milliseconds timeout);
+    // Keeps the value but stops serving it to readers that need fresh data
+    bool mark_stale(const std::string &key);
+    // The handed-out refresh failed; the next reader may try again
+    void abandon_refresh(const std::string &key);
     bool remove(const std::string &key);
     
 private:
     // CRITICAL FIX: The vector now holds movable unique pointers.
     std::vector<std::unique_ptr<CacheShard>> shards;
     size_t total_max_size;
+    std::chrono::milliseconds soft_ttl{0};
+    std::chrono::milliseconds hard_ttl{0};
 
     size_t get_shard_index(const std::string &key) const;
 
     // We no longer pass the shard by reference; we pass the raw pointer.
     void move_to_front_locked(CacheShard *shard, const std::string &key);
+    CacheStatus lookup_locked(CacheShard *shard, const std::string &key, std::string &value,
+                              bool *should_refresh, uint64_t *lease);
+    void put_locked(CacheShard *shard, const std::string &key, const std::string &value);
+    void remove_locked(CacheShard *shard, const std::string &key);
+    void void_lease_locked(CacheShard *shard, const std::string &key);
 };
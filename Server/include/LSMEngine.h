@@ -0,0 +1,144 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "StorageEngine.h"
+#include "SkipList.h"
+#include "SSTable.h"
+#include "AppendLog.h"
+#pragma once
+
+struct LSMConfig
+{
+    std::string dir = "data/lsm";
+    size_t memtable_size = 4 << 20;           // switch to a new memtable past this
+    size_t l0_compaction_trigger = 4;         // compact L0 once it has this many files
+    size_t l0_stop_writes = 12;               // stall writers at this many L0 files
+    std::chrono::milliseconds max_stall{10000}; // a stalled write fails after this
+    uint64_t level1_max_bytes = 10ull << 20;  // each deeper level is 10x larger
+    int level_multiplier = 10;
+    int num_levels = 7;
+    uint64_t target_file_size = 2ull << 20;   // compaction output is split at this size
+    size_t block_size = 4096;
+    int bloom_bits_per_key = 10;
+};
+
+// Embedded log-structured merge tree, no external database needed.
+//
+// Writes go to a WAL (group-committed by AppendLog) and a skiplist
+// memtable. A full memtable becomes immutable and a background thread
+// flushes it to a level-0 SSTable, then deletes its WAL. The same thread
+// runs leveled compaction: L0 (overlapping files, newest first) is merged
+// into L1, and a level over its byte budget pushes one file at a time
+// into the next, so every level past L0 holds disjoint sorted files.
+// Reads check the memtables, then L0, then one file per deeper level,
+// skipping most files via their Bloom filters.
+//
+// The set of live tables is kept in MANIFEST, rewritten atomically after
+// every flush and compaction.
+//
+// Writers stall while L0 is full or the previous memtable is still being
+// flushed. A stalled write is refused, like a shed one, as soon as a
+// flush or compaction fails or after max_stall.
+class LSMEngine : public StorageEngine
+{
+public:
+    explicit LSMEngine(const LSMConfig &config);
+    ~LSMEngine();
+
+    const char *name() const override { return "lsm"; }
+
+    using StorageEngine::get;
+    void get(const std::string &key, GetCallback cb) override;
+    bool put(const std::string &key, const std::string &value,
+             WriteCallback on_commit = nullptr,
+             Durability durability = Durability::Log) override;
+    bool remove(const std::string &key, WriteCallback on_commit = nullptr,
+                Durability durability = Durability::Log) override;
+    KeyValues scan(const std::string &start_key, size_t limit) override;
+    void report_stats(nlohmann::json &out) override;
+
+private:
+    struct MemEntry
+    {
+        std::string value;
+        bool tombstone = false;
+    };
+
+    struct MemTable
+    {
+        uint64_t id = 0; // also names its WAL
+        std::shared_mutex mtx;
+        SkipList<std::string, MemEntry> table;
+        std::atomic<size_t> bytes{0};
+        std::unique_ptr<AppendLog> wal;
+    };
+    friend class MemTableIterator;
+
+    using Level = std::vector<std::shared_ptr<SSTable>>;
+    // Immutable once published; readers hold on to the one they started with
+    struct Version
+    {
+        std::vector<Level> levels; // L0 newest first, deeper levels by key
+    };
+
+    std::string table_path(uint64_t id) const;
+    std::string wal_path(uint64_t id) const;
+
+    // Startup
+    void load();
+    void save_manifest(const Version &v, uint64_t log_number);
+
+    bool write_record(uint8_t flags, const std::string &key, const std::string &value,
+                      WriteCallback on_commit);
+    // Waits for room in the memtable; mtx_ must be held
+    bool make_room_locked(std::unique_lock<std::mutex> &lock);
+    std::shared_ptr<MemTable> new_memtable(uint64_t id);
+
+    // Background work
+    void background_loop();
+    int pick_compaction(const Version &v) const;
+    uint64_t max_bytes_for_level(int level) const;
+    void flush_memtable(const std::shared_ptr<MemTable> &mem);
+    std::shared_ptr<SSTable> write_level0_table(const MemTable &mem);
+    void compact(int level);
+    void install(std::shared_ptr<const Version> v);
+    // Fails stalled writes, then waits a bit before the next attempt
+    void pause_after_failure();
+
+    LSMConfig config_;
+
+    // Guards mem_, imm_, version_ and the file numbers
+    std::mutex mtx_;
+    std::condition_variable cv_bg_;    // work for the background thread
+    std::condition_variable cv_stall_; // a flush or compaction finished
+    std::shared_ptr<MemTable> mem_;
+    std::shared_ptr<MemTable> imm_; // being flushed
+    std::shared_ptr<const Version> version_;
+    uint64_t next_file_id_ = 1;
+    uint64_t log_number_ = 0;                // WALs below this are flushed
+    std::vector<std::string> compact_pointer_; // per level, round-robin position
+    uint64_t background_failures_ = 0;        // flushes and compactions that failed
+
+    // Writers append to the WAL and memtable one at a time
+    std::mutex write_mtx_;
+
+    bool stop_ = false;
+    std::thread background_;
+
+    std::atomic<uint64_t> user_bytes_{0};
+    std::atomic<uint64_t> wal_bytes_{0};
+    std::atomic<uint64_t> flush_bytes_{0};
+    std::atomic<uint64_t> compaction_read_bytes_{0};
+    std::atomic<uint64_t> compaction_write_bytes_{0};
+    std::atomic<uint64_t> flushes_{0};
+    std::atomic<uint64_t> compactions_{0};
+    std::atomic<uint64_t> trivial_moves_{0};
+    std::atomic<uint64_t> stalls_{0};
+    std::atomic<uint64_t> stalls_failed_{0};
+};
@@ -0,0 +1,44 @@
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#pragma once
+
+// Record framing shared by the on-disk logs (Bitcask data files, WALs):
+//   crc32 | flags | key_len | value_len | key | value
+// little endian, the crc covers everything after itself.
+const size_t LOG_HEADER_SIZE = 4 + 1 + 4 + 4;
+const uint8_t LOG_FLAG_PUT = 0;
+const uint8_t LOG_FLAG_TOMBSTONE = 1;
+
+struct LogRecord
+{
+    uint8_t flags;
+    std::string key;
+    std::string value;
+};
+
+// Standard CRC-32 (IEEE)
+uint32_t crc32(const char *data, size_t len);
+
+// Appends one framed record to buf
+void encode_log_record(std::string &buf, uint8_t flags,
+                       const std::string &key, const std::string &value);
+
+// Decodes the record at data[0..avail). Returns its framed size, or 0 if
+// the record is truncated or fails its checksum (a torn write).
+size_t decode_log_record(const char *data, size_t avail, LogRecord &out);
+
+// Little-endian helpers for the other on-disk formats
+template <typename T>
+inline void put_fixed(std::string &buf, T v)
+{
+    buf.append((const char *)&v, sizeof(v));
+}
+
+template <typename T>
+inline T get_fixed(const char *p)
+{
+    T v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
@@ -0,0 +1,38 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <shared_mutex>
+#include "StorageEngine.h"
+#pragma once
+
+// Volatile reference engine: a sharded ordered map, no external database.
+// Useful as a DB-free performance ceiling for the HTTP + cache layers.
+class MemoryEngine : public StorageEngine
+{
+public:
+    MemoryEngine(size_t num_shards = 32);
+
+    const char *name() const override { return "memory"; }
+
+    using StorageEngine::get;
+    void get(const std::string &key, GetCallback cb) override;
+    bool put(const std::string &key, const std::string &value,
+             WriteCallback on_commit = nullptr,
+             Durability durability = Durability::Log) override;
+    bool remove(const std::string &key, WriteCallback on_commit = nullptr,
+                Durability durability = Durability::Log) override;
+    KeyValues scan(const std::string &start_key, size_t limit) override;
+    void report_stats(nlohmann::json &out) override;
+
+private:
+    struct Shard
+    {
+        std::shared_mutex mtx;
+        std::map<std::string, std::string> data;
+    };
+
+    Shard *shard_for(const std::string &key);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -0,0 +1,117 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "StorageEngine.h"
+#include "MySQLPool.h"
+#include "AsyncDBExecutor.h"
+#include "ReadBatcher.h"
+#include "WriteAheadLog.h"
+#include "MySQLHelper.h"
+#pragma once
+
+// One MySQL server (or database) holding a partition of the keys
+struct MySQLEndpoint
+{
+    std::string host = "localhost";
+    int port = 3306;
+    std::string db = "KVStore";
+};
+
+struct MySQLConfig
+{
+    std::string user = "root";
+    std::string password = "";
+    std::string table = "kv_store"; // table behind the *_kv procedures
+
+    // Keys are spread over these by a consistent hash of their MD5, so
+    // appending an endpoint only moves ~1/N of the keys (existing rows are
+    // not migrated). Every setting below applies to each shard.
+    std::vector<MySQLEndpoint> shards = {MySQLEndpoint{}};
+
+    // Reads: non-blocking executor loops x connections per loop
+    size_t read_threads = 2;
+    size_t read_conns_per_thread = 8;
+    // A read not answered within this fails, as does a reconnect
+    std::chrono::milliseconds read_timeout{5000};
+
+    // Writes: one key-hash partition per DB worker, plus an elastic pool
+    size_t db_workers = 16;
+    size_t write_pool_min = 16;
+    size_t write_pool_max = 24;
+
+    // Writes are logged here before they are queued, so an acknowledged
+    // write survives a crash. Empty disables the log. With several shards
+    // each logs to its own host_port_db subdirectory.
+    std::string wal_dir = "data/wal";
+};
+
+// Parses "host[:port][/db],..." (e.g. "127.0.0.1:3307/KVStore") into
+// endpoints, defaulting the port and database. Throws std::invalid_argument.
+std::vector<MySQLEndpoint> parse_mysql_shards(const std::string &spec);
+
+// The original MySQL backend: batched non-blocking reads, and write-behind
+// through the key-partitioned DB worker queues. With a WAL, a write commits
+// (on_commit fires) once it is durable in the log; the workers apply it to
+// MySQL afterwards, and unapplied writes are replayed at startup.
+//
+// With several endpoints, each shard gets its own read executor, write
+// pool, worker queues and WAL, so write throughput scales with the number
+// of mysqld instances.
+class MySQLEngine : public StorageEngine
+{
+public:
+    explicit MySQLEngine(const MySQLConfig &config);
+
+    const char *name() const override { return "mysql"; }
+
+    using StorageEngine::get;
+    void get(const std::string &key, GetCallback cb) override;
+    // Queued behind the key's pending writes, which plain reads may overtake
+    void refresh(const std::string &key, GetCallback cb) override;
+    bool put(const std::string &key, const std::string &value,
+             WriteCallback on_commit = nullptr,
+             Durability durability = Durability::Log) override;
+    bool remove(const std::string &key, WriteCallback on_commit = nullptr,
+                Durability durability = Durability::Log) override;
+    // One query per shard for the reads, one transaction per worker queue
+    // for the writes
+    void multi_get(const std::vector<std::string> &keys, MultiGetCallback cb) override;
+    bool multi_put(const KeyValues &kvs, WriteCallback on_commit = nullptr,
+                   Durability durability = Durability::Log) override;
+    bool multi_remove(const std::vector<std::string> &keys, WriteCallback on_commit = nullptr,
+                      Durability durability = Durability::Log) override;
+    KeyValues scan(const std::string &start_key, size_t limit) override;
+    void report_stats(nlohmann::json &out) override;
+
+private:
+    // Everything that talks to one endpoint
+    struct Shard
+    {
+        Shard(const MySQLConfig &config, const MySQLEndpoint &endpoint,
+              const DBQueueLimits &limits, const std::string &wal_dir);
+
+        MySQLEndpoint endpoint;
+        // Reads and writes get separate connections so a write backlog (which
+        // keeps every DB worker busy holding a connection) never starves reads.
+        AsyncDBExecutor executor;
+        ReadBatcher read_batcher;
+        MySQLPool write_pool;
+        std::unique_ptr<WriteAheadLog> wal;
+        DBWorkers workers;
+        size_t replayed = 0;
+    };
+
+    Shard &shard_for(const std::vector<unsigned char> &key_hash);
+    size_t shard_index(const std::vector<unsigned char> &key_hash) const;
+    bool write_batch(std::vector<DBWrite> writes, WriteCallback on_commit, Durability durability);
+
+    // The WALs under config_.wal_dir that none of wal_dirs is: the single
+    // log from before sharding, or shard logs from another list of shards.
+    // Throws if they hold writes that can't be ordered against wal_dirs'.
+    std::vector<std::string> stray_logs(const std::vector<std::string> &wal_dirs);
+    void adopt_stray_log(const std::string &dir);
+
+    MySQLConfig config_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -8,25 +8,161 @@
 #include <stdexcept>
 #include <functional>
 #include <queue>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include "MySQLPool.h"
+#include "WriteAheadLog.h"
 #pragma once
 
-extern std::queue<std::function<void()>> db_queue;
-extern std::mutex queue_mtx;
-extern std::condition_variable cv_db_queue;
+// A statement MySQL refused, with its error number (0 if it never got
+// that far, e.g. no connection could be had)
+class DBError : public std::runtime_error {
+public:
+    DBError(unsigned int code, const std::string& what) : std::runtime_error(what), code(code) {}
+    unsigned int code;
+};
+
+// Whether a statement that failed with err may succeed if tried again
+// later: lost connections, lock timeouts and the like, but not e.g. a
+// value too long for its column
+bool is_transient_db_error(unsigned int err);
+
+struct DBTask {
+    std::function<void()> run;
+    uint64_t log_end = 0; // WAL position just past this write's record, 0 if not logged
+};
+
+// One task queue per DB worker. Writes are routed to a queue by key hash,
+// so every operation on a given key is applied in order by a single worker.
+struct DBQueue {
+    std::mutex mtx;
+    std::condition_variable cv;          // signalled when a task is pushed
+    std::condition_variable cv_not_full; // signalled when a task is popped
+    std::queue<DBTask> tasks;
+    size_t capacity;
+    bool busy = false;    // the worker is running a task
+    uint64_t applied = 0; // every logged write of this queue up to here is in MySQL
+};
+
+// Backpressure settings for the write-behind queues
+struct DBQueueLimits {
+    size_t high_water_mark = 100000;            // total across all queues
+    std::chrono::milliseconds max_block{100};   // 0 = reject immediately
+};
+
+// Live counters, updated by producers and workers
+struct DBQueueStats {
+    std::atomic<size_t> depth{0};
+    std::atomic<uint64_t> enqueued{0};
+    std::atomic<uint64_t> drained{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> dead_letters{0};
+};
+
+// Point-in-time view of the queues, as exported on /stats
+struct DBQueueGauges {
+    size_t depth, high_water_mark;
+    uint64_t enqueued, drained, rejected, dead_letters;
+    double enqueue_rate, drain_rate; // tasks per second
+};
+
+// Write-behind state of one MySQL server: its worker queues, the pool
+// they write through and the optional write-ahead log in front of them.
+// Must outlive the (detached) workers, i.e. live as long as the process.
+struct DBWorkers {
+    std::vector<std::unique_ptr<DBQueue>> queues;
+    DBQueueLimits limits;
+    DBQueueStats stats;
+    MySQLPool* pool = nullptr;
+    WriteAheadLog* wal = nullptr;
+
+    // Logged writes MySQL refused for good, in the WAL's directory
+    std::mutex dead_letter_mtx;
+    std::unique_ptr<AppendLog> dead_letters; // opened on first use
+
+    // Last sample taken by db_queue_gauges(), for the rates
+    std::mutex sample_mtx;
+    std::chrono::steady_clock::time_point last_sample = std::chrono::steady_clock::now();
+    uint64_t last_enqueued = 0, last_drained = 0;
+    double enqueue_rate = 0.0, drain_rate = 0.0;
+};
+
+extern DBQueueLimits db_queue_limits; // defaults, set before the engine starts
 
 // returns 16-byte MD5 digest
 std::vector<unsigned char> md5_hash(const std::string &key);
 std::string get_value(MYSQL *conn, const std::string &key);
 
-// Worker thread function
-void db_worker(MySQLPool& pool);
+// Picks the worker queue that owns this key hash
+size_t db_queue_index(const DBWorkers& workers, const std::vector<unsigned char>& key_hash);
 
-// Enqueue insert operation
-void async_insert(MySQLPool& pool,
+// Worker thread function, drains workers.queues[index]
+void db_worker(DBWorkers& workers, size_t index);
+
+// Creates one queue per worker and starts the (detached) worker threads.
+// With a write-ahead log, every queued write is appended to it first.
+void start_db_workers(DBWorkers& workers, MySQLPool& pool, size_t num_workers,
+                      const DBQueueLimits& limits, WriteAheadLog* wal = nullptr);
+
+// Re-queues the logged writes the workers had not applied before the
+// last shutdown or crash. Call once, after start_db_workers(). Returns
+// the number of writes replayed.
+size_t replay_db_log(DBWorkers& workers);
+
+// With a write-ahead log, starts the thread recording how far each worker
+// has applied it, which lets old log segments go. Call after
+// replay_db_log(): a queue that runs empty while replay waits for room
+// would otherwise be checkpointed past records replay has yet to read.
+void start_db_checkpointer(DBWorkers& workers);
+
+// Enqueue insert operation. Returns false if the key's queue stayed
+// above its high-water mark for longer than limits.max_block.
+// on_done (optional) runs on the DB worker once the write committed or failed.
+// With a write-ahead log a failed write is retried until MySQL takes it,
+// unless the error is permanent (is_transient_db_error()): the write is
+// then appended to the dead-letter log and dropped, so it can't block its
+// queue. on_done runs once, for the first failure or the commit.
+// on_logged (optional) runs once the write is durable in the write-ahead
+// log, or together with on_done if there is no log.
+bool async_insert(DBWorkers& workers,
+                  const std::string& key,
+                  const std::vector<unsigned char>& key_hash,
+                  const std::string& value,
+                  std::function<void(bool)> on_done = nullptr,
+                  std::function<void(bool)> on_logged = nullptr);
+
+// Enqueue delete operation. Same backpressure and callback rules as async_insert.
+bool async_delete(DBWorkers& workers,
                   const std::string& key,
                   const std::vector<unsigned char>& key_hash,
-                  const std::string& value);
+                  std::function<void(bool)> on_done = nullptr,
+                  std::function<void(bool)> on_logged = nullptr);
+
+// One key's write in a group, see async_write_batch()
+struct DBWrite {
+    std::string key;
+    std::vector<unsigned char> key_hash;
+    std::string value;
+    bool remove = false;
+};
+
+// Enqueues a group of writes as one task per worker queue involved, each
+// applying its share in a single transaction. Same backpressure rules as
+// async_insert; on_done and on_logged run once for the whole group, with
+// false if any part failed or was rejected. Returns false if any queue
+// rejected its share (the other shares still go ahead).
+bool async_write_batch(DBWorkers& workers,
+                       std::vector<DBWrite> writes,
+                       std::function<void(bool)> on_done = nullptr,
+                       std::function<void(bool)> on_logged = nullptr);
+
+// Reads key on the worker that owns it, so the result reflects every
+// write queued for the key before this call. Never blocks: returns false
+// if the queue is full. on_done(ok, value) runs on the DB worker.
+bool async_read(DBWorkers& workers,
+                const std::string& key,
+                const std::vector<unsigned char>& key_hash,
+                std::function<void(bool, std::string)> on_done);
 
-// Enqueue delete operation
-void async_delete(MySQLPool& pool, const std::vector<unsigned char>& key_hash);
\ No newline at end of file
+DBQueueGauges db_queue_gauges(DBWorkers& workers);
\ No newline at end of file
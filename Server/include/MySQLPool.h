@@ -1,10 +1,20 @@
 #include <mysql/mysql.h> // MySQL C API
 #include <vector>
+#include <deque>
 #include <string>
 #include <mutex>
 #include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #pragma once
 
+// Elastic, self-healing connection pool.
+//  - min_size connections are opened in parallel at startup
+//  - acquire() opens extra connections (up to max_size) when a caller has
+//    waited longer than grow_after, and gives up after acquire_timeout
+//  - a background thread pings idle connections, reconnects dead ones and
+//    closes connections that stayed idle for idle_timeout (down to min_size)
 class MySQLPool
 {
 public:
@@ -13,18 +23,72 @@ public:
               const std::string &password,
               const std::string &db,
               int port,
-              size_t pool_size);
+              size_t min_size,
+              size_t max_size,
+              std::chrono::milliseconds acquire_timeout = std::chrono::milliseconds(5000));
     ~MySQLPool();
-    // Acquire a connection (wait if none available)
+    // Acquire a connection, or nullptr if none frees up before the deadline
     MYSQL *acquire();
-    // Release a connection back to the pool
-    void release(MYSQL *conn);
+    // Release a connection back to the pool. Pass broken = true if the
+    // connection failed, it is then closed instead of reused.
+    void release(MYSQL *conn, bool broken = false);
+
+    size_t size();            // open connections, idle or in use
+    size_t idle();            // connections waiting in the pool
+    double avg_wait_us() const { return avg_wait_us_.load(); }
+    uint64_t timeouts() const { return timeouts_.load(); }
 
 private:
-    std::vector<MYSQL *> connections_;
+    struct IdleConn
+    {
+        MYSQL *conn;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    MYSQL *open_connection(); // throws on failure
+    void maintenance_loop();
+
+    std::deque<IdleConn> connections_; // back = most recently released
+    size_t total_ = 0;                 // idle + in use + being opened
     std::mutex mtx_;
     std::condition_variable cv_connections;
 
+    std::thread maintenance_;
+    bool stop_ = false;
+    std::condition_variable cv_stop_;
+
+    std::atomic<double> avg_wait_us_{0.0}; // EWMA of acquire() wait
+    std::atomic<uint64_t> timeouts_{0};
+
     std::string host_, user_, password_, db_;
     int port_;
+    size_t min_size_, max_size_;
+    std::chrono::milliseconds acquire_timeout_;
+    std::chrono::milliseconds grow_after_{2};
+    std::chrono::seconds health_interval_{5};
+    std::chrono::seconds idle_timeout_{60};
+};
+
+// Returns a pooled connection to its pool when it goes out of scope
+class PooledConnection
+{
+public:
+    explicit PooledConnection(MySQLPool &pool) : pool_(pool), conn_(pool.acquire()) {}
+    ~PooledConnection()
+    {
+        if (conn_)
+            pool_.release(conn_, broken_);
+    }
+    PooledConnection(const PooledConnection &) = delete;
+    PooledConnection &operator=(const PooledConnection &) = delete;
+
+    MYSQL *get() const { return conn_; }
+    explicit operator bool() const { return conn_ != nullptr; }
+    // Have the pool drop this connection instead of reusing it
+    void mark_broken() { broken_ = true; }
+
+private:
+    MySQLPool &pool_;
+    MYSQL *conn_;
+    bool broken_ = false;
 };
@@ -0,0 +1,59 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include "AsyncDBExecutor.h"
+#pragma once
+
+// Coalesces concurrent cache-miss lookups into one multi-key query.
+// Misses are collected for up to `window`, or until `max_batch` distinct
+// keys are waiting, then fetched with a single
+//   SELECT key_hash, value FROM <table> WHERE key_hash IN (...)
+// and the results fanned back out to every waiting caller.
+class ReadBatcher
+{
+public:
+    ReadBatcher(AsyncDBExecutor &executor,
+                size_t max_batch = 64,
+                std::chrono::microseconds window = std::chrono::microseconds(200),
+                std::string table = "kv_store");
+    ~ReadBatcher();
+
+    // result is "" if the key does not exist
+    void get(const std::string &key, AsyncDBExecutor::Callback cb);
+    std::future<std::string> get(const std::string &key);
+    // Fetches a whole batch of keys at once, without waiting for the
+    // window: one query per 1000 keys. values[i] belongs to keys[i].
+    void multi_get(const std::vector<std::string> &keys,
+                   std::function<void(bool ok, std::vector<std::string> values)> cb);
+
+    uint64_t batches() const { return batches_.load(); }
+    uint64_t keys() const { return keys_.load(); }
+
+private:
+    // Waiters keyed by the raw 16-byte MD5 of the key
+    using WaiterMap = std::unordered_map<std::string, std::vector<AsyncDBExecutor::Callback>>;
+
+    void flusher_loop();
+    void flush(WaiterMap batch);
+
+    AsyncDBExecutor &executor_;
+    size_t max_batch_;
+    std::chrono::microseconds window_;
+    std::string table_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    WaiterMap pending_;
+    std::chrono::steady_clock::time_point first_pending_;
+    bool stop_ = false;
+    std::thread flusher_;
+
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> keys_{0};
+};
@@ -0,0 +1,20 @@
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#pragma once
+
+// Limits on what a Redis client may send; beyond them the connection is dropped
+constexpr size_t MAX_RESP_ARGS = 1 << 20;
+constexpr long long MAX_RESP_BULK = 16 << 20;
+constexpr size_t MAX_RESP_INLINE = 64 << 10;
+constexpr size_t MAX_RESP_HEADER_LINE = 32; // "*<count>" or "$<length>"
+
+// Parses one command at the start of data[0..len), len > 0: a RESP array
+// of bulk strings, or an inline command split on blanks. The args are
+// views into data. Returns the bytes used, 0 if the command is not
+// complete yet, -1 if it is malformed or over the limits. An inline line
+// of blanks uses its bytes and leaves args empty.
+long parse_resp_command(const char *data, size_t len, std::vector<std::string_view> &args);
+
+// Decimal integer with nothing around it, as in RESP headers and arguments
+bool resp_parse_int(std::string_view s, long long &out);
@@ -0,0 +1,129 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include "KVService.h"
+#include "EventServer.h"
+#pragma once
+
+struct RespServerConfig
+{
+    int port = 6379;
+    size_t threads = 4; // event loops, each with its own SO_REUSEPORT socket
+};
+
+// Redis (RESP2) front end, so redis-cli, redis-benchmark and Redis client
+// libraries can talk to the store. Understands PING, GET, SET [EX|PX],
+// DEL, MGET, MSET, EXISTS and EXPIRE, sent as RESP arrays or inline.
+//
+// Pipelined commands are answered in order, as Redis clients expect;
+// each one waits only for its own storage reads and writes, and for the
+// writes to its keys sent before it, so a GET after a SET sees the SET.
+// Writes are answered once they reach the default (log) durability.
+//
+// Expiry times live in this front end's memory: they are lost on
+// restart, and writes through the HTTP or binary APIs don't clear them.
+// The expiry of a SET ... EX or an EXPIRE only applies if no later write
+// to the key was sent meanwhile.
+class RespServer : public EventServer
+{
+public:
+    // Starts listening; throws std::runtime_error if the port can't be bound
+    RespServer(KVService &kv, const RespServerConfig &config);
+    ~RespServer() override;
+
+private:
+    using Args = std::vector<std::string_view>;
+    using Clock = std::chrono::steady_clock;
+
+    long on_input(Connection &conn, const char *data, size_t len) override;
+    void execute(Connection &conn, const Args &args);
+
+    void get(Connection &conn, const Args &args);
+    void set(Connection &conn, const Args &args);
+    void del(Connection &conn, const Args &args);
+    void mget(Connection &conn, const Args &args);
+    void mset(Connection &conn, const Args &args);
+    void exists(Connection &conn, const Args &args);
+    void expire(Connection &conn, const Args &args);
+
+    // Reads keys, cache first, once the writes to them sent before (with
+    // a ticket below before) are done. Calls done(ok, values) with "" for
+    // missing keys, right away if the cache had them all and no write was
+    // in the way, otherwise later with the response deferred in its slot.
+    using ReadDone = std::function<std::string(bool ok, std::vector<std::string> &values)>;
+    void read_keys(Connection &conn, std::vector<std::string> keys, ReadDone done,
+                   uint64_t before = UINT64_MAX);
+    // The same, without a response of its own: got(ok, values) runs once
+    // the values are known
+    using GotValues = std::function<void(bool ok, std::vector<std::string> &values)>;
+    void read_values(std::vector<std::string> keys, uint64_t before, GotValues got);
+    // The cache lookups of read_keys(): the values it had, and the rest
+    struct ReadMisses
+    {
+        std::vector<size_t> index;
+        std::vector<KVService::ReadMiss> misses;
+    };
+    ReadMisses lookup_keys(const std::vector<std::string> &keys, std::vector<std::string> &values);
+    void fetch_keys(const std::vector<std::string> &keys, std::vector<std::string> values,
+                    const ReadMisses &missing, GotValues got);
+    // Writes (value set) or deletes every pair, then replies with
+    // on_ok() or the first error. A ttl sets the expiry of the keys written.
+    using Write = std::pair<std::string, std::string>;
+    void write_keys(Connection &conn, std::vector<Write> writes, bool remove,
+                    std::function<std::string()> on_ok,
+                    std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
+    // Registers writes to keys: returns their tickets and drops their expiry
+    std::vector<uint64_t> begin_writes(const std::vector<std::string> &keys);
+    // The rest of write_keys(), for writes registered by begin_writes()
+    void send_writes(std::vector<Write> writes, std::vector<uint64_t> tickets, bool remove,
+                     std::function<std::string()> on_ok, std::chrono::milliseconds ttl, Reply reply);
+
+    // Writes in flight by key, each with a ticket from one counter. Reads
+    // of a key wait for the writes to it with lower tickets.
+    uint64_t begin_write(const std::string &key);
+    // The write is done: resumes the reads that only waited for it. Runs
+    // if_latest first if no write to key was sent after this one.
+    void end_write(const std::string &key, uint64_t ticket, const std::function<void()> &if_latest);
+    // Whether a write to one of keys with a ticket below before is in flight
+    bool writes_pending(const std::vector<std::string> &keys, uint64_t before);
+    // Calls resume once those writes are done; false, without calling
+    // it, if there are none
+    bool after_writes(const std::vector<std::string> &keys, uint64_t before, std::function<void()> resume);
+
+    // Key expiry: deadlines by key, and keys by deadline for the reaper
+    void expire_at(const std::string &key, Clock::time_point deadline);
+    void clear_expiry(const std::string &key);
+    void drop_expiry_locked(const std::string &key);
+    void reaper_loop();
+
+    KVService &kv_;
+
+    struct KeyWrites
+    {
+        std::vector<uint64_t> in_flight; // tickets, lowest first
+        uint64_t latest = 0;
+        // Reads waiting for the writes below a ticket
+        std::vector<std::pair<uint64_t, std::function<void()>>> waiting;
+    };
+    std::mutex writes_mtx_;
+    std::unordered_map<std::string, KeyWrites> writes_;
+    uint64_t next_ticket_ = 0;
+    std::atomic<size_t> writing_{0}; // writes_.size(), read without the lock
+
+    std::mutex expiry_mtx_;
+    std::condition_variable expiry_cv_;
+    std::unordered_map<std::string, Clock::time_point> deadlines_;
+    std::multimap<Clock::time_point, std::string> expiry_queue_;
+    std::atomic<size_t> expiring_{0}; // deadlines_.size(), read without the lock
+    bool stop_reaper_ = false;
+    std::thread reaper_;
+};
@@ -0,0 +1,115 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#pragma once
+
+// Sorted key/value stream, as produced by memtables, SSTables and merges.
+// Tombstones are surfaced, not skipped, so newer deletes can shadow older
+// values while merging.
+class KVIterator
+{
+public:
+    virtual ~KVIterator() = default;
+    virtual bool valid() const = 0;
+    virtual void seek(const std::string &target) = 0; // first key >= target
+    virtual void next() = 0;
+    virtual const std::string &key() const = 0;
+    virtual const std::string &value() const = 0;
+    virtual bool tombstone() const = 0;
+};
+
+// Writes an immutable sorted table. Layout:
+//   data blocks   (flags | key_len | value_len | key | value)*
+//   index block   (key_len | last key of block | offset | size)*
+//   bloom block   (k | bits)
+//   meta block    (num_entries | smallest key | largest key)
+//   footer        (index off/size, bloom off/size, meta off/size, magic)
+class SSTableWriter
+{
+public:
+    SSTableWriter(const std::string &path, size_t block_size, int bloom_bits_per_key);
+    ~SSTableWriter();
+
+    // Keys must be added in strictly increasing order
+    void add(const std::string &key, const std::string &value, bool tombstone);
+    // Writes index, filter and footer, fsyncs; returns the file size
+    uint64_t finish();
+
+    uint64_t estimated_size() const { return offset_ + block_.size(); }
+    uint64_t entries() const { return num_entries_; }
+
+private:
+    void flush_block();
+    void write(const std::string &data);
+
+    std::string path_;
+    int fd_ = -1;
+    size_t block_size_;
+    int bloom_bits_per_key_;
+
+    std::string block_;
+    std::string last_key_;
+    std::string smallest_;
+    std::string index_;
+    std::vector<uint64_t> key_hashes_; // for the bloom filter
+    uint64_t offset_ = 0;
+    uint64_t num_entries_ = 0;
+};
+
+class SSTable : public std::enable_shared_from_this<SSTable>
+{
+public:
+    enum class Lookup
+    {
+        NotFound,
+        Found,
+        Deleted,
+    };
+
+    // Throws std::runtime_error on a missing or corrupt file
+    static std::shared_ptr<SSTable> open(const std::string &path, uint64_t id);
+    // Unlinks the file if it was marked obsolete
+    ~SSTable();
+
+    Lookup get(const std::string &key, std::string &value) const;
+    std::unique_ptr<KVIterator> iterator() const;
+
+    uint64_t id() const { return id_; }
+    uint64_t file_size() const { return file_size_; }
+    uint64_t entries() const { return num_entries_; }
+    const std::string &smallest() const { return smallest_; }
+    const std::string &largest() const { return largest_; }
+    bool overlaps(const std::string &lo, const std::string &hi) const
+    {
+        return !(largest_ < lo || hi < smallest_);
+    }
+
+    // Replaced by a compaction: delete the file once no reader holds it
+    void mark_obsolete() { obsolete_ = true; }
+
+private:
+    struct BlockHandle
+    {
+        std::string last_key;
+        uint64_t offset;
+        uint32_t size;
+    };
+    friend class SSTableIterator;
+
+    SSTable() = default;
+    bool may_contain(const std::string &key) const;
+    std::string read_block(size_t index) const;
+
+    std::string path_;
+    uint64_t id_ = 0;
+    int fd_ = -1;
+    uint64_t file_size_ = 0;
+    uint64_t num_entries_ = 0;
+    std::string smallest_, largest_;
+    std::vector<BlockHandle> blocks_;
+    std::string bloom_;
+    uint32_t bloom_k_ = 0;
+    std::atomic<bool> obsolete_{false};
+};
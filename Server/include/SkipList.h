@@ -0,0 +1,124 @@
+#include <random>
+#include <cstddef>
+#pragma once
+
+// Ordered map used as the LSM memtable. Not thread-safe: callers serialize
+// writers against readers (LSMEngine wraps each memtable in a shared_mutex).
+template <typename K, typename V>
+class SkipList
+{
+    static const int MAX_HEIGHT = 12;
+
+    struct Node
+    {
+        K key;
+        V value;
+        int height;
+        Node *next[MAX_HEIGHT];
+
+        Node(const K &k, V v, int h) : key(k), value(std::move(v)), height(h)
+        {
+            for (int i = 0; i < MAX_HEIGHT; ++i)
+                next[i] = nullptr;
+        }
+    };
+
+public:
+    class Iterator
+    {
+    public:
+        explicit Iterator(const Node *node) : node_(node) {}
+        bool valid() const { return node_ != nullptr; }
+        const K &key() const { return node_->key; }
+        const V &value() const { return node_->value; }
+        void next() { node_ = node_->next[0]; }
+
+    private:
+        const Node *node_;
+    };
+
+    SkipList() : head_(new Node(K(), V(), MAX_HEIGHT)), rng_(0x5eed) {}
+    ~SkipList()
+    {
+        Node *n = head_;
+        while (n)
+        {
+            Node *next = n->next[0];
+            delete n;
+            n = next;
+        }
+    }
+    SkipList(const SkipList &) = delete;
+    SkipList &operator=(const SkipList &) = delete;
+
+    // Inserts key, or overwrites its value if already present
+    void put(const K &key, V value)
+    {
+        Node *prev[MAX_HEIGHT];
+        Node *n = find_greater_or_equal(key, prev);
+        if (n && !(key < n->key))
+        {
+            n->value = std::move(value);
+            return;
+        }
+
+        int h = random_height();
+        if (h > height_)
+        {
+            for (int i = height_; i < h; ++i)
+                prev[i] = head_;
+            height_ = h;
+        }
+        Node *node = new Node(key, std::move(value), h);
+        for (int i = 0; i < h; ++i)
+        {
+            node->next[i] = prev[i]->next[i];
+            prev[i]->next[i] = node;
+        }
+        size_++;
+    }
+
+    // nullptr if absent
+    const V *find(const K &key) const
+    {
+        Node *n = find_greater_or_equal(key, nullptr);
+        return (n && !(key < n->key)) ? &n->value : nullptr;
+    }
+
+    Iterator begin() const { return Iterator(head_->next[0]); }
+    // First entry with key >= target
+    Iterator lower_bound(const K &target) const
+    {
+        return Iterator(find_greater_or_equal(target, nullptr));
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    Node *find_greater_or_equal(const K &key, Node **prev) const
+    {
+        Node *x = head_;
+        for (int level = height_ - 1; level >= 0; --level)
+        {
+            while (x->next[level] && x->next[level]->key < key)
+                x = x->next[level];
+            if (prev)
+                prev[level] = x;
+        }
+        return x->next[0];
+    }
+
+    // Each level up is 1/4 as likely, as in LevelDB
+    int random_height()
+    {
+        int h = 1;
+        while (h < MAX_HEIGHT && (rng_() & 3) == 0)
+            ++h;
+        return h;
+    }
+
+    Node *head_;
+    int height_ = 1;
+    size_t size_ = 0;
+    std::mt19937 rng_;
+};
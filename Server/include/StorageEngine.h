@@ -0,0 +1,71 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <functional>
+#include <utility>
+#include "nlohmann/json.hpp"
+#pragma once
+
+// Persistent backend behind the cache. server.cpp only talks to this
+// interface, so the HTTP + cache layers can run (and be benchmarked)
+// against any engine, including one with no external database.
+//
+// Like LRUCache, an empty string means "not found".
+
+// How far a write has to get before its on_commit callback fires
+enum class Durability
+{
+    Log,      // fdatasync'ed in the engine's local log
+    Database, // applied to the backing store (the MySQL commit); the same
+              // point as Log for the embedded engines
+};
+
+class StorageEngine
+{
+public:
+    using GetCallback = std::function<void(bool ok, std::string value)>;
+    using MultiGetCallback = std::function<void(bool ok, std::vector<std::string> values)>;
+    // Called once the write reached the requested durability (ok == false on error)
+    using WriteCallback = std::function<void(bool ok)>;
+    using KeyValues = std::vector<std::pair<std::string, std::string>>;
+
+    virtual ~StorageEngine() = default;
+    virtual const char *name() const = 0;
+
+    // Reads. Callbacks may run on an engine thread, keep them short.
+    virtual void get(const std::string &key, GetCallback cb) = 0;
+    std::future<std::string> get(const std::string &key);
+    // values[i] belongs to keys[i]. Default: one get() per key.
+    virtual void multi_get(const std::vector<std::string> &keys, MultiGetCallback cb);
+
+    // A read on behalf of a background cache refresh, which must not be
+    // older than any write the engine already accepted for key. Should not
+    // block the caller; a refresh that cannot run now fails with ok == false.
+    // Default: get(), for engines whose reads see their writes immediately.
+    virtual void refresh(const std::string &key, GetCallback cb) { get(key, std::move(cb)); }
+
+    // Writes. Returning false means the engine is shedding load and did
+    // not accept the write; on_commit is then never called.
+    virtual bool put(const std::string &key, const std::string &value,
+                     WriteCallback on_commit = nullptr,
+                     Durability durability = Durability::Log) = 0;
+    virtual bool remove(const std::string &key, WriteCallback on_commit = nullptr,
+                        Durability durability = Durability::Log) = 0;
+    // Default: one put()/remove() per key, on_commit fires after the last one
+    virtual bool multi_put(const KeyValues &kvs, WriteCallback on_commit = nullptr,
+                           Durability durability = Durability::Log);
+    virtual bool multi_remove(const std::vector<std::string> &keys,
+                              WriteCallback on_commit = nullptr,
+                              Durability durability = Durability::Log);
+
+    // Up to `limit` pairs with key >= start_key, in key order
+    virtual KeyValues scan(const std::string &start_key, size_t limit) = 0;
+
+    // Engine-specific gauges for /stats
+    virtual void report_stats(nlohmann::json &out) {}
+};
+
+// Builds the engine selected by name ("mysql", "memory", "bitcask" or "lsm").
+// Throws std::invalid_argument for unknown names.
+std::unique_ptr<StorageEngine> create_storage_engine(const std::string &name);
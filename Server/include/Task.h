@@ -0,0 +1,96 @@
+#include <coroutine>
+#include <exception>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include "nlohmann/json.hpp"
+#pragma once
+
+// A request handler written as a coroutine, one stage per await:
+//
+//   Task handle(...)
+//   {
+//       if (!co_await cache_lookup(...))
+//           co_await db_fetch(...);
+//       co_await write_response(...);
+//   }
+//
+// A Task runs as soon as it is called, on the caller's thread, until an
+// await suspends it; the awaited operation then hands it to a Scheduler,
+// which resumes it on one of its threads. Nothing waits for a Task: its
+// frame is freed when it returns. A suspended Task holds no thread, only
+// its frame, so a few threads can have many thousands of them in flight.
+class Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        // A handler that throws would leave its response unsent for good
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Where suspended Tasks continue. schedule() is thread-safe and resumes
+// the Task later on one of the scheduler's threads, or destroys it if the
+// scheduler is stopping.
+class Scheduler
+{
+public:
+    virtual ~Scheduler() = default;
+    virtual void schedule(std::coroutine_handle<> task) = 0;
+};
+
+// The stages of a request, each timed by the code or awaitable running it
+enum class Stage
+{
+    Parse,
+    Cache,
+    Db,
+    Respond,
+};
+
+// Count, total and longest time per stage. Written by one thread only,
+// read by /stats from any.
+class StageTimings
+{
+public:
+    void record(Stage stage, std::chrono::steady_clock::duration elapsed);
+
+    // {"parse": {"count", "avg_us", "max_us"}, "cache": ...} over all of them
+    static void report(const std::vector<const StageTimings *> &all, nlohmann::json &out);
+
+private:
+    static const size_t STAGES = 4;
+
+    struct Counter
+    {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+    };
+    Counter counters_[STAGES];
+};
+
+// Records the time from construction to destruction as one stage
+class StageTimer
+{
+public:
+    StageTimer(StageTimings &timings, Stage stage)
+        : timings_(timings), stage_(stage), start_(std::chrono::steady_clock::now())
+    {
+    }
+    ~StageTimer() { timings_.record(stage_, std::chrono::steady_clock::now() - start_); }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    StageTimings &timings_;
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
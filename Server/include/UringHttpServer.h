@@ -0,0 +1,103 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "nlohmann/json.hpp"
+#include "KVService.h"
+#include "HttpParser.h"
+#include "Task.h"
+#pragma once
+
+struct UringHttpServerConfig
+{
+    int port = 8890;
+    size_t threads = 4; // rings, each with its own SO_REUSEPORT socket
+};
+
+// HTTP/1.1 front end for the /key API on io_uring, for many more
+// keep-alive clients than civetweb's fixed pool of blocking threads can
+// hold. Serves the same requests and JSON as the civetweb handlers:
+//   GET    /key?key=k   honours ?consistency=
+//   POST   /key         {"key": k, "value": v}, honours ?durability=
+//   GET    /key/k       raw value, as application/octet-stream
+//   POST   /key/k       raw application/octet-stream value
+//   DELETE /key/k       honours ?durability=
+//
+// Each thread owns one ring. Connections are accepted with a multishot
+// accept and read with a multishot recv into a ring of buffers
+// registered with the kernel, so an idle connection costs no thread and
+// no buffer. Requests are parsed in place from those buffers; pipelined
+// requests are answered in order. Cache misses and writes complete on
+// the storage engine's threads and are handed back to the ring through
+// an eventfd read, so a slow read holds no thread and never delays a
+// cache hit on the same ring.
+//
+// GETs run as Tasks (see get_task()), which each ring also schedules:
+// a miss suspends its Task, and the ring resumes it once the engine has
+// the value. The time a request spends in each stage is under "stages"
+// in the counters.
+//
+// Needs Linux 6.0 or later (multishot recv); built only with
+// USE_IO_URING=1 and uses the raw system calls, not liburing.
+class UringHttpServer
+{
+public:
+    // Starts the rings; throws std::runtime_error if the port can't be
+    // bound or io_uring is unavailable
+    UringHttpServer(KVService &kv, const UringHttpServerConfig &config);
+    ~UringHttpServer();
+
+    // Connection and request counters for /stats
+    void report_stats(nlohmann::json &out) const;
+
+private:
+    struct Connection;
+    struct Loop;
+
+    // A response completed off the ring's thread. Thread-safe; send() once.
+    class Reply
+    {
+    public:
+        void send(std::string bytes) const;
+
+    private:
+        friend class UringHttpServer;
+        std::shared_ptr<Loop> loop_;
+        uint64_t conn_id_ = 0;
+        uint64_t slot_ = 0;
+    };
+
+    void run(Loop &loop);
+    void on_accept(Loop &loop, int res);
+    void on_recv(Loop &loop, Connection &conn, const char *data, size_t len);
+    void on_send(Loop &loop, Connection &conn, int res);
+    void drain_completions(Loop &loop);
+    // Handles the complete requests at data[0..len); returns the bytes used
+    size_t consume(Connection &conn, const char *data, size_t len);
+    // Sends, pauses or resumes reading, and closes as the state asks for.
+    // conn may be gone afterwards.
+    void update(Loop &loop, Connection &conn);
+    void shut_down(Loop &loop, Connection &conn);
+
+    void handle(Connection &conn, const HttpRequest &req, const char *body);
+    void get(Connection &conn, const HttpRequest &req);
+    // Where a GET's response goes, from inside its Task
+    struct Responder;
+    Task get_task(Responder res, std::string key, bool raw, bool close, ReadConsistency mode);
+    void post(Connection &conn, const HttpRequest &req, const char *body);
+    void del(Connection &conn, const HttpRequest &req);
+
+    // Buffer for an immediate response, sent after the deferred ones
+    // before it
+    std::string &respond(Connection &conn);
+    Reply defer(Connection &conn);
+
+    KVService &kv_;
+    std::vector<std::shared_ptr<Loop>> loops_;
+
+    std::atomic<uint64_t> connections_{0}; // open right now
+    std::atomic<uint64_t> accepted_{0};
+    std::atomic<uint64_t> requests_{0};
+    std::atomic<uint64_t> protocol_errors_{0};
+};
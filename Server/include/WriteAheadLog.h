@@ -0,0 +1,58 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include "AppendLog.h"
+#pragma once
+
+// Segmented write-ahead log in front of the MySQL write-behind queues.
+//
+// Positions are logical byte offsets that keep growing across segments
+// (each segment file is named after the position it starts at), so a
+// record is identified by the position just past its end. Consumers
+// persist how far they have applied with save_checkpoint(); segments
+// entirely below every checkpoint are deleted.
+class WriteAheadLog
+{
+public:
+    // Opens a fresh segment after any existing ones
+    explicit WriteAheadLog(const std::string &dir, uint64_t segment_size = 64ull << 20);
+
+    // Appends and returns the record's end position. on_durable runs once
+    // the record is fdatasync'ed (group commit, see AppendLog).
+    uint64_t append(uint8_t flags, const std::string &key, const std::string &value,
+                    AppendLog::SyncCallback on_durable = nullptr);
+
+    // Position just past the last appended record
+    uint64_t end() const;
+
+    // Every record in the existing segments, oldest first, with its end position
+    void replay(const std::function<void(const LogRecord &, uint64_t end)> &fn);
+
+    // Per-consumer progress, as last saved (empty if never saved)
+    std::vector<uint64_t> load_checkpoint() const;
+    void save_checkpoint(const std::vector<uint64_t> &applied);
+
+    const std::string &dir() const { return dir_; }
+    uint64_t syncs() const;
+    uint64_t synced_records() const;
+    size_t segments() const;
+
+private:
+    std::string segment_path(uint64_t base) const;
+
+    std::string dir_;
+    uint64_t segment_size_;
+
+    mutable std::mutex mtx_;
+    std::map<uint64_t, std::string> segments_; // base position -> file, excluding the active one
+    uint64_t active_base_ = 0;
+    std::unique_ptr<AppendLog> active_;
+
+    // Totals of the rotated-out segments, for stats
+    uint64_t retired_syncs_ = 0;
+    uint64_t retired_records_ = 0;
+};
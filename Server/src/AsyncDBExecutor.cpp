@@ -0,0 +1,403 @@
+#include <mysql/mysql.h> // MySQL C API
+#include <mysql/errmsg.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include "AsyncDBExecutor.h"
+#include "MySQLHelper.h"
+
+using namespace std;
+
+// How long a connection that failed to open waits before the next try
+static const chrono::seconds RECONNECT_DELAY(1);
+
+AsyncDBExecutor::AsyncDBExecutor(const std::string &host,
+                                 const std::string &user,
+                                 const std::string &password,
+                                 const std::string &db,
+                                 int port,
+                                 size_t num_threads,
+                                 size_t conns_per_thread,
+                                 std::chrono::milliseconds timeout)
+    : host_(host), user_(user), password_(password), db_(db), port_(port), timeout_(timeout)
+{
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        auto loop = make_unique<Loop>();
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epoll_fd < 0 || loop->event_fd < 0)
+            throw runtime_error("AsyncDBExecutor: epoll/eventfd setup failed");
+
+        // data.ptr == nullptr identifies the wake-up eventfd
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->event_fd, &ev);
+
+        for (size_t j = 0; j < conns_per_thread; ++j)
+        {
+            loop->conns.push_back(make_unique<Connection>());
+            Connection *c = loop->conns.back().get();
+            connect(c);
+            watch(loop.get(), c);
+        }
+        loops_.push_back(std::move(loop));
+    }
+
+    for (auto &loop : loops_)
+        loop->thread = std::thread(&AsyncDBExecutor::run, this, loop.get());
+}
+
+AsyncDBExecutor::~AsyncDBExecutor()
+{
+    stop_ = true;
+    for (auto &loop : loops_)
+    {
+        uint64_t one = 1;
+        if (write(loop->event_fd, &one, sizeof(one)) < 0)
+            perror("AsyncDBExecutor: eventfd write");
+    }
+    for (auto &loop : loops_)
+    {
+        if (loop->thread.joinable())
+            loop->thread.join();
+        for (auto &c : loop->conns)
+            mysql_close(c->mysql);
+        close(loop->event_fd);
+        close(loop->epoll_fd);
+    }
+}
+
+// Opens c's connection. Blocking, only used at startup.
+void AsyncDBExecutor::connect(Connection *c)
+{
+    c->mysql = mysql_init(nullptr);
+    if (!c->mysql)
+        throw runtime_error("mysql_init failed");
+
+    if (!mysql_real_connect(c->mysql, host_.c_str(), user_.c_str(), password_.c_str(),
+                            db_.c_str(), port_, nullptr, 0))
+    {
+        throw runtime_error(mysql_error(c->mysql));
+    }
+    c->state = ConnState::Idle;
+}
+
+void AsyncDBExecutor::reconnect(Loop *loop, Connection *c)
+{
+    unwatch(loop, c);
+    if (c->mysql)
+        mysql_close(c->mysql);
+    c->mysql = mysql_init(nullptr);
+    c->state = c->mysql ? ConnState::Connecting : ConnState::Down;
+    c->deadline = Clock::now() + timeout_;
+    c->retry_at = Clock::now() + RECONNECT_DELAY;
+}
+
+void AsyncDBExecutor::fail_connect(Loop *loop, Connection *c)
+{
+    unwatch(loop, c);
+    c->state = ConnState::Down;
+    c->retry_at = Clock::now() + RECONNECT_DELAY;
+}
+
+// Edge-triggered: the non-blocking calls are simply retried on every
+// readiness change of the socket.
+void AsyncDBExecutor::watch(Loop *loop, Connection *c)
+{
+    c->fd = mysql_get_socket(c->mysql);
+    if (c->fd < 0)
+        return;
+    epoll_event cev{};
+    cev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    cev.data.ptr = c;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, c->fd, &cev);
+}
+
+void AsyncDBExecutor::unwatch(Loop *loop, Connection *c)
+{
+    if (c->fd >= 0)
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, c->fd, nullptr);
+    c->fd = -1;
+}
+
+void AsyncDBExecutor::execute(std::string sql, Callback cb)
+{
+    execute(std::move(sql), [cb = std::move(cb)](bool ok, Rows rows, string error)
+            {
+        if (!ok)
+            cb(false, std::move(error));
+        else if (rows.empty() || rows[0].empty())
+            cb(true, "");
+        else
+            cb(true, std::move(rows[0][0])); });
+}
+
+void AsyncDBExecutor::execute(std::string sql, RowsCallback cb)
+{
+    in_flight_++;
+    Loop *loop = loops_[next_loop_++ % loops_.size()].get();
+    {
+        lock_guard<mutex> lock(loop->mtx);
+        loop->inbox.push_back({std::move(sql), std::move(cb), Clock::now() + timeout_});
+    }
+    uint64_t one = 1;
+    if (write(loop->event_fd, &one, sizeof(one)) < 0)
+        perror("AsyncDBExecutor: eventfd write");
+}
+
+void AsyncDBExecutor::get(const std::string &key, Callback cb)
+{
+    auto hash = md5_hash(key);
+    string hex(hash.size() * 2 + 1, '\0');
+    hex.resize(mysql_hex_string(hex.data(), (const char *)hash.data(), hash.size()));
+
+    execute("CALL select_kv(X'" + hex + "')", std::move(cb));
+}
+
+std::future<std::string> AsyncDBExecutor::get(const std::string &key)
+{
+    auto promise = make_shared<std::promise<string>>();
+    auto fut = promise->get_future();
+    get(key, [promise](bool ok, string result)
+        {
+        if (ok)
+            promise->set_value(std::move(result));
+        else
+            promise->set_exception(make_exception_ptr(runtime_error(result))); });
+    return fut;
+}
+
+void AsyncDBExecutor::run(Loop *loop)
+{
+    epoll_event events[64];
+    while (!stop_)
+    {
+        int n = epoll_wait(loop->epoll_fd, events, 64, 100);
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.ptr == nullptr)
+            {
+                uint64_t count;
+                while (read(loop->event_fd, &count, sizeof(count)) > 0)
+                    ;
+                {
+                    lock_guard<mutex> lock(loop->mtx);
+                    for (auto &req : loop->inbox)
+                        loop->pending.push_back(std::move(req));
+                    loop->inbox.clear();
+                }
+                // Hand new work to every idle connection
+                for (auto &c : loop->conns)
+                {
+                    if (loop->pending.empty())
+                        break;
+                    if (c->state == ConnState::Idle)
+                        drive(loop, c.get());
+                }
+            }
+            else
+            {
+                drive(loop, static_cast<Connection *>(events[i].data.ptr));
+            }
+        }
+        expire(loop);
+    }
+
+    // Fail whatever never got an answer
+    lock_guard<mutex> lock(loop->mtx);
+    for (auto &c : loop->conns)
+    {
+        if (c->state == ConnState::Query || c->state == ConnState::StoreResult ||
+            c->state == ConnState::NextResult)
+            loop->pending.push_back(std::move(c->req));
+    }
+    for (auto &req : loop->inbox)
+        loop->pending.push_back(std::move(req));
+    loop->inbox.clear();
+    for (auto &req : loop->pending)
+    {
+        in_flight_--;
+        req.cb(false, {}, "AsyncDBExecutor is shutting down");
+    }
+    loop->pending.clear();
+}
+
+void AsyncDBExecutor::expire(Loop *loop)
+{
+    auto now = Clock::now();
+    // Queued in deadline order
+    while (!loop->pending.empty() && loop->pending.front().deadline <= now)
+    {
+        Request req = std::move(loop->pending.front());
+        loop->pending.pop_front();
+        in_flight_--;
+        req.cb(false, {}, "MySQL query timed out");
+    }
+
+    for (auto &conn : loop->conns)
+    {
+        Connection *c = conn.get();
+        switch (c->state)
+        {
+        case ConnState::Query:
+        case ConnState::StoreResult:
+        case ConnState::NextResult:
+            if (c->req.deadline > now)
+                continue;
+            // The answer may still come, so the connection can't be reused
+            finish(loop, c, false, "MySQL query timed out");
+            reconnect(loop, c);
+            break;
+        case ConnState::Connecting:
+            if (c->deadline > now)
+                continue;
+            fprintf(stderr, "[AsyncDBExecutor] Reconnect to %s:%d timed out\n", host_.c_str(), port_);
+            fail_connect(loop, c);
+            continue;
+        case ConnState::Down:
+            if (c->retry_at > now)
+                continue;
+            reconnect(loop, c);
+            break;
+        case ConnState::Idle:
+            continue;
+        }
+        drive(loop, c);
+    }
+}
+
+void AsyncDBExecutor::drive(Loop *loop, Connection *c)
+{
+    while (true)
+    {
+        switch (c->state)
+        {
+        case ConnState::Connecting:
+        {
+            auto status = mysql_real_connect_nonblocking(c->mysql, host_.c_str(), user_.c_str(),
+                                                         password_.c_str(), db_.c_str(), port_,
+                                                         nullptr, 0);
+            // The socket only exists once the first call started the connect
+            if (c->fd < 0 && status != NET_ASYNC_ERROR)
+                watch(loop, c);
+            if (status == NET_ASYNC_NOT_READY)
+                return;
+            if (status == NET_ASYNC_ERROR)
+            {
+                fprintf(stderr, "[AsyncDBExecutor] Reconnect failed: %s\n", mysql_error(c->mysql));
+                fail_connect(loop, c);
+                return;
+            }
+            c->state = ConnState::Idle;
+            break;
+        }
+        case ConnState::Down:
+            return;
+        case ConnState::Idle:
+        {
+            if (loop->pending.empty())
+                return;
+            c->req = std::move(loop->pending.front());
+            loop->pending.pop_front();
+            c->have_rows = false;
+            c->rows.clear();
+            c->state = ConnState::Query;
+            break;
+        }
+        case ConnState::Query:
+        {
+            auto status = mysql_real_query_nonblocking(c->mysql, c->req.sql.data(),
+                                                       c->req.sql.size());
+            if (status == NET_ASYNC_NOT_READY)
+                return;
+            if (status == NET_ASYNC_ERROR)
+            {
+                finish(loop, c, false, mysql_error(c->mysql));
+                break;
+            }
+            c->state = ConnState::StoreResult;
+            break;
+        }
+        case ConnState::StoreResult:
+        {
+            MYSQL_RES *res = nullptr;
+            auto status = mysql_store_result_nonblocking(c->mysql, &res);
+            if (status == NET_ASYNC_NOT_READY)
+                return;
+            if (status == NET_ASYNC_ERROR)
+            {
+                finish(loop, c, false, mysql_error(c->mysql));
+                break;
+            }
+            if (res)
+            {
+                // The whole result set is buffered now, so these don't block
+                if (!c->have_rows)
+                {
+                    unsigned int num_fields = mysql_num_fields(res);
+                    while (MYSQL_ROW row = mysql_fetch_row(res))
+                    {
+                        unsigned long *lengths = mysql_fetch_lengths(res);
+                        std::vector<std::string> fields(num_fields);
+                        for (unsigned int f = 0; f < num_fields; ++f)
+                            if (row[f])
+                                fields[f].assign(row[f], lengths[f]);
+                        c->rows.push_back(std::move(fields));
+                    }
+                    c->have_rows = true;
+                }
+                mysql_free_result(res);
+            }
+            if (mysql_more_results(c->mysql))
+                c->state = ConnState::NextResult;
+            else
+                finish(loop, c, true, "");
+            break;
+        }
+        case ConnState::NextResult:
+        {
+            auto status = mysql_next_result_nonblocking(c->mysql);
+            if (status == NET_ASYNC_NOT_READY)
+                return;
+            if (status == NET_ASYNC_ERROR)
+            {
+                finish(loop, c, false, mysql_error(c->mysql));
+                break;
+            }
+            if (status == NET_ASYNC_COMPLETE_NO_MORE_RESULTS)
+                finish(loop, c, true, "");
+            else
+                c->state = ConnState::StoreResult;
+            break;
+        }
+        }
+    }
+}
+
+// Completes the current request and leaves c Idle
+void AsyncDBExecutor::finish(Loop *loop, Connection *c, bool ok, std::string error)
+{
+    unsigned int err = ok ? 0 : mysql_errno(c->mysql);
+    Request req = std::move(c->req);
+    Rows rows = std::move(c->rows);
+    c->state = ConnState::Idle;
+
+    // drive() carries on with the connect
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+        reconnect(loop, c);
+
+    in_flight_--;
+    try
+    {
+        req.cb(ok, std::move(rows), std::move(error));
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "[AsyncDBExecutor] Callback exception: %s\n", e.what());
+    }
+}
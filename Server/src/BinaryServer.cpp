@@ -0,0 +1,127 @@
+#include <cstring>
+#include <string>
+#include "BinaryServer.h"
+#include "LogFormat.h"
+
+using namespace std;
+using namespace binproto;
+
+void binproto::encode(string &buf, uint8_t magic, uint8_t opcode, uint8_t flags, uint32_t opaque,
+                      const char *key, uint16_t key_len, const char *value, uint32_t value_len)
+{
+    char header[HEADER_SIZE] = {};
+    header[0] = (char)magic;
+    header[1] = (char)opcode;
+    memcpy(header + 2, &key_len, 2);
+    memcpy(header + 4, &value_len, 4);
+    memcpy(header + 8, &opaque, 4);
+    header[12] = (char)flags;
+    buf.append(header, HEADER_SIZE);
+    buf.append(key, key_len);
+    buf.append(value, value_len);
+}
+
+static void encode_response(string &buf, uint8_t opcode, uint8_t status, uint32_t opaque,
+                            const string &value = "")
+{
+    encode(buf, RESPONSE_MAGIC, opcode, status, opaque, nullptr, 0, value.data(), value.size());
+}
+
+static uint8_t to_wire_status(KVStatus status)
+{
+    switch (status)
+    {
+    case KVStatus::Ok:
+        return OK;
+    case KVStatus::NotFound:
+        return NOT_FOUND;
+    case KVStatus::Overloaded:
+        return OVERLOADED;
+    default:
+        return FAILED;
+    }
+}
+
+BinaryServer::BinaryServer(KVService &kv, const BinaryServerConfig &config)
+    : EventServer("BinaryServer", config.port, config.threads), kv_(kv)
+{
+    start();
+}
+
+BinaryServer::~BinaryServer()
+{
+    stop();
+}
+
+long BinaryServer::on_input(Connection &conn, const char *data, size_t len)
+{
+    if (len < HEADER_SIZE)
+        return 0;
+    if ((uint8_t)data[0] != REQUEST_MAGIC)
+        return -1;
+    uint8_t opcode = data[1];
+    uint16_t key_len = get_fixed<uint16_t>(data + 2);
+    uint32_t value_len = get_fixed<uint32_t>(data + 4);
+    uint32_t opaque = get_fixed<uint32_t>(data + 8);
+    uint8_t flags = data[12];
+    if (value_len > MAX_VALUE_SIZE)
+        return -1;
+    size_t total = HEADER_SIZE + key_len + value_len;
+    if (len < total)
+        return 0;
+
+    requests_++;
+    if (key_len == 0)
+    {
+        encode_response(respond(conn), opcode, BAD_REQUEST, opaque, "empty key");
+        return total;
+    }
+    string key(data + HEADER_SIZE, key_len);
+
+    if (opcode == GET)
+    {
+        string cached;
+        KVService::ReadMiss miss;
+        if (kv_.lookup(key, cached, miss))
+        {
+            encode_response(respond(conn), GET, OK, opaque, cached);
+            return total;
+        }
+        kv_.fetch(key, miss, [reply = defer(conn, false), opaque](KVStatus status, string result)
+                  {
+            string response;
+            encode_response(response, GET, to_wire_status(status), opaque,
+                            status == KVStatus::NotFound ? "" : result);
+            reply.send(std::move(response)); });
+        return total;
+    }
+
+    if (opcode != PUT && opcode != DELETE)
+    {
+        encode_response(respond(conn), opcode, BAD_REQUEST, opaque, "unknown opcode");
+        return total;
+    }
+
+    WriteAck ack;
+    if (flags == 1)
+        ack.wait = false;
+    else if (flags == 2)
+        ack.durability = Durability::Database;
+    else if (flags != 0)
+    {
+        encode_response(respond(conn), opcode, BAD_REQUEST, opaque, "durability must be 0 (log), 1 (memory) or 2 (db)");
+        return total;
+    }
+
+    auto done = [reply = defer(conn, false), opaque, opcode](KVStatus status)
+    {
+        string response;
+        encode_response(response, opcode, to_wire_status(status), opaque);
+        reply.send(std::move(response));
+    };
+    if (opcode == PUT)
+        kv_.put(key, string(data + HEADER_SIZE + key_len, value_len), ack, std::move(done));
+    else
+        kv_.remove(key, ack, std::move(done));
+    return total;
+}
@@ -0,0 +1,548 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <functional>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "BitcaskEngine.h"
+#include "LogFormat.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const size_t NUM_INDEX_SHARDS = 32;
+static const size_t HINT_HEADER_SIZE = 1 + 4 + 4 + 8; // flags, key_len, value_len, offset
+
+// Where the record that AppendLog::replay() says ends at end starts
+static uint64_t record_offset(const LogRecord &rec, uint64_t end)
+{
+    return end - (LOG_HEADER_SIZE + rec.key.size() + rec.value.size());
+}
+
+BitcaskEngine::DataFile::~DataFile()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+BitcaskEngine::BitcaskEngine(const BitcaskConfig &config) : config_(config)
+{
+    index_.reserve(NUM_INDEX_SHARDS);
+    for (size_t i = 0; i < NUM_INDEX_SHARDS; ++i)
+        index_.push_back(make_unique<IndexShard>());
+
+    load();
+
+    merger_ = thread(&BitcaskEngine::merge_loop, this);
+}
+
+BitcaskEngine::~BitcaskEngine()
+{
+    {
+        lock_guard<mutex> mlock(merge_mtx_);
+        stop_ = true;
+    }
+    cv_merge_.notify_all();
+    if (merger_.joinable())
+        merger_.join();
+    // Syncs what is outstanding and fires the remaining commit callbacks
+    retired_logs_.clear();
+    log_.reset();
+}
+
+BitcaskEngine::IndexShard *BitcaskEngine::shard_for(const std::string &key)
+{
+    return index_[std::hash<std::string>{}(key) % index_.size()].get();
+}
+
+std::shared_ptr<BitcaskEngine::DataFile> BitcaskEngine::file(uint32_t id)
+{
+    shared_lock<shared_mutex> lock(files_mtx_);
+    auto it = files_.find(id);
+    return it == files_.end() ? nullptr : it->second;
+}
+
+std::string BitcaskEngine::data_path(uint32_t id) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%09u.data", id);
+    return config_.dir + "/" + name;
+}
+
+std::string BitcaskEngine::hint_path(uint32_t id) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%09u.hint", id);
+    return config_.dir + "/" + name;
+}
+
+// ---------------------------------------------------------------------------
+// Startup: rebuild the index from hint files, or data files lacking one
+// ---------------------------------------------------------------------------
+
+void BitcaskEngine::load()
+{
+    fs::create_directories(config_.dir);
+
+    vector<uint32_t> ids;
+    for (auto &entry : fs::directory_iterator(config_.dir))
+    {
+        if (entry.path().extension() == ".data")
+            ids.push_back(stoul(entry.path().stem().string()));
+    }
+    sort(ids.begin(), ids.end());
+
+    for (uint32_t id : ids)
+    {
+        auto f = make_shared<DataFile>();
+        f->id = id;
+        files_[f->id] = f;
+
+        // Without a hint the data file is read through, which also cuts
+        // off a torn tail before the file is opened for reads
+        if (fs::exists(hint_path(f->id)))
+            load_hint(*f);
+        else
+            load_data(*f);
+        f->fd = open(data_path(f->id).c_str(), O_RDONLY | O_CLOEXEC);
+        if (f->fd < 0)
+            throw runtime_error("bitcask: cannot open " + data_path(f->id));
+        f->size = lseek(f->fd, 0, SEEK_END);
+    }
+
+    // Always append to a fresh file; everything loaded is immutable now
+    lock_guard<mutex> lock(write_mtx_);
+    active_ = open_active_locked(ids.empty() ? 1 : ids.back() + 1);
+}
+
+std::shared_ptr<BitcaskEngine::DataFile> BitcaskEngine::open_active_locked(uint32_t id)
+{
+    log_ = make_unique<AppendLog>(data_path(id));
+    auto f = make_shared<DataFile>();
+    f->id = id;
+    f->fd = open(data_path(id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (f->fd < 0)
+        throw runtime_error("bitcask: cannot open " + data_path(id));
+    unique_lock<shared_mutex> lock(files_mtx_);
+    files_[id] = f;
+    return f;
+}
+
+void BitcaskEngine::apply_loaded(const std::string &key, uint8_t flags, const Location &loc)
+{
+    // Files are replayed oldest first, so the last record for a key wins
+    IndexShard *shard = shard_for(key);
+    auto it = shard->entries.find(key);
+    if (it != shard->entries.end())
+    {
+        files_[it->second.file_id]->dead_bytes +=
+            LOG_HEADER_SIZE + it->second.key_len + it->second.value_len;
+        if (flags == LOG_FLAG_TOMBSTONE)
+            shard->entries.erase(it);
+        else
+            it->second = loc;
+    }
+    else if (flags == LOG_FLAG_PUT)
+        shard->entries.emplace(key, loc);
+
+    if (flags == LOG_FLAG_TOMBSTONE)
+        files_[loc.file_id]->dead_bytes += LOG_HEADER_SIZE + loc.key_len;
+}
+
+void BitcaskEngine::read_hint(uint32_t id, const function<void(uint8_t flags, const string &key,
+                                                               const Location &loc)> &fn)
+{
+    ifstream in(hint_path(id), ios::binary);
+    if (!in)
+        throw runtime_error("bitcask: cannot open " + hint_path(id));
+    string hint((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    while (pos + HINT_HEADER_SIZE <= hint.size())
+    {
+        uint8_t flags = hint[pos];
+        uint32_t key_len = get_fixed<uint32_t>(&hint[pos + 1]);
+        uint32_t value_len = get_fixed<uint32_t>(&hint[pos + 5]);
+        uint64_t offset = get_fixed<uint64_t>(&hint[pos + 9]);
+        if (pos + HINT_HEADER_SIZE + key_len > hint.size())
+            break;
+        string key = hint.substr(pos + HINT_HEADER_SIZE, key_len);
+        fn(flags, key, {id, offset, key_len, value_len});
+        pos += HINT_HEADER_SIZE + key_len;
+    }
+}
+
+void BitcaskEngine::load_hint(DataFile &f)
+{
+    read_hint(f.id, [this](uint8_t flags, const string &key, const Location &loc)
+              { apply_loaded(key, flags, loc); });
+    f.has_hint = true;
+}
+
+void BitcaskEngine::load_data(DataFile &f)
+{
+    AppendLog::replay(data_path(f.id), 0, [&](const LogRecord &rec, uint64_t end)
+                      { apply_loaded(rec.key, rec.flags,
+                                     {f.id, record_offset(rec, end), (uint32_t)rec.key.size(), (uint32_t)rec.value.size()}); });
+}
+
+// ---------------------------------------------------------------------------
+// Writes
+// ---------------------------------------------------------------------------
+
+void BitcaskEngine::mark_dead(uint32_t file_id, uint64_t bytes)
+{
+    if (auto f = file(file_id))
+        f->dead_bytes += bytes;
+}
+
+void BitcaskEngine::rotate_locked()
+{
+    // Durable before anything lands in the next file; its syncer still
+    // fires the callbacks of the writers waiting on it
+    log_->sync();
+    retired_logs_.push_back(std::move(log_));
+    active_ = open_active_locked(active_->id + 1);
+
+    // The old file is immutable now: time for its hint file
+    cv_merge_.notify_one();
+}
+
+void BitcaskEngine::append_locked(uint8_t flags, const std::string &key, const std::string &value,
+                                  WriteCallback on_commit)
+{
+    size_t rec_size = LOG_HEADER_SIZE + key.size() + value.size();
+    if (active_->size > 0 && active_->size + rec_size > config_.max_file_size)
+        rotate_locked();
+
+    uint64_t end = log_->append(flags, key, value, std::move(on_commit));
+    Location loc{active_->id, end - rec_size, (uint32_t)key.size(), (uint32_t)value.size()};
+    active_->size = end;
+
+    IndexShard *shard = shard_for(key);
+    Location old;
+    bool had_old = false;
+    {
+        unique_lock<shared_mutex> lock(shard->mtx);
+        auto it = shard->entries.find(key);
+        if (it != shard->entries.end())
+        {
+            old = it->second;
+            had_old = true;
+        }
+        if (flags == LOG_FLAG_PUT)
+            shard->entries[key] = loc;
+        else if (had_old)
+            shard->entries.erase(it);
+    }
+
+    if (had_old)
+        mark_dead(old.file_id, LOG_HEADER_SIZE + old.key_len + old.value_len);
+    if (flags == LOG_FLAG_TOMBSTONE)
+        active_->dead_bytes += rec_size;
+}
+
+bool BitcaskEngine::write_record(uint8_t flags, const std::string &key, const std::string &value,
+                                 WriteCallback on_commit)
+{
+    lock_guard<mutex> lock(write_mtx_);
+    try
+    {
+        append_locked(flags, key, value, std::move(on_commit));
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "[Bitcask] %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool BitcaskEngine::put(const std::string &key, const std::string &value, WriteCallback on_commit,
+                        Durability durability)
+{
+    // The data file is the store, so both durability levels mean the same sync
+    return write_record(LOG_FLAG_PUT, key, value, std::move(on_commit));
+}
+
+bool BitcaskEngine::remove(const std::string &key, WriteCallback on_commit, Durability durability)
+{
+    return write_record(LOG_FLAG_TOMBSTONE, key, "", std::move(on_commit));
+}
+
+// ---------------------------------------------------------------------------
+// Reads
+// ---------------------------------------------------------------------------
+
+void BitcaskEngine::get(const std::string &key, GetCallback cb)
+{
+    IndexShard *shard = shard_for(key);
+    // Compaction may move the key and drop its file between the index
+    // lookup and the read; the retry then sees the new location.
+    for (int attempt = 0; attempt < 3; ++attempt)
+    {
+        Location loc;
+        {
+            shared_lock<shared_mutex> lock(shard->mtx);
+            auto it = shard->entries.find(key);
+            if (it == shard->entries.end())
+            {
+                lock.unlock();
+                cb(true, "");
+                return;
+            }
+            loc = it->second;
+        }
+
+        auto f = file(loc.file_id);
+        if (!f)
+            continue;
+
+        string value(loc.value_len, '\0');
+        uint64_t offset = loc.offset + LOG_HEADER_SIZE + loc.key_len;
+        size_t done = 0;
+        while (done < value.size())
+        {
+            ssize_t n = pread(f->fd, value.data() + done, value.size() - done, offset + done);
+            if (n <= 0)
+            {
+                cb(false, "");
+                return;
+            }
+            done += n;
+        }
+        cb(true, std::move(value));
+        return;
+    }
+    cb(false, "");
+}
+
+BitcaskEngine::KeyValues BitcaskEngine::scan(const std::string &start_key, size_t limit)
+{
+    vector<string> keys;
+    for (auto &shard : index_)
+    {
+        shared_lock<shared_mutex> lock(shard->mtx);
+        for (auto &entry : shard->entries)
+            if (entry.first >= start_key)
+                keys.push_back(entry.first);
+    }
+    sort(keys.begin(), keys.end());
+
+    KeyValues result;
+    for (auto &key : keys)
+    {
+        if (result.size() >= limit)
+            break;
+        string value = get(key).get();
+        if (!value.empty())
+            result.emplace_back(key, std::move(value));
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Hint files and compaction
+// ---------------------------------------------------------------------------
+
+void BitcaskEngine::merge_loop()
+{
+    unique_lock<mutex> lock(merge_mtx_);
+    while (!stop_)
+    {
+        cv_merge_.wait_for(lock, config_.merge_interval);
+        if (stop_)
+            break;
+        lock.unlock();
+
+        uint32_t active_id;
+        vector<unique_ptr<AppendLog>> retired;
+        {
+            lock_guard<mutex> wlock(write_mtx_);
+            active_id = active_->id;
+            retired.swap(retired_logs_);
+        }
+        for (auto &log : retired)
+        {
+            syncs_ += log->syncs();
+            synced_records_ += log->synced_records();
+        }
+        retired.clear();
+        vector<shared_ptr<DataFile>> immutable;
+        {
+            shared_lock<shared_mutex> flock(files_mtx_);
+            for (auto &entry : files_)
+                if (entry.first != active_id)
+                    immutable.push_back(entry.second);
+        }
+
+        for (auto &f : immutable)
+        {
+            try
+            {
+                if (f->size > 0 && f->dead_bytes >= config_.merge_dead_ratio * f->size)
+                    compact(f);
+                else if (!f->has_hint)
+                    write_hint(f);
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "[Bitcask] merge of %s failed: %s\n",
+                        data_path(f->id).c_str(), e.what());
+            }
+        }
+        lock.lock();
+    }
+}
+
+void BitcaskEngine::write_hint(const std::shared_ptr<DataFile> &f)
+{
+    string hint;
+    AppendLog::replay(data_path(f->id), 0, [&](const LogRecord &rec, uint64_t end)
+                      {
+        hint.push_back((char)rec.flags);
+        put_fixed<uint32_t>(hint, rec.key.size());
+        put_fixed<uint32_t>(hint, rec.value.size());
+        put_fixed<uint64_t>(hint, record_offset(rec, end));
+        hint += rec.key; });
+
+    // Write-then-rename so a crash never leaves a partial hint behind
+    string tmp = hint_path(f->id) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw runtime_error("cannot create " + tmp);
+    bool ok = ::write(fd, hint.data(), hint.size()) == (ssize_t)hint.size() && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok)
+        throw runtime_error("cannot write " + tmp);
+    fs::rename(tmp, hint_path(f->id));
+    f->has_hint = true;
+}
+
+std::unordered_set<std::string> BitcaskEngine::keys_in_older_files(
+    const DataFile &f, const unordered_set<string> &keys)
+{
+    vector<shared_ptr<DataFile>> older;
+    {
+        shared_lock<shared_mutex> lock(files_mtx_);
+        for (auto &entry : files_)
+            if (entry.first < f.id)
+                older.push_back(entry.second);
+    }
+
+    unordered_set<string> found;
+    auto check = [&](const string &key)
+    {
+        if (keys.count(key))
+            found.insert(key);
+    };
+    for (auto &o : older)
+    {
+        if (o->has_hint)
+            read_hint(o->id, [&](uint8_t, const string &key, const Location &)
+                      { check(key); });
+        else
+            AppendLog::replay(data_path(o->id), 0, [&](const LogRecord &rec, uint64_t)
+                              { check(rec.key); });
+    }
+    return found;
+}
+
+// Copies the live records of f into the active file, then deletes f
+void BitcaskEngine::compact(const std::shared_ptr<DataFile> &f)
+{
+    vector<pair<LogRecord, uint64_t>> records; // with their offsets
+    unordered_set<string> tombstones;
+    AppendLog::replay(data_path(f->id), 0, [&](const LogRecord &rec, uint64_t end)
+                      {
+        if (rec.flags == LOG_FLAG_TOMBSTONE)
+            tombstones.insert(rec.key);
+        records.emplace_back(rec, record_offset(rec, end)); });
+    // A tombstone only has to move on while an older file may still hold
+    // a value for its key, which a restart would otherwise bring back
+    unordered_set<string> shadowed;
+    if (!tombstones.empty())
+        shadowed = keys_in_older_files(*f, tombstones);
+
+    for (auto &[rec, pos] : records)
+    {
+        const string &key = rec.key;
+        uint8_t flags = rec.flags;
+
+        // Holding write_mtx_ keeps writers from changing the key meanwhile
+        lock_guard<mutex> wlock(write_mtx_);
+        IndexShard *shard = shard_for(key);
+        bool live, present;
+        {
+            shared_lock<shared_mutex> lock(shard->mtx);
+            auto it = shard->entries.find(key);
+            present = it != shard->entries.end();
+            live = present && it->second.file_id == f->id && it->second.offset == pos;
+        }
+        if (flags == LOG_FLAG_PUT && live)
+            append_locked(LOG_FLAG_PUT, key, rec.value);
+        else if (flags == LOG_FLAG_TOMBSTONE && !present && shadowed.count(key))
+        {
+            append_locked(LOG_FLAG_TOMBSTONE, key, "");
+            // Not dead space while it is needed: counted as such, it would
+            // get the file it went to compacted just to copy it again
+            active_->dead_bytes -= LOG_HEADER_SIZE + key.size();
+        }
+    }
+
+    {
+        lock_guard<mutex> wlock(write_mtx_);
+        log_->sync();
+    }
+    {
+        unique_lock<shared_mutex> lock(files_mtx_);
+        files_.erase(f->id);
+    }
+    // Readers still holding f keep a valid fd until they let go of it
+    fs::remove(data_path(f->id));
+    fs::remove(hint_path(f->id));
+    compactions_++;
+}
+
+void BitcaskEngine::report_stats(nlohmann::json &out)
+{
+    size_t keys = 0;
+    for (auto &shard : index_)
+    {
+        shared_lock<shared_mutex> lock(shard->mtx);
+        keys += shard->entries.size();
+    }
+    uint64_t bytes = 0, dead = 0, num_files = 0;
+    {
+        shared_lock<shared_mutex> lock(files_mtx_);
+        for (auto &entry : files_)
+        {
+            bytes += entry.second->size;
+            dead += entry.second->dead_bytes;
+        }
+        num_files = files_.size();
+    }
+    out["bitcask"]["keys"] = keys;
+    out["bitcask"]["files"] = num_files;
+    out["bitcask"]["bytes"] = bytes;
+    out["bitcask"]["dead_bytes"] = dead;
+    uint64_t syncs = syncs_, synced_records = synced_records_;
+    {
+        lock_guard<mutex> lock(write_mtx_);
+        syncs += log_->syncs();
+        synced_records += log_->synced_records();
+    }
+    out["bitcask"]["syncs"] = syncs;
+    out["bitcask"]["synced_records"] = synced_records;
+    out["bitcask"]["compactions"] = compactions_.load();
+}
@@ -0,0 +1,468 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include "ChunkStore.h"
+#include "LogFormat.h"
+
+using namespace std;
+
+// Starts every manifest; the NUL and 0xFF make it unlikely in a text value,
+// and needs_chunks() keeps binary values that match out of the plain path
+static const char MAGIC[8] = {'\0', '\xff', 'K', 'V', 'C', 'H', 'N', 'K'};
+static const size_t MANIFEST_SIZE = sizeof(MAGIC) + 8 + 8 + 4;
+
+string ChunkManifest::encode() const
+{
+    string out(MAGIC, sizeof(MAGIC));
+    put_fixed(out, generation);
+    put_fixed(out, size);
+    put_fixed(out, chunk_size);
+    return out;
+}
+
+bool ChunkManifest::decode(string_view value, ChunkManifest &out)
+{
+    if (value.size() != MANIFEST_SIZE || value.compare(0, sizeof(MAGIC), string_view(MAGIC, sizeof(MAGIC))) != 0)
+        return false;
+    const char *p = value.data() + sizeof(MAGIC);
+    out.generation = get_fixed<uint64_t>(p);
+    out.size = get_fixed<uint64_t>(p + 8);
+    out.chunk_size = get_fixed<uint32_t>(p + 16);
+    return out.chunk_size > 0;
+}
+
+ChunkStore::ChunkStore(StorageEngine &storage, size_t chunk_size)
+    : storage_(storage), chunk_size_(chunk_size),
+      // Generations only have to differ between versions of one key, also
+      // across restarts
+      first_generation_(chrono::system_clock::now().time_since_epoch().count()),
+      next_generation_(first_generation_)
+{
+    sweeper_ = thread(&ChunkStore::sweep_loop, this);
+}
+
+ChunkStore::~ChunkStore()
+{
+    {
+        lock_guard<mutex> lock(mu_);
+        stopping_ = true;
+    }
+    sweep_cv_.notify_all();
+    sweeper_.join();
+}
+
+bool ChunkStore::needs_chunks(string_view value) const
+{
+    ChunkManifest unused;
+    return value.size() > chunk_size_ || ChunkManifest::decode(value, unused);
+}
+
+ChunkManifest ChunkStore::start(uint64_t size)
+{
+    ChunkManifest m;
+    m.generation = next_generation_++;
+    m.size = size;
+    m.chunk_size = chunk_size_;
+    return m;
+}
+
+// "<key>\0#": in front of every chunk key of key; the NUL keeps them apart
+// from keys clients use
+static string chunk_prefix(const string &key)
+{
+    string out = key;
+    out.append("\0#", 2);
+    return out;
+}
+
+// "<key>\0#<generation>#<index>"
+string ChunkStore::chunk_key(const string &key, uint64_t generation, uint64_t index)
+{
+    string out = chunk_prefix(key);
+    out += to_string(generation);
+    out += '#';
+    out += to_string(index);
+    return out;
+}
+
+bool ChunkStore::chunk_data(const string &chunk, const ChunkManifest &m, uint64_t index, string_view &data)
+{
+    uint64_t offset = index * m.chunk_size;
+    uint64_t expected = min<uint64_t>(m.chunk_size, m.size - offset);
+    if (expected == 0 || chunk.size() != expected)
+        return false;
+    data = chunk;
+    return true;
+}
+
+bool ChunkStore::put_chunks(const string &key, const string &value, ChunkManifest &m,
+                            StorageEngine::WriteCallback on_commit)
+{
+    m = start(value.size());
+    StorageEngine::KeyValues kvs;
+    kvs.reserve(m.chunks());
+    for (uint64_t i = 0; i < m.chunks(); ++i)
+        kvs.emplace_back(chunk_key(key, m.generation, i), value.substr(i * m.chunk_size, m.chunk_size));
+    if (!storage_.multi_put(kvs, std::move(on_commit), Durability::Database))
+        return false;
+    values_written_++;
+    chunks_written_ += kvs.size();
+    return true;
+}
+
+void ChunkStore::get(const string &key, const ChunkManifest &m, StorageEngine::GetCallback cb)
+{
+    vector<string> keys;
+    keys.reserve(m.chunks());
+    for (uint64_t i = 0; i < m.chunks(); ++i)
+        keys.push_back(chunk_key(key, m.generation, i));
+    storage_.multi_get(keys, [this, key, m, cb = std::move(cb)](bool ok, vector<string> chunks)
+                       {
+        if (!ok)
+        {
+            cb(false, {});
+            return;
+        }
+        string value;
+        value.reserve(m.size);
+        for (uint64_t i = 0; i < chunks.size(); ++i)
+        {
+            string_view data;
+            if (!chunk_data(chunks[i], m, i, data))
+            {
+                reads_changed_++;
+                cb(false, {});
+                return;
+            }
+            value.append(data);
+        }
+        values_read_++;
+        chunks_read_ += chunks.size();
+        seen(key, m);
+        cb(true, std::move(value)); });
+}
+
+void ChunkStore::drop(const string &key, const ChunkManifest &m)
+{
+    lock_guard<mutex> lock(mu_);
+    drop_locked(key, m);
+}
+
+void ChunkStore::drop_locked(const string &key, const ChunkManifest &m)
+{
+    to_drop_.push_back(Dropped{chrono::steady_clock::now() + DROP_DELAY, key, m});
+    sweep_cv_.notify_one();
+}
+
+void ChunkStore::remove_chunks(const string &key, const ChunkManifest &m)
+{
+    vector<string> keys;
+    keys.reserve(m.chunks());
+    for (uint64_t i = 0; i < m.chunks(); ++i)
+        keys.push_back(chunk_key(key, m.generation, i));
+    // Best effort: a shed delete only leaves garbage behind
+    if (!keys.empty() && storage_.multi_remove(keys))
+        generations_dropped_++;
+}
+
+StorageEngine::WriteCallback ChunkStore::replace(const string &key, const string &cached, const string &stored)
+{
+    ChunkManifest old, next;
+    bool cached_chunked = ChunkManifest::decode(cached, old);
+    bool stores_chunked = ChunkManifest::decode(stored, next);
+    if (!stores_chunked && !cached_chunked)
+    {
+        lock_guard<mutex> lock(mu_);
+        if (chunked_.find(key) == chunked_.end())
+            return nullptr;
+    }
+    // Writes to one key commit in order, so at commit time chunked_ holds
+    // what this write replaced
+    return [this, key, cached_chunked, old, stores_chunked, next](bool ok)
+    {
+        if (!ok)
+            return;
+        lock_guard<mutex> lock(mu_);
+        auto it = chunked_.find(key);
+        bool first_seen = it == chunked_.end();
+        const ChunkManifest *replaced = first_seen ? (cached_chunked ? &old : nullptr) : &it->second;
+        if (replaced && (!stores_chunked || replaced->generation != next.generation))
+            drop_locked(key, *replaced);
+        if (!stores_chunked)
+        {
+            if (!first_seen)
+                chunked_.erase(it);
+            return;
+        }
+        chunked_[key] = next;
+        if (first_seen)
+            sweep_locked(key, next.generation);
+    };
+}
+
+void ChunkStore::seen(const string &key, const ChunkManifest &m)
+{
+    lock_guard<mutex> lock(mu_);
+    // Only the first time: a reader may hold a manifest already replaced
+    if (chunked_.emplace(key, m).second)
+        sweep_locked(key, m.generation);
+}
+
+void ChunkStore::sweep_locked(const string &key, uint64_t current)
+{
+    to_sweep_.emplace_back(key, current);
+    sweep_cv_.notify_one();
+}
+
+void ChunkStore::sweep_loop()
+{
+    unique_lock<mutex> lock(mu_);
+    while (true)
+    {
+        auto due = [this]
+        { return !to_drop_.empty() && to_drop_.front().due <= chrono::steady_clock::now(); };
+        if (stopping_)
+        {
+            // Not waiting any longer for readers
+            for (auto &d : to_drop_)
+                remove_chunks(d.key, d.manifest);
+            return;
+        }
+        if (due())
+        {
+            Dropped d = std::move(to_drop_.front());
+            to_drop_.pop_front();
+            lock.unlock();
+            remove_chunks(d.key, d.manifest);
+            lock.lock();
+        }
+        else if (!to_sweep_.empty())
+        {
+            auto next = std::move(to_sweep_.front());
+            to_sweep_.pop_front();
+            lock.unlock();
+            try
+            {
+                sweep(next.first, next.second);
+            }
+            catch (const std::exception &)
+            {
+                // A failed scan leaves the rest for the next run
+            }
+            lock.lock();
+        }
+        else if (to_drop_.empty())
+            sweep_cv_.wait(lock);
+        else
+            sweep_cv_.wait_until(lock, to_drop_.front().due);
+    }
+}
+
+// Walks key's chunk keys one generation at a time with scan(), reading
+// one chunk of each, and drops those of generations earlier runs handed
+// out other than current's: left behind by a crash mid-upload or by an
+// overwrite this process did not know was replacing chunks
+void ChunkStore::sweep(const string &key, uint64_t current)
+{
+    const string prefix = chunk_prefix(key);
+    string from = prefix;
+    while (true)
+    {
+        auto kvs = storage_.scan(from, 1);
+        if (kvs.empty() || kvs[0].first.compare(0, prefix.size(), prefix) != 0)
+            return;
+        const string &found = kvs[0].first;
+        size_t hash = found.find('#', prefix.size());
+        if (hash == string::npos)
+            return;
+        string generation_prefix = found.substr(0, hash + 1);
+        uint64_t generation = strtoull(found.c_str() + prefix.size(), nullptr, 10);
+        if (generation >= first_generation_ || generation == current)
+        {
+            // Past the rest of this generation: '\xff' sorts after its indexes
+            from = generation_prefix + '\xff';
+            continue;
+        }
+        vector<string> dead;
+        from = found;
+        while (true)
+        {
+            auto page = storage_.scan(from, 64);
+            for (auto &kv : page)
+            {
+                if (kv.first.compare(0, generation_prefix.size(), generation_prefix) != 0)
+                    break;
+                dead.push_back(kv.first);
+            }
+            if (page.size() < 64 || dead.empty() || dead.back() != page.back().first)
+                break;
+            from = dead.back() + '\0';
+        }
+        if (!storage_.multi_remove(dead))
+            return;
+        generations_dropped_++;
+        from = generation_prefix + '\xff';
+    }
+}
+
+ChunkStore::StreamResult ChunkStore::stream(const string &key, const ChunkManifest &m,
+                                            const function<bool(string_view)> &send)
+{
+    future<string> next = storage_.get(chunk_key(key, m.generation, 0));
+    for (uint64_t i = 0; i < m.chunks(); ++i)
+    {
+        string chunk;
+        try
+        {
+            chunk = next.get();
+        }
+        catch (const std::exception &)
+        {
+            return StreamResult::Failed;
+        }
+        // Read ahead while this chunk goes out
+        if (i + 1 < m.chunks())
+            next = storage_.get(chunk_key(key, m.generation, i + 1));
+
+        string_view data;
+        if (!chunk_data(chunk, m, i, data))
+        {
+            reads_changed_++;
+            return StreamResult::Changed;
+        }
+        chunks_read_++;
+        if (!send(data))
+            return StreamResult::Failed;
+    }
+    values_read_++;
+    seen(key, m);
+    return StreamResult::Ok;
+}
+
+// Commits of the chunks a Writer has in flight, shared with their callbacks
+struct ChunkStore::Writer::Pending
+{
+    mutex mu;
+    condition_variable done;
+    int in_flight = 0;
+    bool failed = false;
+};
+
+ChunkStore::Writer::Writer(ChunkStore &store, const string &key)
+    : store_(store), key_(key), manifest_(store.start(0)),
+      pending_(make_shared<Pending>())
+{
+    buf_.resize(store.chunk_size_);
+}
+
+ChunkStore::Writer::~Writer()
+{
+    wait_for(0);
+}
+
+char *ChunkStore::Writer::room(size_t &len)
+{
+    if (used_ == store_.chunk_size_)
+        flush();
+    len = store_.chunk_size_ - used_;
+    return buf_.data() + used_;
+}
+
+void ChunkStore::Writer::append(string_view data)
+{
+    while (!data.empty())
+    {
+        size_t len;
+        char *dst = room(len);
+        len = min(len, data.size());
+        memcpy(dst, data.data(), len);
+        commit(len);
+        data.remove_prefix(len);
+    }
+}
+
+void ChunkStore::Writer::wait_for(int in_flight)
+{
+    unique_lock<mutex> lock(pending_->mu);
+    pending_->done.wait(lock, [&]
+                        { return pending_->in_flight <= in_flight; });
+}
+
+// Writes out the buffered chunk. After a failure the rest of the value is
+// still taken, so the caller can drain the request, but not written.
+bool ChunkStore::Writer::flush()
+{
+    wait_for(MAX_IN_FLIGHT - 1);
+    {
+        lock_guard<mutex> lock(pending_->mu);
+        if (pending_->failed)
+        {
+            written_ += used_;
+            used_ = 0;
+            return false;
+        }
+        pending_->in_flight++;
+    }
+
+    // Only the last chunk is short; the engine copies the buffer
+    buf_.resize(used_);
+    auto on_commit = [pending = pending_](bool ok)
+    {
+        lock_guard<mutex> lock(pending->mu);
+        pending->failed |= !ok;
+        pending->in_flight--;
+        pending->done.notify_all();
+    };
+    bool accepted = store_.storage_.put(chunk_key(key_, manifest_.generation, index_++), buf_, std::move(on_commit), Durability::Database);
+    buf_.resize(store_.chunk_size_);
+    written_ += used_;
+    used_ = 0;
+    store_.chunks_written_++;
+    if (!accepted)
+    {
+        lock_guard<mutex> lock(pending_->mu);
+        shed_ = true;
+        pending_->failed = true;
+        pending_->in_flight--;
+        return false;
+    }
+    return true;
+}
+
+bool ChunkStore::Writer::finish(string &stored)
+{
+    if (index_ == 0 && !store_.needs_chunks(string_view(buf_.data(), used_)))
+    {
+        stored.assign(buf_.data(), used_);
+        return true;
+    }
+    if (used_ > 0 || index_ == 0)
+        flush();
+    wait_for(0);
+    manifest_.size = written_;
+    stored = manifest_.encode();
+    store_.values_written_++;
+    lock_guard<mutex> lock(pending_->mu);
+    if (pending_->failed)
+    {
+        // The chunks that did go in are nobody's
+        store_.drop(key_, manifest_);
+        return false;
+    }
+    return true;
+}
+
+void ChunkStore::report_stats(nlohmann::json &out) const
+{
+    out["chunk_bytes"] = chunk_size_;
+    out["values_written"] = values_written_.load();
+    out["chunks_written"] = chunks_written_.load();
+    out["values_read"] = values_read_.load();
+    out["chunks_read"] = chunks_read_.load();
+    out["reads_changed"] = reads_changed_.load();
+    out["generations_dropped"] = generations_dropped_.load();
+}
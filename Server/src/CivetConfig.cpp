@@ -0,0 +1,130 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "CivetConfig.h"
+#include "civetweb.h"
+
+using namespace std;
+
+#ifdef num_thread
+static const char *DEFAULT_THREADS = "8";
+#else
+static const char *DEFAULT_THREADS = "1";
+#endif
+
+CivetConfig::CivetConfig()
+{
+    // civetweb's defaults close every connection after one request and
+    // leave Nagle on, so each request pays a handshake and small
+    // responses can wait for the client's delayed ACK
+    options_ = {
+        {"listening_ports", "8888"},
+        // Worker threads; a connection holds one for as long as it is kept alive
+        {"num_threads", DEFAULT_THREADS},
+        // Accepted connections waiting for a free worker
+        {"connection_queue", "128"},
+        {"listen_backlog", "1024"},
+        {"enable_keep_alive", "yes"},
+        // How long an idle kept-alive connection may hold its worker
+        {"keep_alive_timeout_ms", "1000"},
+        {"request_timeout_ms", "10000"},
+        {"tcp_nodelay", "1"},
+        // Keys in /key/<key> are decoded by path_key()
+        {"decode_url", "no"},
+    };
+}
+
+void CivetConfig::set(const string &name, const string &value)
+{
+    if (name == "decode_url")
+        throw invalid_argument("decode_url can't be changed: /key/<key> decodes keys itself");
+    bool known = false;
+    for (const mg_option *o = mg_get_valid_options(); o->name; ++o)
+        known |= name == o->name;
+    if (!known)
+        throw invalid_argument("unknown civetweb option: " + name);
+
+    for (auto &option : options_)
+    {
+        if (option.first == name)
+        {
+            option.second = value;
+            return;
+        }
+    }
+    options_.emplace_back(name, value);
+}
+
+const string &CivetConfig::get(const string &name) const
+{
+    static const string none;
+    for (auto &option : options_)
+        if (option.first == name)
+            return option.second;
+    return none;
+}
+
+void CivetConfig::load_file(const string &path)
+{
+    ifstream in(path);
+    if (!in)
+        throw runtime_error("cannot read config file " + path);
+    string line;
+    for (int number = 1; getline(in, line); ++number)
+    {
+        istringstream fields(line.substr(0, line.find('#')));
+        string name, value;
+        if (!(fields >> name))
+            continue; // blank or comment
+        getline(fields >> ws, value);
+        while (!value.empty() && isspace((unsigned char)value.back()))
+            value.pop_back();
+        if (value.empty())
+            throw runtime_error(path + ":" + to_string(number) + ": " + name + " has no value");
+        try
+        {
+            set(name, value);
+        }
+        catch (const invalid_argument &e)
+        {
+            throw runtime_error(path + ":" + to_string(number) + ": " + e.what());
+        }
+    }
+}
+
+void CivetConfig::parse_args(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        string opt = argv[i];
+        if (opt.size() < 3 || opt.compare(0, 2, "--") != 0 || i + 1 >= argc)
+            throw invalid_argument("expected --<option> <value>, got " + opt);
+        if (opt == "--config")
+            load_file(argv[i + 1]);
+    }
+    for (int i = 1; i < argc; i += 2)
+        if (string(argv[i]) != "--config")
+            set(argv[i] + 2, argv[i + 1]);
+}
+
+vector<const char *> CivetConfig::options() const
+{
+    vector<const char *> out;
+    for (auto &option : options_)
+    {
+        out.push_back(option.first.c_str());
+        out.push_back(option.second.c_str());
+    }
+    out.push_back(nullptr);
+    return out;
+}
+
+string CivetConfig::describe() const
+{
+    string out;
+    for (auto &option : options_)
+        out += (out.empty() ? "" : " ") + option.first + "=" + option.second;
+    return out;
+}
@@ -0,0 +1,409 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include "EventServer.h"
+
+using namespace std;
+
+// epoll data of the two non-connection fds of a loop
+static const uint64_t LISTEN_ID = 0;
+static const uint64_t WAKE_ID = 1;
+
+// Per connection, stop parsing new requests while this many are waiting
+// on storage or this much output is unsent, until the client catches up
+static const size_t MAX_IN_FLIGHT = 4096;
+static const size_t MAX_PENDING_OUTPUT = 4 << 20;
+static const size_t READ_CHUNK = 64 << 10;
+
+struct EventServer::Connection
+{
+    int fd;
+    uint64_t id;
+    Loop *loop;
+    string in;
+    size_t in_pos = 0; // first unparsed byte
+    string out;
+    size_t out_pos = 0; // first unsent byte
+    size_t in_flight = 0;
+    uint32_t events = EPOLLIN; // as registered with epoll
+
+    // Ordered responses not yet moved to out, oldest first;
+    // slots.front() is number first_slot
+    struct Slot
+    {
+        bool ready = false;
+        string data;
+    };
+    deque<Slot> slots;
+    uint64_t first_slot = 1;
+
+    bool paused() const
+    {
+        return in_flight >= MAX_IN_FLIGHT || out.size() - out_pos >= MAX_PENDING_OUTPUT;
+    }
+
+    void complete(uint64_t slot, string data)
+    {
+        in_flight--;
+        if (slot == 0)
+        {
+            out += data;
+            return;
+        }
+        Slot &s = slots[slot - first_slot];
+        s.data = std::move(data);
+        s.ready = true;
+        while (!slots.empty() && slots.front().ready)
+        {
+            out += slots.front().data;
+            slots.pop_front();
+            first_slot++;
+        }
+    }
+};
+
+struct EventServer::Loop : enable_shared_from_this<EventServer::Loop>
+{
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int wake_fd = -1;
+    thread worker;
+    unordered_map<uint64_t, Connection> conns;
+    uint64_t next_id = WAKE_ID + 1;
+
+    // Responses completed on other threads: connection, slot, bytes
+    struct Completion
+    {
+        uint64_t conn_id;
+        uint64_t slot;
+        string data;
+    };
+    mutex mtx;
+    vector<Completion> completed;
+    bool stopping = false;
+
+    ~Loop()
+    {
+        for (auto &c : conns)
+            close(c.second.fd);
+        if (listen_fd >= 0)
+            close(listen_fd);
+        if (wake_fd >= 0)
+            close(wake_fd);
+        if (epoll_fd >= 0)
+            close(epoll_fd);
+    }
+};
+
+void EventServer::Reply::send(string bytes) const
+{
+    lock_guard<mutex> lock(loop_->mtx);
+    // Dropped if the server is stopping; a closed connection drops it later
+    if (loop_->stopping)
+        return;
+    loop_->completed.push_back({conn_id_, slot_, std::move(bytes)});
+    if (loop_->completed.size() == 1)
+    {
+        uint64_t one = 1;
+        ssize_t n = write(loop_->wake_fd, &one, sizeof(one));
+        (void)n; // the counter can't overflow at one write per drain
+    }
+}
+
+int listen_reuseport(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw runtime_error(string("socket: ") + strerror(errno));
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // Every loop binds the same port; the kernel spreads connections over them
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+        string error = strerror(errno);
+        close(fd);
+        throw runtime_error("cannot listen on port " + to_string(port) + ": " + error);
+    }
+    return fd;
+}
+
+EventServer::EventServer(const char *name, int port, size_t threads)
+    : name_(name)
+{
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        auto loop = make_shared<Loop>();
+        loop->listen_fd = listen_reuseport(port);
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epoll_fd < 0 || loop->wake_fd < 0)
+            throw runtime_error(string("epoll setup: ") + strerror(errno));
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = LISTEN_ID;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &ev);
+        ev.data.u64 = WAKE_ID;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+        loops_.push_back(loop);
+    }
+}
+
+EventServer::~EventServer()
+{
+    stop();
+}
+
+void EventServer::start()
+{
+    for (auto &loop : loops_)
+        loop->worker = thread(&EventServer::run, this, std::ref(*loop));
+}
+
+void EventServer::stop()
+{
+    for (auto &loop : loops_)
+    {
+        lock_guard<mutex> lock(loop->mtx);
+        loop->stopping = true;
+        uint64_t one = 1;
+        ssize_t n = write(loop->wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+    for (auto &loop : loops_)
+        if (loop->worker.joinable())
+            loop->worker.join();
+    // Loops still referenced by pending storage callbacks close their fds
+    // once the last callback has run
+}
+
+void EventServer::report_stats(nlohmann::json &out) const
+{
+    out["connections"] = connections_.load();
+    out["accepted"] = accepted_.load();
+    out["requests"] = requests_.load();
+    out["protocol_errors"] = protocol_errors_.load();
+}
+
+string &EventServer::respond(Connection &conn)
+{
+    if (conn.slots.empty())
+        return conn.out;
+    conn.slots.push_back({true, ""});
+    return conn.slots.back().data;
+}
+
+EventServer::Reply EventServer::defer(Connection &conn, bool ordered)
+{
+    Reply reply;
+    reply.loop_ = conn.loop->shared_from_this();
+    reply.conn_id_ = conn.id;
+    if (ordered)
+    {
+        reply.slot_ = conn.first_slot + conn.slots.size();
+        conn.slots.emplace_back();
+    }
+    conn.in_flight++;
+    return reply;
+}
+
+void EventServer::run(Loop &loop)
+{
+    epoll_event events[256];
+    while (true)
+    {
+        int n = epoll_wait(loop.epoll_fd, events, 256, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "[%s] epoll_wait failed: %s\n", name_.c_str(), strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            uint64_t id = events[i].data.u64;
+            if (id == LISTEN_ID)
+            {
+                accept_connections(loop);
+                continue;
+            }
+            if (id == WAKE_ID)
+            {
+                uint64_t count;
+                ssize_t r = read(loop.wake_fd, &count, sizeof(count));
+                (void)r;
+                {
+                    lock_guard<mutex> lock(loop.mtx);
+                    if (loop.stopping)
+                        return;
+                }
+                drain_completions(loop);
+                continue;
+            }
+
+            auto it = loop.conns.find(id);
+            if (it == loop.conns.end())
+                continue; // closed earlier in this batch
+            Connection &conn = it->second;
+
+            bool ok = !(events[i].events & EPOLLERR);
+            if (ok && (events[i].events & (EPOLLIN | EPOLLHUP)))
+            {
+                // One read per wakeup keeps the buffer bounded; epoll is
+                // level-triggered and reports the rest next time
+                if (conn.in_pos > 0)
+                {
+                    conn.in.erase(0, conn.in_pos);
+                    conn.in_pos = 0;
+                }
+                size_t old_size = conn.in.size();
+                conn.in.resize(old_size + READ_CHUNK);
+                ssize_t r = recv(conn.fd, conn.in.data() + old_size, READ_CHUNK, 0);
+                conn.in.resize(old_size + std::max<ssize_t>(r, 0));
+                if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+                    ok = false;
+            }
+            if (!ok || !service(loop, id, conn))
+                close_connection(loop, id);
+        }
+    }
+}
+
+void EventServer::accept_connections(Loop &loop)
+{
+    while (true)
+    {
+        int fd = accept4(loop.listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                fprintf(stderr, "[%s] accept failed: %s\n", name_.c_str(), strerror(errno));
+            return;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        uint64_t id = loop.next_id++;
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = id;
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            close(fd);
+            continue;
+        }
+        Connection &conn = loop.conns[id];
+        conn.fd = fd;
+        conn.id = id;
+        conn.loop = &loop;
+        connections_++;
+        accepted_++;
+    }
+}
+
+void EventServer::drain_completions(Loop &loop)
+{
+    vector<Loop::Completion> completed;
+    {
+        lock_guard<mutex> lock(loop.mtx);
+        completed.swap(loop.completed);
+    }
+
+    unordered_set<uint64_t> touched;
+    for (auto &c : completed)
+    {
+        auto it = loop.conns.find(c.conn_id);
+        if (it == loop.conns.end())
+            continue;
+        it->second.complete(c.slot, std::move(c.data));
+        touched.insert(c.conn_id);
+    }
+    // Sends the responses, and resumes parsing on connections that were paused
+    for (uint64_t id : touched)
+    {
+        auto it = loop.conns.find(id);
+        if (it != loop.conns.end() && !service(loop, id, it->second))
+            close_connection(loop, id);
+    }
+}
+
+bool EventServer::service(Loop &loop, uint64_t id, Connection &conn)
+{
+    while (!conn.paused() && conn.in_pos < conn.in.size())
+    {
+        long used = on_input(conn, conn.in.data() + conn.in_pos, conn.in.size() - conn.in_pos);
+        if (used < 0)
+        {
+            protocol_errors_++;
+            return false;
+        }
+        if (used == 0)
+            break;
+        conn.in_pos += used;
+    }
+
+    while (conn.out_pos < conn.out.size())
+    {
+        ssize_t w = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+        if (w < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        conn.out_pos += w;
+    }
+    if (conn.out_pos == conn.out.size())
+    {
+        conn.out.clear();
+        conn.out_pos = 0;
+    }
+
+    uint32_t events = (conn.paused() ? 0 : EPOLLIN) | (conn.out.empty() ? 0 : EPOLLOUT);
+    if (events != conn.events)
+    {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = id;
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.events = events;
+    }
+    return true;
+}
+
+void EventServer::close_connection(Loop &loop, uint64_t id)
+{
+    auto it = loop.conns.find(id);
+    if (it == loop.conns.end())
+        return;
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    close(it->second.fd);
+    loop.conns.erase(it);
+    connections_--;
+}
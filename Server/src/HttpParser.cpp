@@ -0,0 +1,209 @@
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "HttpParser.h"
+
+using namespace std;
+
+static char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+static bool iequals(string_view a, string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (lower(a[i]) != lower(b[i]))
+            return false;
+    return true;
+}
+
+// Header names are tokens: no blanks (not even before the colon, RFC 7230
+// 3.2.4), controls or separators that could hide a Content-Length
+static bool is_token(string_view name)
+{
+    if (name.empty())
+        return false;
+    for (unsigned char c : name)
+        if (c <= ' ' || c >= 0x7f || strchr("\"(),/:;<=>?@[\\]{}", c))
+            return false;
+    return true;
+}
+
+static string_view trim(string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// True if the comma-separated header value lists token
+static bool has_token(string_view value, string_view token)
+{
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        if (iequals(trim(value.substr(0, comma)), token))
+            return true;
+        if (comma == string_view::npos)
+            break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+static bool parse_request_line(string_view line, HttpRequest &req)
+{
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.rfind(' ');
+    if (sp1 == string_view::npos || sp1 == 0 || sp2 == sp1)
+        return false;
+    req.method = line.substr(0, sp1);
+    for (char c : req.method)
+        if (c < 'A' || c > 'Z')
+            return false;
+
+    string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    if (target.empty() || target.front() != '/')
+        return false;
+    size_t q = target.find('?');
+    req.path = target.substr(0, q);
+    req.query = q == string_view::npos ? string_view() : target.substr(q + 1);
+
+    string_view version = line.substr(sp2 + 1);
+    if (version.size() != 8 || version.substr(0, 7) != "HTTP/1." || version[7] < '0' || version[7] > '9')
+        return false;
+    req.minor_version = version[7] - '0';
+    // HTTP/1.0 closes after each response unless asked otherwise
+    req.keep_alive = req.minor_version >= 1;
+    return true;
+}
+
+static bool parse_content_length(string_view value, size_t &out)
+{
+    if (value.empty() || value.size() > 18)
+        return false;
+    size_t n = 0;
+    for (char c : value)
+    {
+        if (c < '0' || c > '9')
+            return false;
+        n = n * 10 + (c - '0');
+    }
+    out = n;
+    return true;
+}
+
+HttpParse parse_http_request(const char *data, size_t len, HttpRequest &req)
+{
+    const char *end = (const char *)memmem(data, std::min(len, MAX_HTTP_HEAD), "\r\n\r\n", 4);
+    if (!end)
+        return len >= MAX_HTTP_HEAD ? HttpParse::Invalid : HttpParse::Incomplete;
+
+    req = HttpRequest();
+    req.head_size = end - data + 4;
+    string_view head(data, end - data + 2); // every line ends in CRLF
+
+    size_t eol = head.find("\r\n");
+    if (!parse_request_line(head.substr(0, eol), req))
+        return HttpParse::Invalid;
+    head.remove_prefix(eol + 2);
+
+    bool have_length = false;
+    while (!head.empty())
+    {
+        eol = head.find("\r\n");
+        string_view line = head.substr(0, eol);
+        head.remove_prefix(eol + 2);
+
+        size_t colon = line.find(':');
+        if (colon == string_view::npos || !is_token(line.substr(0, colon)))
+            return HttpParse::Invalid;
+        string_view name = line.substr(0, colon);
+        string_view value = trim(line.substr(colon + 1));
+
+        if (iequals(name, "content-length"))
+        {
+            size_t n;
+            // Conflicting lengths are a request smuggling vector
+            if (!parse_content_length(value, n) || (have_length && n != req.content_length))
+                return HttpParse::Invalid;
+            req.content_length = n;
+            have_length = true;
+        }
+        else if (iequals(name, "connection"))
+        {
+            if (has_token(value, "close"))
+                req.keep_alive = false;
+            else if (has_token(value, "keep-alive"))
+                req.keep_alive = true;
+        }
+        else if (iequals(name, "transfer-encoding"))
+            req.chunked = true;
+        else if (iequals(name, "expect"))
+            req.expect_continue = iequals(value, "100-continue");
+        else if (iequals(name, "content-type"))
+            req.content_type = value;
+    }
+    if (req.chunked && have_length)
+        return HttpParse::Invalid;
+    return HttpParse::Complete;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+bool http_url_decode(string_view in, string &out, bool form)
+{
+    out.clear();
+    out.reserve(in.size());
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        char c = in[i];
+        if (c == '+' && form)
+            c = ' ';
+        else if (c == '%')
+        {
+            if (i + 2 >= in.size())
+                return false;
+            int hi = hex_digit(in[i + 1]), lo = hex_digit(in[i + 2]);
+            if (hi < 0 || lo < 0)
+                return false;
+            c = (char)(hi << 4 | lo);
+            i += 2;
+        }
+        out += c;
+    }
+    return true;
+}
+
+bool http_media_type_is(string_view content_type, string_view type)
+{
+    return iequals(trim(content_type.substr(0, content_type.find(';'))), type);
+}
+
+bool http_query_param(string_view query, string_view name, string &out)
+{
+    while (!query.empty())
+    {
+        size_t amp = query.find('&');
+        string_view pair = query.substr(0, amp);
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == name)
+            return http_url_decode(eq == string_view::npos ? string_view() : pair.substr(eq + 1), out);
+        if (amp == string_view::npos)
+            break;
+        query.remove_prefix(amp + 1);
+    }
+    return false;
+}
@@ -0,0 +1,210 @@
+#include <string>
+#include <memory>
+#include "KVService.h"
+
+using namespace std;
+
+KVService::KVService(LRUCache &cache, StorageEngine &storage, ChunkStore &chunks)
+    : cache_(cache), storage_(storage), chunks_(chunks)
+{
+}
+
+void KVService::fill(const string &key, const string &value, uint64_t lease)
+{
+    if (!cache_.fill(key, value, lease))
+        fills_rejected_++;
+}
+
+void KVService::refresh(const string &key)
+{
+    refreshes_++;
+    uint64_t lease = cache_.lease(key);
+    storage_.refresh(key, [this, key, lease](bool ok, string value)
+                     {
+        if (!ok)
+        {
+            refresh_failures_++;
+            cache_.release_lease(key, lease);
+            cache_.abandon_refresh(key); // lets a later reader try again
+        }
+        else
+            fill(key, value, lease); });
+}
+
+bool KVService::lookup(const string &key, string &value, ReadMiss &miss, ReadConsistency mode)
+{
+    // Fresh reads skip the cache, but still fill it under a lease
+    if (mode == ReadConsistency::Fresh)
+    {
+        miss.lease = cache_.lease(key);
+        miss.fresh = true;
+        return false;
+    }
+    CacheStatus status = cache_.lookup(key, value, &miss.should_refresh, &miss.lease);
+    if (status == CacheStatus::Hit || status == CacheStatus::SoftExpired ||
+        (status == CacheStatus::Stale && mode == ReadConsistency::StaleOk))
+    {
+        if (miss.should_refresh)
+            refresh(key);
+        // A large value: the cache only holds its manifest
+        if (ChunkManifest::decode(value, miss.manifest))
+        {
+            miss.chunked = true;
+            return false;
+        }
+        return true;
+    }
+    // Stale entries are re-read under a lease like misses
+    if (status == CacheStatus::Stale)
+        miss.lease = cache_.lease(key);
+    return false;
+}
+
+void KVService::fetch(const string &key, const ReadMiss &miss, GetCallback cb)
+{
+    if (miss.chunked)
+    {
+        get_chunks(key, miss.manifest, std::move(cb));
+        return;
+    }
+    auto on_read = [this, key, miss, cb = std::move(cb)](bool ok, string result)
+    {
+        if (!ok)
+        {
+            if (miss.lease)
+                cache_.release_lease(key, miss.lease);
+            if (miss.should_refresh)
+                cache_.abandon_refresh(key);
+            cb(KVStatus::Failed, std::move(result));
+            return;
+        }
+        // An empty value drops any stale copy too
+        if (miss.lease)
+            fill(key, result, miss.lease);
+        ChunkManifest m;
+        if (ChunkManifest::decode(result, m))
+        {
+            get_chunks(key, m, cb);
+            return;
+        }
+        KVStatus status = result.empty() ? KVStatus::NotFound : KVStatus::Ok;
+        cb(status, std::move(result));
+    };
+    // A plain get() could overtake a write still queued for the key, and
+    // fill the cache under a lease taken after that write with the value
+    // it replaced
+    if (miss.fresh)
+        storage_.refresh(key, std::move(on_read));
+    else
+        storage_.get(key, std::move(on_read));
+}
+
+void KVService::get_chunks(const string &key, const ChunkManifest &m, GetCallback cb)
+{
+    chunks_.get(key, m, [cb = std::move(cb)](bool ok, string value)
+                { cb(ok ? KVStatus::Ok : KVStatus::Failed, std::move(value)); });
+}
+
+void KVService::put(const string &key, const string &value, const WriteAck &ack, WriteCallback cb)
+{
+    if (chunks_.needs_chunks(value))
+        put_chunked(key, value, ack, std::move(cb));
+    else
+        put_stored(key, value, ack, std::move(cb));
+}
+
+// Writes what goes under key as is: a value, or a manifest
+void KVService::put_stored(const string &key, const string &value, const WriteAck &ack, WriteCallback cb)
+{
+    // Drops the chunks of the value it replaces once it committed
+    auto replaced = chunks_.replace(key, cache_.get(key), value);
+    if (!ack.wait)
+    {
+        if (!storage_.put(key, value, replaced, ack.durability))
+        {
+            cb(KVStatus::Overloaded);
+            return;
+        }
+        cache_.put(key, value);
+        cb(KVStatus::Ok);
+        return;
+    }
+
+    // Shared with the commit callback, which only needs it on success
+    auto cached = make_shared<string>(value);
+    auto done = make_shared<WriteCallback>(std::move(cb));
+    bool accepted = storage_.put(key, value, [this, key, cached, replaced, done](bool ok)
+                                 {
+        if (ok)
+            cache_.put(key, *cached);
+        if (replaced)
+            replaced(ok);
+        (*done)(ok ? KVStatus::Ok : KVStatus::Failed); },
+                                 ack.durability);
+    if (!accepted)
+        (*done)(KVStatus::Overloaded);
+}
+
+// The chunks go first, the manifest then follows the value's path, so the
+// cache only ever holds the manifest of a large value
+void KVService::put_chunked(const string &key, const string &value, const WriteAck &ack, WriteCallback cb)
+{
+    // A group the engine took in part both reports the rejection and
+    // calls back: only the first answer counts
+    auto manifest = make_shared<ChunkManifest>();
+    auto answered = make_shared<atomic<bool>>(false);
+    auto done = make_shared<WriteCallback>([answered, cb = std::move(cb)](KVStatus status)
+                                           {
+        if (!answered->exchange(true))
+            cb(status); });
+
+    // The manifest waits for the chunks even at durability=memory: one
+    // that got ahead of them would point readers at chunks not there yet
+    auto on_commit = [this, key, ack, manifest, done](bool ok)
+    {
+        if (ok)
+            put_stored(key, manifest->encode(), ack, *done);
+        else
+            (*done)(KVStatus::Failed);
+    };
+    if (!chunks_.put_chunks(key, value, *manifest, std::move(on_commit)))
+        (*done)(KVStatus::Overloaded);
+}
+
+void KVService::remove(const string &key, const WriteAck &ack, WriteCallback cb)
+{
+    // The chunks of a large value go too
+    auto replaced = chunks_.replace(key, cache_.get(key), "");
+
+    if (!ack.wait)
+    {
+        if (!storage_.remove(key, replaced, ack.durability))
+        {
+            cb(KVStatus::Overloaded);
+            return;
+        }
+        cache_.remove(key);
+        cb(KVStatus::Ok);
+        return;
+    }
+
+    auto done = make_shared<WriteCallback>(std::move(cb));
+    bool accepted = storage_.remove(key, [this, key, replaced, done](bool ok)
+                                    {
+        if (ok)
+            cache_.remove(key);
+        if (replaced)
+            replaced(ok);
+        (*done)(ok ? KVStatus::Ok : KVStatus::Failed); },
+                                    ack.durability);
+    if (!accepted)
+        (*done)(KVStatus::Overloaded);
+}
+
+void KVService::report_stats(nlohmann::json &out) const
+{
+    out["refreshes"] = refreshes_.load();
+    out["refresh_failures"] = refresh_failures_.load();
+    out["fill_waits"] = fill_waits_.load();
+    out["fills_rejected"] = fills_rejected_.load();
+}
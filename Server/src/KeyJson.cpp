@@ -0,0 +1,509 @@
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "KeyJson.h"
+
+using namespace std;
+
+// Nesting allowed in members we skip over
+static const int MAX_DEPTH = 256;
+
+// ASCII bytes that stand for themselves inside a JSON string
+static const struct PlainTable
+{
+    bool plain[256] = {};
+    PlainTable()
+    {
+        for (int c = 0x20; c < 0x80; ++c)
+            plain[c] = c != '"' && c != '\\';
+    }
+} PLAIN;
+
+static const char *skip_plain(const char *p, const char *end)
+{
+    while (p < end && PLAIN.plain[(unsigned char)*p])
+        ++p;
+    return p;
+}
+
+struct Scanner
+{
+    const char *p;
+    const char *end;
+
+    void ws()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            ++p;
+    }
+
+    bool eat(char c)
+    {
+        ws();
+        if (p < end && *p == c)
+        {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    bool at(char c)
+    {
+        ws();
+        return p < end && *p == c;
+    }
+};
+
+// Length of the well-formed UTF-8 sequence at p, 0 if there is none
+static size_t utf8_length(const char *p, const char *end)
+{
+    unsigned char c = *p;
+    if (c < 0x80)
+        return 1;
+    size_t n;
+    uint32_t cp;
+    if ((c & 0xE0) == 0xC0)
+        n = 2, cp = c & 0x1F;
+    else if ((c & 0xF0) == 0xE0)
+        n = 3, cp = c & 0x0F;
+    else if ((c & 0xF8) == 0xF0)
+        n = 4, cp = c & 0x07;
+    else
+        return 0;
+    if ((size_t)(end - p) < n)
+        return 0;
+    for (size_t i = 1; i < n; ++i)
+    {
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+        cp = cp << 6 | (p[i] & 0x3F);
+    }
+    // No overlong forms, surrogates or code points past U+10FFFF
+    static const uint32_t MIN[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (cp < MIN[n] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+        return 0;
+    return n;
+}
+
+// Bytes at p, at least one, that a single U+FFFD stands for when
+// utf8_length() found no sequence there: the longest start of a valid
+// sequence (Unicode's "maximal subpart"), as nlohmann's replace handler
+static size_t invalid_length(const char *p, const char *end)
+{
+    unsigned char c = *p;
+    size_t n;
+    unsigned char lo = 0x80, hi = 0xBF; // allowed second byte
+    if (c >= 0xC2 && c <= 0xDF)
+        n = 2;
+    else if (c >= 0xE0 && c <= 0xEF)
+        n = 3, lo = c == 0xE0 ? 0xA0 : 0x80, hi = c == 0xED ? 0x9F : 0xBF;
+    else if (c >= 0xF0 && c <= 0xF4)
+        n = 4, lo = c == 0xF0 ? 0x90 : 0x80, hi = c == 0xF4 ? 0x8F : 0xBF;
+    else
+        return 1;
+    size_t k = 1;
+    if (p + k < end && (unsigned char)p[k] >= lo && (unsigned char)p[k] <= hi)
+        for (++k; k < n && p + k < end && (p[k] & 0xC0) == 0x80; ++k)
+            ;
+    return k;
+}
+
+static void append_utf8(string &out, uint32_t cp)
+{
+    if (cp < 0x80)
+        out += (char)cp;
+    else if (cp < 0x800)
+    {
+        out += (char)(0xC0 | cp >> 6);
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += (char)(0xE0 | cp >> 12);
+        out += (char)(0x80 | (cp >> 6 & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | cp >> 18);
+        out += (char)(0x80 | (cp >> 12 & 0x3F));
+        out += (char)(0x80 | (cp >> 6 & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+static bool read_hex4(Scanner &s, uint32_t &cp)
+{
+    if (s.end - s.p < 4)
+        return false;
+    cp = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        char c = *s.p++;
+        cp <<= 4;
+        if (c >= '0' && c <= '9')
+            cp |= c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            cp |= (c | 0x20) - 'a' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+// The string at s.p (on its opening quote). out is a view into the input
+// unless the string has escapes, then into buf.
+static bool parse_string(Scanner &s, string_view &out, string &buf)
+{
+    const char *start = ++s.p;
+    while ((s.p = skip_plain(s.p, s.end)) < s.end)
+    {
+        unsigned char c = *s.p;
+        if (c == '"')
+        {
+            out = string_view(start, s.p - start);
+            ++s.p;
+            return true;
+        }
+        if (c == '\\')
+            break;
+        if (c < 0x20)
+            return false;
+        size_t n = utf8_length(s.p, s.end);
+        if (n == 0)
+            return false;
+        s.p += n;
+    }
+    if (s.p >= s.end)
+        return false;
+
+    // Escapes: decode from here on
+    buf.assign(start, s.p - start);
+    while (s.p < s.end)
+    {
+        unsigned char c = *s.p;
+        if (c == '"')
+        {
+            out = buf;
+            ++s.p;
+            return true;
+        }
+        if (c < 0x20)
+            return false;
+        if (c != '\\')
+        {
+            size_t n = utf8_length(s.p, s.end);
+            if (n == 0)
+                return false;
+            buf.append(s.p, n);
+            s.p += n;
+            continue;
+        }
+        if (++s.p >= s.end)
+            return false;
+        switch (*s.p++)
+        {
+        case '"':
+            buf += '"';
+            break;
+        case '\\':
+            buf += '\\';
+            break;
+        case '/':
+            buf += '/';
+            break;
+        case 'b':
+            buf += '\b';
+            break;
+        case 'f':
+            buf += '\f';
+            break;
+        case 'n':
+            buf += '\n';
+            break;
+        case 'r':
+            buf += '\r';
+            break;
+        case 't':
+            buf += '\t';
+            break;
+        case 'u':
+        {
+            uint32_t cp;
+            if (!read_hex4(s, cp))
+                return false;
+            if (cp >= 0xD800 && cp <= 0xDBFF)
+            {
+                // Must be followed by its low surrogate
+                uint32_t low;
+                if (s.end - s.p < 2 || s.p[0] != '\\' || s.p[1] != 'u')
+                    return false;
+                s.p += 2;
+                if (!read_hex4(s, low) || low < 0xDC00 || low > 0xDFFF)
+                    return false;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            else if (cp >= 0xDC00 && cp <= 0xDFFF)
+                return false;
+            append_utf8(buf, cp);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool skip_literal(Scanner &s, string_view literal)
+{
+    if ((size_t)(s.end - s.p) < literal.size() || string_view(s.p, literal.size()) != literal)
+        return false;
+    s.p += literal.size();
+    return true;
+}
+
+static bool skip_number(Scanner &s)
+{
+    auto digits = [&s]
+    {
+        const char *start = s.p;
+        while (s.p < s.end && *s.p >= '0' && *s.p <= '9')
+            ++s.p;
+        return s.p > start;
+    };
+    if (s.p < s.end && *s.p == '-')
+        ++s.p;
+    if (s.p < s.end && *s.p == '0')
+        ++s.p;
+    else if (!digits())
+        return false;
+    if (s.p < s.end && *s.p == '.')
+    {
+        ++s.p;
+        if (!digits())
+            return false;
+    }
+    if (s.p < s.end && (*s.p == 'e' || *s.p == 'E'))
+    {
+        ++s.p;
+        if (s.p < s.end && (*s.p == '+' || *s.p == '-'))
+            ++s.p;
+        if (!digits())
+            return false;
+    }
+    return true;
+}
+
+static bool skip_value(Scanner &s, int depth)
+{
+    s.ws();
+    if (s.p >= s.end || depth > MAX_DEPTH)
+        return false;
+    string_view unused;
+    string scratch;
+    switch (*s.p)
+    {
+    case '"':
+        return parse_string(s, unused, scratch);
+    case '{':
+        ++s.p;
+        if (s.eat('}'))
+            return true;
+        do
+        {
+            if (!s.at('"') || !parse_string(s, unused, scratch) || !s.eat(':') || !skip_value(s, depth + 1))
+                return false;
+        } while (s.eat(','));
+        return s.eat('}');
+    case '[':
+        ++s.p;
+        if (s.eat(']'))
+            return true;
+        do
+        {
+            if (!skip_value(s, depth + 1))
+                return false;
+        } while (s.eat(','));
+        return s.eat(']');
+    case 't':
+        return skip_literal(s, "true");
+    case 'f':
+        return skip_literal(s, "false");
+    case 'n':
+        return skip_literal(s, "null");
+    default:
+        return skip_number(s);
+    }
+}
+
+bool keyjson::parse_key_value(string_view body, KeyValue &out)
+{
+    Scanner s{body.data(), body.data() + body.size()};
+    bool have_key = false, have_value = false;
+    if (!s.eat('{'))
+        return false;
+    if (!s.eat('}'))
+    {
+        do
+        {
+            string_view name;
+            string name_buf;
+            if (!s.at('"') || !parse_string(s, name, name_buf) || !s.eat(':'))
+                return false;
+            // A repeated member replaces the earlier one, as in nlohmann
+            if ((name == "key" || name == "value") && s.at('"'))
+            {
+                bool is_key = name == "key";
+                if (!parse_string(s, is_key ? out.key : out.value, is_key ? out.key_buf : out.value_buf))
+                    return false;
+                (is_key ? have_key : have_value) = true;
+            }
+            else
+            {
+                if (!skip_value(s, 1))
+                    return false;
+                if (name == "key")
+                    have_key = false; // not a string
+                else if (name == "value")
+                    have_value = false;
+            }
+        } while (s.eat(','));
+        if (!s.eat('}'))
+            return false;
+    }
+    s.ws();
+    return s.p == s.end && have_key && have_value;
+}
+
+// s escaped, without the quotes
+static void append_escaped(string &out, string_view s)
+{
+    static const char HEX[] = "0123456789abcdef";
+    const char *p = s.data(), *end = p + s.size(), *run = p;
+    while ((p = skip_plain(p, end)) < end)
+    {
+        unsigned char c = *p;
+        if (c >= 0x80)
+        {
+            size_t n = utf8_length(p, end);
+            if (n > 0)
+            {
+                p += n;
+                continue;
+            }
+        }
+        // Flush the plain run before it, then escape this byte
+        out.append(run, p - run);
+        size_t n = 1;
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\b':
+            out += "\\b";
+            break;
+        case '\f':
+            out += "\\f";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20)
+            {
+                out += "\\u00";
+                out += HEX[c >> 4];
+                out += HEX[c & 0xF];
+            }
+            else
+            {
+                out += "\xEF\xBF\xBD"; // not UTF-8
+                n = invalid_length(p, end);
+            }
+        }
+        run = p += n;
+    }
+    out.append(run, p - run);
+}
+
+// Bytes at the end of s that start a UTF-8 sequence it cuts short
+static size_t cut_sequence(string_view s)
+{
+    for (size_t k = 1; k <= 3 && k <= s.size(); ++k)
+    {
+        unsigned char c = s[s.size() - k];
+        if ((c & 0xC0) == 0x80)
+            continue; // continuation byte, look further back
+        size_t n = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 0;
+        return n > k ? k : 0;
+    }
+    return 0;
+}
+
+void keyjson::append_string(string &out, string_view s)
+{
+    out += '"';
+    append_escaped(out, s);
+    out += '"';
+}
+
+void keyjson::append_string_piece(string &out, string &carry, string_view piece, bool last)
+{
+    string joined;
+    if (!carry.empty())
+    {
+        joined.reserve(carry.size() + piece.size());
+        joined.append(carry).append(piece);
+        piece = joined;
+    }
+    size_t keep = last ? 0 : cut_sequence(piece);
+    append_escaped(out, piece.substr(0, piece.size() - keep));
+    carry.assign(piece.substr(piece.size() - keep));
+}
+
+void keyjson::append_value(string &out, string_view key, string_view value)
+{
+    out += "{\"key\":";
+    append_string(out, key);
+    out += ",\"value\":";
+    append_string(out, value);
+    out += '}';
+}
+
+void keyjson::append_not_found(string &out, string_view key)
+{
+    out += "{\"error\":\"Key not found\",\"key\":";
+    append_string(out, key);
+    out += '}';
+}
+
+void keyjson::append_created(string &out, string_view key)
+{
+    out += "{\"created_key\":";
+    append_string(out, key);
+    out += ",\"status\":\"ok\"}";
+}
+
+void keyjson::append_deleted(string &out)
+{
+    out += "{\"key_to_delete\":\"deleted successfully\",\"status\":\"ok\"}";
+}
+
+void keyjson::append_error(string &out, string_view message)
+{
+    out += "{\"message\":";
+    append_string(out, message);
+    out += ",\"status\":\"error\"}";
+}
@@ -4,12 +4,18 @@
 #include <list>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <memory>
 #include <functional>
+#include <chrono>
+#include <algorithm>
 #include "LRUCache.h"
 
 using namespace std;
 
+// A reader that died mid-fill only holds up the others this long
+static const chrono::milliseconds LEASE_TIMEOUT(1000);
+
 // Constructor: Allocates shards using unique_ptr
 LRUCache::LRUCache(size_t size) : total_max_size(size) {
     size_t shard_capacity = size / NUM_SHARDS;
@@ -34,12 +40,26 @@ size_t LRUCache::get_shard_index(const string &key) const {
     return hash % NUM_SHARDS;
 }
 
+void LRUCache::set_ttl(std::chrono::milliseconds soft, std::chrono::milliseconds hard)
+{
+    soft_ttl = soft;
+    hard_ttl = hard;
+}
+
 // Helper function now takes a pointer to the shard
 void LRUCache::move_to_front_locked(CacheShard *shard, const string &key) {
     // Access members using -> (pointer access)
-    shard->lru_list.erase(shard->cache[key].second);
+    CacheEntry &entry = shard->cache[key];
+    shard->lru_list.erase(entry.lru_pos);
     shard->lru_list.push_front(key);
-    shard->cache[key].second = shard->lru_list.begin();
+    entry.lru_pos = shard->lru_list.begin();
+}
+
+// Wakes readers waiting on the key's lease
+void LRUCache::void_lease_locked(CacheShard *shard, const string &key)
+{
+    if (shard->leases.erase(key))
+        shard->lease_released.notify_all();
 }
 
 // Add or update a key-value pair
@@ -50,10 +70,27 @@ void LRUCache::put(const string &key, const string &value)
 
     // Lock ONLY the required shard!
     std::lock_guard<std::mutex> lock(shard->mtx); 
-    
-    if (shard->cache.count(key))
+    void_lease_locked(shard, key);
+    put_locked(shard, key, value);
+}
+
+void LRUCache::put_locked(CacheShard *shard, const string &key, const string &value)
+{
+    auto now = chrono::steady_clock::now();
+    auto soft_expiry = soft_ttl.count() > 0 ? now + soft_ttl : chrono::steady_clock::time_point::max();
+    auto hard_expiry = hard_ttl.count() > 0 ? now + hard_ttl : chrono::steady_clock::time_point::max();
+    // Never past the hard expiry, so an entry with only a hard TTL still
+    // gets the clock read in lookups
+    soft_expiry = min(soft_expiry, hard_expiry);
+
+    auto it = shard->cache.find(key);
+    if (it != shard->cache.end())
     {
-        shard->cache[key].first = value;
+        it->second.value = value;
+        it->second.stale = false;
+        it->second.refreshing = false;
+        it->second.soft_expiry = soft_expiry;
+        it->second.hard_expiry = hard_expiry;
         move_to_front_locked(shard, key);
         return ;
     }
@@ -66,27 +103,196 @@ void LRUCache::put(const string &key, const string &value)
     }
 
     shard->lru_list.push_front(key);
-    shard->cache[key] = {value, shard->lru_list.begin()};
+    CacheEntry &entry = shard->cache[key];
+    entry.value = value;
+    entry.lru_pos = shard->lru_list.begin();
+    entry.soft_expiry = soft_expiry;
+    entry.hard_expiry = hard_expiry;
 }
 
 // Get a value from the cache
 string LRUCache::get(const string &key)
+{
+    string value;
+    if (lookup(key, value) != CacheStatus::Hit)
+        return ""; // Cache miss, or stale
+    return value;
+}
+
+// Same single shard lock as get(); the stale check and the lease ride along with it
+CacheStatus LRUCache::lookup(const string &key, string &value, bool *should_refresh,
+                             uint64_t *lease)
 {
     size_t index = get_shard_index(key);
     CacheShard *shard = shards[index].get(); // Get the raw pointer to the shard
 
     // Lock ONLY the required shard! 
     std::lock_guard<std::mutex> lock(shard->mtx);
+    return lookup_locked(shard, key, value, should_refresh, lease);
+}
 
-    if (!shard->cache.count(key))
+vector<CacheLookup> LRUCache::multi_lookup(const vector<string> &keys)
+{
+    vector<CacheLookup> result(keys.size());
+    vector<vector<size_t>> by_shard(shards.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+        by_shard[get_shard_index(keys[i])].push_back(i);
+
+    for (size_t s = 0; s < by_shard.size(); ++s)
     {
-        return ""; // Cache miss
+        if (by_shard[s].empty())
+            continue;
+        CacheShard *shard = shards[s].get();
+        std::lock_guard<std::mutex> lock(shard->mtx);
+        for (size_t i : by_shard[s])
+            result[i].status = lookup_locked(shard, keys[i], result[i].value,
+                                             &result[i].should_refresh, &result[i].lease);
+    }
+    return result;
+}
+
+CacheStatus LRUCache::lookup_locked(CacheShard *shard, const string &key, string &value,
+                                    bool *should_refresh, uint64_t *lease)
+{
+    // Only the first reader to miss gets to fill, the rest wait for it
+    auto miss = [&]
+    {
+        if (lease)
+        {
+            auto now = chrono::steady_clock::now();
+            auto it = shard->leases.find(key);
+            if (it != shard->leases.end() && now < it->second.expires)
+                *lease = 0;
+            else
+            {
+                *lease = shard->next_lease++;
+                shard->leases[key] = CacheLease{*lease, now + LEASE_TIMEOUT};
+            }
+        }
+        return CacheStatus::Miss;
+    };
+
+    auto it = shard->cache.find(key);
+    if (it == shard->cache.end())
+    {
+        return miss();
+    }
+
+    CacheEntry &entry = it->second;
+    CacheStatus status = entry.stale ? CacheStatus::Stale : CacheStatus::Hit;
+    // Entries without a TTL skip the clock read
+    if (entry.soft_expiry != chrono::steady_clock::time_point::max())
+    {
+        auto now = chrono::steady_clock::now();
+        if (now >= entry.hard_expiry)
+        {
+            remove_locked(shard, key);
+            return miss();
+        }
+        if (status == CacheStatus::Hit && now >= entry.soft_expiry)
+            status = CacheStatus::SoftExpired;
     }
 
     // Cache hit! Update recency
     move_to_front_locked(shard, key);
-    
-    return shard->cache[key].first;
+    value = entry.value;
+    if (status != CacheStatus::Hit && should_refresh)
+    {
+        *should_refresh = !entry.refreshing;
+        entry.refreshing = true;
+    }
+    return status;
+}
+
+uint64_t LRUCache::lease(const string &key)
+{
+    size_t index = get_shard_index(key);
+    CacheShard *shard = shards[index].get();
+
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    uint64_t token = shard->next_lease++;
+    shard->leases[key] = CacheLease{token, chrono::steady_clock::now() + LEASE_TIMEOUT};
+    return token;
+}
+
+bool LRUCache::fill(const string &key, const string &value, uint64_t token)
+{
+    size_t index = get_shard_index(key);
+    CacheShard *shard = shards[index].get();
+
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    auto it = shard->leases.find(key);
+    if (it == shard->leases.end() || it->second.token != token)
+        return false; // a write (or a newer reader) got there first
+
+    void_lease_locked(shard, key);
+    if (value.empty())
+        remove_locked(shard, key);
+    else
+        put_locked(shard, key, value);
+    return true;
+}
+
+void LRUCache::release_lease(const string &key, uint64_t token)
+{
+    size_t index = get_shard_index(key);
+    CacheShard *shard = shards[index].get();
+
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    auto it = shard->leases.find(key);
+    if (it != shard->leases.end() && it->second.token == token)
+        void_lease_locked(shard, key);
+}
+
+bool LRUCache::wait_for_fill(const string &key, string &value, chrono::milliseconds timeout)
+{
+    size_t index = get_shard_index(key);
+    CacheShard *shard = shards[index].get();
+
+    std::unique_lock<std::mutex> lock(shard->mtx);
+    auto deadline = chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        auto it = shard->leases.find(key);
+        if (it == shard->leases.end() || chrono::steady_clock::now() >= it->second.expires)
+            break;
+        if (shard->lease_released.wait_until(lock, deadline) == cv_status::timeout)
+            return false;
+    }
+
+    auto it = shard->cache.find(key);
+    if (it == shard->cache.end() || it->second.stale ||
+        chrono::steady_clock::now() >= it->second.hard_expiry)
+        return false;
+    move_to_front_locked(shard, key);
+    value = it->second.value;
+    return true;
+}
+
+bool LRUCache::mark_stale(const string &key)
+{
+    size_t index = get_shard_index(key);
+    CacheShard *shard = shards[index].get();
+
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    void_lease_locked(shard, key); // a fill in flight may have read the old value
+    auto it = shard->cache.find(key);
+    if (it == shard->cache.end())
+        return false;
+    it->second.stale = true;
+    it->second.refreshing = false; // lets the next stale-ok reader refresh it
+    return true;
+}
+
+void LRUCache::abandon_refresh(const string &key)
+{
+    size_t index = get_shard_index(key);
+    CacheShard *shard = shards[index].get();
+
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    auto it = shard->cache.find(key);
+    if (it != shard->cache.end())
+        it->second.refreshing = false;
 }
 
 bool LRUCache::remove(const string &key)
@@ -96,13 +302,22 @@ bool LRUCache::remove(const string &key)
 
     // Lock ONLY the required shard!
     std::lock_guard<std::mutex> lock(shard->mtx);
+    void_lease_locked(shard, key);
     
     if (!shard->cache.count(key))
     {
         return false; // Key not found
     }
     
-    shard->lru_list.erase(shard->cache[key].second);
-    shard->cache.erase(key);
+    remove_locked(shard, key);
     return true;
 }
+
+void LRUCache::remove_locked(CacheShard *shard, const string &key)
+{
+    auto it = shard->cache.find(key);
+    if (it == shard->cache.end())
+        return;
+    shard->lru_list.erase(it->second.lru_pos);
+    shard->cache.erase(it);
+}
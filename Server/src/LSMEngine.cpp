@@ -0,0 +1,826 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "LSMEngine.h"
+#include "LogFormat.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Rough per-entry cost of a skiplist node on top of key and value
+static const size_t MEMTABLE_ENTRY_OVERHEAD = 64;
+
+// ---------------------------------------------------------------------------
+// Iterators
+// ---------------------------------------------------------------------------
+
+// Holds the memtable's read lock for as long as it lives
+class MemTableIterator : public KVIterator
+{
+public:
+    explicit MemTableIterator(shared_ptr<LSMEngine::MemTable> mem)
+        : mem_(std::move(mem)), lock_(mem_->mtx), it_(mem_->table.begin()) {}
+
+    bool valid() const override { return it_.valid(); }
+    void seek(const string &target) override { it_ = mem_->table.lower_bound(target); }
+    void next() override { it_.next(); }
+    const string &key() const override { return it_.key(); }
+    const string &value() const override { return it_.value().value; }
+    bool tombstone() const override { return it_.value().tombstone; }
+
+private:
+    shared_ptr<LSMEngine::MemTable> mem_;
+    shared_lock<shared_mutex> lock_;
+    SkipList<string, LSMEngine::MemEntry>::Iterator it_;
+};
+
+// Concatenates the disjoint, key-ordered files of one level
+class LevelIterator : public KVIterator
+{
+public:
+    explicit LevelIterator(vector<shared_ptr<SSTable>> files) : files_(std::move(files))
+    {
+        open_file(0);
+    }
+
+    bool valid() const override { return cur_ && cur_->valid(); }
+    const string &key() const override { return cur_->key(); }
+    const string &value() const override { return cur_->value(); }
+    bool tombstone() const override { return cur_->tombstone(); }
+
+    void seek(const string &target) override
+    {
+        auto it = std::lower_bound(files_.begin(), files_.end(), target,
+                                   [](const shared_ptr<SSTable> &t, const string &k)
+                                   { return t->largest() < k; });
+        open_file(it - files_.begin());
+        if (cur_)
+            cur_->seek(target);
+        skip_exhausted();
+    }
+
+    void next() override
+    {
+        cur_->next();
+        skip_exhausted();
+    }
+
+private:
+    void open_file(size_t index)
+    {
+        index_ = index;
+        cur_ = index < files_.size() ? files_[index]->iterator() : nullptr;
+    }
+
+    void skip_exhausted()
+    {
+        while (cur_ && !cur_->valid())
+            open_file(index_ + 1);
+    }
+
+    vector<shared_ptr<SSTable>> files_;
+    size_t index_ = 0;
+    unique_ptr<KVIterator> cur_;
+};
+
+// Merges sorted children into one stream. Children are ordered newest
+// first; for a key present in several, only the newest entry is produced.
+class MergingIterator : public KVIterator
+{
+public:
+    explicit MergingIterator(vector<unique_ptr<KVIterator>> children)
+        : children_(std::move(children))
+    {
+        find_smallest();
+    }
+
+    bool valid() const override { return cur_ != nullptr; }
+    const string &key() const override { return cur_->key(); }
+    const string &value() const override { return cur_->value(); }
+    bool tombstone() const override { return cur_->tombstone(); }
+
+    void seek(const string &target) override
+    {
+        for (auto &c : children_)
+            c->seek(target);
+        find_smallest();
+    }
+
+    void next() override
+    {
+        // Step past this key in every child, dropping the shadowed versions
+        string current = cur_->key();
+        for (auto &c : children_)
+            if (c->valid() && c->key() == current)
+                c->next();
+        find_smallest();
+    }
+
+private:
+    void find_smallest()
+    {
+        cur_ = nullptr;
+        for (auto &c : children_)
+            if (c->valid() && (!cur_ || c->key() < cur_->key()))
+                cur_ = c.get(); // strict <, so the newest child wins ties
+    }
+
+    vector<unique_ptr<KVIterator>> children_;
+    KVIterator *cur_ = nullptr;
+};
+
+// ---------------------------------------------------------------------------
+// Setup
+// ---------------------------------------------------------------------------
+
+LSMEngine::LSMEngine(const LSMConfig &config) : config_(config)
+{
+    compact_pointer_.resize(config_.num_levels);
+    load();
+    background_ = thread(&LSMEngine::background_loop, this);
+}
+
+LSMEngine::~LSMEngine()
+{
+    {
+        lock_guard<mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_bg_.notify_all();
+    cv_stall_.notify_all();
+    if (background_.joinable())
+        background_.join();
+    // Unflushed memtables stay in their WALs and are replayed at startup
+}
+
+std::string LSMEngine::table_path(uint64_t id) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%09llu.sst", (unsigned long long)id);
+    return config_.dir + "/" + name;
+}
+
+std::string LSMEngine::wal_path(uint64_t id) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%09llu.wal", (unsigned long long)id);
+    return config_.dir + "/" + name;
+}
+
+std::shared_ptr<LSMEngine::MemTable> LSMEngine::new_memtable(uint64_t id)
+{
+    auto mem = make_shared<MemTable>();
+    mem->id = id;
+    mem->wal = make_unique<AppendLog>(wal_path(id));
+    return mem;
+}
+
+void LSMEngine::load()
+{
+    fs::create_directories(config_.dir);
+
+    // MANIFEST: "next_file_id N", "log_number N", then one "level id" per table
+    auto v = make_shared<Version>();
+    v->levels.resize(config_.num_levels);
+    set<uint64_t> live;
+    ifstream manifest(config_.dir + "/MANIFEST");
+    string line;
+    while (getline(manifest, line))
+    {
+        istringstream in(line);
+        string word;
+        in >> word;
+        if (word == "next_file_id")
+            in >> next_file_id_;
+        else if (word == "log_number")
+            in >> log_number_;
+        else if (!word.empty())
+        {
+            int level = stoi(word);
+            uint64_t id;
+            in >> id;
+            if (level < 0 || level >= config_.num_levels)
+                throw runtime_error("lsm: bad level in MANIFEST: " + line);
+            v->levels[level].push_back(SSTable::open(table_path(id), id));
+            live.insert(id);
+        }
+    }
+
+    // Leftovers of an interrupted flush or compaction, and flushed WALs
+    vector<uint64_t> wals;
+    for (auto &entry : fs::directory_iterator(config_.dir))
+    {
+        string ext = entry.path().extension();
+        if (ext != ".sst" && ext != ".wal")
+            continue;
+        uint64_t id = stoull(entry.path().stem());
+        next_file_id_ = std::max(next_file_id_, id + 1);
+        if (ext == ".sst" && !live.count(id))
+            fs::remove(entry.path());
+        else if (ext == ".wal" && id < log_number_)
+            fs::remove(entry.path());
+        else if (ext == ".wal")
+            wals.push_back(id);
+    }
+
+    sort(v->levels[0].begin(), v->levels[0].end(),
+         [](const shared_ptr<SSTable> &a, const shared_ptr<SSTable> &b)
+         { return a->id() > b->id(); });
+    for (int level = 1; level < config_.num_levels; ++level)
+        sort(v->levels[level].begin(), v->levels[level].end(),
+             [](const shared_ptr<SSTable> &a, const shared_ptr<SSTable> &b)
+             { return a->smallest() < b->smallest(); });
+
+    // Replay unflushed WALs oldest first and flush them straight to L0
+    sort(wals.begin(), wals.end());
+    MemTable recovered;
+    for (uint64_t id : wals)
+    {
+        AppendLog::replay(wal_path(id), 0, [&](const LogRecord &rec, uint64_t)
+                          { recovered.table.put(rec.key, MemEntry{rec.value, rec.flags == LOG_FLAG_TOMBSTONE}); });
+    }
+    if (recovered.table.size() > 0)
+    {
+        recovered.id = next_file_id_++;
+        v->levels[0].insert(v->levels[0].begin(), write_level0_table(recovered));
+        fprintf(stderr, "[LSM] Recovered %zu entries from %zu WAL(s)\n",
+                recovered.table.size(), wals.size());
+    }
+
+    mem_ = new_memtable(next_file_id_++);
+    log_number_ = mem_->id;
+    save_manifest(*v, log_number_);
+    for (uint64_t id : wals)
+        fs::remove(wal_path(id));
+    version_ = v;
+
+    size_t tables = 0;
+    for (auto &level : v->levels)
+        tables += level.size();
+    fprintf(stderr, "[LSM] Opened %s with %zu tables\n", config_.dir.c_str(), tables);
+}
+
+// Written to a temp file and renamed over the old one, so a crash leaves
+// either the old or the new table set, never a mix
+void LSMEngine::save_manifest(const Version &v, uint64_t log_number)
+{
+    uint64_t next_id;
+    {
+        lock_guard<mutex> lock(mtx_);
+        next_id = next_file_id_;
+    }
+
+    string data = "next_file_id " + to_string(next_id) + "\n";
+    data += "log_number " + to_string(log_number) + "\n";
+    for (size_t level = 0; level < v.levels.size(); ++level)
+        for (auto &t : v.levels[level])
+            data += to_string(level) + " " + to_string(t->id()) + "\n";
+
+    string tmp = config_.dir + "/MANIFEST.tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw runtime_error("lsm: cannot write " + tmp);
+    bool ok = ::write(fd, data.data(), data.size()) == (ssize_t)data.size() && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), (config_.dir + "/MANIFEST").c_str()) != 0)
+        throw runtime_error("lsm: cannot save MANIFEST");
+
+    // Make the rename and any new table files durable too
+    int dir_fd = open(config_.dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Writes
+// ---------------------------------------------------------------------------
+
+bool LSMEngine::make_room_locked(std::unique_lock<std::mutex> &lock)
+{
+    bool stalled = false;
+    uint64_t failures = background_failures_;
+    chrono::steady_clock::time_point deadline;
+    while (!stop_)
+    {
+        if (version_->levels[0].size() >= config_.l0_stop_writes ||
+            (mem_->bytes >= config_.memtable_size && imm_))
+        {
+            // Compaction or the previous flush is behind: wait for it,
+            // unless it fails meanwhile
+            if (!stalled)
+            {
+                stalls_++;
+                stalled = true;
+                deadline = chrono::steady_clock::now() + config_.max_stall;
+            }
+            if (background_failures_ != failures ||
+                cv_stall_.wait_until(lock, deadline) == cv_status::timeout)
+            {
+                stalls_failed_++;
+                return false;
+            }
+            continue;
+        }
+        if (mem_->bytes >= config_.memtable_size)
+        {
+            imm_ = mem_;
+            mem_ = new_memtable(next_file_id_++);
+            cv_bg_.notify_one();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool LSMEngine::write_record(uint8_t flags, const std::string &key, const std::string &value,
+                             WriteCallback on_commit)
+{
+    lock_guard<mutex> wlock(write_mtx_);
+    shared_ptr<MemTable> mem;
+    {
+        unique_lock<mutex> lock(mtx_);
+        if (!make_room_locked(lock))
+            return false;
+        mem = mem_; // only writers replace it, and we hold write_mtx_
+    }
+
+    try
+    {
+        mem->wal->append(flags, key, value, std::move(on_commit));
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "[LSM] %s\n", e.what());
+        return false;
+    }
+    {
+        unique_lock<shared_mutex> lock(mem->mtx);
+        mem->table.put(key, MemEntry{value, flags == LOG_FLAG_TOMBSTONE});
+    }
+    mem->bytes += key.size() + value.size() + MEMTABLE_ENTRY_OVERHEAD;
+    user_bytes_ += key.size() + value.size();
+    wal_bytes_ += LOG_HEADER_SIZE + key.size() + value.size();
+    return true;
+}
+
+bool LSMEngine::put(const std::string &key, const std::string &value, WriteCallback on_commit,
+                    Durability durability)
+{
+    // A synced WAL record is as durable as this engine gets for either level
+    return write_record(LOG_FLAG_PUT, key, value, std::move(on_commit));
+}
+
+bool LSMEngine::remove(const std::string &key, WriteCallback on_commit, Durability durability)
+{
+    return write_record(LOG_FLAG_TOMBSTONE, key, "", std::move(on_commit));
+}
+
+// ---------------------------------------------------------------------------
+// Reads
+// ---------------------------------------------------------------------------
+
+void LSMEngine::get(const std::string &key, GetCallback cb)
+{
+    shared_ptr<MemTable> mem, imm;
+    shared_ptr<const Version> v;
+    {
+        lock_guard<mutex> lock(mtx_);
+        mem = mem_;
+        imm = imm_;
+        v = version_;
+    }
+
+    for (auto &m : {mem, imm})
+    {
+        if (!m)
+            continue;
+        shared_lock<shared_mutex> lock(m->mtx);
+        if (const MemEntry *e = m->table.find(key))
+        {
+            string value = e->tombstone ? "" : e->value;
+            lock.unlock();
+            cb(true, std::move(value));
+            return;
+        }
+    }
+
+    try
+    {
+        string value;
+        for (size_t level = 0; level < v->levels.size(); ++level)
+        {
+            auto &files = v->levels[level];
+            if (level == 0)
+            {
+                // Overlapping, newest first
+                for (auto &t : files)
+                {
+                    auto r = t->get(key, value);
+                    if (r != SSTable::Lookup::NotFound)
+                    {
+                        cb(true, r == SSTable::Lookup::Found ? std::move(value) : "");
+                        return;
+                    }
+                }
+                continue;
+            }
+
+            // At most one candidate file per deeper level
+            auto it = std::lower_bound(files.begin(), files.end(), key,
+                                       [](const shared_ptr<SSTable> &t, const string &k)
+                                       { return t->largest() < k; });
+            if (it == files.end())
+                continue;
+            auto r = (*it)->get(key, value);
+            if (r != SSTable::Lookup::NotFound)
+            {
+                cb(true, r == SSTable::Lookup::Found ? std::move(value) : "");
+                return;
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "[LSM] get: %s\n", e.what());
+        cb(false, "");
+        return;
+    }
+    cb(true, "");
+}
+
+LSMEngine::KeyValues LSMEngine::scan(const std::string &start_key, size_t limit)
+{
+    shared_ptr<MemTable> mem, imm;
+    shared_ptr<const Version> v;
+    {
+        lock_guard<mutex> lock(mtx_);
+        mem = mem_;
+        imm = imm_;
+        v = version_;
+    }
+
+    vector<unique_ptr<KVIterator>> children;
+    children.push_back(make_unique<MemTableIterator>(mem));
+    if (imm)
+        children.push_back(make_unique<MemTableIterator>(imm));
+    for (auto &t : v->levels[0])
+        children.push_back(t->iterator());
+    for (size_t level = 1; level < v->levels.size(); ++level)
+        if (!v->levels[level].empty())
+            children.push_back(make_unique<LevelIterator>(v->levels[level]));
+
+    MergingIterator it(std::move(children));
+    it.seek(start_key);
+    KeyValues result;
+    for (; it.valid() && result.size() < limit; it.next())
+        if (!it.tombstone())
+            result.emplace_back(it.key(), it.value());
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Flush and compaction
+// ---------------------------------------------------------------------------
+
+uint64_t LSMEngine::max_bytes_for_level(int level) const
+{
+    uint64_t bytes = config_.level1_max_bytes;
+    for (int i = 1; i < level; ++i)
+        bytes *= config_.level_multiplier;
+    return bytes;
+}
+
+// Level whose compaction is most overdue, or -1 if none is over budget
+int LSMEngine::pick_compaction(const Version &v) const
+{
+    int best = -1;
+    double best_score = 1.0;
+    for (int level = 0; level + 1 < config_.num_levels; ++level)
+    {
+        double score;
+        if (level == 0)
+            score = (double)v.levels[0].size() / config_.l0_compaction_trigger;
+        else
+        {
+            uint64_t bytes = 0;
+            for (auto &t : v.levels[level])
+                bytes += t->file_size();
+            score = (double)bytes / max_bytes_for_level(level);
+        }
+        if (score >= best_score)
+        {
+            best = level;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+void LSMEngine::background_loop()
+{
+    unique_lock<mutex> lock(mtx_);
+    while (!stop_)
+    {
+        if (imm_)
+        {
+            auto imm = imm_;
+            lock.unlock();
+            flush_memtable(imm);
+            lock.lock();
+            continue;
+        }
+
+        int level = pick_compaction(*version_);
+        if (level < 0)
+        {
+            cv_bg_.wait(lock);
+            continue;
+        }
+        lock.unlock();
+        compact(level);
+        lock.lock();
+    }
+}
+
+std::shared_ptr<SSTable> LSMEngine::write_level0_table(const MemTable &mem)
+{
+    SSTableWriter writer(table_path(mem.id), config_.block_size, config_.bloom_bits_per_key);
+    for (auto it = mem.table.begin(); it.valid(); it.next())
+        writer.add(it.key(), it.value().value, it.value().tombstone);
+    flush_bytes_ += writer.finish();
+    flushes_++;
+    return SSTable::open(table_path(mem.id), mem.id);
+}
+
+void LSMEngine::flush_memtable(const std::shared_ptr<MemTable> &mem)
+{
+    shared_ptr<SSTable> table;
+    try
+    {
+        // Nobody writes an immutable memtable, so no lock is needed
+        if (mem->table.size() > 0)
+            table = write_level0_table(*mem);
+    }
+    catch (const std::exception &e)
+    {
+        // Keep the memtable and its WAL; retry after a pause
+        fprintf(stderr, "[LSM] flush failed: %s\n", e.what());
+        pause_after_failure();
+        return;
+    }
+
+    shared_ptr<Version> v;
+    uint64_t log_number;
+    {
+        lock_guard<mutex> lock(mtx_);
+        v = make_shared<Version>(*version_);
+        log_number = mem_->id; // every older WAL is now in a table
+    }
+    if (table)
+        v->levels[0].insert(v->levels[0].begin(), table);
+
+    try
+    {
+        save_manifest(*v, log_number);
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "[LSM] %s\n", e.what());
+        if (table)
+            table->mark_obsolete();
+        pause_after_failure();
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(mtx_);
+        version_ = v;
+        imm_ = nullptr;
+        log_number_ = log_number;
+    }
+    cv_stall_.notify_all();
+    fs::remove(mem->wal->path());
+}
+
+void LSMEngine::compact(int level)
+{
+    shared_ptr<const Version> base;
+    {
+        lock_guard<mutex> lock(mtx_);
+        base = version_;
+    }
+    auto &cur = base->levels[level];
+    auto &next = base->levels[level + 1];
+
+    // Inputs: all of L0 (its files overlap each other), or the next file
+    // after the compact pointer for deeper levels
+    vector<shared_ptr<SSTable>> inputs;
+    if (level == 0)
+        inputs = cur;
+    else
+    {
+        auto it = find_if(cur.begin(), cur.end(), [&](const shared_ptr<SSTable> &t)
+                          { return t->smallest() > compact_pointer_[level]; });
+        inputs.push_back(it != cur.end() ? *it : cur.front());
+    }
+
+    string lo = inputs.front()->smallest(), hi = inputs.front()->largest();
+    for (auto &t : inputs)
+    {
+        lo = std::min(lo, t->smallest());
+        hi = std::max(hi, t->largest());
+    }
+    vector<shared_ptr<SSTable>> overlapping;
+    for (auto &t : next)
+        if (t->overlaps(lo, hi))
+            overlapping.push_back(t);
+    compact_pointer_[level] = hi;
+
+    auto v = make_shared<Version>(*base);
+    auto drop = [](Level &files, const vector<shared_ptr<SSTable>> &gone)
+    {
+        files.erase(remove_if(files.begin(), files.end(), [&](const shared_ptr<SSTable> &t)
+                              { return find(gone.begin(), gone.end(), t) != gone.end(); }),
+                    files.end());
+    };
+    drop(v->levels[level], inputs);
+    drop(v->levels[level + 1], overlapping);
+
+    vector<shared_ptr<SSTable>> outputs;
+    if (inputs.size() == 1 && overlapping.empty())
+    {
+        // Nothing to merge with: move the file down without rewriting it
+        outputs = inputs;
+        inputs.clear();
+        trivial_moves_++;
+    }
+    else
+    {
+        // Tombstones can go once no deeper level may still hold the key
+        bool bottom = true;
+        for (int deeper = level + 2; deeper < config_.num_levels; ++deeper)
+            for (auto &t : base->levels[deeper])
+                if (t->overlaps(lo, hi))
+                    bottom = false;
+
+        vector<unique_ptr<KVIterator>> children;
+        for (auto &t : inputs) // L0 is already newest first
+        {
+            children.push_back(t->iterator());
+            compaction_read_bytes_ += t->file_size();
+        }
+        for (auto &t : overlapping)
+            compaction_read_bytes_ += t->file_size();
+        if (!overlapping.empty())
+            children.push_back(make_unique<LevelIterator>(overlapping));
+
+        try
+        {
+            MergingIterator it(std::move(children));
+            unique_ptr<SSTableWriter> writer;
+            uint64_t id = 0;
+            auto finish = [&]
+            {
+                compaction_write_bytes_ += writer->finish();
+                writer.reset();
+                outputs.push_back(SSTable::open(table_path(id), id));
+            };
+            for (; it.valid(); it.next())
+            {
+                if (it.tombstone() && bottom)
+                    continue;
+                if (!writer)
+                {
+                    {
+                        lock_guard<mutex> lock(mtx_);
+                        id = next_file_id_++;
+                    }
+                    writer = make_unique<SSTableWriter>(table_path(id), config_.block_size,
+                                                        config_.bloom_bits_per_key);
+                }
+                writer->add(it.key(), it.value(), it.tombstone());
+                if (writer->estimated_size() >= config_.target_file_size)
+                    finish();
+            }
+            if (writer)
+                finish();
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stderr, "[LSM] compaction of level %d failed: %s\n", level, e.what());
+            for (auto &t : outputs)
+                t->mark_obsolete();
+            pause_after_failure();
+            return;
+        }
+        compactions_++;
+    }
+
+    auto &out = v->levels[level + 1];
+    out.insert(out.end(), outputs.begin(), outputs.end());
+    sort(out.begin(), out.end(), [](const shared_ptr<SSTable> &a, const shared_ptr<SSTable> &b)
+         { return a->smallest() < b->smallest(); });
+
+    uint64_t log_number;
+    {
+        lock_guard<mutex> lock(mtx_);
+        log_number = log_number_;
+    }
+    try
+    {
+        save_manifest(*v, log_number);
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "[LSM] %s\n", e.what());
+        if (!inputs.empty())
+            for (auto &t : outputs)
+                t->mark_obsolete();
+        pause_after_failure();
+        return;
+    }
+    install(v);
+
+    // Deleted once the last reader still using them lets go
+    for (auto &t : inputs)
+        t->mark_obsolete();
+    for (auto &t : overlapping)
+        t->mark_obsolete();
+}
+
+void LSMEngine::install(std::shared_ptr<const Version> v)
+{
+    {
+        lock_guard<mutex> lock(mtx_);
+        version_ = std::move(v);
+    }
+    cv_stall_.notify_all();
+}
+
+void LSMEngine::pause_after_failure()
+{
+    unique_lock<mutex> lock(mtx_);
+    background_failures_++;
+    cv_stall_.notify_all();
+    cv_bg_.wait_for(lock, chrono::seconds(1));
+}
+
+// ---------------------------------------------------------------------------
+// Stats
+// ---------------------------------------------------------------------------
+
+void LSMEngine::report_stats(nlohmann::json &out)
+{
+    shared_ptr<MemTable> mem, imm;
+    shared_ptr<const Version> v;
+    {
+        lock_guard<mutex> lock(mtx_);
+        mem = mem_;
+        imm = imm_;
+        v = version_;
+    }
+
+    auto &s = out["lsm"];
+    s["memtable_bytes"] = mem->bytes.load();
+    s["immutable_pending"] = imm != nullptr;
+    s["levels"] = nlohmann::json::array();
+    for (auto &level : v->levels)
+    {
+        uint64_t bytes = 0, entries = 0;
+        for (auto &t : level)
+        {
+            bytes += t->file_size();
+            entries += t->entries();
+        }
+        s["levels"].push_back({{"files", level.size()}, {"bytes", bytes}, {"entries", entries}});
+    }
+
+    // Bytes written to disk per byte of user data
+    uint64_t user = user_bytes_, wal = wal_bytes_, flushed = flush_bytes_,
+             compacted = compaction_write_bytes_;
+    s["user_bytes"] = user;
+    s["wal_bytes"] = wal;
+    s["flush_bytes"] = flushed;
+    s["compaction_read_bytes"] = compaction_read_bytes_.load();
+    s["compaction_write_bytes"] = compacted;
+    s["write_amplification"] = user ? (double)(wal + flushed + compacted) / user : 0.0;
+    s["wal_syncs"] = mem->wal->syncs();
+    s["flushes"] = flushes_.load();
+    s["compactions"] = compactions_.load();
+    s["trivial_moves"] = trivial_moves_.load();
+    s["write_stalls"] = stalls_.load();
+    s["write_stalls_failed"] = stalls_failed_.load();
+}
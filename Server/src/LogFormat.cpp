@@ -0,0 +1,58 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include "LogFormat.h"
+
+using namespace std;
+
+uint32_t crc32(const char *data, size_t len)
+{
+    static const auto table = []
+    {
+        vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; ++i)
+        crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void encode_log_record(std::string &buf, uint8_t flags,
+                       const std::string &key, const std::string &value)
+{
+    size_t start = buf.size();
+    put_fixed<uint32_t>(buf, 0); // crc, filled in below
+    buf.push_back((char)flags);
+    put_fixed<uint32_t>(buf, key.size());
+    put_fixed<uint32_t>(buf, value.size());
+    buf += key;
+    buf += value;
+    uint32_t crc = crc32(buf.data() + start + 4, buf.size() - start - 4);
+    memcpy(buf.data() + start, &crc, sizeof(crc));
+}
+
+size_t decode_log_record(const char *data, size_t avail, LogRecord &out)
+{
+    if (avail < LOG_HEADER_SIZE)
+        return 0;
+    uint32_t crc = get_fixed<uint32_t>(data);
+    uint32_t key_len = get_fixed<uint32_t>(data + 5);
+    uint32_t value_len = get_fixed<uint32_t>(data + 9);
+    size_t size = LOG_HEADER_SIZE + (size_t)key_len + value_len;
+    if (size > avail || crc32(data + 4, size - 4) != crc)
+        return 0;
+
+    out.flags = (uint8_t)data[4];
+    out.key.assign(data + LOG_HEADER_SIZE, key_len);
+    out.value.assign(data + LOG_HEADER_SIZE + key_len, value_len);
+    return size;
+}
@@ -0,0 +1,89 @@
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <functional>
+#include "MemoryEngine.h"
+
+using namespace std;
+
+MemoryEngine::MemoryEngine(size_t num_shards)
+{
+    shards_.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i)
+        shards_.push_back(make_unique<Shard>());
+}
+
+MemoryEngine::Shard *MemoryEngine::shard_for(const std::string &key)
+{
+    return shards_[std::hash<std::string>{}(key) % shards_.size()].get();
+}
+
+void MemoryEngine::get(const std::string &key, GetCallback cb)
+{
+    Shard *shard = shard_for(key);
+    string value;
+    {
+        shared_lock<shared_mutex> lock(shard->mtx);
+        auto it = shard->data.find(key);
+        if (it != shard->data.end())
+            value = it->second;
+    }
+    cb(true, std::move(value));
+}
+
+bool MemoryEngine::put(const std::string &key, const std::string &value, WriteCallback on_commit,
+                       Durability durability)
+{
+    // Nothing is durable here; every level commits immediately
+    Shard *shard = shard_for(key);
+    {
+        unique_lock<shared_mutex> lock(shard->mtx);
+        shard->data[key] = value;
+    }
+    if (on_commit)
+        on_commit(true);
+    return true;
+}
+
+bool MemoryEngine::remove(const std::string &key, WriteCallback on_commit, Durability durability)
+{
+    Shard *shard = shard_for(key);
+    {
+        unique_lock<shared_mutex> lock(shard->mtx);
+        shard->data.erase(key);
+    }
+    if (on_commit)
+        on_commit(true);
+    return true;
+}
+
+MemoryEngine::KeyValues MemoryEngine::scan(const std::string &start_key, size_t limit)
+{
+    // Take the first `limit` candidates from every shard, then merge
+    KeyValues result;
+    for (auto &shard : shards_)
+    {
+        shared_lock<shared_mutex> lock(shard->mtx);
+        auto it = shard->data.lower_bound(start_key);
+        for (size_t n = 0; it != shard->data.end() && n < limit; ++it, ++n)
+            result.emplace_back(it->first, it->second);
+    }
+    sort(result.begin(), result.end());
+    if (result.size() > limit)
+        result.resize(limit);
+    return result;
+}
+
+void MemoryEngine::report_stats(nlohmann::json &out)
+{
+    size_t keys = 0;
+    for (auto &shard : shards_)
+    {
+        shared_lock<shared_mutex> lock(shard->mtx);
+        keys += shard->data.size();
+    }
+    out["memory"]["keys"] = keys;
+}
@@ -0,0 +1,532 @@
+#include <mysql/mysql.h> // MySQL C API
+#include <string>
+#include <vector>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include "MySQLEngine.h"
+#include "MySQLHelper.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+std::vector<MySQLEndpoint> parse_mysql_shards(const std::string &spec)
+{
+    vector<MySQLEndpoint> endpoints;
+    size_t start = 0;
+    while (start <= spec.size())
+    {
+        size_t end = spec.find(',', start);
+        if (end == string::npos)
+            end = spec.size();
+        const string entry = spec.substr(start, end - start);
+        start = end + 1;
+        if (entry.empty())
+            continue;
+
+        string item = entry;
+        MySQLEndpoint ep;
+        size_t slash = item.find('/');
+        if (slash != string::npos)
+        {
+            ep.db = item.substr(slash + 1);
+            item.resize(slash);
+        }
+        size_t colon = item.find(':');
+        if (colon != string::npos)
+        {
+            try
+            {
+                ep.port = stoi(item.substr(colon + 1));
+            }
+            catch (const std::exception &)
+            {
+                throw std::invalid_argument("Bad MySQL shard port: " + entry);
+            }
+            item.resize(colon);
+        }
+        if (!item.empty())
+            ep.host = item;
+        if (ep.db.empty())
+            throw std::invalid_argument("Empty database name in MySQL shard: " + entry);
+        endpoints.push_back(std::move(ep));
+    }
+    if (endpoints.empty())
+        throw std::invalid_argument("No MySQL shards in: " + spec);
+    return endpoints;
+}
+
+MySQLEngine::Shard::Shard(const MySQLConfig &config, const MySQLEndpoint &ep,
+                          const DBQueueLimits &limits, const std::string &wal_dir)
+    : endpoint(ep),
+      executor(ep.host, config.user, config.password, ep.db, ep.port,
+               config.read_threads, config.read_conns_per_thread, config.read_timeout),
+      // Concurrent misses are coalesced into one multi-key SELECT
+      // (up to 64 keys, or whatever arrived within 200us).
+      read_batcher(executor, 64, chrono::microseconds(200), config.table),
+      write_pool(ep.host, config.user, config.password, ep.db, ep.port,
+                 config.write_pool_min, config.write_pool_max)
+{
+    if (!wal_dir.empty())
+        wal = make_unique<WriteAheadLog>(wal_dir);
+    start_db_workers(workers, write_pool, config.db_workers, limits, wal.get());
+
+    replayed = replay_db_log(workers);
+    if (replayed > 0)
+        fprintf(stderr, "[WAL] Replaying %zu writes not yet applied to %s:%d/%s\n",
+                replayed, ep.host.c_str(), ep.port, ep.db.c_str());
+    start_db_checkpointer(workers);
+}
+
+MySQLEngine::MySQLEngine(const MySQLConfig &config)
+    : config_(config)
+{
+    if (config.shards.empty())
+        throw std::invalid_argument("MySQL engine needs at least one shard");
+
+    // The queue high-water mark is a total across every shard
+    DBQueueLimits limits = db_queue_limits;
+    limits.high_water_mark = std::max<size_t>(1, limits.high_water_mark / config.shards.size());
+
+    vector<string> wal_dirs;
+    for (auto &ep : config.shards)
+    {
+        // A single shard keeps the log where it always was
+        string wal_dir = config.wal_dir;
+        if (!wal_dir.empty() && config.shards.size() > 1)
+            wal_dir += "/" + ep.host + "_" + to_string(ep.port) + "_" + ep.db;
+        wal_dirs.push_back(wal_dir);
+    }
+    // Checked before the shards open their logs
+    vector<string> stray;
+    if (!config.wal_dir.empty())
+        stray = stray_logs(wal_dirs);
+
+    shards_.reserve(config.shards.size());
+    try
+    {
+        for (size_t i = 0; i < config.shards.size(); ++i)
+            shards_.push_back(make_unique<Shard>(config, config.shards[i], limits, wal_dirs[i]));
+        for (auto &dir : stray)
+            adopt_stray_log(dir);
+    }
+    catch (...)
+    {
+        // The detached DB workers of the shards already started still use
+        // them, so they must not be destroyed
+        for (auto &shard : shards_)
+            shard.release();
+        throw;
+    }
+}
+
+// Whether dir holds a WAL that was written to: segments or a checkpoint
+static bool log_in_use(const string &dir)
+{
+    error_code ec;
+    if (fs::exists(dir + "/CHECKPOINT", ec))
+        return true;
+    for (auto &entry : fs::directory_iterator(dir, ec))
+        if (entry.path().extension() == ".wal" && fs::file_size(entry.path(), ec) > 0)
+            return true;
+    return false;
+}
+
+// The writes of log that may not be applied yet: those past its lowest
+// checkpoint, since its worker count may differ from the current one
+static void for_each_unapplied(WriteAheadLog &log, const function<void(const LogRecord &)> &fn)
+{
+    vector<uint64_t> applied = log.load_checkpoint();
+    uint64_t low = applied.empty() ? 0 : *std::min_element(applied.begin(), applied.end());
+    log.replay([&](const LogRecord &rec, uint64_t end)
+               {
+        if (end > low)
+            fn(rec); });
+}
+
+std::vector<std::string> MySQLEngine::stray_logs(const std::vector<std::string> &wal_dirs)
+{
+    set<string> own(wal_dirs.begin(), wal_dirs.end());
+    vector<string> stray;
+    if (!own.count(config_.wal_dir) && log_in_use(config_.wal_dir))
+        stray.push_back(config_.wal_dir);
+    error_code ec;
+    for (auto &entry : fs::directory_iterator(config_.wal_dir, ec))
+    {
+        string dir = config_.wal_dir + "/" + entry.path().filename().string();
+        if (entry.is_directory() && !own.count(dir) && log_in_use(dir))
+            stray.push_back(dir);
+    }
+    if (stray.empty() || std::none_of(wal_dirs.begin(), wal_dirs.end(), log_in_use))
+        return stray;
+
+    // Writes the shards logged since may be newer than the stray ones;
+    // replaying those after them could put old values back
+    for (auto &dir : stray)
+    {
+        size_t pending = 0;
+        {
+            WriteAheadLog log(dir);
+            for_each_unapplied(log, [&](const LogRecord &)
+                               { pending++; });
+        }
+        if (pending > 0)
+            throw runtime_error("mysql: " + dir + " holds " + to_string(pending) +
+                                " writes that may not be applied to MySQL, and the shards' own logs "
+                                "are already in use; restart once with the shard list that wrote it");
+    }
+    return stray;
+}
+
+// Re-logs the writes of a stray log that may not be applied yet into the
+// shards that own their keys now, then deletes it. Without this they
+// would never be replayed, losing writes that were acknowledged.
+void MySQLEngine::adopt_stray_log(const std::string &dir)
+{
+    {
+        WriteAheadLog log(dir);
+        struct Progress
+        {
+            mutex mtx;
+            condition_variable cv;
+            size_t remaining = 1; // held until every write is sent
+            bool ok = true;
+        } progress;
+        auto logged = [&progress](bool ok)
+        {
+            lock_guard<mutex> lock(progress.mtx);
+            progress.ok = progress.ok && ok;
+            if (--progress.remaining == 0)
+                progress.cv.notify_all();
+        };
+        size_t moved = 0;
+        for_each_unapplied(log, [&](const LogRecord &rec)
+                           {
+            {
+                lock_guard<mutex> lock(progress.mtx);
+                progress.remaining++;
+            }
+            // Waits for room in the owning queue, like the replay of a shard's own log
+            while (!(rec.flags == LOG_FLAG_TOMBSTONE ? remove(rec.key, logged)
+                                                     : put(rec.key, rec.value, logged)))
+                this_thread::sleep_for(chrono::milliseconds(10));
+            moved++; });
+        logged(true);
+
+        unique_lock<mutex> lock(progress.mtx);
+        progress.cv.wait(lock, [&progress]
+                         { return progress.remaining == 0; });
+        if (!progress.ok)
+            throw runtime_error("mysql: could not re-log the writes in " + dir);
+        if (moved > 0)
+            fprintf(stderr, "[WAL] Moved %zu writes from %s into the shards' logs\n", moved, dir.c_str());
+    }
+
+    for (auto &entry : fs::directory_iterator(dir))
+    {
+        string name = entry.path().filename().string();
+        if (entry.path().extension() == ".wal" || name == "CHECKPOINT" || name == "CHECKPOINT.tmp")
+            fs::remove(entry.path());
+    }
+    error_code ec;
+    if (dir != config_.wal_dir)
+        fs::remove(dir, ec);
+}
+
+// Jump consistent hash (Lamping & Veach): a bucket in [0, num_buckets)
+// such that growing num_buckets by one only moves keys into the new one.
+static size_t jump_consistent_hash(uint64_t key, size_t num_buckets)
+{
+    int64_t b = -1, j = 0;
+    while (j < (int64_t)num_buckets)
+    {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((b + 1) * (double(1LL << 31) / double((key >> 33) + 1)));
+    }
+    return (size_t)b;
+}
+
+size_t MySQLEngine::shard_index(const std::vector<unsigned char> &key_hash) const
+{
+    if (shards_.size() == 1)
+        return 0;
+    // Bytes 8..15 of the digest; the worker queues partition on bytes 0..7
+    uint64_t h = 0;
+    if (key_hash.size() >= 16)
+        memcpy(&h, key_hash.data() + 8, sizeof(h));
+    return jump_consistent_hash(h, shards_.size());
+}
+
+MySQLEngine::Shard &MySQLEngine::shard_for(const std::vector<unsigned char> &key_hash)
+{
+    return *shards_[shard_index(key_hash)];
+}
+
+void MySQLEngine::get(const std::string &key, GetCallback cb)
+{
+    shard_for(md5_hash(key)).read_batcher.get(key, std::move(cb));
+}
+
+void MySQLEngine::refresh(const std::string &key, GetCallback cb)
+{
+    auto key_hash = md5_hash(key);
+    auto shared_cb = make_shared<GetCallback>(std::move(cb));
+    if (!async_read(shard_for(key_hash).workers, key, key_hash, [shared_cb](bool ok, string value)
+                    { (*shared_cb)(ok, std::move(value)); }))
+        (*shared_cb)(false, "");
+}
+
+bool MySQLEngine::put(const std::string &key, const std::string &value, WriteCallback on_commit,
+                      Durability durability)
+{
+    auto key_hash = md5_hash(key);
+    DBWorkers &workers = shard_for(key_hash).workers;
+    if (durability == Durability::Database)
+        return async_insert(workers, key, key_hash, value, std::move(on_commit));
+    return async_insert(workers, key, key_hash, value, nullptr, std::move(on_commit));
+}
+
+bool MySQLEngine::remove(const std::string &key, WriteCallback on_commit, Durability durability)
+{
+    auto key_hash = md5_hash(key);
+    DBWorkers &workers = shard_for(key_hash).workers;
+    if (durability == Durability::Database)
+        return async_delete(workers, key, key_hash, std::move(on_commit));
+    return async_delete(workers, key, key_hash, nullptr, std::move(on_commit));
+}
+
+void MySQLEngine::multi_get(const std::vector<std::string> &keys, MultiGetCallback cb)
+{
+    if (shards_.size() == 1)
+    {
+        shards_[0]->read_batcher.multi_get(keys, std::move(cb));
+        return;
+    }
+
+    // Per shard: its keys and where their values go in the result
+    vector<vector<string>> shard_keys(shards_.size());
+    vector<vector<size_t>> positions(shards_.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        size_t s = shard_index(md5_hash(keys[i]));
+        shard_keys[s].push_back(keys[i]);
+        positions[s].push_back(i);
+    }
+
+    struct State
+    {
+        vector<string> values;
+        atomic<size_t> remaining;
+        atomic<bool> ok{true};
+        MultiGetCallback cb;
+    };
+    auto state = make_shared<State>();
+    state->values.resize(keys.size());
+    state->remaining = shards_.size();
+    state->cb = std::move(cb);
+
+    for (size_t s = 0; s < shards_.size(); ++s)
+    {
+        shards_[s]->read_batcher.multi_get(
+            shard_keys[s], [state, where = std::move(positions[s])](bool ok, vector<string> values)
+            {
+            if (ok)
+                for (size_t j = 0; j < values.size(); ++j)
+                    state->values[where[j]] = std::move(values[j]);
+            else
+                state->ok = false;
+            if (--state->remaining == 0)
+                state->cb(state->ok, std::move(state->values)); });
+    }
+}
+
+// Splits the group by shard; on_commit fires once every shard reported
+bool MySQLEngine::write_batch(std::vector<DBWrite> writes, WriteCallback on_commit,
+                              Durability durability)
+{
+    vector<vector<DBWrite>> by_shard(shards_.size());
+    for (auto &w : writes)
+        by_shard[shard_index(w.key_hash)].push_back(std::move(w));
+    size_t parts = 0;
+    for (auto &part : by_shard)
+        parts += !part.empty();
+    if (parts == 0)
+    {
+        if (on_commit)
+            on_commit(true);
+        return true;
+    }
+
+    WriteCallback done;
+    if (on_commit)
+    {
+        auto remaining = make_shared<atomic<size_t>>(parts);
+        auto all_ok = make_shared<atomic<bool>>(true);
+        done = [remaining, all_ok, on_commit](bool ok)
+        {
+            if (!ok)
+                *all_ok = false;
+            if (--*remaining == 0)
+                on_commit(*all_ok);
+        };
+    }
+
+    bool accepted = true;
+    for (size_t s = 0; s < by_shard.size(); ++s)
+    {
+        if (by_shard[s].empty())
+            continue;
+        DBWorkers &workers = shards_[s]->workers;
+        if (durability == Durability::Database)
+            accepted &= async_write_batch(workers, std::move(by_shard[s]), done);
+        else
+            accepted &= async_write_batch(workers, std::move(by_shard[s]), nullptr, done);
+    }
+    return accepted;
+}
+
+bool MySQLEngine::multi_put(const KeyValues &kvs, WriteCallback on_commit, Durability durability)
+{
+    vector<DBWrite> writes;
+    writes.reserve(kvs.size());
+    for (auto &kv : kvs)
+        writes.push_back(DBWrite{kv.first, md5_hash(kv.first), kv.second, false});
+    return write_batch(std::move(writes), std::move(on_commit), durability);
+}
+
+bool MySQLEngine::multi_remove(const std::vector<std::string> &keys, WriteCallback on_commit,
+                               Durability durability)
+{
+    vector<DBWrite> writes;
+    writes.reserve(keys.size());
+    for (auto &key : keys)
+        writes.push_back(DBWrite{key, md5_hash(key), "", true});
+    return write_batch(std::move(writes), std::move(on_commit), durability);
+}
+
+// Asks every shard for its first `limit` keys from start_key and merges them
+MySQLEngine::KeyValues MySQLEngine::scan(const std::string &start_key, size_t limit)
+{
+    string hex(start_key.size() * 2 + 1, '\0');
+    hex.resize(mysql_hex_string(hex.data(), start_key.data(), start_key.size()));
+    // The key column is assumed to be named `key`, as in insert_kv's signature
+    string sql = "SELECT `key`, value FROM " + config_.table +
+                 " WHERE `key` >= X'" + hex + "' ORDER BY `key` LIMIT " + to_string(limit);
+
+    vector<future<KeyValues>> parts;
+    for (auto &shard : shards_)
+    {
+        auto promise = make_shared<std::promise<KeyValues>>();
+        parts.push_back(promise->get_future());
+        shard->executor.execute(sql, [promise](bool ok, AsyncDBExecutor::Rows rows, string error)
+                                {
+            if (!ok)
+            {
+                promise->set_exception(make_exception_ptr(runtime_error(error)));
+                return;
+            }
+            KeyValues result;
+            for (auto &row : rows)
+                if (row.size() >= 2)
+                    result.emplace_back(std::move(row[0]), std::move(row[1]));
+            promise->set_value(std::move(result)); });
+    }
+
+    KeyValues result;
+    for (auto &part : parts)
+    {
+        KeyValues kvs = part.get();
+        result.insert(result.end(), make_move_iterator(kvs.begin()), make_move_iterator(kvs.end()));
+    }
+    if (shards_.size() > 1)
+    {
+        sort(result.begin(), result.end());
+        if (result.size() > limit)
+            result.resize(limit);
+    }
+    return result;
+}
+
+void MySQLEngine::report_stats(nlohmann::json &out)
+{
+    // Totals across shards at the top level, the breakdown under "shards"
+    DBQueueGauges total{};
+    uint64_t batches = 0, batched_keys = 0, acquire_timeouts = 0;
+    size_t pool_size = 0, pool_idle = 0;
+    double pool_wait_us = 0.0;
+    size_t wal_segments = 0, replayed = 0;
+    uint64_t wal_syncs = 0, wal_synced_records = 0;
+
+    out["shards"] = nlohmann::json::array();
+    for (auto &shard : shards_)
+    {
+        DBQueueGauges g = db_queue_gauges(shard->workers);
+        total.depth += g.depth;
+        total.high_water_mark += g.high_water_mark;
+        total.enqueued += g.enqueued;
+        total.drained += g.drained;
+        total.rejected += g.rejected;
+        total.dead_letters += g.dead_letters;
+        total.enqueue_rate += g.enqueue_rate;
+        total.drain_rate += g.drain_rate;
+        batches += shard->read_batcher.batches();
+        batched_keys += shard->read_batcher.keys();
+        pool_size += shard->write_pool.size();
+        pool_idle += shard->write_pool.idle();
+        pool_wait_us += shard->write_pool.avg_wait_us();
+        acquire_timeouts += shard->write_pool.timeouts();
+
+        nlohmann::json s;
+        s["endpoint"] = shard->endpoint.host + ":" + to_string(shard->endpoint.port) + "/" +
+                        shard->endpoint.db;
+        s["db_queue_depth"] = g.depth;
+        s["db_queue_rejected_total"] = g.rejected;
+        s["dead_letters_total"] = g.dead_letters;
+        s["drain_rate"] = g.drain_rate;
+        s["write_pool_size"] = shard->write_pool.size();
+        if (shard->wal)
+        {
+            s["wal_end"] = shard->wal->end();
+            wal_segments += shard->wal->segments();
+            wal_syncs += shard->wal->syncs();
+            wal_synced_records += shard->wal->synced_records();
+            replayed += shard->replayed;
+        }
+        out["shards"].push_back(std::move(s));
+    }
+
+    out["db_queue"]["depth"] = total.depth;
+    out["db_queue"]["high_water_mark"] = total.high_water_mark;
+    out["db_queue"]["enqueued_total"] = total.enqueued;
+    out["db_queue"]["drained_total"] = total.drained;
+    out["db_queue"]["rejected_total"] = total.rejected;
+    out["db_queue"]["dead_letters_total"] = total.dead_letters;
+    out["db_queue"]["enqueue_rate"] = total.enqueue_rate;
+    out["db_queue"]["drain_rate"] = total.drain_rate;
+    out["read_batcher"]["batches"] = batches;
+    out["read_batcher"]["keys"] = batched_keys;
+    out["write_pool"]["size"] = pool_size;
+    out["write_pool"]["idle"] = pool_idle;
+    out["write_pool"]["avg_wait_us"] = pool_wait_us / shards_.size();
+    out["write_pool"]["acquire_timeouts"] = acquire_timeouts;
+    if (!config_.wal_dir.empty())
+    {
+        if (shards_.size() == 1)
+            out["wal"]["end"] = shards_[0]->wal->end();
+        out["wal"]["segments"] = wal_segments;
+        out["wal"]["syncs"] = wal_syncs;
+        out["wal"]["synced_records"] = wal_synced_records;
+        out["wal"]["replayed"] = replayed;
+    }
+}
@@ -1,4 +1,6 @@
 #include <mysql/mysql.h> // MySQL C API
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
 #include <cstring>
 #include <vector>
 #include <openssl/md5.h>
@@ -8,13 +10,24 @@
 #include <stdexcept>
 #include <functional>
 #include <queue>
-#include "MySQLPool.h"
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include "MySQLHelper.h"
+#include "LogFormat.h"
+#include "AppendLog.h"
 
 using namespace std;
 
-queue<function<void()>> db_queue;
-mutex queue_mtx;
-condition_variable cv_db_queue;
+DBQueueLimits db_queue_limits;
+
+static const chrono::milliseconds CHECKPOINT_INTERVAL(200);
+// Backoff between attempts at a logged write MySQL refused
+static const chrono::milliseconds RETRY_MIN(50);
+static const chrono::milliseconds RETRY_MAX(5000);
 
 // returns 16-byte MD5 digest
 vector<unsigned char> md5_hash(const string &key)
@@ -107,110 +120,716 @@ std::string get_value(MYSQL *conn, const std::string &key)
 
     return result;
 }
+// Picks the worker queue that owns this key hash
+size_t db_queue_index(const DBWorkers &workers, const vector<unsigned char> &key_hash)
+{
+    // The MD5 digest is already uniformly distributed, so its first
+    // 8 bytes are a good enough partitioning key.
+    uint64_t h = 0;
+    memcpy(&h, key_hash.data(), std::min(sizeof(h), key_hash.size()));
+    return h % workers.queues.size();
+}
+
 // Worker thread function
-void db_worker(MySQLPool &pool)
+void db_worker(DBWorkers &workers, size_t index)
+{
+    DBQueue *q = workers.queues[index].get();
+    while (true)
+    {
+        DBTask task;
+        {
+            unique_lock<mutex> lock(q->mtx);
+            q->cv.wait(lock, [q]
+                       { return !q->tasks.empty(); });
+            task = std::move(q->tasks.front());
+            q->tasks.pop();
+            q->busy = true;
+        }
+        // Wake up one producer blocked on a full queue
+        q->cv_not_full.notify_one();
+        workers.stats.depth--;
+        workers.stats.drained++;
+
+        // A logged write was already acknowledged and the checkpoint must
+        // not pass it, so it is retried until MySQL takes it. The queue
+        // stalls meanwhile; producers back off at its high-water mark.
+        // Writes MySQL refuses for good are dead-lettered by the task
+        // itself (see run_write()), so only errors worth a retry get here.
+        chrono::milliseconds backoff = RETRY_MIN;
+        bool applied = false;
+        while (!applied)
+        {
+            try
+            {
+                task.run();
+                applied = true;
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "[DB Worker %zu] Exception: %s%s\n", index, e.what(),
+                        task.log_end ? " (logged write, retrying)" : "");
+                if (!task.log_end)
+                    break;
+                this_thread::sleep_for(backoff);
+                backoff = std::min(backoff * 2, RETRY_MAX);
+            }
+        }
+
+        lock_guard<mutex> lock(q->mtx);
+        q->busy = false;
+        if (applied && task.log_end)
+            q->applied = task.log_end;
+    }
+}
+
+// Persists how far each worker has applied the write-ahead log. A queue
+// with nothing pending has applied every record logged so far: its
+// records are appended under its lock, so none can be in flight.
+static void checkpoint_loop(DBWorkers &workers)
 {
+    WriteAheadLog *wal = workers.wal;
+    vector<uint64_t> last;
     while (true)
     {
-        function<void()> task;
+        this_thread::sleep_for(CHECKPOINT_INTERVAL);
+
+        vector<uint64_t> applied(workers.queues.size());
+        for (size_t i = 0; i < workers.queues.size(); ++i)
         {
-            unique_lock<mutex> lock(queue_mtx);
-            cv_db_queue.wait(lock, []
-                             { return !db_queue.empty(); });
-            task = db_queue.front();
-            db_queue.pop();
+            DBQueue *q = workers.queues[i].get();
+            lock_guard<mutex> lock(q->mtx);
+            if (q->tasks.empty() && !q->busy)
+                q->applied = wal->end();
+            applied[i] = q->applied;
         }
+        if (applied == last)
+            continue;
+
         try
         {
-            task();
+            wal->save_checkpoint(applied);
+            last = std::move(applied);
         }
         catch (const std::exception &e)
         {
-            fprintf(stderr, "[DB Worker] Exception: %s\n", e.what());
+            fprintf(stderr, "[DB WAL] %s\n", e.what());
+        }
+    }
+}
+
+// Creates one queue per worker and starts the (detached) worker threads
+void start_db_workers(DBWorkers &workers, MySQLPool &pool, size_t num_workers,
+                      const DBQueueLimits &limits, WriteAheadLog *wal)
+{
+    workers.limits = limits;
+    workers.pool = &pool;
+    workers.wal = wal;
+
+    // The high-water mark is split evenly across the partitions
+    size_t per_queue = std::max<size_t>(1, limits.high_water_mark / num_workers);
+
+    workers.queues.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; ++i)
+    {
+        workers.queues.push_back(std::make_unique<DBQueue>());
+        workers.queues.back()->capacity = per_queue;
+    }
+
+    for (size_t i = 0; i < num_workers; ++i)
+        std::thread(db_worker, std::ref(workers), i).detach();
+}
+
+void start_db_checkpointer(DBWorkers &workers)
+{
+    if (workers.wal)
+        std::thread(checkpoint_loop, std::ref(workers)).detach();
+}
+
+// Pushes a task onto the queue owning key_hash. If that queue is at its
+// high-water mark, waits up to workers.limits.max_block for room and
+// returns false if none frees up (at once, unless wait_for_room).
+//
+// log_write, if set, appends the write to the WAL and returns its end
+// position. It runs under the queue lock so each queue holds its writes
+// in log order, which is what makes per-queue checkpoints valid.
+static bool enqueue_db_task(DBWorkers &workers, const vector<unsigned char> &key_hash,
+                            function<void()> task,
+                            const function<uint64_t()> &log_write = nullptr,
+                            bool wait_for_room = true)
+{
+    DBQueue *q = workers.queues[db_queue_index(workers, key_hash)].get();
+    {
+        unique_lock<mutex> lock(q->mtx);
+        auto has_room = [q]
+        { return q->tasks.size() < q->capacity; };
+
+        if (!has_room() &&
+            (!wait_for_room || workers.limits.max_block.count() <= 0 ||
+             !q->cv_not_full.wait_for(lock, workers.limits.max_block, has_room)))
+        {
+            workers.stats.rejected++;
+            return false;
+        }
+
+        uint64_t log_end = 0;
+        if (log_write)
+        {
+            try
+            {
+                log_end = log_write();
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "[DB WAL] %s\n", e.what());
+                return false;
+            }
+        }
+        // Counted before the worker can pop it, so depth never wraps
+        workers.stats.depth++;
+        q->tasks.push(DBTask{std::move(task), log_end});
+    } // <-- lock released here
+    workers.stats.enqueued++;
+    q->cv.notify_one();
+    return true;
+}
+
+// Runs one prepared statement; on failure fills in the error
+static bool run_statement(MYSQL *conn, const char *query, MYSQL_BIND *bind,
+                          unsigned int &err, string &error)
+{
+    MYSQL_STMT *stmt_handle = mysql_stmt_init(conn);
+    if (!stmt_handle)
+        throw std::runtime_error("mysql_stmt_init() failed");
+    std::unique_ptr<MYSQL_STMT, void(*)(MYSQL_STMT*)> stmt_guard(stmt_handle, [](MYSQL_STMT* s){
+        if(s) mysql_stmt_close(s);
+    });
+    MYSQL_STMT* stmt = stmt_guard.get();
+
+    if (mysql_stmt_prepare(stmt, query, strlen(query)) == 0 &&
+        !mysql_stmt_bind_param(stmt, bind) &&
+        mysql_stmt_execute(stmt) == 0)
+        return true;
+
+    err = mysql_stmt_errno(stmt);
+    error = mysql_stmt_error(stmt);
+    return false;
+}
+
+static bool is_connection_lost(unsigned int err)
+{
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+bool is_transient_db_error(unsigned int err)
+{
+    switch (err)
+    {
+    case 0: // not an SQL error, e.g. no connection to be had
+    case CR_SERVER_GONE_ERROR:
+    case CR_SERVER_LOST:
+    case CR_CONNECTION_ERROR:
+    case CR_CONN_HOST_ERROR:
+    case ER_CON_COUNT_ERROR:
+    case ER_SERVER_SHUTDOWN:
+    case ER_LOCK_WAIT_TIMEOUT:
+    case ER_LOCK_DEADLOCK:
+    case ER_OPTION_PREVENTS_STATEMENT: // read-only, e.g. during a failover
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Runs a prepared write statement on a pooled connection. If the server
+// dropped the connection, it is discarded and the (idempotent) statement is
+// retried once on a fresh one.
+static void execute_write(MySQLPool &pool, const char *query, MYSQL_BIND *bind)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        PooledConnection conn(pool);
+        if (!conn)
+            throw std::runtime_error("Failed to acquire connection");
+
+        unsigned int err = 0;
+        string error;
+        if (run_statement(conn.get(), query, bind, err, error))
+            return;
+
+        if (is_connection_lost(err))
+        {
+            conn.mark_broken();
+            if (attempt == 0)
+                continue;
+        }
+        throw DBError(err, error);
+    }
+}
+
+static void bind_insert(MYSQL_BIND *bind, const string &key, const vector<unsigned char> &key_hash,
+                        const string &value)
+{
+    memset(bind, 0, sizeof(MYSQL_BIND) * 3);
+    bind[0].buffer_type = MYSQL_TYPE_BLOB;
+    bind[0].buffer = (void*)key_hash.data();
+    bind[0].buffer_length = key_hash.size();
+
+    bind[1].buffer_type = MYSQL_TYPE_STRING;
+    bind[1].buffer = (void*)key.c_str();
+    bind[1].buffer_length = key.size();
+
+    bind[2].buffer_type = MYSQL_TYPE_BLOB;
+    bind[2].buffer = (void*)value.c_str();
+    bind[2].buffer_length = value.size();
+}
+
+static void bind_delete(MYSQL_BIND *bind, const vector<unsigned char> &key_hash)
+{
+    memset(bind, 0, sizeof(MYSQL_BIND));
+    bind[0].buffer_type = MYSQL_TYPE_BLOB;
+    bind[0].buffer = (void*)key_hash.data();
+    bind[0].buffer_length = key_hash.size();
+}
+
+// Applies a group of writes in one transaction, so they share a single
+// commit. Retried once on a fresh connection like execute_write().
+static void execute_batch(MySQLPool &pool, const vector<DBWrite> &writes)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        PooledConnection conn(pool);
+        if (!conn)
+            throw std::runtime_error("Failed to acquire connection");
+
+        unsigned int err = 0;
+        string error;
+        bool ok = mysql_autocommit(conn.get(), 0) == 0;
+        for (size_t i = 0; ok && i < writes.size(); ++i)
+        {
+            const DBWrite &w = writes[i];
+            MYSQL_BIND bind[3];
+            if (w.remove)
+            {
+                bind_delete(bind, w.key_hash);
+                ok = run_statement(conn.get(), "CALL delete_kv(?)", bind, err, error);
+            }
+            else
+            {
+                bind_insert(bind, w.key, w.key_hash, w.value);
+                ok = run_statement(conn.get(), "CALL insert_kv(?, ?, ?)", bind, err, error);
+            }
+        }
+        if (ok && mysql_commit(conn.get()) == 0)
+        {
+            mysql_autocommit(conn.get(), 1);
+            return;
+        }
+
+        if (err == 0)
+        {
+            err = mysql_errno(conn.get());
+            error = mysql_error(conn.get());
         }
+        if (is_connection_lost(err))
+        {
+            conn.mark_broken();
+            if (attempt == 0)
+                continue;
+            throw DBError(err, error);
+        }
+        mysql_rollback(conn.get());
+        mysql_autocommit(conn.get(), 1);
+        throw DBError(err, error);
+    }
+}
+
+// Keeps a logged write MySQL refused for good in the dead-letter log, so
+// it can be looked at and replayed by hand, and lets its queue move on.
+// Throws (and the write is retried) if the dead-letter log can't take it.
+static void dead_letter(DBWorkers &workers, uint8_t flags, const string &key, const string &value,
+                        const string &error)
+{
+    {
+        lock_guard<mutex> lock(workers.dead_letter_mtx);
+        if (!workers.dead_letters)
+            workers.dead_letters = std::make_unique<AppendLog>(workers.wal->dir() + "/dead_letters.log");
+        workers.dead_letters->append(flags, key, value);
+        if (!workers.dead_letters->sync())
+            throw std::runtime_error("cannot sync the dead-letter log");
+    }
+    workers.stats.dead_letters++;
+    fprintf(stderr, "[DB Worker] Dead-lettered a %s of key '%.64s': %s\n",
+            flags == LOG_FLAG_TOMBSTONE ? "delete" : "write", key.c_str(), error.c_str());
+}
+
+// execute_write() plus the optional completion callback
+static void run_write(DBWorkers &workers, const char *query, MYSQL_BIND *bind,
+                      const std::function<void(bool)> &on_done,
+                      uint8_t flags, const string &key, const string &value)
+{
+    try
+    {
+        execute_write(*workers.pool, query, bind);
     }
+    catch (const DBError &e)
+    {
+        if (on_done)
+            on_done(false);
+        if (!workers.wal || is_transient_db_error(e.code))
+            throw; // logged by db_worker
+        dead_letter(workers, flags, key, value, e.what());
+        return;
+    }
+    catch (...)
+    {
+        if (on_done)
+            on_done(false);
+        throw; // logged by db_worker
+    }
+    if (on_done)
+        on_done(true);
+}
+
+static function<void()> make_insert_task(DBWorkers &workers, const string &key,
+                                         const vector<unsigned char> &key_hash,
+                                         const string &value, function<void(bool)> on_done)
+{
+    return [workers_ptr = &workers, key, key_hash, value, on_done]
+    {
+        MYSQL_BIND bind[3];
+        bind_insert(bind, key, key_hash, value);
+        run_write(*workers_ptr, "CALL insert_kv(?, ?, ?)", bind, on_done, LOG_FLAG_PUT, key, value);
+    };
+}
+
+static function<void()> make_delete_task(DBWorkers &workers, const string &key,
+                                         const vector<unsigned char> &key_hash,
+                                         function<void(bool)> on_done)
+{
+    return [workers_ptr = &workers, key, key_hash, on_done]
+    {
+        MYSQL_BIND bind[1];
+        bind_delete(bind, key_hash);
+        run_write(*workers_ptr, "CALL delete_kv(?)", bind, on_done, LOG_FLAG_TOMBSTONE, key, "");
+    };
+}
+
+// After a group's transaction failed for good: applies its writes one
+// statement each, dead-lettering only those MySQL refuses. Returns false
+// if any was; throws on an error worth retrying the group for.
+static bool apply_each(DBWorkers &workers, const vector<DBWrite> &writes)
+{
+    bool all_applied = true;
+    for (auto &w : writes)
+    {
+        MYSQL_BIND bind[3];
+        try
+        {
+            if (w.remove)
+            {
+                bind_delete(bind, w.key_hash);
+                execute_write(*workers.pool, "CALL delete_kv(?)", bind);
+            }
+            else
+            {
+                bind_insert(bind, w.key, w.key_hash, w.value);
+                execute_write(*workers.pool, "CALL insert_kv(?, ?, ?)", bind);
+            }
+        }
+        catch (const DBError &e)
+        {
+            if (is_transient_db_error(e.code))
+                throw;
+            dead_letter(workers, w.remove ? LOG_FLAG_TOMBSTONE : LOG_FLAG_PUT, w.key, w.value, e.what());
+            all_applied = false;
+        }
+    }
+    return all_applied;
+}
+
+// Enqueues a write, logging it first when there is a WAL
+static bool enqueue_write(DBWorkers &workers, const string &key,
+                          const vector<unsigned char> &key_hash, uint8_t flags,
+                          const string &value, function<void()> task,
+                          function<void(bool)> on_logged)
+{
+    if (!workers.wal)
+        return enqueue_db_task(workers, key_hash, std::move(task));
+
+    return enqueue_db_task(workers, key_hash, std::move(task), [&]
+                           { return workers.wal->append(flags, key, value, std::move(on_logged)); });
+}
+
+// A logged write is retried until it is applied (see db_worker()); its
+// caller only hears about the first attempt that failed, or the success
+static function<void(bool)> first_result(function<void(bool)> cb)
+{
+    if (!cb)
+        return nullptr;
+    auto reported = make_shared<atomic<bool>>(false);
+    return [reported, cb = std::move(cb)](bool ok)
+    {
+        if (!reported->exchange(true))
+            cb(ok);
+    };
+}
+
+// Without a WAL, a write is "logged" once it is in MySQL
+static function<void(bool)> chain_callbacks(const DBWorkers &workers, function<void(bool)> on_done,
+                                            function<void(bool)> on_logged)
+{
+    if (workers.wal)
+        return first_result(std::move(on_done));
+    if (!on_logged)
+        return on_done;
+    return [on_done, on_logged](bool ok)
+    {
+        if (on_done)
+            on_done(ok);
+        on_logged(ok);
+    };
 }
 
 // Enqueue insert operation
-void async_insert(MySQLPool &pool,
+bool async_insert(DBWorkers &workers,
+                  const std::string &key,
+                  const std::vector<unsigned char> &key_hash,
+                  const std::string &value,
+                  std::function<void(bool)> on_done,
+                  std::function<void(bool)> on_logged)
+{
+    auto task = make_insert_task(workers, key, key_hash, value,
+                                 chain_callbacks(workers, std::move(on_done), on_logged));
+    return enqueue_write(workers, key, key_hash, LOG_FLAG_PUT, value, std::move(task),
+                         std::move(on_logged));
+}
+
+// Enqueue delete operation
+bool async_delete(DBWorkers &workers,
                   const std::string &key,
                   const std::vector<unsigned char> &key_hash,
-                  const std::string &value)
+                  std::function<void(bool)> on_done,
+                  std::function<void(bool)> on_logged)
+{
+    auto task = make_delete_task(workers, key, key_hash,
+                                 chain_callbacks(workers, std::move(on_done), on_logged));
+    return enqueue_write(workers, key, key_hash, LOG_FLAG_TOMBSTONE, "", std::move(task),
+                         std::move(on_logged));
+}
+
+// Joins the callbacks of `count` parts into one
+static function<void(bool)> join_callbacks(size_t count, function<void(bool)> cb)
+{
+    if (!cb)
+        return nullptr;
+
+    struct State
+    {
+        atomic<size_t> remaining;
+        atomic<bool> ok{true};
+        function<void(bool)> cb;
+    };
+    auto state = make_shared<State>();
+    state->remaining = count;
+    state->cb = std::move(cb);
+    return [state](bool ok)
+    {
+        if (!ok)
+            state->ok = false;
+        if (--state->remaining == 0)
+            state->cb(state->ok);
+    };
+}
+
+// Enqueue a group of writes
+bool async_write_batch(DBWorkers &workers,
+                       std::vector<DBWrite> writes,
+                       std::function<void(bool)> on_done,
+                       std::function<void(bool)> on_logged)
 {
+    if (writes.empty())
+    {
+        if (on_done)
+            on_done(true);
+        if (on_logged)
+            on_logged(true);
+        return true;
+    }
+
+    // Split by owning queue, keeping each key's writes in order
+    vector<vector<DBWrite>> groups(workers.queues.size());
+    for (auto &w : writes)
+        groups[db_queue_index(workers, w.key_hash)].push_back(std::move(w));
+    size_t num_groups = 0;
+    for (auto &g : groups)
+        num_groups += !g.empty();
+
+    // With a WAL each record reports when it is durable; without one a
+    // group is "logged" once it committed
+    auto done = join_callbacks(num_groups, std::move(on_done));
+    auto logged = join_callbacks(workers.wal ? writes.size() : num_groups, std::move(on_logged));
+
+    bool accepted = true;
+    for (auto &group : groups)
     {
-        std::lock_guard<std::mutex> lock(queue_mtx);
-        db_queue.push([pool_ptr = &pool, key, key_hash, value]
-                      {
-            MYSQL* conn = pool_ptr->acquire();
-            if (!conn) {
-                fprintf(stderr, "[DB Worker] Failed to acquire connection\n");
-                return;
+        if (group.empty())
+            continue;
+
+        auto shared_group = make_shared<vector<DBWrite>>(std::move(group));
+        bool has_wal = workers.wal != nullptr;
+        auto group_done = has_wal ? first_result(done) : done;
+        auto task = [workers_ptr = &workers, shared_group, done = group_done, logged, has_wal]
+        {
+            bool ok = true;
+            try
+            {
+                try
+                {
+                    execute_batch(*workers_ptr->pool, *shared_group);
+                }
+                catch (const DBError &e)
+                {
+                    if (!has_wal || is_transient_db_error(e.code))
+                        throw;
+                    // One refused write rolls back the whole group
+                    ok = apply_each(*workers_ptr, *shared_group);
+                }
+            }
+            catch (...)
+            {
+                if (done)
+                    done(false);
+                if (logged && !has_wal)
+                    logged(false);
+                throw; // logged by db_worker
             }
-            
-            const char* query = "CALL insert_kv(?, ?, ?)";
-            MYSQL_STMT* stmt = mysql_stmt_init(conn);
-            if (!stmt)
-                throw std::runtime_error("mysql_stmt_init() failed");
-            if (mysql_stmt_prepare(stmt, query, strlen(query)))
-                throw std::runtime_error(mysql_stmt_error(stmt));
+            if (done)
+                done(ok);
+            if (logged && !has_wal)
+                logged(ok);
+        };
 
-            MYSQL_BIND bind[3] = {0};
-            bind[0].buffer_type = MYSQL_TYPE_BLOB;
-            bind[0].buffer = (void*)key_hash.data();
-            bind[0].buffer_length = key_hash.size();
+        size_t appended = 0;
+        function<uint64_t()> log_write;
+        if (has_wal)
+            log_write = [&]
+            {
+                uint64_t end = 0;
+                for (auto &w : *shared_group)
+                {
+                    end = workers.wal->append(w.remove ? LOG_FLAG_TOMBSTONE : LOG_FLAG_PUT,
+                                              w.key, w.value, logged);
+                    appended++;
+                }
+                return end;
+            };
 
-            bind[1].buffer_type = MYSQL_TYPE_STRING;
-            bind[1].buffer = (void*)key.c_str();
-            bind[1].buffer_length = key.size();
+        if (!enqueue_db_task(workers, shared_group->front().key_hash, std::move(task), log_write))
+        {
+            accepted = false;
+            if (done)
+                done(false);
+            // Records already in the log report for themselves
+            size_t unreported = has_wal ? shared_group->size() - appended : 1;
+            if (logged)
+                for (size_t i = 0; i < unreported; ++i)
+                    logged(false);
+        }
+    }
+    return accepted;
+}
 
-            bind[2].buffer_type = MYSQL_TYPE_BLOB;
-            bind[2].buffer = (void*)value.c_str();
-            bind[2].buffer_length = value.size();
+// Enqueue an ordered read
+bool async_read(DBWorkers &workers,
+                const std::string &key,
+                const std::vector<unsigned char> &key_hash,
+                std::function<void(bool, std::string)> on_done)
+{
+    auto task = [pool_ptr = workers.pool, key, on_done]
+    {
+        string value;
+        try
+        {
+            PooledConnection conn(*pool_ptr);
+            if (!conn)
+                throw std::runtime_error("Failed to acquire connection");
+            value = get_value(conn.get(), key);
+        }
+        catch (...)
+        {
+            on_done(false, "");
+            throw; // logged by db_worker
+        }
+        on_done(true, std::move(value));
+    };
+    return enqueue_db_task(workers, key_hash, std::move(task), nullptr, false);
+}
 
-            if (mysql_stmt_bind_param(stmt, bind))
-                throw std::runtime_error(mysql_stmt_error(stmt));
+// Re-queues logged writes past their queue's checkpoint. Waits for room
+// instead of shedding: these writes were already acknowledged.
+size_t replay_db_log(DBWorkers &workers)
+{
+    if (!workers.wal)
+        return 0;
+
+    vector<uint64_t> applied = workers.wal->load_checkpoint();
+    // With a different worker count the per-queue positions no longer
+    // line up; fall back to the lowest one for every queue.
+    if (applied.size() != workers.queues.size())
+    {
+        uint64_t low = applied.empty() ? 0 : *std::min_element(applied.begin(), applied.end());
+        applied.assign(workers.queues.size(), low);
+    }
 
-            if (mysql_stmt_execute(stmt))
-                throw std::runtime_error(mysql_stmt_error(stmt));
-            mysql_stmt_close(stmt);
+    size_t replayed = 0;
+    workers.wal->replay([&](const LogRecord &rec, uint64_t end)
+                        {
+        auto key_hash = md5_hash(rec.key);
+        size_t index = db_queue_index(workers, key_hash);
+        if (end <= applied[index])
+            return;
 
-            pool_ptr->release(conn); });
-    } // <-- lock_guard destroyed here, mutex released
-    cv_db_queue.notify_one();
+        auto task = rec.flags == LOG_FLAG_TOMBSTONE
+                        ? make_delete_task(workers, rec.key, key_hash, nullptr)
+                        : make_insert_task(workers, rec.key, key_hash, rec.value, nullptr);
+        DBQueue *q = workers.queues[index].get();
+        {
+            unique_lock<mutex> lock(q->mtx);
+            q->cv_not_full.wait(lock, [q]
+                                { return q->tasks.size() < q->capacity; });
+            workers.stats.depth++;
+            q->tasks.push(DBTask{std::move(task), end});
+        }
+        workers.stats.enqueued++;
+        q->cv.notify_one();
+        replayed++; });
+    return replayed;
 }
 
-// Enqueue delete operation
-void async_delete(MySQLPool &pool, const std::vector<unsigned char> &key_hash)
+// Snapshot of the write-behind queue gauges. Rates are averaged over the
+// interval since the previous snapshot (at least one second apart).
+DBQueueGauges db_queue_gauges(DBWorkers &workers)
 {
+    DBQueueGauges g;
+    g.depth = workers.stats.depth.load();
+    g.high_water_mark = workers.limits.high_water_mark;
+    g.enqueued = workers.stats.enqueued.load();
+    g.drained = workers.stats.drained.load();
+    g.rejected = workers.stats.rejected.load();
+    g.dead_letters = workers.stats.dead_letters.load();
+
+    lock_guard<mutex> lock(workers.sample_mtx);
+    auto now = chrono::steady_clock::now();
+    double secs = chrono::duration<double>(now - workers.last_sample).count();
+    if (secs >= 1.0)
     {
-        std::lock_guard<std::mutex> lock(queue_mtx);
-        db_queue.push([pool_ptr = &pool, key_hash]
-                      {
-            MYSQL* conn = pool_ptr->acquire();
-            if (!conn) {
-                fprintf(stderr, "[DB Worker] Failed to acquire connection\n");
-                return;
-            }
-            const char* query = "CALL delete_kv(?)";
-            MYSQL_STMT* stmt = mysql_stmt_init(conn);
-            if (!stmt)
-                throw std::runtime_error("mysql_stmt_init() failed");
-            if (mysql_stmt_prepare(stmt, query, strlen(query)))
-                throw std::runtime_error(mysql_stmt_error(stmt));
-
-            MYSQL_BIND bind[1] = {0};
-            bind[0].buffer_type = MYSQL_TYPE_BLOB;
-            bind[0].buffer = (void*)key_hash.data();
-            bind[0].buffer_length = key_hash.size();
-
-            if (mysql_stmt_bind_param(stmt, bind))
-                throw std::runtime_error(mysql_stmt_error(stmt));
-
-            if (mysql_stmt_execute(stmt))
-                throw std::runtime_error(mysql_stmt_error(stmt));
-            mysql_stmt_close(stmt);
-
-            pool_ptr->release(conn); });
-    } // <-- lock_guard destroyed here, mutex released
-    cv_db_queue.notify_one();
-}
\ No newline at end of file
+        workers.enqueue_rate = (g.enqueued - workers.last_enqueued) / secs;
+        workers.drain_rate = (g.drained - workers.last_drained) / secs;
+        workers.last_sample = now;
+        workers.last_enqueued = g.enqueued;
+        workers.last_drained = g.drained;
+    }
+    g.enqueue_rate = workers.enqueue_rate;
+    g.drain_rate = workers.drain_rate;
+    return g;
+}
@@ -6,56 +6,273 @@
 #include <stdexcept>
 #include <functional>
 #include <queue>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
 #include "MySQLPool.h"
 
+using namespace std::chrono;
+
 MySQLPool::MySQLPool(const std::string &host,
                      const std::string &user,
                      const std::string &password,
                      const std::string &db,
                      int port,
-                     size_t pool_size)
-    : host_(host), user_(user), password_(password), db_(db), port_(port)
+                     size_t min_size,
+                     size_t max_size,
+                     milliseconds acquire_timeout)
+    : host_(host), user_(user), password_(password), db_(db), port_(port),
+      min_size_(min_size), max_size_(std::max(min_size, max_size)),
+      acquire_timeout_(acquire_timeout)
 {
-    for (size_t i = 0; i < pool_size; ++i)
-    {
-        MYSQL *conn = mysql_init(nullptr);
-        if (!conn)
-            throw std::runtime_error("mysql_init failed");
+    // mysql_init() is only thread-safe once the library is initialized
+    mysql_library_init(0, nullptr, nullptr);
 
-        if (!mysql_real_connect(conn, host.c_str(), user.c_str(), password.c_str(),
-                                db.c_str(), port, nullptr, 0))
-        {
-            throw std::runtime_error(mysql_error(conn));
-        }
+    // Open the initial connections in parallel so boot time does not
+    // scale with the pool size.
+    std::vector<MYSQL *> opened(min_size_, nullptr);
+    std::vector<std::thread> openers;
+    std::mutex err_mtx;
+    std::string first_error;
 
-        connections_.push_back(conn);
+    for (size_t i = 0; i < min_size_; ++i)
+    {
+        openers.emplace_back([&, i]
+                             {
+            try
+            {
+                opened[i] = open_connection();
+            }
+            catch (const std::exception &e)
+            {
+                std::lock_guard<std::mutex> lock(err_mtx);
+                if (first_error.empty())
+                    first_error = e.what();
+            } });
     }
+    for (auto &t : openers)
+        t.join();
+
+    if (!first_error.empty())
+    {
+        for (auto conn : opened)
+            if (conn)
+                mysql_close(conn);
+        throw std::runtime_error(first_error);
+    }
+
+    auto now = steady_clock::now();
+    for (auto conn : opened)
+        connections_.push_back({conn, now});
+    total_ = min_size_;
+
+    maintenance_ = std::thread(&MySQLPool::maintenance_loop, this);
 }
 
 MySQLPool::~MySQLPool()
 {
-    for (auto conn : connections_)
     {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_stop_.notify_all();
+    if (maintenance_.joinable())
+        maintenance_.join();
+
+    for (auto &idle : connections_)
+    {
+        mysql_close(idle.conn);
+    }
+}
+
+MYSQL *MySQLPool::open_connection()
+{
+    MYSQL *conn = mysql_init(nullptr);
+    if (!conn)
+        throw std::runtime_error("mysql_init failed");
+
+    unsigned int connect_timeout = 5; // seconds
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+
+    if (!mysql_real_connect(conn, host_.c_str(), user_.c_str(), password_.c_str(),
+                            db_.c_str(), port_, nullptr, 0))
+    {
+        std::string err = mysql_error(conn);
         mysql_close(conn);
+        throw std::runtime_error(err);
     }
+    return conn;
 }
 
-// Acquire a connection (wait if none available)
+// Acquire a connection, or nullptr if none frees up before the deadline
 MYSQL *MySQLPool::acquire()
 {
+    auto start = steady_clock::now();
+    auto deadline = start + acquire_timeout_;
+    bool grow_failed = false;
+    MYSQL *conn = nullptr;
+
     std::unique_lock<std::mutex> lock(mtx_);
-    cv_connections.wait(lock, [this]
-                        { return !connections_.empty(); });
+    while (true)
+    {
+        if (!connections_.empty())
+        {
+            conn = connections_.back().conn;
+            connections_.pop_back();
+            break;
+        }
 
-    MYSQL *conn = connections_.back();
-    connections_.pop_back();
+        auto now = steady_clock::now();
+        if (now >= deadline)
+            break;
+
+        // Waited long enough and there is headroom: open a new connection
+        bool can_grow = !grow_failed && total_ < max_size_;
+        if (can_grow && now - start >= grow_after_)
+        {
+            total_++;
+            lock.unlock();
+            try
+            {
+                conn = open_connection();
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "[MySQLPool] Failed to grow pool: %s\n", e.what());
+            }
+            lock.lock();
+            if (conn)
+                break;
+            total_--;
+            grow_failed = true;
+            continue;
+        }
+
+        cv_connections.wait_until(lock, can_grow ? start + grow_after_ : deadline);
+    }
+    lock.unlock();
+
+    double waited = duration<double, std::micro>(steady_clock::now() - start).count();
+    avg_wait_us_ = 0.9 * avg_wait_us_.load() + 0.1 * waited;
+    if (!conn)
+        timeouts_++;
     return conn;
 }
 
 // Release a connection back to the pool
-void MySQLPool::release(MYSQL *conn)
+void MySQLPool::release(MYSQL *conn, bool broken)
 {
+    if (broken)
+    {
+        // Dropping it frees a slot, so a waiter may open a fresh one
+        mysql_close(conn);
+        std::lock_guard<std::mutex> lock(mtx_);
+        total_--;
+        cv_connections.notify_one();
+        return;
+    }
+
     std::lock_guard<std::mutex> lock(mtx_);
-    connections_.push_back(conn);
+    connections_.push_back({conn, steady_clock::now()});
     cv_connections.notify_one();
-}
\ No newline at end of file
+}
+
+size_t MySQLPool::size()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return total_;
+}
+
+size_t MySQLPool::idle()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return connections_.size();
+}
+
+// Background health checks, reconnects and shrinking
+void MySQLPool::maintenance_loop()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (true)
+    {
+        cv_stop_.wait_for(lock, health_interval_, [this]
+                          { return stop_; });
+        if (stop_)
+            break;
+
+        auto now = steady_clock::now();
+
+        // Shrink: the front of the deque has been idle the longest
+        std::vector<MYSQL *> to_close;
+        while (total_ > min_size_ && !connections_.empty() &&
+               now - connections_.front().since >= idle_timeout_)
+        {
+            to_close.push_back(connections_.front().conn);
+            connections_.pop_front();
+            total_--;
+        }
+
+        // Check connections that sat unused for a whole interval;
+        // recently released ones have just proven themselves.
+        std::vector<IdleConn> to_check;
+        for (auto it = connections_.begin(); it != connections_.end();)
+        {
+            if (now - it->since >= health_interval_)
+            {
+                to_check.push_back(*it);
+                it = connections_.erase(it);
+            }
+            else
+                ++it;
+        }
+
+        // Refill up to min_size (after failed reconnects or broken releases)
+        size_t missing = total_ < min_size_ ? min_size_ - total_ : 0;
+        total_ += missing;
+        lock.unlock();
+
+        for (auto conn : to_close)
+            mysql_close(conn);
+
+        std::vector<IdleConn> healthy;
+        size_t failed = 0;
+        for (auto &idle : to_check)
+        {
+            if (mysql_ping(idle.conn) == 0)
+            {
+                healthy.push_back(idle);
+                continue;
+            }
+            fprintf(stderr, "[MySQLPool] Dropping dead connection: %s\n", mysql_error(idle.conn));
+            mysql_close(idle.conn);
+            try
+            {
+                healthy.push_back({open_connection(), idle.since});
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "[MySQLPool] Reconnect failed: %s\n", e.what());
+                failed++;
+            }
+        }
+        for (size_t i = 0; i < missing; ++i)
+        {
+            try
+            {
+                healthy.push_back({open_connection(), steady_clock::now()});
+            }
+            catch (const std::exception &e)
+            {
+                fprintf(stderr, "[MySQLPool] Reconnect failed: %s\n", e.what());
+                failed++;
+            }
+        }
+
+        lock.lock();
+        total_ -= failed;
+        // Checked connections keep their idle age so they can still expire
+        for (auto &idle : healthy)
+            connections_.push_front(idle);
+        cv_connections.notify_all();
+    }
+}
@@ -0,0 +1,179 @@
+#include <mysql/mysql.h> // MySQL C API
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include "ReadBatcher.h"
+#include "MySQLHelper.h"
+
+using namespace std;
+
+// Keeps each multi_get() query to a few tens of KB of SQL
+static const size_t MAX_KEYS_PER_QUERY = 1000;
+
+ReadBatcher::ReadBatcher(AsyncDBExecutor &executor,
+                         size_t max_batch,
+                         chrono::microseconds window,
+                         string table)
+    : executor_(executor), max_batch_(max_batch), window_(window), table_(std::move(table))
+{
+    flusher_ = thread(&ReadBatcher::flusher_loop, this);
+}
+
+ReadBatcher::~ReadBatcher()
+{
+    {
+        lock_guard<mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (flusher_.joinable())
+        flusher_.join();
+}
+
+void ReadBatcher::get(const std::string &key, AsyncDBExecutor::Callback cb)
+{
+    auto hash = md5_hash(key);
+    string raw_hash(hash.begin(), hash.end());
+
+    WaiterMap full;
+    {
+        lock_guard<mutex> lock(mtx_);
+        if (pending_.empty())
+        {
+            first_pending_ = chrono::steady_clock::now();
+            cv_.notify_one();
+        }
+        // Concurrent misses on the same key share one slot in the batch
+        pending_[raw_hash].push_back(std::move(cb));
+
+        if (pending_.size() >= max_batch_)
+            full.swap(pending_);
+    }
+    // A full batch goes out right away from the caller's thread
+    if (!full.empty())
+        flush(std::move(full));
+}
+
+std::future<std::string> ReadBatcher::get(const std::string &key)
+{
+    auto promise = make_shared<std::promise<string>>();
+    auto fut = promise->get_future();
+    get(key, [promise](bool ok, string result)
+        {
+        if (ok)
+            promise->set_value(std::move(result));
+        else
+            promise->set_exception(make_exception_ptr(runtime_error(result))); });
+    return fut;
+}
+
+void ReadBatcher::multi_get(const std::vector<std::string> &keys,
+                            std::function<void(bool, std::vector<std::string>)> cb)
+{
+    if (keys.empty())
+    {
+        cb(true, {});
+        return;
+    }
+
+    // Shared by the per-key callbacks; the last one to finish reports
+    struct State
+    {
+        vector<string> values;
+        atomic<size_t> remaining;
+        atomic<bool> ok{true};
+        function<void(bool, vector<string>)> cb;
+    };
+    auto state = make_shared<State>();
+    state->values.resize(keys.size());
+    state->remaining = keys.size();
+    state->cb = std::move(cb);
+
+    for (size_t begin = 0; begin < keys.size(); begin += MAX_KEYS_PER_QUERY)
+    {
+        WaiterMap batch;
+        size_t end = std::min(keys.size(), begin + MAX_KEYS_PER_QUERY);
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto hash = md5_hash(keys[i]);
+            batch[string(hash.begin(), hash.end())].push_back([state, i](bool ok, string value)
+                                                               {
+                if (ok)
+                    state->values[i] = std::move(value);
+                else
+                    state->ok = false;
+                if (--state->remaining == 0)
+                    state->cb(state->ok, std::move(state->values)); });
+        }
+        flush(std::move(batch));
+    }
+}
+
+void ReadBatcher::flusher_loop()
+{
+    unique_lock<mutex> lock(mtx_);
+    while (!stop_)
+    {
+        cv_.wait(lock, [this]
+                 { return stop_ || !pending_.empty(); });
+        if (stop_)
+            break;
+
+        // Let the batch fill up until the window closes (or it gets
+        // flushed by a caller because it hit max_batch)
+        auto deadline = first_pending_ + window_;
+        if (chrono::steady_clock::now() < deadline)
+        {
+            cv_.wait_until(lock, deadline);
+            continue;
+        }
+
+        WaiterMap batch;
+        batch.swap(pending_);
+        lock.unlock();
+        flush(std::move(batch));
+        lock.lock();
+    }
+}
+
+void ReadBatcher::flush(WaiterMap batch)
+{
+    batches_++;
+    keys_ += batch.size();
+
+    string sql = "SELECT key_hash, value FROM " + table_ + " WHERE key_hash IN (";
+    bool first = true;
+    for (auto &entry : batch)
+    {
+        string hex(entry.first.size() * 2 + 1, '\0');
+        hex.resize(mysql_hex_string(hex.data(), entry.first.data(), entry.first.size()));
+        sql += first ? "X'" : ",X'";
+        sql += hex;
+        sql += "'";
+        first = false;
+    }
+    sql += ")";
+
+    auto waiters = make_shared<WaiterMap>(std::move(batch));
+    executor_.execute(std::move(sql), [waiters](bool ok, AsyncDBExecutor::Rows rows, string error)
+                      {
+        if (ok)
+        {
+            for (auto &row : rows)
+            {
+                if (row.size() < 2)
+                    continue;
+                auto it = waiters->find(row[0]);
+                if (it == waiters->end())
+                    continue;
+                for (auto &cb : it->second)
+                    cb(true, row[1]);
+                waiters->erase(it);
+            }
+        }
+        // Keys without a row are misses (or share the query's error)
+        for (auto &entry : *waiters)
+            for (auto &cb : entry.second)
+                cb(ok, ok ? "" : error); });
+}
@@ -0,0 +1,77 @@
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+#include "RespParser.h"
+
+using namespace std;
+
+bool resp_parse_int(string_view s, long long &out)
+{
+    auto result = from_chars(s.data(), s.data() + s.size(), out);
+    return result.ec == errc() && result.ptr == s.data() + s.size();
+}
+
+// The "<type><number>\r\n" line at data[pos..len): >0 is the offset just
+// past it, 0 means it is not complete yet, -1 that it is malformed
+static long header_line(const char *data, size_t len, size_t pos, long long &number)
+{
+    size_t avail = std::min(len - pos, MAX_RESP_HEADER_LINE);
+    const char *cr = (const char *)memchr(data + pos, '\r', avail);
+    if (!cr)
+        return avail == MAX_RESP_HEADER_LINE ? -1 : 0;
+    if (cr + 1 == data + len)
+        return 0;
+    if (cr[1] != '\n' || !resp_parse_int(string_view(data + pos + 1, cr - data - pos - 1), number))
+        return -1;
+    return cr - data + 2;
+}
+
+long parse_resp_command(const char *data, size_t len, vector<string_view> &args)
+{
+    args.clear();
+    if (data[0] != '*')
+    {
+        const char *nl = (const char *)memchr(data, '\n', std::min(len, MAX_RESP_INLINE));
+        if (!nl)
+            return len >= MAX_RESP_INLINE ? -1 : 0;
+        const char *p = data;
+        while (p < nl)
+        {
+            while (p < nl && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+            const char *start = p;
+            while (p < nl && *p != ' ' && *p != '\t' && *p != '\r')
+                p++;
+            if (p > start)
+                args.emplace_back(start, p - start);
+        }
+        return nl - data + 1;
+    }
+
+    long long count;
+    long pos = header_line(data, len, 0, count);
+    if (pos <= 0)
+        return pos;
+    if (count < 1 || (size_t)count > MAX_RESP_ARGS)
+        return -1;
+    for (long long i = 0; i < count; ++i)
+    {
+        if ((size_t)pos >= len)
+            return 0;
+        if (data[pos] != '$')
+            return -1;
+        long long size;
+        long end = header_line(data, len, pos, size);
+        if (end <= 0)
+            return end;
+        if (size < 0 || size > MAX_RESP_BULK)
+            return -1;
+        if (len - end < (size_t)size + 2)
+            return 0;
+        if (data[end + size] != '\r' || data[end + size + 1] != '\n')
+            return -1;
+        args.emplace_back(data + end, size);
+        pos = end + size + 2;
+    }
+    return pos;
+}
@@ -0,0 +1,625 @@
+#include <strings.h>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <unordered_set>
+#include "RespServer.h"
+#include "RespParser.h"
+
+using namespace std;
+
+// How long the reaper waits before retrying an expiry the engine shed
+static const chrono::seconds EXPIRE_RETRY(1);
+// Longest expiry accepted, far below where a deadline would overflow the clock
+static const long long MAX_EXPIRE_SECONDS = 100LL * 365 * 24 * 3600;
+
+static bool is(string_view arg, const char *name)
+{
+    return arg.size() == strlen(name) && strncasecmp(arg.data(), name, arg.size()) == 0;
+}
+
+static void append_bulk(string &out, const string &value)
+{
+    // "" is how the store says "not found"
+    if (value.empty())
+    {
+        out += "$-1\r\n";
+        return;
+    }
+    out += '$';
+    out += to_string(value.size());
+    out += "\r\n";
+    out += value;
+    out += "\r\n";
+}
+
+static string integer(long long n)
+{
+    return ":" + to_string(n) + "\r\n";
+}
+
+static string wrong_arity(string_view command)
+{
+    string name(command);
+    for (auto &c : name)
+        c = tolower(c);
+    return "-ERR wrong number of arguments for '" + name + "' command\r\n";
+}
+
+static const char *const READ_FAILED = "-ERR storage read failed\r\n";
+
+RespServer::RespServer(KVService &kv, const RespServerConfig &config)
+    : EventServer("RespServer", config.port, config.threads), kv_(kv)
+{
+    reaper_ = thread(&RespServer::reaper_loop, this);
+    start();
+}
+
+RespServer::~RespServer()
+{
+    stop();
+    {
+        lock_guard<mutex> lock(expiry_mtx_);
+        stop_reaper_ = true;
+    }
+    expiry_cv_.notify_all();
+    if (reaper_.joinable())
+        reaper_.join();
+}
+
+long RespServer::on_input(Connection &conn, const char *data, size_t len)
+{
+    // Views into the connection's buffer, only valid during this call
+    thread_local Args args;
+    long used = parse_resp_command(data, len, args);
+    if (used > 0 && !args.empty())
+    {
+        requests_++;
+        execute(conn, args);
+    }
+    return used;
+}
+
+void RespServer::execute(Connection &conn, const Args &args)
+{
+    string_view command = args[0];
+    if (is(command, "GET"))
+        get(conn, args);
+    else if (is(command, "SET"))
+        set(conn, args);
+    else if (is(command, "DEL"))
+        del(conn, args);
+    else if (is(command, "MGET"))
+        mget(conn, args);
+    else if (is(command, "MSET"))
+        mset(conn, args);
+    else if (is(command, "EXISTS"))
+        exists(conn, args);
+    else if (is(command, "EXPIRE"))
+        expire(conn, args);
+    else if (is(command, "PING"))
+    {
+        if (args.size() == 1)
+            respond(conn) += "+PONG\r\n";
+        else
+            append_bulk(respond(conn), string(args[1]));
+    }
+    else
+        respond(conn) += "-ERR unknown command '" + string(command.substr(0, 64)) + "'\r\n";
+}
+
+void RespServer::get(Connection &conn, const Args &args)
+{
+    if (args.size() != 2)
+    {
+        respond(conn) += wrong_arity(args[0]);
+        return;
+    }
+    string key(args[1]), value;
+    // A write in flight may be to key: read_keys() waits for those
+    if (writing_ > 0)
+    {
+        read_keys(conn, {key}, [](bool ok, vector<string> &values)
+                  {
+            if (!ok)
+                return string(READ_FAILED);
+            string response;
+            append_bulk(response, values[0]);
+            return response; });
+        return;
+    }
+    // The common case, a cache hit, skips read_keys()'s bookkeeping
+    KVService::ReadMiss miss;
+    if (kv_.lookup(key, value, miss))
+    {
+        append_bulk(respond(conn), value);
+        return;
+    }
+    kv_.fetch(key, miss, [reply = defer(conn, true)](KVStatus status, string result)
+              {
+        string response;
+        if (status == KVStatus::Failed)
+            response = READ_FAILED;
+        else
+            append_bulk(response, status == KVStatus::Ok ? result : "");
+        reply.send(std::move(response)); });
+}
+
+void RespServer::set(Connection &conn, const Args &args)
+{
+    if (args.size() != 3 && args.size() != 5)
+    {
+        respond(conn) += args.size() < 3 ? wrong_arity(args[0]) : "-ERR syntax error\r\n";
+        return;
+    }
+    if (args[2].empty())
+    {
+        respond(conn) += "-ERR empty values are not supported\r\n";
+        return;
+    }
+
+    string key(args[1]);
+    chrono::milliseconds ttl(0);
+    if (args.size() == 5)
+    {
+        long long n;
+        bool seconds = is(args[3], "EX");
+        if (!seconds && !is(args[3], "PX"))
+        {
+            respond(conn) += "-ERR syntax error\r\n";
+            return;
+        }
+        if (!resp_parse_int(args[4], n) || n <= 0 || n > (seconds ? 1 : 1000) * MAX_EXPIRE_SECONDS)
+        {
+            respond(conn) += "-ERR invalid expire time in 'set' command\r\n";
+            return;
+        }
+        ttl = seconds ? chrono::milliseconds(n * 1000) : chrono::milliseconds(n);
+    }
+
+    write_keys(conn, {{key, string(args[2])}}, false, []
+               { return string("+OK\r\n"); }, ttl);
+}
+
+void RespServer::del(Connection &conn, const Args &args)
+{
+    if (args.size() < 2)
+    {
+        respond(conn) += wrong_arity(args[0]);
+        return;
+    }
+    // Like in Redis, answers with the number of keys that existed: reads
+    // them after the writes sent before, then deletes them all. The deletes
+    // are registered first, so commands sent after this one wait for them.
+    vector<string> keys(args.begin() + 1, args.end());
+    vector<uint64_t> tickets = begin_writes(keys);
+    read_values(keys, tickets.front(), [this, keys, tickets, reply = defer(conn, true)](bool ok, vector<string> &values) mutable
+                {
+        if (!ok)
+        {
+            for (size_t i = 0; i < keys.size(); ++i)
+                end_write(keys[i], tickets[i], [] {});
+            reply.send(READ_FAILED);
+            return;
+        }
+        unordered_set<string> existed;
+        vector<Write> writes;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (!values[i].empty())
+                existed.insert(keys[i]);
+            writes.emplace_back(std::move(keys[i]), "");
+        }
+        long long count = existed.size();
+        send_writes(std::move(writes), std::move(tickets), true, [count]
+                    { return integer(count); },
+                    chrono::milliseconds(0), std::move(reply)); });
+}
+
+void RespServer::mget(Connection &conn, const Args &args)
+{
+    if (args.size() < 2)
+    {
+        respond(conn) += wrong_arity(args[0]);
+        return;
+    }
+    read_keys(conn, vector<string>(args.begin() + 1, args.end()), [](bool ok, vector<string> &values)
+              {
+        if (!ok)
+            return string(READ_FAILED);
+        string response = "*" + to_string(values.size()) + "\r\n";
+        for (auto &value : values)
+            append_bulk(response, value);
+        return response; });
+}
+
+void RespServer::mset(Connection &conn, const Args &args)
+{
+    if (args.size() < 3 || args.size() % 2 == 0)
+    {
+        respond(conn) += wrong_arity(args[0]);
+        return;
+    }
+    vector<Write> writes;
+    for (size_t i = 1; i < args.size(); i += 2)
+    {
+        if (args[i + 1].empty())
+        {
+            respond(conn) += "-ERR empty values are not supported\r\n";
+            return;
+        }
+        writes.emplace_back(string(args[i]), string(args[i + 1]));
+    }
+    write_keys(conn, std::move(writes), false, []
+               { return string("+OK\r\n"); });
+}
+
+void RespServer::exists(Connection &conn, const Args &args)
+{
+    if (args.size() < 2)
+    {
+        respond(conn) += wrong_arity(args[0]);
+        return;
+    }
+    read_keys(conn, vector<string>(args.begin() + 1, args.end()), [](bool ok, vector<string> &values)
+              {
+        if (!ok)
+            return string(READ_FAILED);
+        long long count = 0;
+        for (auto &value : values)
+            count += !value.empty();
+        return integer(count); });
+}
+
+void RespServer::expire(Connection &conn, const Args &args)
+{
+    long long seconds;
+    if (args.size() != 3)
+    {
+        respond(conn) += wrong_arity(args[0]);
+        return;
+    }
+    if (!resp_parse_int(args[2], seconds))
+    {
+        respond(conn) += "-ERR value is not an integer or out of range\r\n";
+        return;
+    }
+    if (seconds > MAX_EXPIRE_SECONDS)
+    {
+        respond(conn) += "-ERR invalid expire time in 'expire' command\r\n";
+        return;
+    }
+    // Only keys that exist get a deadline; one in the past deletes the key.
+    // Counts as a write to key, so a SET sent after it clears the deadline
+    // even if it commits before the read here is done.
+    string key(args[1]);
+    uint64_t ticket = begin_write(key);
+    read_keys(conn, {key}, [this, key, seconds, ticket](bool ok, vector<string> &values)
+              {
+        bool exists = ok && !values[0].empty();
+        end_write(key, ticket, [&]
+                  {
+            if (exists)
+                expire_at(key, Clock::now() + chrono::seconds(std::max(seconds, 0LL))); });
+        if (!ok)
+            return string(READ_FAILED);
+        return integer(exists); },
+              ticket);
+}
+
+void RespServer::read_keys(Connection &conn, vector<string> keys, ReadDone done, uint64_t before)
+{
+    // Answers in the response slot it defers
+    auto deferred = [&conn, this](ReadDone done)
+    {
+        return [done = std::move(done), reply = defer(conn, true)](bool ok, vector<string> &values)
+        { reply.send(done(ok, values)); };
+    };
+    if (writing_ > 0 && writes_pending(keys, before))
+    {
+        // Read once the writes sent before are done
+        read_values(std::move(keys), before, deferred(std::move(done)));
+        return;
+    }
+
+    vector<string> values(keys.size());
+    ReadMisses missing = lookup_keys(keys, values);
+    if (missing.index.empty())
+    {
+        respond(conn) += done(true, values);
+        return;
+    }
+    fetch_keys(keys, std::move(values), missing, deferred(std::move(done)));
+}
+
+void RespServer::read_values(vector<string> keys, uint64_t before, GotValues got)
+{
+    auto shared_keys = make_shared<vector<string>>(std::move(keys));
+    auto resume = [this, shared_keys, got = std::move(got)]
+    {
+        vector<string> values(shared_keys->size());
+        ReadMisses missing = lookup_keys(*shared_keys, values);
+        if (missing.index.empty())
+            got(true, values);
+        else
+            fetch_keys(*shared_keys, std::move(values), missing, got);
+    };
+    if (writing_ == 0 || !after_writes(*shared_keys, before, resume))
+        resume();
+}
+
+RespServer::ReadMisses RespServer::lookup_keys(const vector<string> &keys, vector<string> &values)
+{
+    ReadMisses missing;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        KVService::ReadMiss miss;
+        if (!kv_.lookup(keys[i], values[i], miss))
+        {
+            missing.index.push_back(i);
+            missing.misses.push_back(miss);
+        }
+    }
+    return missing;
+}
+
+void RespServer::fetch_keys(const vector<string> &keys, vector<string> values,
+                            const ReadMisses &missing, GotValues got)
+{
+    // Shared by the fetches; the last one to finish hands over the values
+    struct State
+    {
+        vector<string> values;
+        atomic<size_t> remaining;
+        atomic<bool> ok{true};
+        GotValues got;
+    };
+    auto state = make_shared<State>();
+    state->values = std::move(values);
+    state->remaining = missing.index.size();
+    state->got = std::move(got);
+
+    for (size_t j = 0; j < missing.index.size(); ++j)
+    {
+        size_t i = missing.index[j];
+        kv_.fetch(keys[i], missing.misses[j], [state, i](KVStatus status, string value)
+                  {
+            if (status == KVStatus::Failed)
+                state->ok = false;
+            else if (status == KVStatus::Ok)
+                state->values[i] = std::move(value);
+            if (--state->remaining == 0)
+                state->got(state->ok, state->values); });
+    }
+}
+
+void RespServer::write_keys(Connection &conn, vector<Write> writes, bool remove,
+                            function<string()> on_ok, chrono::milliseconds ttl)
+{
+    vector<string> keys;
+    keys.reserve(writes.size());
+    for (auto &w : writes)
+        keys.push_back(w.first);
+    vector<uint64_t> tickets = begin_writes(keys);
+    send_writes(std::move(writes), std::move(tickets), remove, std::move(on_ok), ttl, defer(conn, true));
+}
+
+vector<uint64_t> RespServer::begin_writes(const vector<string> &keys)
+{
+    vector<uint64_t> tickets;
+    tickets.reserve(keys.size());
+    for (auto &key : keys)
+    {
+        // Registered first, so an earlier SET ... EX committing now can't
+        // put its deadline back after this write cleared it
+        tickets.push_back(begin_write(key));
+        // Like in Redis, a write drops the key's expiry
+        clear_expiry(key);
+    }
+    return tickets;
+}
+
+void RespServer::send_writes(vector<Write> writes, vector<uint64_t> tickets, bool remove,
+                             function<string()> on_ok, chrono::milliseconds ttl, Reply reply)
+{
+    struct State
+    {
+        atomic<size_t> remaining;
+        atomic<bool> overloaded{false};
+        atomic<bool> failed{false};
+        function<string()> on_ok;
+        Reply reply;
+    };
+    auto state = make_shared<State>();
+    state->remaining = writes.size();
+    state->on_ok = std::move(on_ok);
+    state->reply = std::move(reply);
+
+    auto done = [state](KVStatus status)
+    {
+        if (status == KVStatus::Overloaded)
+            state->overloaded = true;
+        else if (status == KVStatus::Failed)
+            state->failed = true;
+        if (--state->remaining > 0)
+            return;
+        if (state->failed)
+            state->reply.send("-ERR write could not be persisted\r\n");
+        else if (state->overloaded)
+            state->reply.send("-BUSY write backlog is full, retry later\r\n");
+        else
+            state->reply.send(state->on_ok());
+    };
+    for (size_t i = 0; i < writes.size(); ++i)
+    {
+        auto &w = writes[i];
+        auto finish = [this, key = w.first, ticket = tickets[i], ttl, done](KVStatus status)
+        {
+            end_write(key, ticket, [&]
+                      {
+                if (status == KVStatus::Ok && ttl.count() > 0)
+                    expire_at(key, Clock::now() + ttl); });
+            done(status);
+        };
+        if (remove)
+            kv_.remove(w.first, WriteAck{}, finish);
+        else
+            kv_.put(w.first, w.second, WriteAck{}, finish);
+    }
+}
+
+uint64_t RespServer::begin_write(const string &key)
+{
+    lock_guard<mutex> lock(writes_mtx_);
+    KeyWrites &kw = writes_[key];
+    kw.latest = ++next_ticket_;
+    kw.in_flight.push_back(kw.latest);
+    writing_ = writes_.size();
+    return kw.latest;
+}
+
+void RespServer::end_write(const string &key, uint64_t ticket, const function<void()> &if_latest)
+{
+    vector<function<void()>> ready;
+    {
+        lock_guard<mutex> lock(writes_mtx_);
+        auto it = writes_.find(key);
+        KeyWrites &kw = it->second;
+        if (kw.latest == ticket)
+            if_latest();
+        kw.in_flight.erase(find(kw.in_flight.begin(), kw.in_flight.end(), ticket));
+
+        // Reads no longer behind a write still in flight
+        uint64_t lowest = kw.in_flight.empty() ? UINT64_MAX : kw.in_flight.front();
+        vector<pair<uint64_t, function<void()>>> still_waiting;
+        for (auto &w : kw.waiting)
+        {
+            if (w.first <= lowest)
+                ready.push_back(std::move(w.second));
+            else
+                still_waiting.push_back(std::move(w));
+        }
+        kw.waiting.swap(still_waiting);
+        if (kw.in_flight.empty())
+            writes_.erase(it);
+        writing_ = writes_.size();
+    }
+    for (auto &resume : ready)
+        resume();
+}
+
+bool RespServer::writes_pending(const vector<string> &keys, uint64_t before)
+{
+    lock_guard<mutex> lock(writes_mtx_);
+    for (auto &key : keys)
+    {
+        auto it = writes_.find(key);
+        if (it != writes_.end() && it->second.in_flight.front() < before)
+            return true;
+    }
+    return false;
+}
+
+bool RespServer::after_writes(const vector<string> &keys, uint64_t before, function<void()> resume)
+{
+    // One count per key waited for, plus one held until all are registered
+    auto remaining = make_shared<atomic<size_t>>(1);
+    auto one_done = [remaining, resume = std::move(resume)]
+    {
+        if (--*remaining == 0)
+            resume();
+    };
+    size_t waited = 0;
+    {
+        lock_guard<mutex> lock(writes_mtx_);
+        // Not the writes sent after the read
+        uint64_t limit = std::min(before, next_ticket_ + 1);
+        for (auto &key : keys)
+        {
+            auto it = writes_.find(key);
+            if (it == writes_.end() || it->second.in_flight.front() >= limit)
+                continue;
+            (*remaining)++;
+            it->second.waiting.emplace_back(limit, one_done);
+            waited++;
+        }
+    }
+    if (waited == 0)
+        return false;
+    one_done();
+    return true;
+}
+
+void RespServer::expire_at(const string &key, Clock::time_point deadline)
+{
+    {
+        lock_guard<mutex> lock(expiry_mtx_);
+        drop_expiry_locked(key);
+        deadlines_[key] = deadline;
+        expiry_queue_.emplace(deadline, key);
+        expiring_ = deadlines_.size();
+    }
+    expiry_cv_.notify_one();
+}
+
+void RespServer::clear_expiry(const string &key)
+{
+    // Most stores never see EXPIRE; don't make every write take the lock
+    if (expiring_ == 0)
+        return;
+    lock_guard<mutex> lock(expiry_mtx_);
+    drop_expiry_locked(key);
+    expiring_ = deadlines_.size();
+}
+
+void RespServer::drop_expiry_locked(const string &key)
+{
+    auto it = deadlines_.find(key);
+    if (it == deadlines_.end())
+        return;
+    auto range = expiry_queue_.equal_range(it->second);
+    for (auto q = range.first; q != range.second; ++q)
+        if (q->second == key)
+        {
+            expiry_queue_.erase(q);
+            break;
+        }
+    deadlines_.erase(it);
+}
+
+void RespServer::reaper_loop()
+{
+    unique_lock<mutex> lock(expiry_mtx_);
+    while (!stop_reaper_)
+    {
+        if (expiry_queue_.empty())
+        {
+            expiry_cv_.wait(lock);
+            continue;
+        }
+        auto first = expiry_queue_.begin();
+        if (Clock::now() < first->first)
+        {
+            expiry_cv_.wait_until(lock, first->first);
+            continue;
+        }
+
+        string key = first->second;
+        expiry_queue_.erase(first);
+        deadlines_.erase(key);
+        expiring_ = deadlines_.size();
+        lock.unlock();
+
+        kv_.remove(key, WriteAck{}, [this, key](KVStatus status)
+                   {
+            if (status == KVStatus::Overloaded)
+                expire_at(key, Clock::now() + EXPIRE_RETRY);
+            else if (status == KVStatus::Failed)
+                fprintf(stderr, "[RespServer] expiring %s failed\n", key.c_str()); });
+        lock.lock();
+    }
+}
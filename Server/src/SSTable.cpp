@@ -0,0 +1,362 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "SSTable.h"
+#include "LogFormat.h"
+
+using namespace std;
+
+static const uint64_t SSTABLE_MAGIC = 0x4b5653535442304cull; // "L0BTSSVK"
+static const size_t FOOTER_SIZE = 7 * 8;
+static const size_t ENTRY_HEADER_SIZE = 1 + 4 + 4;
+
+// FNV-1a: the filter is persisted, so it needs a hash that is stable
+// across builds (std::hash is not)
+static uint64_t bloom_hash(const string &key)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void pread_all(int fd, char *buf, size_t len, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pread(fd, buf + done, len - done, offset + done);
+        if (n <= 0)
+            throw runtime_error("sstable: short read");
+        done += n;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------------------
+
+SSTableWriter::SSTableWriter(const std::string &path, size_t block_size, int bloom_bits_per_key)
+    : path_(path), block_size_(block_size), bloom_bits_per_key_(bloom_bits_per_key)
+{
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+        throw runtime_error("sstable: cannot create " + path);
+}
+
+SSTableWriter::~SSTableWriter()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+void SSTableWriter::write(const std::string &data)
+{
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0)
+    {
+        ssize_t n = ::write(fd_, p, left);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error("sstable: write failed: " + string(strerror(errno)));
+        }
+        p += n;
+        left -= n;
+    }
+    offset_ += data.size();
+}
+
+void SSTableWriter::add(const std::string &key, const std::string &value, bool tombstone)
+{
+    if (num_entries_ == 0)
+        smallest_ = key;
+
+    block_.push_back(tombstone ? (char)LOG_FLAG_TOMBSTONE : (char)LOG_FLAG_PUT);
+    put_fixed<uint32_t>(block_, key.size());
+    put_fixed<uint32_t>(block_, value.size());
+    block_ += key;
+    block_ += value;
+
+    last_key_ = key;
+    key_hashes_.push_back(bloom_hash(key));
+    num_entries_++;
+
+    if (block_.size() >= block_size_)
+        flush_block();
+}
+
+void SSTableWriter::flush_block()
+{
+    if (block_.empty())
+        return;
+    put_fixed<uint32_t>(index_, last_key_.size());
+    index_ += last_key_;
+    put_fixed<uint64_t>(index_, offset_);
+    put_fixed<uint32_t>(index_, block_.size());
+    write(block_);
+    block_.clear();
+}
+
+uint64_t SSTableWriter::finish()
+{
+    flush_block();
+
+    uint64_t index_off = offset_;
+    write(index_);
+
+    // Bloom filter with k = bits_per_key * ln2, probed by double hashing
+    size_t bits = std::max<size_t>(64, key_hashes_.size() * bloom_bits_per_key_);
+    size_t bytes = (bits + 7) / 8;
+    bits = bytes * 8;
+    uint32_t k = std::clamp(static_cast<int>(bloom_bits_per_key_ * 0.69), 1, 30);
+    string bloom(bytes, '\0');
+    for (uint64_t h : key_hashes_)
+    {
+        uint64_t delta = (h >> 33) | 1;
+        for (uint32_t i = 0; i < k; ++i)
+        {
+            size_t bit = h % bits;
+            bloom[bit / 8] |= (char)(1 << (bit % 8));
+            h += delta;
+        }
+    }
+    string bloom_block;
+    put_fixed<uint32_t>(bloom_block, k);
+    bloom_block += bloom;
+    uint64_t bloom_off = offset_;
+    write(bloom_block);
+
+    string meta;
+    put_fixed<uint64_t>(meta, num_entries_);
+    put_fixed<uint32_t>(meta, smallest_.size());
+    meta += smallest_;
+    put_fixed<uint32_t>(meta, last_key_.size());
+    meta += last_key_;
+    uint64_t meta_off = offset_;
+    write(meta);
+
+    string footer;
+    put_fixed<uint64_t>(footer, index_off);
+    put_fixed<uint64_t>(footer, index_.size());
+    put_fixed<uint64_t>(footer, bloom_off);
+    put_fixed<uint64_t>(footer, bloom_block.size());
+    put_fixed<uint64_t>(footer, meta_off);
+    put_fixed<uint64_t>(footer, meta.size());
+    put_fixed<uint64_t>(footer, SSTABLE_MAGIC);
+    write(footer);
+
+    if (fdatasync(fd_) != 0)
+        throw runtime_error("sstable: fdatasync failed for " + path_);
+    close(fd_);
+    fd_ = -1;
+    return offset_;
+}
+
+// ---------------------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------------------
+
+std::shared_ptr<SSTable> SSTable::open(const std::string &path, uint64_t id)
+{
+    shared_ptr<SSTable> t(new SSTable());
+    t->path_ = path;
+    t->id_ = id;
+    t->fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (t->fd_ < 0)
+        throw runtime_error("sstable: cannot open " + path);
+    t->file_size_ = lseek(t->fd_, 0, SEEK_END);
+    if (t->file_size_ < FOOTER_SIZE)
+        throw runtime_error("sstable: truncated " + path);
+
+    char footer[FOOTER_SIZE];
+    pread_all(t->fd_, footer, FOOTER_SIZE, t->file_size_ - FOOTER_SIZE);
+    uint64_t f[7];
+    for (int i = 0; i < 7; ++i)
+        f[i] = get_fixed<uint64_t>(footer + i * 8);
+    if (f[6] != SSTABLE_MAGIC)
+        throw runtime_error("sstable: bad magic in " + path);
+
+    string index(f[1], '\0');
+    pread_all(t->fd_, index.data(), index.size(), f[0]);
+    for (size_t pos = 0; pos < index.size();)
+    {
+        BlockHandle h;
+        uint32_t klen = get_fixed<uint32_t>(&index[pos]);
+        h.last_key = index.substr(pos + 4, klen);
+        pos += 4 + klen;
+        h.offset = get_fixed<uint64_t>(&index[pos]);
+        h.size = get_fixed<uint32_t>(&index[pos + 8]);
+        pos += 12;
+        t->blocks_.push_back(std::move(h));
+    }
+
+    string bloom(f[3], '\0');
+    pread_all(t->fd_, bloom.data(), bloom.size(), f[2]);
+    t->bloom_k_ = get_fixed<uint32_t>(bloom.data());
+    t->bloom_ = bloom.substr(4);
+
+    string meta(f[5], '\0');
+    pread_all(t->fd_, meta.data(), meta.size(), f[4]);
+    t->num_entries_ = get_fixed<uint64_t>(meta.data());
+    uint32_t slen = get_fixed<uint32_t>(&meta[8]);
+    t->smallest_ = meta.substr(12, slen);
+    uint32_t llen = get_fixed<uint32_t>(&meta[12 + slen]);
+    t->largest_ = meta.substr(16 + slen, llen);
+    return t;
+}
+
+SSTable::~SSTable()
+{
+    if (fd_ >= 0)
+        close(fd_);
+    if (obsolete_)
+        unlink(path_.c_str());
+}
+
+bool SSTable::may_contain(const std::string &key) const
+{
+    if (bloom_.empty())
+        return true;
+    size_t bits = bloom_.size() * 8;
+    uint64_t h = bloom_hash(key);
+    uint64_t delta = (h >> 33) | 1;
+    for (uint32_t i = 0; i < bloom_k_; ++i)
+    {
+        size_t bit = h % bits;
+        if (!(bloom_[bit / 8] & (1 << (bit % 8))))
+            return false;
+        h += delta;
+    }
+    return true;
+}
+
+std::string SSTable::read_block(size_t index) const
+{
+    string block(blocks_[index].size, '\0');
+    pread_all(fd_, block.data(), block.size(), blocks_[index].offset);
+    return block;
+}
+
+SSTable::Lookup SSTable::get(const std::string &key, std::string &value) const
+{
+    if (key < smallest_ || largest_ < key || !may_contain(key))
+        return Lookup::NotFound;
+
+    // First block whose last key is >= key
+    auto it = std::lower_bound(blocks_.begin(), blocks_.end(), key,
+                               [](const BlockHandle &h, const string &k)
+                               { return h.last_key < k; });
+    if (it == blocks_.end())
+        return Lookup::NotFound;
+
+    string block = read_block(it - blocks_.begin());
+    for (size_t pos = 0; pos + ENTRY_HEADER_SIZE <= block.size();)
+    {
+        uint8_t flags = block[pos];
+        uint32_t klen = get_fixed<uint32_t>(&block[pos + 1]);
+        uint32_t vlen = get_fixed<uint32_t>(&block[pos + 5]);
+        int cmp = key.compare(0, string::npos, block, pos + ENTRY_HEADER_SIZE, klen);
+        if (cmp == 0)
+        {
+            if (flags == LOG_FLAG_TOMBSTONE)
+                return Lookup::Deleted;
+            value.assign(block, pos + ENTRY_HEADER_SIZE + klen, vlen);
+            return Lookup::Found;
+        }
+        if (cmp < 0)
+            break; // keys are sorted, it is not here
+        pos += ENTRY_HEADER_SIZE + klen + vlen;
+    }
+    return Lookup::NotFound;
+}
+
+// Walks the table one block at a time
+class SSTableIterator : public KVIterator
+{
+public:
+    explicit SSTableIterator(shared_ptr<const SSTable> table) : table_(std::move(table))
+    {
+        load_block(0);
+    }
+
+    bool valid() const override { return valid_; }
+    const string &key() const override { return key_; }
+    const string &value() const override { return value_; }
+    bool tombstone() const override { return tombstone_; }
+
+    void seek(const string &target) override
+    {
+        auto &blocks = table_->blocks_;
+        auto it = std::lower_bound(blocks.begin(), blocks.end(), target,
+                                   [](const SSTable::BlockHandle &h, const string &k)
+                                   { return h.last_key < k; });
+        load_block(it - blocks.begin());
+        while (valid_ && key_ < target)
+            next();
+    }
+
+    void next() override
+    {
+        if (pos_ >= block_.size())
+        {
+            load_block(block_index_ + 1);
+            return;
+        }
+        parse();
+    }
+
+private:
+    void load_block(size_t index)
+    {
+        block_index_ = index;
+        if (index >= table_->blocks_.size())
+        {
+            valid_ = false;
+            return;
+        }
+        block_ = table_->read_block(index);
+        pos_ = 0;
+        parse();
+    }
+
+    void parse()
+    {
+        if (pos_ + ENTRY_HEADER_SIZE > block_.size())
+        {
+            load_block(block_index_ + 1);
+            return;
+        }
+        tombstone_ = block_[pos_] == (char)LOG_FLAG_TOMBSTONE;
+        uint32_t klen = get_fixed<uint32_t>(&block_[pos_ + 1]);
+        uint32_t vlen = get_fixed<uint32_t>(&block_[pos_ + 5]);
+        key_.assign(block_, pos_ + ENTRY_HEADER_SIZE, klen);
+        value_.assign(block_, pos_ + ENTRY_HEADER_SIZE + klen, vlen);
+        pos_ += ENTRY_HEADER_SIZE + klen + vlen;
+        valid_ = true;
+    }
+
+    shared_ptr<const SSTable> table_;
+    size_t block_index_ = 0;
+    string block_;
+    size_t pos_ = 0;
+    bool valid_ = false;
+    string key_, value_;
+    bool tombstone_ = false;
+};
+
+std::unique_ptr<KVIterator> SSTable::iterator() const
+{
+    return make_unique<SSTableIterator>(shared_from_this());
+}
@@ -0,0 +1,166 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
+#include <cstdlib>
+#include <chrono>
+#include "StorageEngine.h"
+#include "MySQLEngine.h"
+#include "MemoryEngine.h"
+#include "BitcaskEngine.h"
+#include "LSMEngine.h"
+
+using namespace std;
+
+std::future<std::string> StorageEngine::get(const std::string &key)
+{
+    auto promise = make_shared<std::promise<string>>();
+    auto fut = promise->get_future();
+    get(key, [promise](bool ok, string value)
+        {
+        if (ok)
+            promise->set_value(std::move(value));
+        else
+            promise->set_exception(make_exception_ptr(runtime_error("storage read failed"))); });
+    return fut;
+}
+
+void StorageEngine::multi_get(const std::vector<std::string> &keys, MultiGetCallback cb)
+{
+    if (keys.empty())
+    {
+        cb(true, {});
+        return;
+    }
+
+    // Shared between the per-key callbacks; the last one to finish reports
+    struct State
+    {
+        vector<string> values;
+        atomic<size_t> remaining;
+        atomic<bool> ok{true};
+        MultiGetCallback cb;
+    };
+    auto state = make_shared<State>();
+    state->values.resize(keys.size());
+    state->remaining = keys.size();
+    state->cb = std::move(cb);
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        get(keys[i], [state, i](bool ok, string value)
+            {
+            if (ok)
+                state->values[i] = std::move(value);
+            else
+                state->ok = false;
+            if (--state->remaining == 0)
+                state->cb(state->ok, std::move(state->values)); });
+    }
+}
+
+// Joins the commit callbacks of a group of writes into one
+static StorageEngine::WriteCallback join_commits(size_t count, StorageEngine::WriteCallback on_commit)
+{
+    if (!on_commit)
+        return nullptr;
+
+    struct State
+    {
+        atomic<size_t> remaining;
+        atomic<bool> ok{true};
+        StorageEngine::WriteCallback cb;
+    };
+    auto state = make_shared<State>();
+    state->remaining = count;
+    state->cb = std::move(on_commit);
+    return [state](bool ok)
+    {
+        if (!ok)
+            state->ok = false;
+        if (--state->remaining == 0)
+            state->cb(state->ok);
+    };
+}
+
+bool StorageEngine::multi_put(const KeyValues &kvs, WriteCallback on_commit, Durability durability)
+{
+    if (kvs.empty())
+    {
+        if (on_commit)
+            on_commit(true);
+        return true;
+    }
+
+    auto done = join_commits(kvs.size(), std::move(on_commit));
+    bool accepted = true;
+    for (auto &kv : kvs)
+    {
+        // Rejected writes never call back; count them as failed
+        if (!put(kv.first, kv.second, done, durability))
+        {
+            accepted = false;
+            if (done)
+                done(false);
+        }
+    }
+    return accepted;
+}
+
+bool StorageEngine::multi_remove(const std::vector<std::string> &keys, WriteCallback on_commit,
+                                 Durability durability)
+{
+    if (keys.empty())
+    {
+        if (on_commit)
+            on_commit(true);
+        return true;
+    }
+
+    auto done = join_commits(keys.size(), std::move(on_commit));
+    bool accepted = true;
+    for (auto &key : keys)
+    {
+        if (!remove(key, done, durability))
+        {
+            accepted = false;
+            if (done)
+                done(false);
+        }
+    }
+    return accepted;
+}
+
+std::unique_ptr<StorageEngine> create_storage_engine(const std::string &name)
+{
+    if (name == "mysql")
+    {
+        MySQLConfig config;
+        if (const char *dir = getenv("KV_DATA_DIR"))
+            config.wal_dir = string(dir) + "/wal";
+        // e.g. KV_MYSQL_SHARDS=127.0.0.1:3306/KVStore,127.0.0.1:3307/KVStore
+        if (const char *shards = getenv("KV_MYSQL_SHARDS"))
+            config.shards = parse_mysql_shards(shards);
+        if (const char *ms = getenv("KV_DB_READ_TIMEOUT_MS"))
+            config.read_timeout = chrono::milliseconds(stol(ms));
+        return make_unique<MySQLEngine>(config);
+    }
+    if (name == "memory")
+        return make_unique<MemoryEngine>();
+    if (name == "bitcask")
+    {
+        BitcaskConfig config;
+        if (const char *dir = getenv("KV_DATA_DIR"))
+            config.dir = string(dir) + "/bitcask";
+        return make_unique<BitcaskEngine>(config);
+    }
+    if (name == "lsm")
+    {
+        LSMConfig config;
+        if (const char *dir = getenv("KV_DATA_DIR"))
+            config.dir = string(dir) + "/lsm";
+        return make_unique<LSMEngine>(config);
+    }
+    throw std::invalid_argument("Unknown storage engine: " + name);
+}
@@ -0,0 +1,36 @@
+#include <algorithm>
+#include "Task.h"
+
+using namespace std;
+
+static const char *STAGE_NAMES[] = {"parse", "cache", "db", "respond"};
+
+void StageTimings::record(Stage stage, chrono::steady_clock::duration elapsed)
+{
+    Counter &c = counters_[(size_t)stage];
+    uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+    // Only one thread writes, so plain loads and stores are enough
+    c.count.store(c.count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    c.total_ns.store(c.total_ns.load(memory_order_relaxed) + ns, memory_order_relaxed);
+    if (ns > c.max_ns.load(memory_order_relaxed))
+        c.max_ns.store(ns, memory_order_relaxed);
+}
+
+void StageTimings::report(const vector<const StageTimings *> &all, nlohmann::json &out)
+{
+    for (size_t i = 0; i < STAGES; ++i)
+    {
+        uint64_t count = 0, total_ns = 0, max_ns = 0;
+        for (const StageTimings *t : all)
+        {
+            const Counter &c = t->counters_[i];
+            count += c.count.load(memory_order_relaxed);
+            total_ns += c.total_ns.load(memory_order_relaxed);
+            max_ns = std::max(max_ns, c.max_ns.load(memory_order_relaxed));
+        }
+        nlohmann::json &stage = out[STAGE_NAMES[i]];
+        stage["count"] = count;
+        stage["avg_us"] = count ? total_ns / 1000.0 / count : 0.0;
+        stage["max_us"] = max_ns / 1000.0;
+    }
+}
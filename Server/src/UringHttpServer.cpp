@@ -0,0 +1,1073 @@
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include <chrono>
+#include <coroutine>
+#include "UringHttpServer.h"
+#include "EventServer.h"
+#include "KeyJson.h"
+#include "KVTask.h"
+
+using namespace std;
+
+// Same per-connection limits as the epoll front ends
+static const size_t MAX_IN_FLIGHT = 4096;
+static const size_t MAX_PENDING_OUTPUT = 4 << 20;
+// Largest POST body
+static const size_t MAX_BODY = 16 << 20;
+
+// Receive buffers are only held while their data is parsed or copied
+// out, so a few hundred per ring serve any number of idle connections
+static const unsigned SQ_ENTRIES = 4096;
+static const unsigned CQ_ENTRIES = 16384;
+static const unsigned BUF_COUNT = 256; // power of two
+static const unsigned BUF_SIZE = 16 << 10;
+static const uint16_t BUF_GROUP = 0;
+
+// user_data of a submission: connection id << 3 | operation
+enum Op : uint64_t
+{
+    OP_ACCEPT,
+    OP_WAKE,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL,
+};
+
+static uint64_t tag(uint64_t id, Op op)
+{
+    return id << 3 | op;
+}
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// One io_uring instance: the submission and completion queues mapped
+// from the kernel. Only the ring's own thread touches it after init().
+struct Ring
+{
+    int fd = -1;
+    void *queues = MAP_FAILED;
+    size_t queues_size = 0;
+    io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+    size_t sqes_size = 0;
+    bool disabled = false;
+
+    unsigned *sq_head = nullptr, *sq_tail = nullptr;
+    unsigned sq_mask = 0, sq_entries = 0, sq_local_tail = 0;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+
+    void init()
+    {
+        // Created disabled, so the thread that enables it becomes its
+        // single issuer and the kernel can defer task work to our waits
+        io_uring_params p{};
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+                  IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+        p.cq_entries = CQ_ENTRIES;
+        fd = sys_io_uring_setup(SQ_ENTRIES, &p);
+        if (fd < 0 && errno == EINVAL)
+        {
+            // Kernels before 6.1
+            p = io_uring_params{};
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = CQ_ENTRIES;
+            fd = sys_io_uring_setup(SQ_ENTRIES, &p);
+        }
+        if (fd < 0)
+            throw runtime_error(string("io_uring_setup: ") + strerror(errno));
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP))
+            throw runtime_error("io_uring: kernel too old");
+        disabled = p.flags & IORING_SETUP_R_DISABLED;
+
+        queues_size = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                               p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+        queues = mmap(nullptr, queues_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe *)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                    IORING_OFF_SQES);
+        if (queues == MAP_FAILED || sqes == MAP_FAILED)
+            throw runtime_error(string("io_uring mmap: ") + strerror(errno));
+
+        char *base = (char *)queues;
+        sq_head = (unsigned *)(base + p.sq_off.head);
+        sq_tail = (unsigned *)(base + p.sq_off.tail);
+        sq_mask = *(unsigned *)(base + p.sq_off.ring_mask);
+        sq_entries = p.sq_entries;
+        sq_local_tail = *sq_tail;
+        // Submission slot i always holds sqes[i]
+        unsigned *array = (unsigned *)(base + p.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; ++i)
+            array[i] = i;
+        cq_head = (unsigned *)(base + p.cq_off.head);
+        cq_tail = (unsigned *)(base + p.cq_off.tail);
+        cq_mask = *(unsigned *)(base + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(base + p.cq_off.cqes);
+    }
+
+    // On the ring's thread, before the first submission
+    bool enable()
+    {
+        return !disabled || sys_io_uring_register(fd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) == 0;
+    }
+
+    io_uring_sqe *get_sqe()
+    {
+        // Full: hand the queued entries to the kernel to make room
+        while (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+            submit(0);
+        io_uring_sqe *sqe = &sqes[sq_local_tail & sq_mask];
+        sq_local_tail++;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Submits everything queued and waits for wait_nr completions
+    int submit(unsigned wait_nr)
+    {
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        unsigned to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        return sys_io_uring_enter(fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS);
+    }
+
+    bool next(io_uring_cqe &cqe)
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            return false;
+        cqe = cqes[head & cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    void close_ring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        if (queues != MAP_FAILED)
+            munmap(queues, queues_size);
+        if (fd >= 0)
+            close(fd);
+        sqes = (io_uring_sqe *)MAP_FAILED;
+        queues = MAP_FAILED;
+        fd = -1;
+    }
+};
+
+struct UringHttpServer::Connection
+{
+    int fd;
+    uint64_t id;
+    Loop *loop;
+    string in;      // unparsed bytes that did not fit one receive
+    string out;     // responses waiting for the send in flight
+    string sending; // bytes of the send in flight
+    size_t sent = 0;
+    size_t in_flight = 0;
+    bool send_busy = false;
+    bool recv_armed = false;
+    bool recv_cancelled = false; // asked the kernel to stop receiving
+    bool continue_sent = false;
+    bool last_request = false; // "Connection: close" or a broken request seen
+    bool shut = false;         // shut down, freed once the ring lets go
+
+    // Ordered responses not yet moved to out, oldest first;
+    // slots.front() is number first_slot
+    struct Slot
+    {
+        bool ready = false;
+        string data;
+    };
+    deque<Slot> slots;
+    uint64_t first_slot = 1;
+
+    bool paused() const
+    {
+        return in_flight >= MAX_IN_FLIGHT || out.size() >= MAX_PENDING_OUTPUT;
+    }
+
+    void complete(uint64_t slot, string data)
+    {
+        in_flight--;
+        Slot &s = slots[slot - first_slot];
+        s.data = std::move(data);
+        s.ready = true;
+        while (!slots.empty() && slots.front().ready)
+        {
+            out += slots.front().data;
+            slots.pop_front();
+            first_slot++;
+        }
+    }
+};
+
+struct UringHttpServer::Loop : enable_shared_from_this<UringHttpServer::Loop>, Scheduler
+{
+    Ring ring;
+    int listen_fd = -1;
+    int wake_fd = -1;
+    uint64_t wake_count = 0; // where the pending eventfd read lands
+    thread worker;
+    unordered_map<uint64_t, Connection> conns;
+    uint64_t next_id = 1;
+    bool accepting = false;     // multishot accept armed
+    bool shutting_down = false; // stop seen, waiting for connections to drain
+
+    // Receive buffers the kernel picks from, and the ring handing them over
+    io_uring_buf_ring *buf_ring = (io_uring_buf_ring *)MAP_FAILED;
+    char *buffers = (char *)MAP_FAILED;
+    uint16_t buf_tail = 0;
+
+    // Responses completed on other threads: connection, slot, bytes
+    struct Completion
+    {
+        uint64_t conn_id;
+        uint64_t slot;
+        string data;
+    };
+    mutex mtx;
+    vector<Completion> completed;
+    vector<coroutine_handle<>> resumable; // Tasks to resume on this ring
+    bool draining = false;                // drain_completions() will see new ones
+    bool stopping = false;
+
+    StageTimings timings; // written by this ring's thread only
+
+    // Wakes the ring for the first completion or Task since it last drained
+    void wake_locked()
+    {
+        if (draining || completed.size() + resumable.size() != 1)
+            return;
+        uint64_t one = 1;
+        ssize_t n = write(wake_fd, &one, sizeof(one));
+        (void)n; // the counter can't overflow at one write per drain
+    }
+
+    void schedule(coroutine_handle<> task) override
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            if (!stopping)
+            {
+                resumable.push_back(task);
+                wake_locked();
+                return;
+            }
+        }
+        task.destroy();
+    }
+
+    void init_buffers()
+    {
+        buf_ring = (io_uring_buf_ring *)mmap(nullptr, BUF_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        buffers = (char *)mmap(nullptr, (size_t)BUF_COUNT * BUF_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_ring == MAP_FAILED || buffers == MAP_FAILED)
+            throw runtime_error(string("receive buffers: ") + strerror(errno));
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = (uint64_t)buf_ring;
+        reg.ring_entries = BUF_COUNT;
+        reg.bgid = BUF_GROUP;
+        if (sys_io_uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            throw runtime_error(string("registering receive buffers: ") + strerror(errno));
+        for (unsigned bid = 0; bid < BUF_COUNT; ++bid)
+            provide(bid);
+    }
+
+    // Hands buffer bid (back) to the kernel
+    void provide(uint16_t bid)
+    {
+        // Not buf_ring->bufs: in C++ the header's flexible array sits
+        // after an empty struct, one slot too far. Field by field, as
+        // entry 0 shares its last bytes with the tail.
+        io_uring_buf &buf = ((io_uring_buf *)buf_ring)[buf_tail & (BUF_COUNT - 1)];
+        buf.addr = (uint64_t)(buffers + (size_t)bid * BUF_SIZE);
+        buf.len = BUF_SIZE;
+        buf.bid = bid;
+        buf_tail++;
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    void arm_accept()
+    {
+        io_uring_sqe *sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = tag(0, OP_ACCEPT);
+        accepting = true;
+    }
+
+    void arm_wake()
+    {
+        io_uring_sqe *sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = wake_fd;
+        sqe->addr = (uint64_t)&wake_count;
+        sqe->len = sizeof(wake_count);
+        sqe->user_data = tag(0, OP_WAKE);
+    }
+
+    // Keeps receiving into the registered buffers until cancelled
+    void arm_recv(Connection &conn)
+    {
+        io_uring_sqe *sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn.fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        sqe->user_data = tag(conn.id, OP_RECV);
+        conn.recv_armed = true;
+        conn.recv_cancelled = false;
+    }
+
+    void cancel(uint64_t target, uint64_t id)
+    {
+        io_uring_sqe *sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = tag(id, OP_CANCEL);
+    }
+
+    // Sends what is left of conn.sending
+    void send_rest(Connection &conn)
+    {
+        io_uring_sqe *sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn.fd;
+        sqe->addr = (uint64_t)(conn.sending.data() + conn.sent);
+        sqe->len = conn.sending.size() - conn.sent;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = tag(conn.id, OP_SEND);
+        conn.send_busy = true;
+    }
+
+    ~Loop()
+    {
+        // The ring goes first, so the kernel is done with our memory
+        ring.close_ring();
+        for (auto &c : conns)
+            close(c.second.fd);
+        if (buffers != MAP_FAILED)
+            munmap(buffers, (size_t)BUF_COUNT * BUF_SIZE);
+        if (buf_ring != MAP_FAILED)
+            munmap(buf_ring, BUF_COUNT * sizeof(io_uring_buf));
+        if (listen_fd >= 0)
+            close(listen_fd);
+        if (wake_fd >= 0)
+            close(wake_fd);
+    }
+};
+
+void UringHttpServer::Reply::send(string bytes) const
+{
+    lock_guard<mutex> lock(loop_->mtx);
+    // Dropped if the server is stopping; a closed connection drops it later
+    if (loop_->stopping)
+        return;
+    loop_->completed.push_back({conn_id_, slot_, std::move(bytes)});
+    loop_->wake_locked();
+}
+
+static void append_response(string &out, const char *status, string_view body, bool close,
+                            const char *extra_headers = "", const char *content_type = "application/json")
+{
+    out += "HTTP/1.1 ";
+    out += status;
+    out += "\r\nContent-Type: ";
+    out += content_type;
+    out += "\r\n";
+    out += extra_headers;
+    out += "Content-Length: ";
+    out += to_string(body.size());
+    out += close ? "\r\nConnection: close\r\n\r\n" : "\r\n\r\n";
+    out += body;
+}
+
+// Response bodies are built in per-thread buffers and then copied once,
+// behind their head, into the connection's output
+static string &json_body()
+{
+    thread_local string body;
+    // Don't keep a large value's worth of memory per thread
+    if (body.capacity() > (1 << 20))
+        string().swap(body);
+    body.clear();
+    return body;
+}
+
+// Separate from json_body(), so an error can replace a body being built
+static const string &error_body(string_view message)
+{
+    thread_local string body;
+    body.clear();
+    keyjson::append_error(body, message);
+    return body;
+}
+
+// The answer to a write, as the civetweb handlers give it
+static string write_response(KVStatus status, const char *ok_status, string_view ok_body, bool close)
+{
+    string out;
+    if (status == KVStatus::Ok)
+        append_response(out, ok_status, ok_body, close);
+    else if (status == KVStatus::Overloaded)
+        append_response(out, "503 Service Unavailable", error_body("Write backlog is full, retry later"), close,
+                        "Retry-After: 1\r\n");
+    else
+        append_response(out, "500 Internal Server Error", error_body("Write could not be persisted"), close);
+    return out;
+}
+
+// The answer to a read, as JSON or, for /key/<key>, the raw value. An
+// empty value means not found.
+static void append_read(string &out, const string &key, const string &value, bool raw, bool close)
+{
+    if (raw && !value.empty())
+    {
+        append_response(out, "200 OK", value, close, "", "application/octet-stream");
+        return;
+    }
+    string &body = json_body();
+    if (value.empty())
+        keyjson::append_not_found(body, key);
+    else
+        keyjson::append_value(body, key, value);
+    append_response(out, raw && value.empty() ? "404 Not Found" : "200 OK", body, close);
+}
+
+// The key of /key/<key>, URL-decoded. False if the path has none.
+static bool path_key(string_view path, string &key)
+{
+    return path.size() > 5 && path.substr(0, 5) == "/key/" && http_url_decode(path.substr(5), key, false);
+}
+
+// ?durability=, false if it has an unknown value
+static bool parse_write_ack(string_view query, WriteAck &ack)
+{
+    string level;
+    if (!http_query_param(query, "durability", level))
+        return true;
+    if (level == "memory")
+        ack.wait = false;
+    else if (level == "log")
+        ack.durability = Durability::Log;
+    else if (level == "db")
+        ack.durability = Durability::Database;
+    else
+        return false;
+    return true;
+}
+
+UringHttpServer::UringHttpServer(KVService &kv, const UringHttpServerConfig &config)
+    : kv_(kv)
+{
+    size_t threads = std::max<size_t>(config.threads, 1);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        auto loop = make_shared<Loop>();
+        loop->listen_fd = listen_reuseport(config.port);
+        // Blocking: the ring waits on it like on a socket
+        loop->wake_fd = eventfd(0, EFD_CLOEXEC);
+        if (loop->wake_fd < 0)
+            throw runtime_error(string("eventfd: ") + strerror(errno));
+        loop->ring.init();
+        loop->init_buffers();
+        loops_.push_back(loop);
+    }
+    for (auto &loop : loops_)
+        loop->worker = thread(&UringHttpServer::run, this, std::ref(*loop));
+}
+
+UringHttpServer::~UringHttpServer()
+{
+    for (auto &loop : loops_)
+    {
+        lock_guard<mutex> lock(loop->mtx);
+        loop->stopping = true;
+        uint64_t one = 1;
+        ssize_t n = write(loop->wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+    for (auto &loop : loops_)
+        if (loop->worker.joinable())
+            loop->worker.join();
+}
+
+void UringHttpServer::report_stats(nlohmann::json &out) const
+{
+    out["connections"] = connections_.load();
+    out["accepted"] = accepted_.load();
+    out["requests"] = requests_.load();
+    out["protocol_errors"] = protocol_errors_.load();
+    vector<const StageTimings *> timings;
+    for (auto &loop : loops_)
+        timings.push_back(&loop->timings);
+    StageTimings::report(timings, out["stages"]);
+}
+
+void UringHttpServer::run(Loop &loop)
+{
+    if (!loop.ring.enable())
+    {
+        fprintf(stderr, "[UringHttpServer] cannot enable ring: %s\n", strerror(errno));
+        return;
+    }
+    loop.arm_wake();
+    loop.arm_accept();
+
+    while (!(loop.shutting_down && loop.conns.empty() && !loop.accepting))
+    {
+        if (loop.ring.submit(1) < 0 && errno != EINTR && errno != EBUSY)
+        {
+            fprintf(stderr, "[UringHttpServer] io_uring_enter failed: %s\n", strerror(errno));
+            return;
+        }
+
+        io_uring_cqe cqe;
+        while (loop.ring.next(cqe))
+        {
+            uint64_t id = cqe.user_data >> 3;
+            bool more = cqe.flags & IORING_CQE_F_MORE;
+            switch (cqe.user_data & 7)
+            {
+            case OP_ACCEPT:
+                on_accept(loop, cqe.res);
+                if (!more)
+                {
+                    loop.accepting = false;
+                    // After an error (out of fds) a closing connection re-arms it
+                    if (cqe.res >= 0 && !loop.shutting_down)
+                        loop.arm_accept();
+                }
+                break;
+
+            case OP_WAKE:
+            {
+                bool stopping;
+                vector<coroutine_handle<>> abandoned;
+                {
+                    lock_guard<mutex> lock(loop.mtx);
+                    stopping = loop.stopping;
+                    if (stopping)
+                        abandoned.swap(loop.resumable);
+                }
+                if (!stopping)
+                {
+                    drain_completions(loop);
+                    loop.arm_wake();
+                    break;
+                }
+                // Their responses would be dropped anyway
+                for (coroutine_handle<> task : abandoned)
+                    task.destroy();
+                // Let go of every connection, then of the ring
+                loop.shutting_down = true;
+                if (loop.accepting)
+                    loop.cancel(tag(0, OP_ACCEPT), 0);
+                vector<uint64_t> ids;
+                for (auto &c : loop.conns)
+                    ids.push_back(c.first);
+                for (uint64_t conn_id : ids)
+                {
+                    Connection &conn = loop.conns.at(conn_id);
+                    shut_down(loop, conn);
+                    update(loop, conn);
+                }
+                break;
+            }
+
+            case OP_RECV:
+            {
+                bool has_buffer = cqe.flags & IORING_CQE_F_BUFFER;
+                uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                auto it = loop.conns.find(id);
+                if (it == loop.conns.end())
+                {
+                    if (has_buffer)
+                        loop.provide(bid);
+                    break;
+                }
+                Connection &conn = it->second;
+                if (!more)
+                    conn.recv_armed = false;
+                if (cqe.res > 0 && !conn.shut)
+                    on_recv(loop, conn, loop.buffers + (size_t)bid * BUF_SIZE, cqe.res);
+                if (has_buffer)
+                    loop.provide(bid);
+                // Out of buffers just ends this receive; update() re-arms it
+                if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED))
+                    shut_down(loop, conn);
+                update(loop, conn);
+                break;
+            }
+
+            case OP_SEND:
+            {
+                auto it = loop.conns.find(id);
+                if (it != loop.conns.end())
+                    on_send(loop, it->second, cqe.res);
+                break;
+            }
+
+            default: // OP_CANCEL, whatever the outcome
+                break;
+            }
+        }
+    }
+}
+
+void UringHttpServer::on_accept(Loop &loop, int res)
+{
+    if (res < 0)
+    {
+        if (res != -ECANCELED)
+            fprintf(stderr, "[UringHttpServer] accept failed: %s\n", strerror(-res));
+        return;
+    }
+    int on = 1;
+    setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    uint64_t id = loop.next_id++;
+    Connection &conn = loop.conns[id];
+    conn.fd = res;
+    conn.id = id;
+    conn.loop = &loop;
+    connections_++;
+    accepted_++;
+    if (loop.shutting_down)
+        shut_down(loop, conn);
+    update(loop, conn);
+}
+
+void UringHttpServer::on_recv(Loop &loop, Connection &conn, const char *data, size_t len)
+{
+    // Common case: whole requests, parsed straight from the kernel's buffer
+    if (conn.in.empty())
+    {
+        size_t used = consume(conn, data, len);
+        conn.in.assign(data + used, len - used);
+        return;
+    }
+    conn.in.append(data, len);
+    conn.in.erase(0, consume(conn, conn.in.data(), conn.in.size()));
+}
+
+void UringHttpServer::on_send(Loop &loop, Connection &conn, int res)
+{
+    conn.send_busy = false;
+    if (res < 0)
+        shut_down(loop, conn);
+    else
+    {
+        conn.sent += res;
+        if (conn.sent < conn.sending.size() && !conn.shut)
+        {
+            loop.send_rest(conn);
+            return;
+        }
+        conn.sending.clear();
+    }
+    update(loop, conn);
+}
+
+void UringHttpServer::drain_completions(Loop &loop)
+{
+    vector<uint64_t> touched;
+    vector<Loop::Completion> completed;
+    vector<coroutine_handle<>> resumable;
+    for (;;)
+    {
+        {
+            lock_guard<mutex> lock(loop.mtx);
+            completed.swap(loop.completed);
+            resumable.swap(loop.resumable);
+            // Until both stay empty, what arrives is picked up here
+            // without another wakeup
+            loop.draining = !completed.empty() || !resumable.empty();
+            if (!loop.draining)
+                break;
+        }
+        // Resumed Tasks answer through completed, taken on the next round
+        for (coroutine_handle<> task : resumable)
+            task.resume();
+        resumable.clear();
+        for (auto &c : completed)
+        {
+            auto it = loop.conns.find(c.conn_id);
+            if (it == loop.conns.end())
+                continue;
+            it->second.complete(c.slot, std::move(c.data));
+            touched.push_back(c.conn_id);
+        }
+        completed.clear();
+    }
+    // Sends the responses, and resumes parsing on connections that were paused
+    for (uint64_t id : touched)
+    {
+        auto it = loop.conns.find(id);
+        if (it != loop.conns.end())
+            update(loop, it->second);
+    }
+}
+
+size_t UringHttpServer::consume(Connection &conn, const char *data, size_t len)
+{
+    size_t used = 0;
+    while (!conn.paused() && !conn.last_request && used < len)
+    {
+        HttpRequest req;
+        HttpParse parsed;
+        {
+            StageTimer timer(conn.loop->timings, Stage::Parse);
+            parsed = parse_http_request(data + used, len - used, req);
+        }
+        if (parsed == HttpParse::Incomplete)
+            break;
+
+        const char *reject = nullptr;
+        string message;
+        if (parsed == HttpParse::Invalid)
+        {
+            reject = "400 Bad Request";
+            message = "Malformed HTTP request";
+        }
+        else if (req.chunked)
+        {
+            reject = "501 Not Implemented";
+            message = "Chunked request bodies are not supported";
+        }
+        else if (req.content_length > MAX_BODY)
+        {
+            reject = "413 Payload Too Large";
+            message = "Request body over " + to_string(MAX_BODY) + " bytes";
+        }
+        if (reject)
+        {
+            // The framing can't be trusted any more: answer and close
+            protocol_errors_++;
+            conn.last_request = true;
+            append_response(respond(conn), reject, error_body(message), true);
+            return len;
+        }
+
+        size_t total = req.head_size + req.content_length;
+        if (len - used < total)
+        {
+            if (req.expect_continue && !conn.continue_sent)
+            {
+                respond(conn) += "HTTP/1.1 100 Continue\r\n\r\n";
+                conn.continue_sent = true;
+            }
+            break;
+        }
+        conn.continue_sent = false;
+        requests_++;
+        if (!req.keep_alive)
+            conn.last_request = true;
+        handle(conn, req, data + used + req.head_size);
+        used += total;
+    }
+    return used;
+}
+
+void UringHttpServer::update(Loop &loop, Connection &conn)
+{
+    auto wants_input = [&conn]
+    { return !conn.paused() && !conn.last_request && !conn.shut; };
+
+    // Resumed: parse what arrived while paused before reading more
+    if (wants_input() && !conn.recv_armed)
+    {
+        if (!conn.in.empty())
+            conn.in.erase(0, consume(conn, conn.in.data(), conn.in.size()));
+        if (wants_input())
+            loop.arm_recv(conn);
+    }
+    else if (!wants_input() && conn.recv_armed && !conn.recv_cancelled)
+    {
+        loop.cancel(tag(conn.id, OP_RECV), conn.id);
+        conn.recv_cancelled = true;
+    }
+    if (conn.last_request)
+        conn.in.clear();
+
+    if (!conn.send_busy && !conn.out.empty() && !conn.shut)
+    {
+        conn.sending.swap(conn.out);
+        conn.out.clear();
+        conn.sent = 0;
+        loop.send_rest(conn);
+    }
+
+    if (conn.last_request && conn.slots.empty() && conn.in_flight == 0 && conn.out.empty() && !conn.send_busy)
+        shut_down(loop, conn);
+    if (conn.shut && !conn.recv_armed && !conn.send_busy)
+    {
+        close(conn.fd);
+        loop.conns.erase(conn.id);
+        connections_--;
+        if (!loop.accepting && !loop.shutting_down)
+            loop.arm_accept();
+    }
+}
+
+void UringHttpServer::shut_down(Loop &loop, Connection &conn)
+{
+    if (conn.shut)
+        return;
+    conn.shut = true;
+    // Ends the receive and any send in flight; the fd is closed once both
+    // have completed, as the kernel may still be using their buffers
+    shutdown(conn.fd, SHUT_RDWR);
+    if (conn.recv_armed && !conn.recv_cancelled)
+    {
+        loop.cancel(tag(conn.id, OP_RECV), conn.id);
+        conn.recv_cancelled = true;
+    }
+}
+
+string &UringHttpServer::respond(Connection &conn)
+{
+    if (conn.slots.empty())
+        return conn.out;
+    conn.slots.push_back({true, ""});
+    return conn.slots.back().data;
+}
+
+UringHttpServer::Reply UringHttpServer::defer(Connection &conn)
+{
+    Reply reply;
+    reply.loop_ = conn.loop->shared_from_this();
+    reply.conn_id_ = conn.id;
+    reply.slot_ = conn.first_slot + conn.slots.size();
+    conn.slots.emplace_back();
+    conn.in_flight++;
+    return reply;
+}
+
+void UringHttpServer::handle(Connection &conn, const HttpRequest &req, const char *body)
+{
+    if (req.path != "/key" && req.path.substr(0, 5) != "/key/")
+    {
+        append_response(respond(conn), "404 Not Found", error_body("Not found"), conn.last_request);
+        return;
+    }
+    if (req.method == "GET")
+        get(conn, req);
+    else if (req.method == "POST")
+        post(conn, req, body);
+    else if (req.method == "DELETE")
+        del(conn, req);
+    else
+        append_response(respond(conn), "405 Method Not Allowed", error_body("Method not allowed"),
+                        conn.last_request);
+}
+
+// A GET Task answers straight into its connection while it still runs
+// inside consume(), and through a Reply once it may have been suspended,
+// as the connection can be gone by the time it is resumed
+struct UringHttpServer::Responder
+{
+    UringHttpServer *server;
+    Loop *loop;
+    Connection *conn; // null once deferred
+    Reply reply;
+
+    // Takes the response's place among the connection's pending ones
+    void defer()
+    {
+        if (!conn)
+            return;
+        reply = server->defer(*conn);
+        conn = nullptr;
+    }
+
+    // co_await res.write_response(build): build(out) appends the response
+    // to out. Never suspends; timed as the Respond stage.
+    template <class Build>
+    auto write_response(Build build)
+    {
+        struct Write
+        {
+            Responder &res;
+            Build build;
+
+            bool await_ready() const noexcept { return true; }
+            void await_suspend(coroutine_handle<>) const noexcept {}
+            void await_resume()
+            {
+                StageTimer timer(res.loop->timings, Stage::Respond);
+                if (res.conn)
+                {
+                    build(res.server->respond(*res.conn));
+                    return;
+                }
+                string out;
+                build(out);
+                res.reply.send(std::move(out));
+            }
+        };
+        return Write{*this, std::move(build)};
+    }
+};
+
+void UringHttpServer::get(Connection &conn, const HttpRequest &req)
+{
+    bool close = conn.last_request;
+    string key;
+    bool raw = path_key(req.path, key);
+    if (!raw && !http_query_param(req.query, "key", key))
+    {
+        append_response(respond(conn), "200 OK", "{\"error\": \"No 'key' parameter was provided.\"}", close);
+        return;
+    }
+    string level;
+    ReadConsistency mode = ReadConsistency::Cache;
+    if (http_query_param(req.query, "consistency", level) && level != "cache")
+    {
+        if (level == "fresh")
+            mode = ReadConsistency::Fresh;
+        else if (level == "stale-ok")
+            mode = ReadConsistency::StaleOk;
+        else
+        {
+            append_response(respond(conn), "400 Bad Request",
+                            error_body("consistency must be one of cache, fresh, stale-ok"), close);
+            return;
+        }
+    }
+
+    get_task(Responder{this, conn.loop, &conn, {}}, std::move(key), raw, close, mode);
+}
+
+// The cache, then storage on a miss, then the response. A miss parks the
+// request: its Task is suspended, the ring serves other connections, and
+// resumes the Task once the engine has the value.
+Task UringHttpServer::get_task(Responder res, string key, bool raw, bool close, ReadConsistency mode)
+{
+    StageTimings &timings = res.loop->timings;
+    string value;
+    KVService::ReadMiss miss;
+    if (!co_await cache_lookup(kv_, key, value, miss, mode, timings))
+    {
+        res.defer();
+        FetchResult result = co_await db_fetch(kv_, key, miss, *res.loop, timings);
+        if (result.status == KVStatus::Failed)
+        {
+            co_await res.write_response([&](string &out)
+                                        { append_response(out, "500 Internal Server Error",
+                                                          error_body("storage read failed"), close); });
+            co_return;
+        }
+        // A stale or chunked entry the cache gave is no answer
+        value = result.status == KVStatus::Ok ? std::move(result.value) : string();
+    }
+    co_await res.write_response([&](string &out)
+                                { append_read(out, key, value, raw, close); });
+}
+
+void UringHttpServer::post(Connection &conn, const HttpRequest &req, const char *body)
+{
+    bool close = conn.last_request;
+    string key, value;
+    bool raw = path_key(req.path, key);
+    if (raw && !http_media_type_is(req.content_type, "application/octet-stream"))
+    {
+        append_response(respond(conn), "415 Unsupported Media Type",
+                        error_body("POST /key/<key> takes an application/octet-stream body"), close);
+        return;
+    }
+    if (req.content_length == 0)
+    {
+        append_response(respond(conn), "411 Length Required",
+                        error_body("Content-Length header is missing or invalid."), close);
+        return;
+    }
+    WriteAck ack;
+    if (!parse_write_ack(req.query, ack))
+    {
+        append_response(respond(conn), "400 Bad Request", error_body("durability must be one of memory, log, db"),
+                        close);
+        return;
+    }
+
+    if (raw)
+        value.assign(body, req.content_length);
+    else
+    {
+        keyjson::KeyValue kv;
+        if (!keyjson::parse_key_value(string_view(body, req.content_length), kv))
+        {
+            append_response(respond(conn), "400 Bad Request", error_body("Invalid JSON format"), close);
+            return;
+        }
+        key = kv.key;
+        value = kv.value;
+    }
+
+    kv_.put(key, value, ack, [reply = defer(conn), key, close](KVStatus status)
+            {
+        string &body = json_body();
+        keyjson::append_created(body, key);
+        reply.send(write_response(status, "201 Created", body, close)); });
+}
+
+void UringHttpServer::del(Connection &conn, const HttpRequest &req)
+{
+    bool close = conn.last_request;
+    string key;
+    if (!path_key(req.path, key))
+    {
+        append_response(respond(conn), "400 Bad Request", error_body("No key specified in path"), close);
+        return;
+    }
+    WriteAck ack;
+    if (!parse_write_ack(req.query, ack))
+    {
+        append_response(respond(conn), "400 Bad Request", error_body("durability must be one of memory, log, db"),
+                        close);
+        return;
+    }
+
+    kv_.remove(key, ack, [reply = defer(conn), close](KVStatus status)
+               {
+        string &body = json_body();
+        keyjson::append_deleted(body);
+        reply.send(write_response(status, "200 OK", body, close)); });
+}
@@ -0,0 +1,149 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "WriteAheadLog.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+WriteAheadLog::WriteAheadLog(const std::string &dir, uint64_t segment_size)
+    : dir_(dir), segment_size_(segment_size)
+{
+    fs::create_directories(dir_);
+
+    uint64_t next_base = 0;
+    for (auto &entry : fs::directory_iterator(dir_))
+    {
+        if (entry.path().extension() != ".wal")
+            continue;
+        if (fs::file_size(entry.path()) == 0)
+        {
+            fs::remove(entry.path()); // left by a run that wrote nothing
+            continue;
+        }
+        uint64_t base = stoull(entry.path().stem());
+        segments_[base] = entry.path();
+        next_base = std::max(next_base, base + fs::file_size(entry.path()));
+    }
+
+    // A torn tail in the last segment only leaves a gap in the positions
+    active_base_ = next_base;
+    active_ = make_unique<AppendLog>(segment_path(active_base_));
+}
+
+std::string WriteAheadLog::segment_path(uint64_t base) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu.wal", (unsigned long long)base);
+    return dir_ + "/" + name;
+}
+
+uint64_t WriteAheadLog::append(uint8_t flags, const std::string &key, const std::string &value,
+                               AppendLog::SyncCallback on_durable)
+{
+    lock_guard<mutex> lock(mtx_);
+    uint64_t end = active_base_ + active_->append(flags, key, value, std::move(on_durable));
+
+    if (active_->size() >= segment_size_)
+    {
+        // The old segment's destructor syncs it and fires its callbacks
+        retired_syncs_ += active_->syncs();
+        retired_records_ += active_->synced_records();
+        segments_[active_base_] = active_->path();
+        active_base_ = end;
+        active_.reset();
+        active_ = make_unique<AppendLog>(segment_path(active_base_));
+    }
+    return end;
+}
+
+uint64_t WriteAheadLog::end() const
+{
+    lock_guard<mutex> lock(mtx_);
+    return active_base_ + active_->size();
+}
+
+void WriteAheadLog::replay(const std::function<void(const LogRecord &, uint64_t end)> &fn)
+{
+    map<uint64_t, string> segments;
+    {
+        lock_guard<mutex> lock(mtx_);
+        segments = segments_;
+    }
+    for (auto &[base, path] : segments)
+    {
+        uint64_t segment_base = base;
+        AppendLog::replay(path, 0, [&](const LogRecord &rec, uint64_t end)
+                          { fn(rec, segment_base + end); });
+    }
+}
+
+// CHECKPOINT holds one position per line
+std::vector<uint64_t> WriteAheadLog::load_checkpoint() const
+{
+    vector<uint64_t> applied;
+    ifstream in(dir_ + "/CHECKPOINT");
+    uint64_t pos;
+    while (in >> pos)
+        applied.push_back(pos);
+    return applied;
+}
+
+void WriteAheadLog::save_checkpoint(const std::vector<uint64_t> &applied)
+{
+    if (applied.empty())
+        return;
+
+    string data;
+    for (uint64_t pos : applied)
+        data += to_string(pos) + "\n";
+
+    // tmp + rename, so a crash leaves the old or the new checkpoint
+    string tmp = dir_ + "/CHECKPOINT.tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw runtime_error("wal: cannot write " + tmp);
+    bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size() && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), (dir_ + "/CHECKPOINT").c_str()) != 0)
+        throw runtime_error("wal: cannot save checkpoint");
+
+    // A segment can go once the next one starts below every checkpoint
+    uint64_t low = *std::min_element(applied.begin(), applied.end());
+    lock_guard<mutex> lock(mtx_);
+    while (!segments_.empty())
+    {
+        auto first = segments_.begin();
+        auto next = std::next(first);
+        uint64_t segment_end = next != segments_.end() ? next->first : active_base_;
+        if (segment_end > low)
+            break;
+        fs::remove(first->second);
+        segments_.erase(first);
+    }
+}
+
+uint64_t WriteAheadLog::syncs() const
+{
+    lock_guard<mutex> lock(mtx_);
+    return retired_syncs_ + active_->syncs();
+}
+
+uint64_t WriteAheadLog::synced_records() const
+{
+    lock_guard<mutex> lock(mtx_);
+    return retired_records_ + active_->synced_records();
+}
+
+size_t WriteAheadLog::segments() const
+{
+    lock_guard<mutex> lock(mtx_);
+    return segments_.size() + 1;
+}
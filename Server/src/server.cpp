@@ -3,229 +3,1203 @@
 #include <stdio.h>
 #include <iostream>
 #include <sstream>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <semaphore>
 #include "LRUCache.h"
 #include "MySQLHelper.h"
-#include "MySQLPool.h"
+#include "StorageEngine.h"
+#include "KVService.h"
+#include "ChunkStore.h"
+#include "BinaryServer.h"
+#include "RespServer.h"
+#include "KeyJson.h"
+#include "CivetConfig.h"
+#ifdef KV_IO_URING
+#include "UringHttpServer.h"
+#endif
 #include "nlohmann/json.hpp"
 using json = nlohmann::json;
 #define cache_size 1024
 LRUCache cache(cache_size);
-MySQLPool mysql_pool("localhost", "root", "", "KVStore", 3306, 10);
-#ifdef num_thread
-const char *num_threads = "8";
-#else
-const char *num_threads = "1";
+// Persistent backend, picked at startup (KV_STORAGE_ENGINE, default "mysql")
+std::unique_ptr<StorageEngine> storage;
+// Values longer than KV_CHUNK_BYTES (default 256KB) are stored in chunks
+std::unique_ptr<ChunkStore> chunks;
+// Largest value a POST may store (KV_MAX_VALUE_BYTES, default 1GB)
+static uint64_t max_value_bytes = 1ull << 30;
+// Cache-aside rules shared by the HTTP handlers and the binary listener
+std::unique_ptr<KVService> kv;
+// Binary protocol listener (KV_BINARY_PORT, default 8889, 0 = off)
+static std::unique_ptr<BinaryServer> binary_server;
+// Redis protocol listener (KV_RESP_PORT, default 6379, 0 = off)
+static std::unique_ptr<RespServer> resp_server;
+#ifdef KV_IO_URING
+// io_uring HTTP listener for /key (KV_URING_PORT, default 8890, 0 = off)
+static std::unique_ptr<UringHttpServer> uring_server;
 #endif
 using namespace std;
 
-// This handler will be called for all requests to /key
+// Per-thread buffers grown past this are given back after the response
+static const size_t KEEP_BUFFER = 1 << 20;
+
+static string &reuse(string &buf)
+{
+    if (buf.capacity() > KEEP_BUFFER)
+        string().swap(buf);
+    buf.clear();
+    return buf;
+}
+
+// Per-thread buffer to build a response body in
+static string &json_body()
+{
+    thread_local string body;
+    return reuse(body);
+}
+
+// Raw values up to this size go out in the same write as the head
+static const size_t COALESCE_VALUE = 16 << 10;
+
+// Head of a response, in a per-thread buffer the caller may append to.
+// A negative length announces a chunked body.
+static string &start_response(const char *status, const char *content_type, long long length,
+                              const char *extra_headers = "")
+{
+    thread_local string response;
+    reuse(response);
+    response += "HTTP/1.1 ";
+    response += status;
+    response += "\r\nContent-Type: ";
+    response += content_type;
+    response += "\r\n";
+    response += extra_headers;
+    if (length < 0)
+        response += "Transfer-Encoding: chunked\r\n\r\n";
+    else
+    {
+        response += "Content-Length: ";
+        response += to_string(length);
+        response += "\r\n\r\n";
+    }
+    return response;
+}
+
+// Sends head and body with a single mg_write. civetweb has no writev, and
+// mg_printf for the head plus mg_write for the body cost two sends, so
+// both are gathered in a per-thread buffer first.
+static void send_json(struct mg_connection *conn, const char *status, string_view body,
+                      const char *extra_headers = "")
+{
+    string &response = start_response(status, "application/json", body.size(), extra_headers);
+    response += body;
+    mg_write(conn, response.data(), response.size());
+}
+
+// A value as the raw body. Large ones are written straight from the value
+// rather than copied behind the head first.
+static void send_raw(struct mg_connection *conn, const string &value)
+{
+    string &response = start_response("200 OK", "application/octet-stream", value.size());
+    if (value.size() <= COALESCE_VALUE)
+    {
+        response += value;
+        mg_write(conn, response.data(), response.size());
+        return;
+    }
+    mg_write(conn, response.data(), response.size());
+    mg_write(conn, value.data(), value.size());
+}
+
+// A 200 with a Transfer-Encoding: chunked body. The head goes out with
+// the first chunk, and each chunk's closing CRLF with the next chunk's
+// size line, so a chunk costs two writes rather than mg_send_chunk()'s three.
+class ChunkedResponse
+{
+public:
+    ChunkedResponse(struct mg_connection *conn, const char *content_type)
+        : conn_(conn), pending_(start_response("200 OK", content_type, -1))
+    {
+    }
+
+    bool started() const { return started_; }
+
+    bool send(string_view data)
+    {
+        if (data.empty())
+            return true; // a zero-size chunk would end the body
+        char size[24];
+        pending_.append(size, snprintf(size, sizeof(size), "%zx\r\n", data.size()));
+        started_ = true;
+        bool ok = write(pending_) && write(data);
+        pending_ = "\r\n";
+        return ok;
+    }
+
+    bool end()
+    {
+        pending_ += "0\r\n\r\n";
+        return write(pending_);
+    }
+
+private:
+    bool write(string_view s) { return mg_write(conn_, s.data(), s.size()) == (int)s.size(); }
+
+    struct mg_connection *conn_;
+    string pending_;
+    bool started_ = false;
+};
+
+// {"message": ..., "status": "error"}
+static void send_json_error(struct mg_connection *conn, const char *status, string_view message,
+                            const char *extra_headers = "")
+{
+    thread_local string body;
+    keyjson::append_error(reuse(body), message);
+    send_json(conn, status, body, extra_headers);
+}
+
+// Tells the client the write-behind queue is saturated and to back off
+static void send_overloaded(struct mg_connection *conn)
+{
+    send_json_error(conn, "503 Service Unavailable", "Write backlog is full, retry later", "Retry-After: 1\r\n");
+}
+
+// The engine accepted the write but could not make it durable
+static void send_write_failed(struct mg_connection *conn)
+{
+    send_json_error(conn, "500 Internal Server Error", "Write could not be persisted");
+}
+
+enum class WriteResult
+{
+    Ok,
+    Overloaded, // shed by the engine, answer 503
+    Failed,     // accepted but not persisted, answer 500
+};
+
+// False if the parameter has an unknown value
+static bool parse_write_ack(struct mg_connection *conn, WriteAck &ack)
+{
+    const char *query = mg_get_request_info(conn)->query_string;
+    string level;
+    if (!query || !CivetServer::getParam(query, strlen(query), "durability", level))
+        return true;
+
+    if (level == "memory")
+        ack.wait = false;
+    else if (level == "log")
+        ack.durability = Durability::Log;
+    else if (level == "db")
+        ack.durability = Durability::Database;
+    else
+        return false;
+    return true;
+}
+
+static void send_bad_durability(struct mg_connection *conn)
+{
+    send_json_error(conn, "400 Bad Request", "durability must be one of memory, log, db");
+}
+
+// Issues a storage write and, unless the client asked for memory
+// durability, blocks until the engine reports it reached the level asked
+// for, so an acknowledged write survives a crash.
+template <typename Write>
+static WriteResult acked_write(const WriteAck &ack, Write write,
+                               StorageEngine::WriteCallback on_commit = nullptr)
+{
+    if (!ack.wait)
+        return write(std::move(on_commit), ack.durability) ? WriteResult::Ok : WriteResult::Overloaded;
+
+    auto committed = std::make_shared<std::promise<bool>>();
+    auto fut = committed->get_future();
+    if (!write([committed, on_commit = std::move(on_commit)](bool ok)
+               {
+                   if (on_commit)
+                       on_commit(ok);
+                   committed->set_value(ok); },
+               ack.durability))
+        return WriteResult::Overloaded;
+    return fut.get() ? WriteResult::Ok : WriteResult::Failed;
+}
+
+// ReadConsistency from ?consistency=. False if the parameter has an unknown value
+static bool parse_read_consistency(CivetServer *server, struct mg_connection *conn,
+                                   ReadConsistency &mode)
+{
+    string level;
+    mode = ReadConsistency::Cache;
+    if (!server->getParam(conn, "consistency", level) || level == "cache")
+        return true;
+    if (level == "fresh")
+        mode = ReadConsistency::Fresh;
+    else if (level == "stale-ok")
+        mode = ReadConsistency::StaleOk;
+    else
+        return false;
+    return true;
+}
+
+// Cache expiry, from KV_CACHE_SOFT_TTL_MS / KV_CACHE_HARD_TTL_MS (0 = never)
+static chrono::milliseconds cache_soft_ttl{0};
+static chrono::milliseconds cache_hard_ttl{0};
+
+// How long a reader that missed waits for another reader's fill of the
+// same key before going to storage itself
+static const chrono::milliseconds FILL_WAIT(100);
+
+// A civetweb worker waits for the storage read of a miss. Fewer misses
+// than workers may wait at once (KV_HTTP_MAX_MISSES, default num_threads
+// - 1), so some worker is always left for hits; the others get a 503.
+static unique_ptr<counting_semaphore<>> miss_slots;
+static size_t max_misses = 0;
+static atomic<uint64_t> misses_shed{0};
+
+enum class ReadResult
+{
+    Ok,
+    Busy,   // every miss slot taken, answer 503
+    Failed, // storage error, answer 500
+};
+
+// StorageEngine::refresh() as a blocking read: unlike get(), it sees every
+// write the engine already accepted for key, even one still queued for
+// MySQL. Throws if the read failed or was shed.
+static string read_ordered(const string &key)
+{
+    auto done = make_shared<promise<string>>();
+    auto fut = done->get_future();
+    storage->refresh(key, [done](bool ok, string value)
+                     {
+        if (ok)
+            done->set_value(std::move(value));
+        else
+            done->set_exception(make_exception_ptr(
+                runtime_error("Fresh read failed or the write queue is full, retry later"))); });
+    return fut.get();
+}
+
+// Reads key through the cache under the rules of mode. An empty value
+// means not found. On Failed, error holds the storage's message.
+static ReadResult read_value(const string &key, ReadConsistency mode, string &value, string &error)
+{
+    CacheStatus status = CacheStatus::Miss;
+    bool should_refresh = false;
+    uint64_t lease = 0;
+    if (mode != ReadConsistency::Fresh)
+        status = cache.lookup(key, value, &should_refresh, &lease);
+
+    // Soft-expired entries are served in every mode but fresh, so
+    // hot keys never wait on storage; stale ones only to stale-ok.
+    bool serve_cached = status == CacheStatus::Hit || status == CacheStatus::SoftExpired ||
+                        (status == CacheStatus::Stale && mode == ReadConsistency::StaleOk);
+    bool waited = false;
+    if (status == CacheStatus::Miss && mode != ReadConsistency::Fresh && lease == 0)
+    {
+        // Another reader is already filling this key: wait for
+        // its result instead of piling onto storage as well
+        kv->count_fill_wait();
+        waited = true;
+        serve_cached = cache.wait_for_fill(key, value, FILL_WAIT);
+    }
+
+    if (serve_cached)
+    {
+        // One reader kicks off the refresh
+        if (should_refresh)
+            kv->refresh(key);
+        return ReadResult::Ok;
+    }
+
+    if (!miss_slots->try_acquire())
+    {
+        misses_shed++;
+        if (lease)
+            cache.release_lease(key, lease);
+        if (should_refresh)
+            cache.abandon_refresh(key);
+        return ReadResult::Busy;
+    }
+    // Fresh and stale reads fill under a lease too. A reader
+    // that gave up waiting leaves the fill to the lease holder.
+    if (lease == 0 && !waited)
+        lease = cache.lease(key);
+    try
+    {
+        value = mode == ReadConsistency::Fresh ? read_ordered(key) : storage->get(key).get();
+        miss_slots->release();
+    }
+    catch (const std::exception &e)
+    {
+        miss_slots->release();
+        if (lease)
+            cache.release_lease(key, lease);
+        if (should_refresh)
+            cache.abandon_refresh(key);
+        error = e.what();
+        return ReadResult::Failed;
+    }
+
+    // An empty value drops any stale copy too
+    if (lease)
+        kv->fill(key, value, lease);
+    return ReadResult::Ok;
+}
+
+// The key of /key/<key>, URL-decoded. False if the path has none.
+static bool path_key(struct mg_connection *conn, string &key)
+{
+    // civetweb leaves the path as sent (decode_url is off), so a '+' or a
+    // "/../" in a key survives
+    const char *uri = mg_get_request_info(conn)->local_uri_raw;
+    if (!uri || strncmp(uri, "/key/", 5) != 0 || uri[5] == '\0')
+        return false;
+    int len = (int)strlen(uri + 5);
+    key.resize(len + 1);
+    int n = mg_url_decode(uri + 5, len, key.data(), len + 1, 0);
+    key.resize(std::max(n, 0));
+    return n > 0;
+}
+
+static bool is_octet_stream(struct mg_connection *conn)
+{
+    static const char TYPE[] = "application/octet-stream";
+    const size_t n = sizeof(TYPE) - 1;
+    const char *header = mg_get_header(conn, "Content-Type");
+    return header && mg_strncasecmp(header, TYPE, n) == 0 &&
+           (header[n] == '\0' || header[n] == ';' || header[n] == ' ');
+}
+
+// Reads the whole request body into body, already sized to its length.
+// False if the client sent less.
+static bool read_body(struct mg_connection *conn, string &body)
+{
+    size_t got = 0;
+    while (got < body.size())
+    {
+        int n = mg_read(conn, body.data() + got, body.size() - got);
+        if (n <= 0)
+            return false;
+        got += n;
+    }
+    return true;
+}
+
+static bool is_chunked_request(struct mg_connection *conn)
+{
+    const char *header = mg_get_header(conn, "Transfer-Encoding");
+    return header && mg_strcasecmp(header, "chunked") == 0;
+}
+
+static void send_value_too_large(struct mg_connection *conn)
+{
+    send_json_error(conn, "413 Payload Too Large",
+                    "Values are limited to " + to_string(max_value_bytes) + " bytes");
+}
+
+// Finishes a chunked write, with the error response if it failed
+static bool finish_chunks(struct mg_connection *conn, ChunkStore::Writer &writer, string &stored)
+{
+    if (writer.finish(stored))
+        return true;
+    if (writer.shed())
+        send_overloaded(conn);
+    else
+        send_write_failed(conn);
+    return false;
+}
+
+// Reads a raw POST body into stored, what to put under key. A body of up
+// to a chunk is read straight into place. Longer ones, and chunked ones of
+// unknown length, go to storage a chunk at a time as they arrive and
+// stored gets their manifest, so the request never holds more than a
+// chunk of the value. Sends the error response itself when it returns false.
+static bool read_raw_body(struct mg_connection *conn, const string &key, long long length,
+                          string &stored)
+{
+    if (length >= 0 && (uint64_t)length <= chunks->chunk_size())
+    {
+        stored.resize(length);
+        if (!read_body(conn, stored))
+        {
+            send_json_error(conn, "400 Bad Request", "Request body is shorter than its Content-Length");
+            return false;
+        }
+        if (!chunks->needs_chunks(stored))
+            return true;
+    }
+
+    ChunkStore::Writer writer(*chunks, key);
+    writer.append(stored); // a short value that looks like a manifest
+    while (length < 0 || writer.size() < (uint64_t)length)
+    {
+        size_t room;
+        char *dst = writer.room(room);
+        if (length >= 0)
+            room = std::min<uint64_t>(room, length - writer.size());
+        int n = mg_read(conn, dst, room);
+        if (n == 0 && length < 0)
+            break; // end of a chunked body
+        if (n <= 0)
+        {
+            send_json_error(conn, "400 Bad Request", "Request body is shorter than its Content-Length");
+            return false;
+        }
+        writer.commit(n);
+        if (writer.size() > max_value_bytes)
+        {
+            send_value_too_large(conn);
+            return false;
+        }
+    }
+    return finish_chunks(conn, writer, stored);
+}
+
+// A value read whole: raw or as {"key": k, "value": v}
+static void send_value(struct mg_connection *conn, const string &key, const string &value, bool raw)
+{
+    string &response_body = json_body();
+    if (value.empty())
+    {
+        keyjson::append_not_found(response_body, key);
+        send_json(conn, raw ? "404 Not Found" : "200 OK", response_body);
+    }
+    else if (raw)
+        send_raw(conn, value);
+    else
+    {
+        keyjson::append_value(response_body, key, value);
+        send_json(conn, "200 OK", response_body);
+    }
+}
+
+// A chunked value put back together, for responses that need it whole.
+// False if it could not be read or was overwritten meanwhile.
+static bool expand_chunks(const string &key, string &value)
+{
+    ChunkManifest m;
+    if (!ChunkManifest::decode(value, m))
+        return true;
+    value.clear();
+    auto result = chunks->stream(key, m, [&value](string_view data)
+                                 {
+        value.append(data);
+        return true; });
+    return result == ChunkStore::StreamResult::Ok;
+}
+
+// Sends the value behind manifest m one stored chunk at a time, as a
+// chunked response. Nothing goes out before the first chunk was read, so
+// if the value was overwritten by then this returns false for the caller
+// to read it again; a failure later can only cut the response short.
+static bool stream_value(struct mg_connection *conn, const string &key, const ChunkManifest &m, bool raw)
+{
+    if (strcmp(mg_get_request_info(conn)->http_version, "1.1") != 0)
+    {
+        // No chunked encoding before HTTP/1.1
+        string value = m.encode();
+        if (!expand_chunks(key, value))
+            return false;
+        send_value(conn, key, value, raw);
+        return true;
+    }
+
+    ChunkedResponse response(conn, raw ? "application/octet-stream" : "application/json");
+    uint64_t sent = 0;
+    string carry; // a UTF-8 sequence split between two chunks
+    auto result = chunks->stream(key, m, [&](string_view data)
+                                 {
+        if (raw)
+            return response.send(data);
+        // JSON: the escaped value between the same fragments as append_value()
+        string &out = json_body();
+        if (!response.started())
+        {
+            out += "{\"key\":";
+            keyjson::append_string(out, key);
+            out += ",\"value\":\"";
+        }
+        sent += data.size();
+        keyjson::append_string_piece(out, carry, data, sent == m.size);
+        if (sent == m.size)
+            out += "\"}";
+        return response.send(out); });
+
+    if (result == ChunkStore::StreamResult::Ok)
+        response.end();
+    else if (!response.started())
+    {
+        if (result == ChunkStore::StreamResult::Changed)
+            return false;
+        send_json_error(conn, "500 Internal Server Error", "storage read failed");
+    }
+    return true;
+}
+
+// This handler will be called for all requests to /key. Values travel as
+// JSON strings on /key, and as raw bytes on /key/<key>:
+//   GET    /key?key=k  -> {"key": k, "value": v}
+//   POST   /key           {"key": k, "value": v}
+//   GET    /key/k      -> v (application/octet-stream), 404 if missing
+//   POST   /key/k         v (Content-Type: application/octet-stream)
+//   DELETE /key/k
+// Values longer than a chunk are stored in chunks and sent back chunked.
 class ItemHandler : public CivetHandler
 {
 public:
     bool handleGet(CivetServer *server, struct mg_connection *conn) override
     {
-        string key, response_body;
-        if (server->getParam(conn, "key", key))
+        string key;
+        bool raw = path_key(conn, key);
+        if (raw || server->getParam(conn, "key", key))
         {
-            // In handleGet
-            json j_response;
-            j_response["key"] = key;
-            string value = cache.get(key);
-            if (value.empty())
+            ReadConsistency mode;
+            if (!parse_read_consistency(server, conn, mode))
             {
-                MYSQL *conn = mysql_pool.acquire();
-                value = get_value(conn, key);
-                mysql_pool.release(conn);
-
-                if (!value.empty())
-                { // Only cache if we found it
-                    cache.put(key, value);
-                    j_response["value"] = value;
-                }
-                else{
-                    j_response["error"] = "Key not found";
-                }
+                send_json_error(conn, "400 Bad Request", "consistency must be one of cache, fresh, stale-ok");
+                return true;
             }
-            else
+
+            string value, error;
+            for (int attempt = 0; attempt < 3; ++attempt)
             {
-                j_response["value"] = value;
+                // A large value overwritten while it was read: the new
+                // manifest follows its chunks into the cache shortly
+                if (attempt > 0)
+                    this_thread::sleep_for(chrono::milliseconds(10 * attempt));
+                ReadResult result = read_value(key, mode, value, error);
+                if (result == ReadResult::Busy)
+                {
+                    send_json_error(conn, "503 Service Unavailable", "Too many reads waiting for storage, retry later",
+                                    "Retry-After: 1\r\n");
+                    return true;
+                }
+                if (result == ReadResult::Failed)
+                {
+                    send_json_error(conn, "500 Internal Server Error", error);
+                    return true;
+                }
+                ChunkManifest m;
+                if (!ChunkManifest::decode(value, m))
+                {
+                    send_value(conn, key, value, raw);
+                    return true;
+                }
+                if (stream_value(conn, key, m, raw))
+                    return true;
             }
-            
-            response_body = j_response.dump();
+            send_json_error(conn, "500 Internal Server Error", "Value kept changing while it was read");
         }
         else
         {
             // Failure, 'id' was not found
-            response_body = "{\"error\": \"No 'key' parameter was provided.\"}";
+            send_json(conn, "200 OK", "{\"error\": \"No 'key' parameter was provided.\"}");
         }
-
-        mg_printf(conn,
-            "HTTP/1.1 200 OK\r\n"
-            "Content-Type: application/json\r\n"
-            "Content-Length: %zu\r\n\r\n",
-            response_body.size());
-
-        mg_write(conn, response_body.data(), response_body.size());
         return true; // We handled the request
     }
 
     bool handlePost(CivetServer *server, struct mg_connection *conn) override
     {
         long long content_length = mg_get_request_info(conn)->content_length;
-        string post_data, key, value;
+        // stored is the value, or for a large one the manifest of its chunks
+        string post_data, key, stored;
+        bool raw = path_key(conn, key);
+        if (raw && !is_octet_stream(conn))
+        {
+            send_json_error(conn, "415 Unsupported Media Type",
+                            "POST /key/<key> takes an application/octet-stream body");
+            return true;
+        }
         // --- FIX: VALIDATE THE CONTENT-LENGTH ---
-        if (content_length <= 0)
+        // (a raw value may also come as a chunked body of unknown length)
+        if (content_length == 0 || (content_length < 0 && !(raw && is_chunked_request(conn))))
         {
             // 411 Length Required is the correct HTTP response
-            json j_error;
-            j_error["status"] = "error";
-            j_error["message"] = "Content-Length header is missing or invalid.";
-            std::string err_resp = j_error.dump();
-
-            mg_printf(conn,
-                      "HTTP/1.1 411 Length Required\r\n"
-                      "Content-Type: application/json\r\n"
-                      "Content-Length: %zu\r\n\r\n",
-                      err_resp.size());
-            mg_write(conn, err_resp.data(), err_resp.size());
-
+            send_json_error(conn, "411 Length Required", "Content-Length header is missing or invalid.");
+            return true;
+        }
+        if (content_length > 0 && (uint64_t)content_length > max_value_bytes)
+        {
+            send_value_too_large(conn);
             return true;
         }
-        post_data.resize(content_length);
-        mg_read(conn, post_data.data(), content_length);
 
-        try
+        WriteAck ack;
+        if (!parse_write_ack(conn, ack))
         {
-            // 1. PARSE: Attempt to parse the raw string into a JSON object
-            auto json_data = nlohmann::json::parse(post_data);
+            send_bad_durability(conn);
+            return true;
+        }
 
-            // 2. ACCESS: Get the field value (e.g., "username")
-            key = json_data["key"].get<std::string>();
-            value = json_data["value"].get<std::string>();
+        if (raw)
+        {
+            if (!read_raw_body(conn, key, content_length, stored))
+                return true;
         }
-        catch (...)
+        else
         {
-            json j_error;
-            j_error["status"] = "error";
-            j_error["message"] = "Invalid JSON format";
-            std::string err_resp = j_error.dump();
+            post_data.resize(content_length);
+            if (!read_body(conn, post_data))
+            {
+                send_json_error(conn, "400 Bad Request", "Request body is shorter than its Content-Length");
+                return true;
+            }
+            // Scanned in place; key and value are copied out once, for storage
+            keyjson::KeyValue fields;
+            if (!keyjson::parse_key_value(post_data, fields))
+            {
+                send_json_error(conn, "400 Bad Request", "Invalid JSON format");
+                return true;
+            }
+            key = fields.key;
+            if (chunks->needs_chunks(fields.value))
+            {
+                ChunkStore::Writer writer(*chunks, key);
+                writer.append(fields.value);
+                if (!finish_chunks(conn, writer, stored))
+                    return true;
+            }
+            else
+                stored = fields.value;
+        }
 
-            mg_printf(conn,
-                      "HTTP/1.1 400 Bad Request\r\n"
-                      "Content-Type: application/json\r\n"
-                      "Content-Length: %zu\r\n\r\n",
-                      err_resp.size());
-            
-            mg_write(conn, err_resp.data(), err_resp.size());
+        // persist first, shedding load if the backlog is full
+        // The chunks of the value it replaces go once it committed
+        WriteResult result = acked_write(ack, [&](StorageEngine::WriteCallback done, Durability d)
+                                         { return storage->put(key, stored, std::move(done), d); },
+                                         chunks->replace(key, cache.get(key), stored));
+        if (result == WriteResult::Overloaded)
+        {
+            send_overloaded(conn);
+            return true;
+        }
+        if (result == WriteResult::Failed)
+        {
+            send_write_failed(conn);
             return true;
         }
-
         // store in cache
-        cache.put(key, value);
-        // store in DB asynchronously
-        auto key_hash = md5_hash(key);
-        async_insert(mysql_pool, key, key_hash, value);
+        cache.put(key, stored);
 
         // Send Success Response
-        // = std::format("{{\"status\": \"ok\", \"create_key\": \"{}\"}}", key);
-        json j_response;
-        j_response["status"] = "ok";
-        j_response["created_key"] = key;
-        string response_body = j_response.dump(); // Much faster than ostringstream
+        string &response_body = json_body();
+        keyjson::append_created(response_body, key);
+        send_json(conn, "201 Created", response_body);
+        return true;
+    }
+    bool handleDelete(CivetServer *server, struct mg_connection *conn) override
+    {
+        // The key is everything after /key/ (e.g. "/key/2")
+        std::string key_to_delete;
+        if (!path_key(conn, key_to_delete))
+        {
+            send_json_error(conn, "400 Bad Request", "No key specified in path");
+            return true;
+        }
 
-        mg_printf(conn,
-                  "HTTP/1.1 201 Created\r\n"
-                  "Content-Type: application/json\r\n"
-                  "Content-Length: %zu\r\n\r\n", // <-- Headers end here
-                  response_body.size()); // <-- Pass the body as an argument
-        
-        mg_write(conn, response_body.data(), response_body.size());
+        WriteAck ack;
+        if (!parse_write_ack(conn, ack))
+        {
+            send_bad_durability(conn);
+            return true;
+        }
+        // persist the delete first, shedding load if the backlog is full.
+        // The chunks of a large value go too.
+        WriteResult result = acked_write(ack, [&](StorageEngine::WriteCallback done, Durability d)
+                                         { return storage->remove(key_to_delete, std::move(done), d); },
+                                         chunks->replace(key_to_delete, cache.get(key_to_delete), ""));
+        if (result == WriteResult::Overloaded)
+        {
+            send_overloaded(conn);
+            return true;
+        }
+        if (result == WriteResult::Failed)
+        {
+            send_write_failed(conn);
+            return true;
+        }
+        // synchronously remove from cache
+        cache.remove(key_to_delete);
 
+        string &response_body = json_body();
+        keyjson::append_deleted(response_body);
+        send_json(conn, "200 OK", response_body);
+        return true; // We handled the request
+    }
+};
+
+// Largest batch accepted by /keys/*
+static const size_t MAX_BATCH_KEYS = 10000;
+
+// Reads keys[idx] from storage in one multi_get(), filling the cache for
+// those that hold a lease. On failure the leases and refreshes are handed back.
+static bool fetch_batch(const vector<string> &keys, const vector<size_t> &idx,
+                        const vector<CacheLookup> &found, vector<string> &values)
+{
+    if (idx.empty())
         return true;
+
+    vector<string> batch;
+    batch.reserve(idx.size());
+    for (size_t i : idx)
+        batch.push_back(keys[i]);
+
+    auto promise = make_shared<std::promise<vector<string>>>();
+    auto fut = promise->get_future();
+    storage->multi_get(batch, [promise](bool ok, vector<string> result)
+                       {
+        if (ok)
+            promise->set_value(std::move(result));
+        else
+            promise->set_exception(make_exception_ptr(runtime_error("storage read failed"))); });
+
+    vector<string> result;
+    try
+    {
+        result = fut.get();
     }
-    bool handleDelete(CivetServer *server, struct mg_connection *conn) override
+    catch (const std::exception &)
     {
-        string key, response_body;
+        for (size_t i : idx)
+        {
+            if (found[i].lease)
+                cache.release_lease(keys[i], found[i].lease);
+            if (found[i].should_refresh)
+                cache.abandon_refresh(keys[i]);
+        }
+        return false;
+    }
 
-        // 1. Get the full URI (e.g., "/keys/2")
-        const struct mg_request_info *ri = mg_get_request_info(conn);
-        std::string uri = ri->request_uri;
+    for (size_t j = 0; j < idx.size(); ++j)
+    {
+        size_t i = idx[j];
+        values[i] = std::move(result[j]);
+        if (found[i].lease)
+            kv->fill(keys[i], values[i], found[i].lease);
+    }
+    return true;
+}
 
-        // 2. Extract the key from the URI path
-        // We look for the last '/' and take everything after it.
-        size_t last_slash_pos = uri.rfind('/');
+// Batched counterparts of /key, all POST with a JSON body:
+//   /keys/mget {"keys": [k, ...]}                        -> {"values": [v or null, ...]}
+//   /keys/mset {"items": [{"key": k, "value": v}, ...]}  -> {"status": "ok", "count": n}
+//   /keys/mdel {"keys": [k, ...]}                        -> {"status": "ok", "count": n}
+// The cache is searched shard by shard in one pass, misses go to storage
+// as one multi_get(), and writes are handed to the engine as one group
+// (mset/mdel honour ?durability= like POST /key).
+class BatchHandler : public CivetHandler
+{
+public:
+    bool handlePost(CivetServer *server, struct mg_connection *conn) override
+    {
+        string uri = mg_get_request_info(conn)->local_uri;
+        string op = uri.substr(uri.rfind('/') + 1);
+        if (op != "mget" && op != "mset" && op != "mdel")
+        {
+            send_json_error(conn, "404 Not Found", "Unknown batch operation: " + op);
+            return true;
+        }
 
-        // Check if the URI is just "/keys" or if a key is present
-        if (last_slash_pos == std::string::npos || last_slash_pos == uri.length() - 1)
+        long long content_length = mg_get_request_info(conn)->content_length;
+        if (content_length <= 0)
         {
-            json j_error;
-            j_error["status"] = "error";
-            j_error["message"] = "No key specified in path";
-            std::string err_resp = j_error.dump();
+            send_json_error(conn, "411 Length Required", "Content-Length header is missing or invalid.");
+            return true;
+        }
+        string post_data(content_length, '\0');
+        mg_read(conn, post_data.data(), content_length);
+
+        vector<string> keys;
+        StorageEngine::KeyValues items;
+        try
+        {
+            auto json_data = nlohmann::json::parse(post_data);
+            if (op == "mset")
+                for (auto &item : json_data.at("items"))
+                    items.emplace_back(item.at("key").get<std::string>(), item.at("value").get<std::string>());
+            else
+                keys = json_data.at("keys").get<vector<string>>();
+        }
+        catch (...)
+        {
+            send_json_error(conn, "400 Bad Request", op == "mset" ? "Expected {\"items\": [{\"key\": ..., \"value\": ...}, ...]}"
+                                                                  : "Expected {\"keys\": [...]}");
+            return true;
+        }
+        if (keys.size() > MAX_BATCH_KEYS || items.size() > MAX_BATCH_KEYS)
+        {
+            send_json_error(conn, "413 Payload Too Large",
+                            "At most " + to_string(MAX_BATCH_KEYS) + " keys per batch");
+            return true;
+        }
 
-            mg_printf(conn,
-                      "HTTP/1.1 400 Bad Request\r\n"
-                      "Content-Type: application/json\r\n"
-                      "Content-Length: %zu\r\n\r\n",
-                      err_resp.size());
-            mg_write(conn, err_resp.data(), err_resp.size());
+        if (op == "mget")
+            return mget(conn, keys);
+        for (auto &item : items)
+        {
+            if (chunks->needs_chunks(item.second))
+            {
+                send_json_error(conn, "413 Payload Too Large",
+                                "Values over " + to_string(chunks->chunk_size()) + " bytes go to POST /key");
+                return true;
+            }
+        }
 
+        WriteAck ack;
+        if (!parse_write_ack(conn, ack))
+        {
+            send_bad_durability(conn);
             return true;
         }
+        return op == "mset" ? mset(conn, ack, items) : mdel(conn, ack, keys);
+    }
 
-        std::string key_to_delete = uri.substr(last_slash_pos + 1);
-        // synchronously remove from cache
-        cache.remove(key_to_delete);
+private:
+    static bool mget(struct mg_connection *conn, const vector<string> &keys)
+    {
+        vector<CacheLookup> found = cache.multi_lookup(keys);
+        vector<string> values(keys.size());
+        vector<size_t> fetch, waiting;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            CacheLookup &f = found[i];
+            if (f.status == CacheStatus::Hit || f.status == CacheStatus::SoftExpired)
+            {
+                values[i] = std::move(f.value);
+                if (f.should_refresh)
+                    kv->refresh(keys[i]);
+            }
+            else if (f.status == CacheStatus::Miss && f.lease == 0)
+                waiting.push_back(i); // another reader is filling it
+            else
+            {
+                if (f.lease == 0)
+                    f.lease = cache.lease(keys[i]); // stale entry
+                fetch.push_back(i);
+            }
+        }
 
-        // asynchronously remove from DB
-        auto key_hash = md5_hash(key_to_delete);
-        async_delete(mysql_pool, key_hash);
+        bool ok = fetch_batch(keys, fetch, found, values);
+        if (ok && !waiting.empty())
+        {
+            // One shared wait for the other readers' fills, then read the rest ourselves
+            auto deadline = chrono::steady_clock::now() + FILL_WAIT;
+            vector<size_t> leftover;
+            for (size_t i : waiting)
+            {
+                kv->count_fill_wait();
+                auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+                if (!cache.wait_for_fill(keys[i], values[i], std::max(left, chrono::milliseconds(0))))
+                    leftover.push_back(i);
+            }
+            ok = fetch_batch(keys, leftover, found, values);
+        }
+        for (size_t i = 0; ok && i < keys.size(); ++i)
+            ok = expand_chunks(keys[i], values[i]);
+        if (!ok)
+        {
+            send_json_error(conn, "500 Internal Server Error", "storage read failed");
+            return true;
+        }
 
         json j_response;
-        j_response["status"] = "ok";
-        j_response["key_to_delete"] = "deleted successfully";
-        response_body = j_response.dump(); // Much faster than ostringstream
+        j_response["values"] = json::array();
+        for (auto &value : values)
+        {
+            if (value.empty())
+                j_response["values"].push_back(nullptr);
+            else
+                j_response["values"].push_back(std::move(value));
+        }
+        // Raw values need not be UTF-8: replace what isn't, as KeyJson does
+        send_ok(conn, j_response.dump(-1, ' ', false, json::error_handler_t::replace));
+        return true;
+    }
+
+    static bool mset(struct mg_connection *conn, const WriteAck &ack, const StorageEngine::KeyValues &items)
+    {
+        vector<StorageEngine::WriteCallback> replaced;
+        for (auto &kv : items)
+            if (auto on_commit = chunks->replace(kv.first, cache.get(kv.first), kv.second))
+                replaced.push_back(std::move(on_commit));
+        WriteResult result = acked_write(ack, [&](StorageEngine::WriteCallback done, Durability d)
+                                         { return storage->multi_put(items, std::move(done), d); },
+                                         all_of(std::move(replaced)));
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            // Part of a failed group may still have been written: drop
+            // those keys instead of keeping values that may be outdated
+            if (result == WriteResult::Ok)
+                cache.put(items[i].first, items[i].second);
+            else
+                cache.remove(items[i].first);
+        }
+        return send_write_result(conn, result, items.size());
+    }
+
+    static bool mdel(struct mg_connection *conn, const WriteAck &ack, const vector<string> &keys)
+    {
+        vector<StorageEngine::WriteCallback> replaced;
+        for (auto &key : keys)
+            if (auto on_commit = chunks->replace(key, cache.get(key), ""))
+                replaced.push_back(std::move(on_commit));
+        WriteResult result = acked_write(ack, [&](StorageEngine::WriteCallback done, Durability d)
+                                         { return storage->multi_remove(keys, std::move(done), d); },
+                                         all_of(std::move(replaced)));
+        for (auto &key : keys)
+            cache.remove(key);
+        return send_write_result(conn, result, keys.size());
+    }
 
+    // One on_commit for a group that calls all of callbacks
+    static StorageEngine::WriteCallback all_of(vector<StorageEngine::WriteCallback> callbacks)
+    {
+        if (callbacks.empty())
+            return nullptr;
+        return [callbacks = std::move(callbacks)](bool ok)
+        {
+            for (auto &cb : callbacks)
+                cb(ok);
+        };
+    }
+
+    static bool send_write_result(struct mg_connection *conn, WriteResult result, size_t count)
+    {
+        if (result == WriteResult::Overloaded)
+            send_overloaded(conn);
+        else if (result == WriteResult::Failed)
+            send_write_failed(conn);
+        else
+        {
+            json j_response;
+            j_response["status"] = "ok";
+            j_response["count"] = count;
+            send_ok(conn, j_response.dump());
+        }
+        return true;
+    }
+
+    static void send_ok(struct mg_connection *conn, const string &response_body)
+    {
         mg_printf(conn,
-                  "HTTP/1.1 200 OK\r\n" // <-- FIX
+                  "HTTP/1.1 200 OK\r\n"
                   "Content-Type: application/json\r\n"
                   "Content-Length: %zu\r\n\r\n",
                   response_body.size());
         mg_write(conn, response_body.data(), response_body.size());
+    }
+};
 
-        return true; // We handled the request
+// POST /cache?key=k marks a cached key stale, e.g. after the DB was
+// changed behind the server's back. Default reads then go to storage,
+// stale-ok reads keep serving it while it refreshes.
+class CacheHandler : public CivetHandler
+{
+public:
+    bool handlePost(CivetServer *server, struct mg_connection *conn) override
+    {
+        string key, response_body;
+        json j_response;
+        if (server->getParam(conn, "key", key))
+        {
+            j_response["status"] = "ok";
+            j_response["key"] = key;
+            j_response["cached"] = cache.mark_stale(key);
+        }
+        else
+        {
+            j_response["error"] = "No 'key' parameter was provided.";
+        }
+        response_body = j_response.dump();
+
+        mg_printf(conn,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: application/json\r\n"
+                  "Content-Length: %zu\r\n\r\n",
+                  response_body.size());
+        mg_write(conn, response_body.data(), response_body.size());
+        return true;
     }
 };
 
-int main(void)
+// Exposes live gauges of the storage engine on /stats
+class StatsHandler : public CivetHandler
 {
-    const char *options[] = {
-        "listening_ports", "8888", "num_threads", num_threads,
-        NULL};
+public:
+    bool handleGet(CivetServer *server, struct mg_connection *conn) override
+    {
+        json j_response;
+        j_response["engine"] = storage->name();
+        j_response["cache"]["soft_ttl_ms"] = cache_soft_ttl.count();
+        j_response["cache"]["hard_ttl_ms"] = cache_hard_ttl.count();
+        j_response["http"]["max_misses"] = max_misses;
+        j_response["http"]["misses_shed"] = misses_shed.load();
+        kv->report_stats(j_response["cache"]);
+        chunks->report_stats(j_response["chunks"]);
+        if (binary_server)
+            binary_server->report_stats(j_response["binary"]);
+        if (resp_server)
+            resp_server->report_stats(j_response["resp"]);
+#ifdef KV_IO_URING
+        if (uring_server)
+            uring_server->report_stats(j_response["uring"]);
+#endif
+        storage->report_stats(j_response);
+        string response_body = j_response.dump();
+
+        mg_printf(conn,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: application/json\r\n"
+                  "Content-Length: %zu\r\n\r\n",
+                  response_body.size());
+        mg_write(conn, response_body.data(), response_body.size());
+        return true;
+    }
+};
 
+int main(int argc, char **argv)
+{
     try
     {
-        // Number of DB worker threads
-        const int num_db_threads = 10; // heuristic
-
-        for (int i = 0; i < num_db_threads; ++i)
+        // HTTP API: keep-alive, backlog, linger, nodelay and worker threads,
+        // from --config <file> and --<option> <value> (see CivetConfig.h)
+        CivetConfig civet_config;
+        try
+        {
+            civet_config.parse_args(argc, argv);
+        }
+        catch (const std::exception &e)
         {
-            std::thread(db_worker, std::ref(mysql_pool)).detach();
+            std::cerr << e.what() << "\nUsage: ./server [--config <file>] [--<civetweb option> <value> ...]"
+                      << std::endl;
+            return 1;
         }
-        CivetServer server(options); // Server starts here
+
+        // Backpressure: KV_DB_QUEUE_HWM caps the number of queued writes,
+        // KV_DB_QUEUE_BLOCK_MS is how long a POST/DELETE may wait for room
+        // before getting a 503 (0 = reject immediately).
+        if (const char *hwm = getenv("KV_DB_QUEUE_HWM"))
+            db_queue_limits.high_water_mark = std::stoul(hwm);
+        if (const char *block_ms = getenv("KV_DB_QUEUE_BLOCK_MS"))
+            db_queue_limits.max_block = std::chrono::milliseconds(std::stol(block_ms));
+
+        // Cache expiry: past the soft TTL an entry is still served but one
+        // reader triggers a background refresh; past the hard TTL it is a miss.
+        if (const char *soft_ms = getenv("KV_CACHE_SOFT_TTL_MS"))
+            cache_soft_ttl = std::chrono::milliseconds(std::stol(soft_ms));
+        if (const char *hard_ms = getenv("KV_CACHE_HARD_TTL_MS"))
+            cache_hard_ttl = std::chrono::milliseconds(std::stol(hard_ms));
+        cache.set_ttl(cache_soft_ttl, cache_hard_ttl);
+
+        const char *engine = getenv("KV_STORAGE_ENGINE");
+        storage = create_storage_engine(engine ? engine : "mysql");
+        std::cout << "Storage engine: " << storage->name() << std::endl;
+        // Large values: stored in chunks of KV_CHUNK_BYTES, and at most
+        // KV_MAX_VALUE_BYTES in all
+        size_t chunk_bytes = 256 << 10;
+        if (const char *bytes = getenv("KV_CHUNK_BYTES"))
+            chunk_bytes = std::stoul(bytes);
+        if (const char *bytes = getenv("KV_MAX_VALUE_BYTES"))
+            max_value_bytes = std::stoull(bytes);
+        if (chunk_bytes == 0 || chunk_bytes > UINT32_MAX)
+            throw std::invalid_argument("KV_CHUNK_BYTES must be between 1 and 2^32 - 1");
+        chunks = std::make_unique<ChunkStore>(*storage, chunk_bytes);
+        kv = std::make_unique<KVService>(cache, *storage, *chunks);
+
+        max_misses = std::max(std::stoul(civet_config.get("num_threads")), 2ul) - 1;
+        if (const char *limit = getenv("KV_HTTP_MAX_MISSES"))
+            max_misses = std::stoul(limit);
+        if (max_misses == 0)
+            throw std::invalid_argument("KV_HTTP_MAX_MISSES must be at least 1");
+        miss_slots = std::make_unique<counting_semaphore<>>(max_misses);
+
+        vector<const char *> options = civet_config.options();
+        CivetServer server(options.data()); // Server starts here
+        std::cout << "civetweb: " << civet_config.describe() << std::endl;
 
         ItemHandler h_item;
         server.addHandler("/key*", h_item);
+        StatsHandler h_stats;
+        server.addHandler("/stats", h_stats);
+        CacheHandler h_cache;
+        server.addHandler("/cache", h_cache);
+        // Matched before the /key* pattern: civetweb tries prefix handlers first
+        BatchHandler h_batch;
+        server.addHandler("/keys", h_batch);
+
+        std::cout << "C++ server running on port " << civet_config.get("listening_ports") << "." << std::endl;
+
+        // Second front end: the binary protocol, on the same cache and storage
+        BinaryServerConfig binary_config;
+        if (const char *port = getenv("KV_BINARY_PORT"))
+            binary_config.port = std::stoi(port);
+        if (const char *threads = getenv("KV_BINARY_THREADS"))
+            binary_config.threads = std::stoul(threads);
+        if (binary_config.port > 0)
+        {
+            binary_server = std::make_unique<BinaryServer>(*kv, binary_config);
+            std::cout << "Binary protocol on port " << binary_config.port << " (" << binary_config.threads
+                      << " event loops)." << std::endl;
+        }
+
+        RespServerConfig resp_config;
+        if (const char *port = getenv("KV_RESP_PORT"))
+            resp_config.port = std::stoi(port);
+        if (const char *threads = getenv("KV_RESP_THREADS"))
+            resp_config.threads = std::stoul(threads);
+        if (resp_config.port > 0)
+        {
+            resp_server = std::make_unique<RespServer>(*kv, resp_config);
+            std::cout << "Redis protocol on port " << resp_config.port << " (" << resp_config.threads
+                      << " event loops)." << std::endl;
+        }
+
+#ifdef KV_IO_URING
+        UringHttpServerConfig uring_config;
+        if (const char *port = getenv("KV_URING_PORT"))
+            uring_config.port = std::stoi(port);
+        if (const char *threads = getenv("KV_URING_THREADS"))
+            uring_config.threads = std::stoul(threads);
+        if (uring_config.port > 0)
+        {
+            // Optional: kernels without io_uring (or with it disabled) keep
+            // the other listeners
+            try
+            {
+                uring_server = std::make_unique<UringHttpServer>(*kv, uring_config);
+                std::cout << "io_uring HTTP on port " << uring_config.port << " (" << uring_config.threads
+                          << " rings)." << std::endl;
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "io_uring HTTP listener disabled: " << e.what() << std::endl;
+            }
+        }
+#endif
 
-        std::cout << "C++ server running on port 8888." << std::endl;
         std::cout << "Press Enter to exit." << std::endl;
         getchar();
+#ifdef KV_IO_URING
+        uring_server.reset();
+#endif
+        resp_server.reset();
+        binary_server.reset();
     }
     catch (const CivetException &e)
     {
         std::cerr << "Failed to start server: " << e.what() << std::endl;
         return 1;
     }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Failed to start: " << e.what() << std::endl;
+        return 1;
+    }
 
     return 0;
 }
\ No newline at end of file
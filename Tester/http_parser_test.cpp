@@ -0,0 +1,274 @@
+// Table-driven test of the io_uring listener's HTTP parser (HttpParser):
+// request heads, partial and pipelined input, the head size limit,
+// headers that must be refused, and query decoding.
+//
+//   g++ -std=c++20 -O2 -I. -I../Server/include http_parser_test.cpp ../Server/src/HttpParser.cpp -o http_parser_test
+//   ./http_parser_test
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <functional>
+#include "HttpParser.h"
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        throw std::runtime_error(what);
+    }
+}
+
+static std::string shown(std::string_view s) {
+    std::string out;
+    for (char c : s.substr(0, 100)) {
+        out += c == '\r' ? "\\r" : c == '\n' ? "\\n" : std::string(1, c);
+    }
+    return s.size() > 100 ? out + "..." : out;
+}
+
+static const char *name_of(HttpParse p) {
+    return p == HttpParse::Complete ? "Complete" : p == HttpParse::Incomplete ? "Incomplete" : "Invalid";
+}
+
+static HttpParse parse(const std::string &input, HttpRequest &req) {
+    return parse_http_request(input.data(), input.size(), req);
+}
+
+// Heads that parse, and what they parse to
+struct Parsed {
+    std::string name;
+    std::string input;
+    std::string method;
+    std::string path;
+    std::string query;
+    int minor_version;
+    bool keep_alive;
+    size_t content_length;
+    std::string content_type;
+    bool expect_continue;
+    bool chunked;
+};
+
+// Heads that don't parse (yet)
+struct Refused {
+    std::string name;
+    std::string input;
+    HttpParse result;
+};
+
+// --- Test Definitions ---
+
+void test_complete_heads() {
+    std::vector<Parsed> cases = {
+        {"GET", "GET /key?name=a HTTP/1.1\r\nHost: x\r\n\r\n", "GET", "/key", "name=a", 1, true, 0, "", false, false},
+        {"POST", "POST /key HTTP/1.1\r\nContent-Type: application/json\r\nContent-Length: 27\r\n\r\n", "POST", "/key", "",
+         1, true, 27, "application/json", false, false},
+        {"no headers", "DELETE /key?name=a HTTP/1.1\r\n\r\n", "DELETE", "/key", "name=a", 1, true, 0, "", false, false},
+        {"HTTP/1.0 closes", "GET / HTTP/1.0\r\n\r\n", "GET", "/", "", 0, false, 0, "", false, false},
+        {"HTTP/1.0 keep-alive", "GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", "GET", "/", "", 0, true, 0, "",
+         false, false},
+        {"close in a list", "GET / HTTP/1.1\r\nconnection: Upgrade, close\r\n\r\n", "GET", "/", "", 1, false, 0, "",
+         false, false},
+        {"names ignore case", "POST /key HTTP/1.1\r\ncOnTeNt-LeNgTh: 5\r\nCONTENT-TYPE: text/plain\r\n\r\n", "POST",
+         "/key", "", 1, true, 5, "text/plain", false, false},
+        {"values trimmed", "POST /key HTTP/1.1\r\nContent-Length: \t 7 \t\r\nContent-Type:   a/b; q=1  \r\n\r\n", "POST",
+         "/key", "", 1, true, 7, "a/b; q=1", false, false},
+        {"same length twice", "POST /key HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\n", "POST", "/key",
+         "", 1, true, 3, "", false, false},
+        {"100-continue", "POST /key HTTP/1.1\r\nExpect: 100-Continue\r\nContent-Length: 1\r\n\r\n", "POST", "/key",
+         "", 1, true, 1, "", true, false},
+        {"chunked", "POST /key HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", "POST", "/key", "", 1, true, 0, "",
+         false, true},
+        {"empty value", "GET / HTTP/1.1\r\nX-Empty:\r\n\r\n", "GET", "/", "", 1, true, 0, "", false, false},
+        {"empty query", "GET /stats? HTTP/1.1\r\n\r\n", "GET", "/stats", "", 1, true, 0, "", false, false},
+    };
+    for (const Parsed &c : cases) {
+        HttpRequest req;
+        HttpParse got = parse(c.input, req);
+        expect(got == HttpParse::Complete, c.name + ": " + name_of(got) + " for \"" + shown(c.input) + "\"");
+        expect(req.method == c.method && req.path == c.path && req.query == c.query,
+               c.name + ": request line parsed as " + std::string(req.method) + " " + std::string(req.path) + " ? " +
+                   std::string(req.query));
+        expect(req.minor_version == c.minor_version, c.name + ": HTTP/1." + std::to_string(req.minor_version));
+        expect(req.keep_alive == c.keep_alive, c.name + ": keep_alive is " + std::to_string(req.keep_alive));
+        expect(req.content_length == c.content_length,
+               c.name + ": content_length is " + std::to_string(req.content_length));
+        expect(req.content_type == c.content_type, c.name + ": content_type is \"" + std::string(req.content_type) + "\"");
+        expect(req.expect_continue == c.expect_continue && req.chunked == c.chunked, c.name + ": wrong Expect or TE");
+        expect(req.head_size == c.input.size(), c.name + ": head_size " + std::to_string(req.head_size));
+    }
+}
+
+void test_refused_heads() {
+    std::string head = "POST /key HTTP/1.1\r\n";
+    std::vector<Refused> cases = {
+        {"empty", "", HttpParse::Incomplete},
+        {"no blank line yet", head + "Content-Length: 5\r\n", HttpParse::Incomplete},
+        {"bare LF", "GET / HTTP/1.1\n\n", HttpParse::Incomplete},
+        {"lowercase method", "get / HTTP/1.1\r\n\r\n", HttpParse::Invalid},
+        {"no target", "GET HTTP/1.1\r\n\r\n", HttpParse::Invalid},
+        {"target not a path", "GET key HTTP/1.1\r\n\r\n", HttpParse::Invalid},
+        {"two spaces", "GET  / HTTP/1.1\r\n\r\n", HttpParse::Invalid},
+        {"HTTP/2", "GET / HTTP/2.0\r\n\r\n", HttpParse::Invalid},
+        {"HTTP/1.10", "GET / HTTP/1.10\r\n\r\n", HttpParse::Invalid},
+        {"no version", "GET /\r\n\r\n", HttpParse::Invalid},
+        {"no colon", head + "Content-Length 5\r\n\r\n", HttpParse::Invalid},
+        {"empty name", head + ": 5\r\n\r\n", HttpParse::Invalid},
+        {"space before the colon", head + "Content-Length : 5\r\n\r\n", HttpParse::Invalid},
+        {"folded line", head + "X-A: 1\r\n X-B: 2\r\n\r\n", HttpParse::Invalid},
+        {"control in the name", head + "Content\rLength: 5\r\n\r\n", HttpParse::Invalid},
+        {"separator in the name", head + "Content/Length: 5\r\n\r\n", HttpParse::Invalid},
+        {"signed length", head + "Content-Length: +5\r\n\r\n", HttpParse::Invalid},
+        {"negative length", head + "Content-Length: -1\r\n\r\n", HttpParse::Invalid},
+        {"length list", head + "Content-Length: 5, 5\r\n\r\n", HttpParse::Invalid},
+        {"empty length", head + "Content-Length:\r\n\r\n", HttpParse::Invalid},
+        {"length too long", head + "Content-Length: 9999999999999999999\r\n\r\n", HttpParse::Invalid},
+        {"conflicting lengths", head + "Content-Length: 5\r\nContent-Length: 6\r\n\r\n", HttpParse::Invalid},
+        {"length and chunked", head + "Transfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", HttpParse::Invalid},
+        {"chunked and length", head + "Content-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n", HttpParse::Invalid},
+    };
+    for (const Refused &c : cases) {
+        HttpRequest req;
+        HttpParse got = parse(c.input, req);
+        expect(got == c.result, c.name + ": " + name_of(got) + ", expected " + name_of(c.result) + " for \"" +
+                                    shown(c.input) + "\"");
+    }
+}
+
+void test_partial_and_pipelined() {
+    std::string first = "POST /key HTTP/1.1\r\nContent-Length: 5\r\n\r\n";
+    std::string second = "GET /key?name=b HTTP/1.1\r\n\r\n";
+    std::string stream = first + "hello" + second + "GET /stats HTTP/1.1\r\nHo";
+
+    // Every cut short of the blank line waits for more
+    HttpRequest req;
+    for (size_t cut = 0; cut < first.size(); ++cut) {
+        HttpParse got = parse_http_request(first.data(), cut, req);
+        expect(got == HttpParse::Incomplete, "cut at " + std::to_string(cut) + ": " + name_of(got));
+    }
+
+    // The next request starts after the head and the body
+    expect(parse(stream, req) == HttpParse::Complete, "first request not parsed");
+    expect(req.head_size == first.size() && req.content_length == 5, "first request's head or body size wrong");
+    expect(std::string_view(stream).substr(req.head_size, req.content_length) == "hello", "body not after the head");
+    size_t pos = req.head_size + req.content_length;
+    expect(parse_http_request(stream.data() + pos, stream.size() - pos, req) == HttpParse::Complete,
+           "second request not parsed");
+    expect(req.method == "GET" && req.query == "name=b" && req.head_size == second.size(), "second request wrong");
+    pos += req.head_size;
+    expect(parse_http_request(stream.data() + pos, stream.size() - pos, req) == HttpParse::Incomplete,
+           "cut third request not incomplete");
+}
+
+void test_head_limit() {
+    std::string line = "GET / HTTP/1.1\r\n";
+    auto padded = [&](size_t size) {
+        // X-Pad header so the head, blank line included, is size bytes
+        std::string head = line + "X-Pad: ";
+        head += std::string(size - head.size() - 4, 'p');
+        return head + "\r\n\r\n";
+    };
+    HttpRequest req;
+    std::string at_limit = padded(MAX_HTTP_HEAD);
+    expect(parse(at_limit, req) == HttpParse::Complete, "head of exactly MAX_HTTP_HEAD refused");
+    expect(parse(padded(MAX_HTTP_HEAD + 1), req) == HttpParse::Invalid, "head over MAX_HTTP_HEAD accepted");
+    std::string unterminated = line + "X-Pad: " + std::string(MAX_HTTP_HEAD, 'p');
+    expect(parse(unterminated, req) == HttpParse::Invalid, "head without an end past the limit kept waiting");
+    expect(parse_http_request(unterminated.data(), MAX_HTTP_HEAD - 1, req) == HttpParse::Incomplete,
+           "head under the limit not waited for");
+}
+
+void test_url_decode() {
+    struct Case {
+        std::string name;
+        std::string in;
+        bool form;
+        bool ok;
+        std::string out;
+    };
+    std::vector<Case> cases = {
+        {"plain", "abc", true, true, "abc"},
+        {"escapes", "a%20b%2Fc%41", true, true, "a b/cA"},
+        {"lowercase hex", "%e2%82%ac", true, true, "\xe2\x82\xac"},
+        {"NUL", "a%00b", true, true, std::string("a\0b", 3)},
+        {"plus in a form", "a+b", true, true, "a b"},
+        {"plus in a path", "a+b", false, true, "a+b"},
+        {"escaped plus", "%2B", true, true, "+"},
+        {"cut escape", "ab%4", true, false, ""},
+        {"bare percent", "%", true, false, ""},
+        {"bad hex", "%zz", true, false, ""},
+        {"empty", "", true, true, ""},
+    };
+    for (const Case &c : cases) {
+        std::string out = "stale";
+        bool ok = http_url_decode(c.in, out, c.form);
+        expect(ok == c.ok, c.name + ": decode returned " + std::to_string(ok));
+        expect(!ok || out == c.out, c.name + ": decoded to \"" + out + "\"");
+    }
+}
+
+void test_query_params() {
+    struct Case {
+        std::string query;
+        std::string name;
+        bool found;
+        std::string value;
+    };
+    std::vector<Case> cases = {
+        {"name=a", "name", true, "a"},
+        {"x=1&name=a%20b&y=2", "name", true, "a b"},
+        {"durability=db", "durability", true, "db"},
+        {"name", "name", true, ""},
+        {"name=", "name", true, ""},
+        {"names=a", "name", false, ""},
+        {"xname=a", "name", false, ""},
+        {"", "name", false, ""},
+        {"name=a&name=b", "name", true, "a"},
+        {"name=%zz", "name", false, ""},
+        {"&&name=c", "name", true, "c"},
+    };
+    for (const Case &c : cases) {
+        std::string out;
+        bool found = http_query_param(c.query, c.name, out);
+        expect(found == c.found && (!found || out == c.value),
+               "\"" + c.query + "\" gave " + std::to_string(found) + " \"" + out + "\" for " + c.name);
+    }
+
+    expect(http_media_type_is("application/json", "application/json"), "exact media type");
+    expect(http_media_type_is(" Application/JSON ; charset=utf-8", "application/json"), "case and parameters");
+    expect(!http_media_type_is("application/json-patch", "application/json"), "prefix matched");
+    expect(!http_media_type_is("", "application/json"), "empty matched");
+}
+
+/**
+ * @brief Simple test runner
+ */
+int main() {
+    std::map<std::string, std::function<void()>> tests;
+    tests["Test 1: complete request heads"] = test_complete_heads;
+    tests["Test 2: refused request heads"] = test_refused_heads;
+    tests["Test 3: partial and pipelined requests"] = test_partial_and_pipelined;
+    tests["Test 4: head size limit"] = test_head_limit;
+    tests["Test 5: URL decoding"] = test_url_decode;
+    tests["Test 6: query parameters and media types"] = test_query_params;
+
+    int passed = 0;
+    int failed = 0;
+    for (const auto &test_pair : tests) {
+        std::cout << "--- " << test_pair.first << " ---" << std::endl;
+        try {
+            test_pair.second();
+            std::cout << "[  PASS  ]\n" << std::endl;
+            passed++;
+        } catch (const std::exception &e) {
+            std::cout << "[  FAIL  ] - " << e.what() << "\n" << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << "\n--- Test Summary ---" << std::endl;
+    std::cout << "Passed: " << passed << std::endl;
+    std::cout << "Failed: " << failed << std::endl;
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+// Per-request cost of the /key JSON: nlohmann::json against the server's
+// hand-rolled KeyJson, for the POST body parse and the GET response.
+//
+//   g++ -std=c++20 -O2 -I. -I../Server/include json_bench.cpp ../Server/src/KeyJson.cpp -o json_bench
+//   ./json_bench [iterations] [value bytes]
+//
+// Reports CPU time and heap allocations per request. Both sides end with
+// the key and value as std::strings, as the handlers need them for storage.
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <time.h>
+#include "nlohmann/json.hpp"
+#include "KeyJson.h"
+
+using json = nlohmann::json;
+
+static long long allocations = 0;
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+double cpu_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keeps the compiler from dropping the work
+static size_t sink = 0;
+
+template <typename F>
+void measure(const char* name, int iterations, F f) {
+    for(int i = 0; i < iterations / 10; i++) f(); // warm up
+    long long allocs_before = allocations;
+    double start = cpu_seconds();
+    for(int i = 0; i < iterations; i++) f();
+    double ns = (cpu_seconds() - start) * 1e9 / iterations;
+    double allocs = (double)(allocations - allocs_before) / iterations;
+    std::cout << "  " << name << ": " << ns << " ns, " << allocs << " allocations per request\n";
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    size_t value_size = argc > 2 ? std::atoi(argv[2]) : 100;
+
+    std::string key = "user:123456";
+    std::string value(value_size, 'v');
+    std::string body = "{\"key\": \"" + key + "\", \"value\": \"" + value + "\"}";
+    // Same size, with escapes to decode and encode
+    std::string escaped_value = value.substr(0, value_size / 2) + "\"quoted\"\n\ttabbed \xc3\xa9";
+    std::string escaped_body = json({{"key", key}, {"value", escaped_value}}).dump();
+
+    std::cout << "====== /key JSON, " << iterations << " requests, " << value_size << " byte values ======\n";
+    for(int escapes = 0; escapes < 2; escapes++) {
+        const std::string& in = escapes ? escaped_body : body;
+        const std::string& out_value = escapes ? escaped_value : value;
+        std::cout << (escapes ? "With escapes\n" : "Plain strings\n");
+
+        measure("parse POST body, nlohmann", iterations, [&] {
+            auto j = json::parse(in);
+            std::string k = j["key"].get<std::string>();
+            std::string v = j["value"].get<std::string>();
+            sink += k.size() + v.size();
+        });
+        measure("parse POST body, KeyJson ", iterations, [&] {
+            keyjson::KeyValue kv;
+            keyjson::parse_key_value(in, kv);
+            std::string k(kv.key), v(kv.value);
+            sink += k.size() + v.size();
+        });
+
+        measure("GET response,    nlohmann", iterations, [&] {
+            json j;
+            j["key"] = key;
+            j["value"] = out_value;
+            std::string response = j.dump();
+            sink += response.size();
+        });
+        std::string buffer; // the server's per-thread buffer
+        measure("GET response,    KeyJson ", iterations, [&] {
+            buffer.clear();
+            keyjson::append_value(buffer, key, out_value);
+            sink += buffer.size();
+        });
+    }
+    return sink == 0;
+}
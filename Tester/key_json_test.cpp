@@ -0,0 +1,354 @@
+// Table-driven test of the /key JSON codec (KeyJson), plus a differential
+// check against nlohmann::json, whose output it must match byte for byte:
+// escapes, surrogate pairs, invalid UTF-8, and duplicate, non-string and
+// unknown members.
+//
+//   g++ -std=c++20 -O2 -I. -I../Server/include key_json_test.cpp ../Server/src/KeyJson.cpp -o key_json_test
+//   ./key_json_test [random cases]
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <functional>
+#include <random>
+#include <cstdlib>
+#include "nlohmann/json.hpp"
+#include "KeyJson.h"
+
+using json = nlohmann::json;
+
+static int random_cases = 100000;
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        throw std::runtime_error(what);
+    }
+}
+
+// Shows bytes outside printable ASCII as \xNN, so a failing case is readable
+static std::string shown(std::string_view s) {
+    static const char HEX[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : s) {
+        if (c < 0x20 || c >= 0x7f) {
+            out += "\\x";
+            out += HEX[c >> 4];
+            out += HEX[c & 15];
+        } else {
+            out += char(c);
+        }
+    }
+    return out;
+}
+
+// What the server's responses used to be, with invalid UTF-8 replaced
+// instead of throwing
+static std::string dumped(const json &j) {
+    return j.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+static std::string escaped(std::string_view s) {
+    std::string out;
+    keyjson::append_string(out, s);
+    return out;
+}
+
+struct ParseCase {
+    std::string name;
+    std::string body;
+    bool ok;
+    std::string key;
+    std::string value;
+};
+
+static void run(const std::vector<ParseCase> &cases) {
+    for (const ParseCase &c : cases) {
+        keyjson::KeyValue kv;
+        bool ok = keyjson::parse_key_value(c.body, kv);
+        expect(ok == c.ok, c.name + ": parse returned " + std::to_string(ok) + " for " + shown(c.body));
+        expect(!ok || (kv.key == c.key && kv.value == c.value),
+               c.name + ": parsed as key " + shown(kv.key) + ", value " + shown(kv.value));
+    }
+}
+
+// --- Test Definitions ---
+
+void test_parse_members() {
+    run({
+        {"plain", R"({"key":"a","value":"1"})", true, "a", "1"},
+        {"whitespace", " \t\r\n{ \"value\" : \"1\" ,\n\"key\"\t:\"a\" } \n", true, "a", "1"},
+        {"empty strings", R"({"key":"","value":""})", true, "", ""},
+        {"other members skipped", R"({"n":1.5e-3,"key":"a","o":{"x":[1,true,null,{"y":"z"}]},"value":"1","f":false})",
+         true, "a", "1"},
+        {"repeated key, last wins", R"({"key":"a","value":"1","key":"b"})", true, "b", "1"},
+        {"number key", R"({"key":1,"value":"1"})", false, "", ""},
+        {"null value", R"({"key":"a","value":null})", false, "", ""},
+        {"object value", R"({"key":"a","value":{"v":"1"}})", false, "", ""},
+        {"string replaced by a number", R"({"key":"a","value":"1","key":2})", false, "", ""},
+        {"number replaced by a string", R"({"key":2,"value":"1","key":"a"})", true, "a", "1"},
+        {"no value", R"({"key":"a"})", false, "", ""},
+        {"no key", R"({"value":"1"})", false, "", ""},
+        {"empty object", "{}", false, "", ""},
+        {"member names are case sensitive", R"({"Key":"a","value":"1"})", false, "", ""},
+        {"escaped member name", R"({"k\u0065y":"a","valu\u0065":"1"})", true, "a", "1"},
+        {"nested key ignored", R"({"o":{"key":"x","value":"y"},"key":"a","value":"1"})", true, "a", "1"},
+    });
+}
+
+void test_parse_syntax() {
+    run({
+        {"empty body", "", false, "", ""},
+        {"array", R"(["key","a"])", false, "", ""},
+        {"string", R"("key")", false, "", ""},
+        {"trailing comma", R"({"key":"a","value":"1",})", false, "", ""},
+        {"trailing garbage", R"({"key":"a","value":"1"}x)", false, "", ""},
+        {"two objects", R"({"key":"a","value":"1"}{})", false, "", ""},
+        {"single quotes", R"({'key':'a','value':'1'})", false, "", ""},
+        {"unquoted name", R"({key:"a","value":"1"})", false, "", ""},
+        {"missing colon", R"({"key" "a","value":"1"})", false, "", ""},
+        {"leading zero", R"({"n":01,"key":"a","value":"1"})", false, "", ""},
+        {"bare minus", R"({"n":-,"key":"a","value":"1"})", false, "", ""},
+        {"bad literal", R"({"n":nul,"key":"a","value":"1"})", false, "", ""},
+        {"unclosed array", R"({"n":[1,"key":"a","value":"1"})", false, "", ""},
+        {"NUL after the object", std::string(R"({"key":"a","value":"1"})") + '\0', false, "", ""},
+    });
+
+    // Every cut of a valid body is refused
+    std::string body = R"({"key":"a\n","value":"\ud83d\ude00", "x": [1, {"y": null}]})";
+    keyjson::KeyValue kv;
+    expect(keyjson::parse_key_value(body, kv), "uncut body refused");
+    for (size_t cut = 0; cut < body.size(); ++cut) {
+        std::string_view part(body.data(), cut);
+        expect(!keyjson::parse_key_value(part, kv), "body cut at " + std::to_string(cut) + " accepted");
+    }
+}
+
+void test_parse_escapes() {
+    run({
+        {"simple escapes", R"({"key":"\"\\\/\b\f\n\r\t","value":"1"})", true, "\"\\/\b\f\n\r\t", "1"},
+        {"\\u ASCII", R"({"key":"\u0041\u0062","value":"1"})", true, "Ab", "1"},
+        {"\\u NUL", R"({"key":"a\u0000b","value":"1"})", true, std::string("a\0b", 3), "1"},
+        {"\\u two bytes", R"({"key":"\u00e9","value":"1"})", true, "\xc3\xa9", "1"},
+        {"\\u three bytes", R"({"key":"\u20AC","value":"1"})", true, "\xe2\x82\xac", "1"},
+        {"surrogate pair", R"({"key":"\ud83d\ude00","value":"1"})", true, "\xf0\x9f\x98\x80", "1"},
+        {"highest pair", R"({"key":"\uDBFF\uDFFF","value":"1"})", true, "\xf4\x8f\xbf\xbf", "1"},
+        {"escapes after plain text", R"({"key":"abc\tdef","value":"x\"y"})", true, "abc\tdef", "x\"y"},
+        {"raw UTF-8", "{\"key\":\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\",\"value\":\"1\"}", true,
+         "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", "1"},
+        {"raw UTF-8 next to an escape", "{\"key\":\"\xc3\xa9\\n\xc3\xa9\",\"value\":\"1\"}", true, "\xc3\xa9\n\xc3\xa9",
+         "1"},
+        {"lone high surrogate", R"({"key":"\ud83d","value":"1"})", false, "", ""},
+        {"high surrogate then text", R"({"key":"\ud83dx","value":"1"})", false, "", ""},
+        {"two high surrogates", R"({"key":"\ud83d\ud83d","value":"1"})", false, "", ""},
+        {"lone low surrogate", R"({"key":"\ude00","value":"1"})", false, "", ""},
+        {"short \\u", R"({"key":"\u12","value":"1"})", false, "", ""},
+        {"bad hex", R"({"key":"\u12g4","value":"1"})", false, "", ""},
+        {"unknown escape", R"({"key":"\x41","value":"1"})", false, "", ""},
+        {"raw control", "{\"key\":\"a\tb\",\"value\":\"1\"}", false, "", ""},
+        {"raw newline", "{\"key\":\"a\nb\",\"value\":\"1\"}", false, "", ""},
+        {"unterminated", R"({"key":"a,"value":"1"})", false, "", ""},
+        {"escaped quote at the end", R"({"key":"a\"})", false, "", ""},
+    });
+}
+
+void test_parse_invalid_utf8() {
+    // Bytes nlohmann's parser refuses too, raw or after an escape
+    std::vector<std::string> bad = {
+        "\x80",             // continuation without a lead
+        "\xc3",             // cut two-byte sequence
+        "\xe2\x82",         // cut three-byte sequence
+        "\xf0\x9f\x98",     // cut four-byte sequence
+        "\xc0\xaf",         // overlong '/'
+        "\xe0\x80\xaf",     // overlong '/' in three bytes
+        "\xf0\x80\x80\xaf", // overlong '/' in four bytes
+        "\xed\xa0\x80",     // encoded surrogate
+        "\xf4\x90\x80\x80", // past U+10FFFF
+        "\xf8\x88\x80\x80\x80",
+        "\xfe",
+        "\xff",
+    };
+    for (auto &bytes : bad) {
+        for (std::string prefix : {"", "a", "\\n"}) {
+            std::string body = "{\"key\":\"" + prefix + bytes + "\",\"value\":\"1\"}";
+            keyjson::KeyValue kv;
+            expect(!keyjson::parse_key_value(body, kv), "invalid UTF-8 accepted: " + shown(body));
+            expect(json::parse(body, nullptr, false).is_discarded(), "nlohmann accepts " + shown(body));
+        }
+    }
+}
+
+void test_parse_views() {
+    // Strings without escapes point into the body, the others into the buffers
+    std::string body = R"({"key":"plain","value":"esc\naped"})";
+    keyjson::KeyValue kv;
+    expect(keyjson::parse_key_value(body, kv), "body refused");
+    expect(kv.key.data() >= body.data() && kv.key.data() < body.data() + body.size(), "key copied");
+    expect(kv.value.data() == kv.value_buf.data() && kv.value == "esc\naped", "escaped value not in value_buf");
+}
+
+void test_escaping() {
+    struct Case {
+        std::string name;
+        std::string in;
+        std::string out;
+    };
+    std::vector<Case> cases = {
+        {"plain", "abc", "\"abc\""},
+        {"quote and backslash", "a\"b\\c", "\"a\\\"b\\\\c\""},
+        {"short escapes", "\b\f\n\r\t", "\"\\b\\f\\n\\r\\t\""},
+        {"other controls", std::string("\0\x01\x1f", 3), "\"\\u0000\\u0001\\u001f\""},
+        {"DEL and slash as they are", "\x7f/", "\"\x7f/\""},
+        {"UTF-8 as it is", "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", "\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\""},
+        {"lone continuation", "a\x80" "b", "\"a\xef\xbf\xbd" "b\""},
+        {"cut sequence, one replacement", "\xe2\x82" "A", "\"\xef\xbf\xbd" "A\""},
+        {"cut at the end", "a\xf0\x9f\x98", "\"a\xef\xbf\xbd\""},
+        {"overlong, per byte", "\xc0\xaf", "\"\xef\xbf\xbd\xef\xbf\xbd\""},
+        {"encoded surrogate, per byte", "\xed\xa0\x80", "\"\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\""},
+        {"invalid then quote", "\xff\"", "\"\xef\xbf\xbd\\\"\""},
+    };
+    for (const Case &c : cases) {
+        std::string got = escaped(c.in);
+        expect(got == c.out, c.name + ": " + shown(got) + ", expected " + shown(c.out));
+        expect(got == dumped(json(c.in)), c.name + ": differs from nlohmann's " + shown(dumped(json(c.in))));
+    }
+
+    // The response bodies, against the nlohmann objects they replaced
+    std::string key = "k\"\xc3\xa9\x01", value = "v\n\xff";
+    std::string out;
+    keyjson::append_value(out, key, value);
+    expect(out == dumped({{"key", key}, {"value", value}}), "append_value: " + shown(out));
+    out.clear();
+    keyjson::append_not_found(out, key);
+    expect(out == dumped({{"error", "Key not found"}, {"key", key}}), "append_not_found: " + shown(out));
+    out.clear();
+    keyjson::append_created(out, key);
+    expect(out == dumped({{"created_key", key}, {"status", "ok"}}), "append_created: " + shown(out));
+    out.clear();
+    keyjson::append_deleted(out);
+    expect(out == dumped({{"key_to_delete", "deleted successfully"}, {"status", "ok"}}), "append_deleted: " + shown(out));
+    out.clear();
+    keyjson::append_error(out, "bad \"input\"");
+    expect(out == dumped({{"message", "bad \"input\""}, {"status", "error"}}), "append_error: " + shown(out));
+}
+
+// Random strings heavy in the bytes the escaper treats specially
+static std::string random_string(std::mt19937 &rng) {
+    static const std::vector<std::string> pieces = {
+        "a", "Z", "0", " ", "/", "\"", "\\", "\n", "\t", std::string(1, '\0'), "\x01", "\x1f", "\x7f",
+        "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf", // valid
+        "\x80", "\xbf", "\xc0", "\xc1", "\xc2", "\xdf", "\xe0", "\xe0\xa0", "\xed", "\xed\x9f", "\xed\xa0",
+        "\xef", "\xf0", "\xf0\x90", "\xf0\x8f", "\xf4", "\xf4\x90", "\xf5", "\xfe", "\xff", // fragments
+    };
+    std::string s;
+    size_t n = rng() % 12;
+    for (size_t i = 0; i < n; ++i) {
+        s += pieces[rng() % pieces.size()];
+    }
+    return s;
+}
+
+void test_random_escaping() {
+    std::mt19937 rng(45);
+    for (int i = 0; i < random_cases; ++i) {
+        std::string s = random_string(rng);
+        std::string ours = escaped(s);
+        std::string theirs = dumped(json(s));
+        expect(ours == theirs, "escaping " + shown(s) + ": " + shown(ours) + ", nlohmann " + shown(theirs));
+
+        // The same string in pieces, as a chunked value is streamed
+        std::string streamed = "\"", carry;
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t n = std::min<size_t>(1 + rng() % 4, s.size() - pos);
+            keyjson::append_string_piece(streamed, carry, std::string_view(s).substr(pos, n), pos + n == s.size());
+            pos += n;
+        }
+        if (s.empty()) {
+            keyjson::append_string_piece(streamed, carry, "", true);
+        }
+        streamed += '"';
+        expect(streamed == ours, "streaming " + shown(s) + ": " + shown(streamed));
+    }
+}
+
+void test_random_bodies() {
+    // Valid bodies, damaged at random; both parsers must agree
+    std::mt19937 rng(44);
+    static const std::string noise = "{}[]:,\"\\u0123456789abcdefnrt -.eE\xc3\xa9\xed\xa0\x80\xff";
+    int accepted = 0;
+    for (int i = 0; i < random_cases; ++i) {
+        json j = {{"key", random_string(rng)}, {"value", random_string(rng)}};
+        if (rng() % 2) {
+            j["other"] = {{"n", 1.5}, {"list", {1, nullptr, "x"}}};
+        }
+        std::string body = dumped(j);
+        int edits = rng() % 3;
+        for (int e = 0; e < edits && !body.empty(); ++e) {
+            size_t at = rng() % body.size();
+            switch (rng() % 3) {
+            case 0:
+                body.erase(at, 1);
+                break;
+            case 1:
+                body.insert(at, 1, noise[rng() % noise.size()]);
+                break;
+            default:
+                body[at] = noise[rng() % noise.size()];
+            }
+        }
+
+        json theirs = json::parse(body, nullptr, false);
+        bool want = !theirs.is_discarded() && theirs.is_object() && theirs.contains("key") &&
+                    theirs["key"].is_string() && theirs.contains("value") && theirs["value"].is_string();
+        keyjson::KeyValue kv;
+        bool ok = keyjson::parse_key_value(body, kv);
+        expect(ok == want, "parse returned " + std::to_string(ok) + ", nlohmann " + std::to_string(want) + " for " +
+                               shown(body));
+        if (ok) {
+            accepted++;
+            expect(kv.key == theirs["key"].get<std::string>() && kv.value == theirs["value"].get<std::string>(),
+                   "parsed differently from nlohmann: " + shown(body));
+        }
+    }
+    expect(accepted > random_cases / 10, "only " + std::to_string(accepted) + " random bodies were valid");
+}
+
+/**
+ * @brief Simple test runner
+ */
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        random_cases = std::atoi(argv[1]);
+    }
+
+    std::map<std::string, std::function<void()>> tests;
+    tests["Test 1: key and value members"] = test_parse_members;
+    tests["Test 2: JSON syntax"] = test_parse_syntax;
+    tests["Test 3: string escapes"] = test_parse_escapes;
+    tests["Test 4: invalid UTF-8 in bodies"] = test_parse_invalid_utf8;
+    tests["Test 5: views into the body"] = test_parse_views;
+    tests["Test 6: escaping responses"] = test_escaping;
+    tests["Test 7: random strings against nlohmann"] = test_random_escaping;
+    tests["Test 8: random bodies against nlohmann"] = test_random_bodies;
+
+    int passed = 0;
+    int failed = 0;
+    for (const auto &test_pair : tests) {
+        std::cout << "--- " << test_pair.first << " ---" << std::endl;
+        try {
+            test_pair.second();
+            std::cout << "[  PASS  ]\n" << std::endl;
+            passed++;
+        } catch (const std::exception &e) {
+            std::cout << "[  FAIL  ] - " << e.what() << "\n" << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << "\n--- Test Summary ---" << std::endl;
+    std::cout << "Passed: " << passed << std::endl;
+    std::cout << "Failed: " << failed << std::endl;
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+// Functional test of LSMEngine on its own, no server or MySQL needed:
+// memtable flushes, leveled compaction, recovery from the WAL and
+// MANIFEST, and writers refused rather than stalled for ever.
+//
+//   g++ -std=c++20 -O2 -I. -I../Server/include lsm_test.cpp ../Server/src/{LSMEngine,SSTable,StorageEngine,MemoryEngine,BitcaskEngine,MySQLEngine,MySQLHelper,MySQLPool,AsyncDBExecutor,ReadBatcher,WriteAheadLog,AppendLog,LogFormat}.cpp -lmysqlclient -lpthread -lcrypto -o lsm_test
+//   ./lsm_test [data dir]
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <map>
+#include <functional>
+#include <future>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include "LSMEngine.h"
+#include "nlohmann/json.hpp"
+
+namespace fs = std::filesystem;
+
+static std::string base_dir = "/tmp/lsm_test";
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        throw std::runtime_error(what);
+    }
+}
+
+// A 4 KB memtable, so a few thousand writes go through many flushes
+static LSMConfig config(const std::string &name) {
+    LSMConfig c;
+    c.dir = base_dir + "/" + name;
+    c.memtable_size = 4096;
+    c.level1_max_bytes = 64 << 10;
+    c.target_file_size = 16 << 10;
+    return c;
+}
+
+static void put(LSMEngine &e, const std::string &key, const std::string &value) {
+    std::promise<bool> done;
+    auto committed = done.get_future();
+    expect(e.put(key, value, [&](bool ok) { done.set_value(ok); }), "put of " + key + " was refused");
+    expect(committed.get(), "put of " + key + " failed");
+}
+
+static void remove(LSMEngine &e, const std::string &key) {
+    std::promise<bool> done;
+    auto committed = done.get_future();
+    expect(e.remove(key, [&](bool ok) { done.set_value(ok); }), "delete of " + key + " was refused");
+    expect(committed.get(), "delete of " + key + " failed");
+}
+
+static nlohmann::json stats(LSMEngine &e) {
+    nlohmann::json j;
+    e.report_stats(j);
+    return j["lsm"];
+}
+
+static size_t table_files(const nlohmann::json &s) {
+    size_t n = 0;
+    for (auto &level : s["levels"]) {
+        n += level["files"].get<size_t>();
+    }
+    return n;
+}
+
+static bool wait_for(const std::function<bool()> &pred, int seconds) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > until) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return true;
+}
+
+// N keys written `rounds` times, every fourth one deleted at the end
+static const int N = 3000;
+
+static std::string key_of(int i) {
+    char key[16];
+    snprintf(key, sizeof(key), "k%06d", i);
+    return key;
+}
+
+static std::string value_of(int i, int round) {
+    return "v" + std::to_string(round) + "_" + std::to_string(i) + std::string(60, 'x');
+}
+
+static void write_rounds(LSMEngine &e, int rounds) {
+    for (int round = 0; round < rounds; ++round) {
+        for (int i = 0; i < N; ++i) {
+            put(e, key_of(i), value_of(i, round));
+        }
+    }
+    for (int i = 0; i < N; i += 4) {
+        remove(e, key_of(i));
+    }
+}
+
+static void check_rounds(LSMEngine &e, int last_round, const std::string &when) {
+    for (int i = 0; i < N; ++i) {
+        std::string want = i % 4 == 0 ? "" : value_of(i, last_round);
+        expect(e.get(key_of(i)).get() == want, when + ": wrong value for " + key_of(i));
+    }
+}
+
+// --- Test Definitions ---
+
+void test_flush() {
+    LSMEngine e(config("flush"));
+    write_rounds(e, 1);
+    expect(wait_for([&] { return stats(e)["immutable_pending"] == false; }, 10), "memtable never flushed");
+    nlohmann::json s = stats(e);
+    expect(s["flushes"] > 10, "only " + s["flushes"].dump() + " flushes of a 4 KB memtable");
+    expect(table_files(s) > 0, "no SSTables after flushes");
+    expect(s["flush_bytes"] > 0 && s["user_bytes"] > 0, "flushed bytes not counted: " + s.dump());
+    check_rounds(e, 0, "after flushes");
+}
+
+void test_compaction() {
+    LSMEngine e(config("compaction"));
+    write_rounds(e, 4);
+    nlohmann::json s;
+    expect(wait_for([&] {
+        s = stats(e);
+        return s["compactions"] > 0 && s["levels"][0]["files"] < 4;
+    }, 15), "L0 never compacted: " + stats(e).dump());
+    expect(s["levels"][1]["files"] > 0, "compaction wrote nothing to L1: " + s.dump());
+    expect(s["write_amplification"] > 1.0, "write amplification not counted: " + s.dump());
+    check_rounds(e, 3, "after compaction");
+
+    // Scans merge the levels in key order and skip deleted keys
+    auto kvs = e.scan(key_of(0), 5);
+    expect(kvs.size() == 5, "scan returned " + std::to_string(kvs.size()) + " pairs");
+    int want[] = {1, 2, 3, 5, 6};
+    for (size_t i = 0; i < kvs.size(); ++i) {
+        expect(kvs[i].first == key_of(want[i]) && kvs[i].second == value_of(want[i], 3),
+               "scan out of order or stale at " + kvs[i].first);
+    }
+}
+
+void test_recovery() {
+    LSMConfig c = config("recovery");
+    {
+        LSMEngine e(c);
+        write_rounds(e, 2);
+        // The last writes are only in the memtable and its WAL
+        put(e, key_of(1), "only in the WAL");
+        remove(e, key_of(2));
+    }
+    for (int restart = 0; restart < 2; ++restart) {
+        LSMEngine e(c);
+        expect(e.get(key_of(1)).get() == "only in the WAL", "write in the WAL lost");
+        expect(e.get(key_of(2)).get().empty(), "delete in the WAL lost");
+        for (int i = 3; i < N; ++i) {
+            std::string want = i % 4 == 0 ? "" : value_of(i, 1);
+            expect(e.get(key_of(i)).get() == want, "after restart: wrong value for " + key_of(i));
+        }
+    }
+}
+
+void test_stall_is_refused() {
+    LSMConfig c = config("stall");
+    c.max_stall = std::chrono::milliseconds(1000);
+    fs::create_directories(c.dir);
+    LSMEngine e(c);
+    // Directories where the next SSTables go make every flush fail
+    for (int id = 1; id < 400; ++id) {
+        char name[32];
+        snprintf(name, sizeof(name), "/%09d.sst", id);
+        fs::create_directories(c.dir + name);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int accepted = 0;
+    int refused = 0;
+    for (int i = 0; i < 2000 && refused < 10; ++i) {
+        if (e.put(key_of(i), std::string(100, 'x'))) {
+            accepted++;
+        } else {
+            refused++;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    nlohmann::json s = stats(e);
+    expect(refused == 10, "no write refused while flushes fail: " + s.dump());
+    expect(seconds < 10 * 1.5, "refusing 10 writes took " + std::to_string(seconds) + " s");
+    expect(s["write_stalls_failed"] >= 10, "refused stalls not counted: " + s.dump());
+    // What was accepted is still readable from the memtables
+    expect(accepted > 0 && e.get(key_of(0)).get() == std::string(100, 'x'), "accepted write lost");
+}
+
+/**
+ * @brief Simple test runner
+ */
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        base_dir = argv[1];
+    }
+    fs::remove_all(base_dir);
+
+    std::map<std::string, std::function<void()>> tests;
+    tests["Test 1: memtable flushes"] = test_flush;
+    tests["Test 2: leveled compaction"] = test_compaction;
+    tests["Test 3: recovery from WAL and MANIFEST"] = test_recovery;
+    tests["Test 4: stalled writes are refused"] = test_stall_is_refused;
+
+    int passed = 0;
+    int failed = 0;
+    for (const auto &test_pair : tests) {
+        std::cout << "--- " << test_pair.first << " ---" << std::endl;
+        try {
+            test_pair.second();
+            std::cout << "[  PASS  ]\n" << std::endl;
+            passed++;
+        } catch (const std::exception &e) {
+            std::cout << "[  FAIL  ] - " << e.what() << "\n" << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << "\n--- Test Summary ---" << std::endl;
+    std::cout << "Passed: " << passed << std::endl;
+    std::cout << "Failed: " << failed << std::endl;
+    fs::remove_all(base_dir);
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+// Table-driven test of the Redis protocol parser (parse_resp_command):
+// RESP arrays and inline commands, partial and pipelined input, and
+// input over the limits or malformed, which must drop the connection.
+//
+//   g++ -std=c++20 -O2 -I. -I../Server/include resp_parser_test.cpp ../Server/src/RespParser.cpp -o resp_parser_test
+//   ./resp_parser_test
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <functional>
+#include "RespParser.h"
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        throw std::runtime_error(what);
+    }
+}
+
+static const long WHOLE = -2; // the case's whole input is used
+static const long INCOMPLETE = 0;
+static const long INVALID = -1;
+
+struct Case {
+    std::string name;
+    std::string input;
+    long used;
+    std::vector<std::string> args;
+};
+
+// Shows control characters, so a failing case is readable
+static std::string shown(std::string_view s) {
+    std::string out;
+    for (unsigned char c : s.substr(0, 80)) {
+        if (c == '\r') {
+            out += "\\r";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c < 0x20 || c >= 0x7f) {
+            out += "\\x" + std::string(1, "0123456789abcdef"[c >> 4]) + "0123456789abcdef"[c & 15];
+        } else {
+            out += char(c);
+        }
+    }
+    return s.size() > 80 ? out + "..." : out;
+}
+
+static void run(const std::vector<Case> &cases) {
+    std::vector<std::string_view> args;
+    for (const Case &c : cases) {
+        long want = c.used == WHOLE ? long(c.input.size()) : c.used;
+        long got = parse_resp_command(c.input.data(), c.input.size(), args);
+        expect(got == want, c.name + ": used " + std::to_string(got) + ", expected " + std::to_string(want) +
+                                " for \"" + shown(c.input) + "\"");
+        if (got <= 0) {
+            continue;
+        }
+        expect(args.size() == c.args.size(), c.name + ": " + std::to_string(args.size()) + " args, expected " +
+                                                 std::to_string(c.args.size()));
+        for (size_t i = 0; i < args.size(); ++i) {
+            expect(args[i] == c.args[i], c.name + ": arg " + std::to_string(i) + " is \"" + shown(args[i]) + "\"");
+        }
+    }
+}
+
+static std::string bulk(const std::string &s) {
+    return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+static std::string array(const std::vector<std::string> &items) {
+    std::string out = "*" + std::to_string(items.size()) + "\r\n";
+    for (auto &item : items) {
+        out += bulk(item);
+    }
+    return out;
+}
+
+// --- Test Definitions ---
+
+void test_arrays() {
+    std::string binary("a\0b\r\nc", 6);
+    run({
+        {"GET", array({"GET", "k"}), WHOLE, {"GET", "k"}},
+        {"SET EX", array({"SET", "k", "v", "EX", "10"}), WHOLE, {"SET", "k", "v", "EX", "10"}},
+        {"empty bulk", array({"SET", "k", ""}), WHOLE, {"SET", "k", ""}},
+        {"binary bulk", array({"SET", binary}), WHOLE, {"SET", binary}},
+        {"leading zeros", "*01\r\n$004\r\nPING\r\n", WHOLE, {"PING"}},
+        {"large bulk", array({"SET", "k", std::string(1 << 20, 'v')}), WHOLE, {"SET", "k", std::string(1 << 20, 'v')}},
+    });
+}
+
+void test_inline() {
+    run({
+        {"PING", "PING\r\n", WHOLE, {"PING"}},
+        {"bare newline", "PING\n", WHOLE, {"PING"}},
+        {"blanks", "  SET\tk   v \r\n", WHOLE, {"SET", "k", "v"}},
+        {"blank line", " \t\r\n", WHOLE, {}},
+        {"empty line", "\n", WHOLE, {}},
+        {"no newline yet", "GET k", INCOMPLETE, {}},
+        {"newline only up to the limit", std::string(MAX_RESP_INLINE - 1, 'a') + "\n", WHOLE,
+         {std::string(MAX_RESP_INLINE - 1, 'a')}},
+    });
+}
+
+void test_partial_input() {
+    // Every cut of a command short of its end waits for more
+    std::vector<std::string> commands = {array({"SET", "key", "value"}), array({"GET", ""}), "GET key\r\n"};
+    std::vector<std::string_view> args;
+    for (auto &command : commands) {
+        for (size_t cut = 1; cut < command.size(); ++cut) {
+            long used = parse_resp_command(command.data(), cut, args);
+            expect(used == 0, "\"" + shown(command.substr(0, cut)) + "\" used " + std::to_string(used));
+        }
+    }
+    run({
+        {"bulk without its CRLF", "*1\r\n$4\r\nPING", INCOMPLETE, {}},
+        {"bulk with half its CRLF", "*1\r\n$4\r\nPING\r", INCOMPLETE, {}},
+        {"header without LF", "*2\r", INCOMPLETE, {}},
+        {"missing element", "*2\r\n$4\r\nPING\r\n", INCOMPLETE, {}},
+    });
+}
+
+void test_pipelined() {
+    std::string batch = array({"SET", "a", "1"}) + "PING\r\n" + array({"GET", "a"}) + " \r\n" + array({"DEL", "a"});
+    std::vector<std::vector<std::string>> want = {{"SET", "a", "1"}, {"PING"}, {"GET", "a"}, {}, {"DEL", "a"}};
+    std::vector<std::string_view> args;
+    size_t pos = 0;
+    for (auto &command : want) {
+        long used = parse_resp_command(batch.data() + pos, batch.size() - pos, args);
+        expect(used > 0, "command at offset " + std::to_string(pos) + " used " + std::to_string(used));
+        expect(std::vector<std::string>(args.begin(), args.end()) == command,
+               "wrong args for the command at offset " + std::to_string(pos));
+        pos += used;
+    }
+    expect(pos == batch.size(), "the batch was not used up");
+    // A command cut at the end of a read waits, the ones before it don't
+    std::string cut = array({"GET", "a"}) + "*2\r\n$3\r\nGET";
+    long used = parse_resp_command(cut.data(), cut.size(), args);
+    expect(used == long(array({"GET", "a"}).size()), "first of a cut pipeline used " + std::to_string(used));
+    expect(parse_resp_command(cut.data() + used, cut.size() - used, args) == 0, "cut command not incomplete");
+}
+
+void test_invalid() {
+    run({
+        {"zero elements", "*0\r\n", INVALID, {}},
+        {"negative count", "*-1\r\n", INVALID, {}},
+        {"plus sign", "*+1\r\n$4\r\nPING\r\n", INVALID, {}},
+        {"empty count", "*\r\n", INVALID, {}},
+        {"count not a number", "*x\r\n", INVALID, {}},
+        {"count with trailing junk", "*1 \r\n$4\r\nPING\r\n", INVALID, {}},
+        {"CR without LF", "*1\rX$4\r\nPING\r\n", INVALID, {}},
+        {"integer element", "*1\r\n:4\r\n", INVALID, {}},
+        {"null bulk", "*1\r\n$-1\r\n", INVALID, {}},
+        {"bulk longer than sent", "*1\r\n$3\r\nPING\r\n", INVALID, {}},
+        {"bulk shorter than sent", "*1\r\n$5\r\nPING\r\n\r\n", INVALID, {}},
+        {"count overflows", "*99999999999999999999\r\n", INVALID, {}},
+    });
+}
+
+void test_limits() {
+    run({
+        {"too many elements", "*" + std::to_string(MAX_RESP_ARGS + 1) + "\r\n", INVALID, {}},
+        {"bulk over the limit", "*1\r\n$" + std::to_string(MAX_RESP_BULK + 1) + "\r\n", INVALID, {}},
+        {"bulk at the limit waits", "*1\r\n$" + std::to_string(MAX_RESP_BULK) + "\r\n", INCOMPLETE, {}},
+        {"header line too long", "*" + std::string(MAX_RESP_HEADER_LINE, '0') + "1\r\n", INVALID, {}},
+        {"header line of zeros still short", "*" + std::string(MAX_RESP_HEADER_LINE - 4, '0') + "1\r\n$0\r\n\r\n", WHOLE,
+         {""}},
+        {"unterminated header at the limit", "*1\r\n$" + std::string(MAX_RESP_HEADER_LINE, '1'), INVALID, {}},
+        {"inline line too long", std::string(MAX_RESP_INLINE, 'a'), INVALID, {}},
+        {"inline newline past the limit", std::string(MAX_RESP_INLINE, 'a') + "\n", INVALID, {}},
+    });
+}
+
+/**
+ * @brief Simple test runner
+ */
+int main() {
+    std::map<std::string, std::function<void()>> tests;
+    tests["Test 1: RESP arrays"] = test_arrays;
+    tests["Test 2: inline commands"] = test_inline;
+    tests["Test 3: partial input"] = test_partial_input;
+    tests["Test 4: pipelined commands"] = test_pipelined;
+    tests["Test 5: malformed input"] = test_invalid;
+    tests["Test 6: limits"] = test_limits;
+
+    int passed = 0;
+    int failed = 0;
+    for (const auto &test_pair : tests) {
+        std::cout << "--- " << test_pair.first << " ---" << std::endl;
+        try {
+            test_pair.second();
+            std::cout << "[  PASS  ]\n" << std::endl;
+            passed++;
+        } catch (const std::exception &e) {
+            std::cout << "[  FAIL  ] - " << e.what() << "\n" << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << "\n--- Test Summary ---" << std::endl;
+    std::cout << "Passed: " << passed << std::endl;
+    std::cout << "Failed: " << failed << std::endl;
+    return (failed > 0) ? 1 : 0;
+}
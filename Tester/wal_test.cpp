@@ -0,0 +1,214 @@
+// Functional test of the WriteAheadLog in front of the MySQL write queues:
+// replay after a restart, torn tails, segment rotation, and checkpoints
+// deleting the segments every consumer is past. No MySQL needed.
+//
+//   g++ -std=c++20 -O2 -I. -I../Server/include wal_test.cpp ../Server/src/{WriteAheadLog,AppendLog,LogFormat}.cpp -lpthread -o wal_test
+//   ./wal_test [log dir]
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <map>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <filesystem>
+#include "WriteAheadLog.h"
+
+namespace fs = std::filesystem;
+
+static std::string base_dir = "/tmp/wal_test";
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        throw std::runtime_error(what);
+    }
+}
+
+struct Replayed {
+    LogRecord record;
+    uint64_t end;
+};
+
+static std::vector<Replayed> replay(WriteAheadLog &wal) {
+    std::vector<Replayed> out;
+    wal.replay([&](const LogRecord &rec, uint64_t end) { out.push_back({rec, end}); });
+    return out;
+}
+
+static size_t wal_files(const std::string &dir) {
+    size_t n = 0;
+    for (auto &entry : fs::directory_iterator(dir)) {
+        n += entry.path().extension() == ".wal";
+    }
+    return n;
+}
+
+static std::string key_of(int i) {
+    return "key" + std::to_string(i);
+}
+
+static std::string value_of(int i) {
+    return "value" + std::to_string(i) + std::string(i % 50, 'x');
+}
+
+// Appends records [from, to), every fifth a delete; returns their end positions
+static std::vector<uint64_t> append(WriteAheadLog &wal, int from, int to) {
+    std::vector<uint64_t> ends;
+    for (int i = from; i < to; ++i) {
+        bool remove = i % 5 == 0;
+        ends.push_back(wal.append(remove ? LOG_FLAG_TOMBSTONE : LOG_FLAG_PUT, key_of(i), remove ? "" : value_of(i)));
+    }
+    return ends;
+}
+
+static void expect_records(const std::vector<Replayed> &got, int from, int to, const std::string &when) {
+    expect(got.size() == size_t(to - from),
+           when + ": replayed " + std::to_string(got.size()) + " records, expected " + std::to_string(to - from));
+    for (int i = from; i < to; ++i) {
+        const LogRecord &rec = got[i - from].record;
+        bool remove = i % 5 == 0;
+        expect(rec.key == key_of(i) && rec.flags == (remove ? LOG_FLAG_TOMBSTONE : LOG_FLAG_PUT) &&
+                   rec.value == (remove ? "" : value_of(i)),
+               when + ": wrong record for " + key_of(i));
+    }
+}
+
+// --- Test Definitions ---
+
+void test_replay_after_restart() {
+    std::string dir = base_dir + "/replay";
+    std::vector<uint64_t> ends;
+    std::atomic<int> durable{0};
+    {
+        WriteAheadLog wal(dir);
+        ends = append(wal, 0, 500);
+        std::promise<bool> synced;
+        wal.append(LOG_FLAG_TOMBSTONE, key_of(500), "", [&](bool ok) {
+            durable++;
+            synced.set_value(ok);
+        });
+        expect(synced.get_future().get(), "record never became durable");
+        ends.push_back(wal.end());
+    }
+    expect(durable == 1, "durability callback ran " + std::to_string(durable) + " times");
+
+    WriteAheadLog wal(dir);
+    auto got = replay(wal);
+    expect_records(got, 0, 501, "after restart");
+    for (size_t i = 0; i < got.size(); ++i) {
+        expect(got[i].end == ends[i], "record " + std::to_string(i) + " replayed at another position");
+    }
+    // New records go after the old ones
+    uint64_t next = wal.append(LOG_FLAG_PUT, "after", "restart");
+    expect(next > ends.back(), "positions went backwards after a restart");
+}
+
+void test_torn_tail() {
+    std::string dir = base_dir + "/torn";
+    {
+        WriteAheadLog wal(dir);
+        append(wal, 0, 100);
+    }
+    // A crash in the middle of the last record
+    fs::path segment;
+    for (auto &entry : fs::directory_iterator(dir)) {
+        segment = entry.path();
+    }
+    fs::resize_file(segment, fs::file_size(segment) - 3);
+    {
+        WriteAheadLog wal(dir);
+        expect_records(replay(wal), 0, 99, "torn tail");
+        append(wal, 100, 150);
+    }
+    WriteAheadLog wal(dir);
+    auto got = replay(wal);
+    expect(got.size() == 149, "replayed " + std::to_string(got.size()) + " records after the torn one");
+    expect(got[98].record.key == key_of(98) && got[99].record.key == key_of(100), "records after the tear lost");
+}
+
+void test_segments_rotate() {
+    std::string dir = base_dir + "/rotate";
+    {
+        WriteAheadLog wal(dir, 4096);
+        append(wal, 0, 1000);
+        expect(wal.segments() > 5, "only " + std::to_string(wal.segments()) + " segments of 4 KB");
+        expect(wal.segments() == wal_files(dir), "segments() doesn't match the files");
+    }
+    WriteAheadLog wal(dir, 4096);
+    expect_records(replay(wal), 0, 1000, "across segments");
+    // A run that wrote nothing leaves no empty segment behind
+    size_t files = wal_files(dir);
+    { WriteAheadLog idle(dir, 4096); }
+    expect(wal_files(dir) <= files + 1, "empty segments pile up");
+}
+
+void test_checkpoint_deletes_segments() {
+    std::string dir = base_dir + "/checkpoint";
+    std::vector<uint64_t> ends;
+    {
+        WriteAheadLog wal(dir, 4096);
+        expect(wal.load_checkpoint().empty(), "checkpoint before any was saved");
+        ends = append(wal, 0, 1000);
+        size_t segments = wal.segments();
+
+        // Two consumers: the slower one decides what can go
+        wal.save_checkpoint({ends[999], ends[99]});
+        expect(wal.load_checkpoint() == std::vector<uint64_t>({ends[999], ends[99]}), "checkpoint not saved as given");
+        expect(wal.segments() < segments, "no segment deleted below the checkpoint");
+        expect(wal.segments() == wal_files(dir), "deleted segments left on disk");
+        auto got = replay(wal);
+        expect(!got.empty() && got.front().end <= ends[100], "a segment past the slower consumer was deleted");
+
+        // Both past everything: only the active segment stays
+        wal.save_checkpoint({ends[999], ends[999]});
+        expect(wal.segments() == 1 && wal_files(dir) == 1,
+               std::to_string(wal.segments()) + " segments left past every checkpoint");
+        append(wal, 1000, 1001);
+    }
+
+    // A restart resumes from the checkpoint
+    WriteAheadLog wal(dir, 4096);
+    expect(wal.load_checkpoint().back() == ends[999], "checkpoint lost on restart");
+    size_t unapplied = 0;
+    for (auto &r : replay(wal)) {
+        unapplied += r.end > ends[999];
+    }
+    expect(unapplied == 1, std::to_string(unapplied) + " records past the checkpoint, expected 1");
+}
+
+/**
+ * @brief Simple test runner
+ */
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        base_dir = argv[1];
+    }
+    fs::remove_all(base_dir);
+
+    std::map<std::string, std::function<void()>> tests;
+    tests["Test 1: replay after restart"] = test_replay_after_restart;
+    tests["Test 2: torn tail"] = test_torn_tail;
+    tests["Test 3: segment rotation"] = test_segments_rotate;
+    tests["Test 4: checkpoints delete applied segments"] = test_checkpoint_deletes_segments;
+
+    int passed = 0;
+    int failed = 0;
+    for (const auto &test_pair : tests) {
+        std::cout << "--- " << test_pair.first << " ---" << std::endl;
+        try {
+            test_pair.second();
+            std::cout << "[  PASS  ]\n" << std::endl;
+            passed++;
+        } catch (const std::exception &e) {
+            std::cout << "[  FAIL  ] - " << e.what() << "\n" << std::endl;
+            failed++;
+        }
+    }
+
+    std::cout << "\n--- Test Summary ---" << std::endl;
+    std::cout << "Passed: " << passed << std::endl;
+    std::cout << "Failed: " << failed << std::endl;
+    fs::remove_all(base_dir);
+    return (failed > 0) ? 1 : 0;
+}